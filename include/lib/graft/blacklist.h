@@ -1,6 +1,7 @@
 #pragma once
 
 #include <utility>
+#include <array>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -9,6 +10,9 @@ typedef uint32_t in_addr_t;
 
 namespace graft {
 
+//IPv6 address in network order, IPv4 addresses are kept mapped (::ffff:a.b.c.d)
+using Ip6Addr = std::array<uint8_t, 16>;
+
 class BlackList
 {
 public:
@@ -16,7 +20,8 @@ public:
 
     //requests_per_sec == 0, means disable ban
     //ban_ip_sec == 0, means ban forever
-    static std::unique_ptr<BlackList> Create(int requests_per_sec, int window_size_sec, int ban_ip_sec);
+    //max_sources limits the number of sources tracked by the rate limiter and banned, 0 means the default
+    static std::unique_ptr<BlackList> Create(int requests_per_sec, int window_size_sec, int ban_ip_sec, size_t max_sources = 0);
 
     virtual ~BlackList() = default;
 
@@ -25,6 +30,7 @@ public:
     virtual std::string getWarnings() = 0;
 
     virtual bool processIp(in_addr_t addr, bool networkOrder = true) = 0;
+    virtual bool processIp(const Ip6Addr& addr) = 0;
 protected:
     BlackList(const BlackList&) = delete;
     BlackList& operator = (const BlackList&) = delete;
@@ -34,9 +40,10 @@ protected:
 class BlackListTest : public BlackList
 {
 public:
-    static std::unique_ptr<BlackListTest> Create(int requests_per_sec, int window_size_sec, int ban_ip_sec);
+    static std::unique_ptr<BlackListTest> Create(int requests_per_sec, int window_size_sec, int ban_ip_sec, size_t max_sources = 0);
 
-    virtual void addEntry(const char* ip, int len = 32, Allow allow = false) = 0;
+    //ip is either IPv4 or IPv6 address, len < 0 means the full length of the address
+    virtual void addEntry(const char* ip, int len = -1, Allow allow = false) = 0;
     virtual void addEntry(in_addr_t addr, bool networkOrder = true, Allow allow = false, int len = 32) = 0;
     virtual void removeEntry(const char* ip) = 0;
     virtual void removeEntry(in_addr_t addr, bool networkOrder = true) = 0;
@@ -0,0 +1,152 @@
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+namespace graft::detail {
+
+//////////////
+/// \brief The CircuitBreakerT class
+/// Judges the health of an upstream by the outcomes of its latest requests.
+/// It opens when the share of failed requests in the window reaches the error rate, a request slower than
+/// the slow threshold counts as failed. While it is open the requests are refused. After the open interval
+/// a single probing request is let through (half-open), its outcome closes or reopens the breaker.
+/// The latencies of the successful requests are kept to get percentiles for hedging.
+///
+template<typename Clock = std::chrono::steady_clock>
+class CircuitBreakerT
+{
+public:
+    using Duration = typename Clock::duration;
+
+    enum class State
+    {
+        Closed,
+        Open,
+        HalfOpen,
+    };
+
+    static constexpr size_t LatencySamples = 128;
+    static constexpr size_t MinLatencySamples = 16;
+
+    CircuitBreakerT() = default;
+    CircuitBreakerT(double errorRate, Duration slow, size_t window, Duration openInterval)
+        : m_errorRate(errorRate)
+        , m_slow(slow)
+        , m_window(std::max(window, size_t(1)))
+        , m_openInterval(openInterval)
+    { }
+
+    bool enabled() const { return 0 < m_errorRate; }
+    State state() const { return m_state; }
+
+    //returns false if the request should be refused
+    bool allow() const
+    {
+        switch(m_state)
+        {
+        case State::Closed: return true;
+        case State::Open: return m_openUntil <= Clock::now();
+        case State::HalfOpen: return !m_probing;
+        }
+        return true;
+    }
+
+    //the allowed request is sent, it is the probing one unless the breaker is closed
+    void onSend()
+    {
+        if(m_state == State::Closed) return;
+        m_state = State::HalfOpen;
+        m_probing = true;
+    }
+
+    //returns true if the outcome has opened the breaker
+    bool onResult(bool ok, Duration latency)
+    {
+        if(ok) addLatency(latency);
+        if(!enabled()) return false;
+
+        bool failed = !ok || (m_slow != Duration::zero() && m_slow < latency);
+        switch(m_state)
+        {
+        case State::Open:
+            //the request has been sent before the breaker opened
+            return false;
+        case State::HalfOpen:
+        {
+            m_probing = false;
+            if(failed)
+            {
+                open();
+                return true;
+            }
+            m_state = State::Closed;
+            return false;
+        }
+        case State::Closed:
+            break;
+        }
+
+        m_outcomes.push_back(failed);
+        if(failed) ++m_failed;
+        if(m_window < m_outcomes.size())
+        {
+            if(m_outcomes.front()) --m_failed;
+            m_outcomes.pop_front();
+        }
+        if(m_outcomes.size() < m_window || m_failed < m_errorRate * m_window) return false;
+        open();
+        return true;
+    }
+
+    //returns the percentile (0..100) of the recent latencies, zero if there are not enough samples
+    Duration percentile(double p) const
+    {
+        if(m_latencies.size() < MinLatencySamples) return Duration::zero();
+        std::vector<Duration> latencies(m_latencies);
+        size_t n = std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size() / 100));
+        std::nth_element(latencies.begin(), latencies.begin() + n, latencies.end());
+        return latencies[n];
+    }
+
+private:
+    void open()
+    {
+        m_state = State::Open;
+        m_openUntil = Clock::now() + m_openInterval;
+        m_outcomes.clear();
+        m_failed = 0;
+    }
+
+    void addLatency(Duration latency)
+    {
+        if(m_latencies.size() < LatencySamples)
+        {
+            m_latencies.push_back(latency);
+            return;
+        }
+        m_latencies[m_nextLatency] = latency;
+        m_nextLatency = (m_nextLatency + 1) % LatencySamples;
+    }
+
+    double m_errorRate = 0;
+    Duration m_slow = Duration::zero();
+    size_t m_window = 1;
+    Duration m_openInterval = Duration::zero();
+
+    State m_state = State::Closed;
+    bool m_probing = false;
+    typename Clock::time_point m_openUntil;
+    std::deque<bool> m_outcomes;
+    size_t m_failed = 0;
+
+    std::vector<Duration> m_latencies;
+    size_t m_nextLatency = 0;
+};
+
+using CircuitBreaker = CircuitBreakerT<>;
+
+}
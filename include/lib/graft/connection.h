@@ -4,6 +4,8 @@
 #include "lib/graft/task.h"
 #include "lib/graft/blacklist.h"
 
+struct mg_coap_message;
+
 namespace graft {
 
 namespace details
@@ -54,17 +56,30 @@ public:
     {
         m_onCloseCallback = onCloseCallback;
     }
+    //an idle connection is closed after the timeout in seconds, 0 means never
+    void setIdleTimeout(double idleTimeout) { m_idleTimeout = idleTimeout; }
+    //an idle connection is probed by TCP keep-alive after the interval in seconds, 0 means no probes;
+    //the peer that closes the connection is noticed at once, the probes find the peers that are gone silently
+    void setProbeInterval(int probeInterval) { m_probeInterval = probeInterval; }
 
     void ev_handler(mg_connection *upstream, int ev, void *ev_data);
+    //closes the idle connection, the callback is called at once
+    void close(mg_connection *upstream);
 
 private:
     OnCloseCallback m_onCloseCallback;
+    double m_idleTimeout = 0;
+    int m_probeInterval = 0;
+    //the unanswered probes after which the connection is considered dead
+    static constexpr int ProbeCount = 3;
 };
 
 class UpstreamSender : public SelfHolder<UpstreamSender>
 {
 public:
     using OnDone = std::function<void(UpstreamSender& uss, uint64_t connectionId, mg_connection* client)>;
+    using OnHedge = std::function<void(UpstreamSender& uss)>;
+    using Clock = std::chrono::steady_clock;
 
     UpstreamSender(const BaseTaskPtr& bt, OnDone onDone, double timeout) : m_bt(bt), m_onDone(onDone), m_timeout(timeout) { }
 
@@ -72,14 +87,44 @@ public:
         : m_bt(bt), m_onDone(onDone), m_keepAlive(true), m_connectioId(connectionId), m_upstream(upstream), m_timeout(timeout)
     { }
 
+    //the request is pipelined over the busy keep-alive connection upstream,
+    //the connection is passed to it by attach() when the previous response is received
+    UpstreamSender(const BaseTaskPtr& bt, OnDone onDone, mg_connection* upstream, double timeout)
+        : m_bt(bt), m_onDone(onDone), m_keepAlive(true), m_pipelined(true), m_upstream(upstream), m_timeout(timeout)
+    { }
+
     BaseTaskPtr& getTask() { return m_bt; }
+    mg_connection* getUpstream() const { return m_upstream; }
 
     void send(TaskManager& manager, const std::string& uri);
+    //the pipelined request takes the connection over
+    void attach(uint64_t connectionId);
+    //the pipelined request fails because its connection is lost
+    void abort(const std::string& error);
+    //the request is not sent, it fails at once with Status::CircuitOpen
+    void reject(const std::string& error);
+    //called before send(), onHedge is called once if the response is not received in delay seconds
+    void setHedge(double delay, OnHedge onHedge);
+    //the request duplicates the one of primary, the first successful response of them is delivered
+    void joinHedge(UpstreamSender& primary);
+    //the response of a duplicate request has been delivered instead
+    bool superseded() const { return m_superseded; }
     Status getStatus() const { return m_status; }
     const std::string& getError() const { return m_error; }
+    Clock::duration elapsed() const { return Clock::now() - m_start; }
 
     void ev_handler(mg_connection* upstream, int ev, void *ev_data);
 private:
+    struct HedgeGroup
+    {
+        int pending = 1;
+        bool settled = false;
+    };
+
+    //returns true if the result should be delivered
+    bool settle(bool ok);
+    void armTimer();
+
     void setError(Status status, const std::string& error = std::string())
     {
         m_status = status;
@@ -89,11 +134,17 @@ private:
     BaseTaskPtr m_bt;
     OnDone m_onDone;
     bool m_keepAlive = false;
+    bool m_pipelined = false;
     uint64_t m_connectioId = 0;
     double m_timeout;
     mg_connection* m_upstream = nullptr;
     Status m_status = Status::None;
     std::string m_error;
+    Clock::time_point m_start = Clock::now();
+    OnHedge m_onHedge;
+    double m_hedgeDelay = 0;
+    std::shared_ptr<HedgeGroup> m_hedge;
+    bool m_superseded = false;
 };
 
 class ConnectionBase;
@@ -101,15 +152,21 @@ class ConnectionBase;
 class Looper final : public TaskManager
 {
 public:
-    Looper(const ConfigOpts& copts, ConnectionBase& connectionBase);
+    //primary is not null for the additional I/O threads
+    Looper(const ConfigOpts& copts, ConnectionBase& connectionBase, Looper* primary = nullptr);
     virtual ~Looper();
 
+    static Looper& from(mg_mgr* mgr);
+    ConnectionBase& getConnectionBase() { return m_connectionBase; }
+
     void serve();
     void notifyJobReady() override;
 
     void stop(bool force = false);
     bool ready() const { return m_ready; }
     bool stopped() const { return m_stop; }
+    //can be called from any thread, the options are applied by the I/O thread of the looper
+    void reconfigure(const ConfigOpts& copts, const OutHttp::UriSubstitutions& substitutions);
 
     virtual mg_mgr* getMgMgr() override { return m_mgr.get(); }
 protected:
@@ -118,6 +175,13 @@ private:
     ////static functions
     static void cb_event(mg_mgr* mgr, uint64_t cnt);
 
+    void applyConfig();
+
+    ConnectionBase& m_connectionBase;
+    const bool m_main;
+    std::mutex m_configMutex;
+    std::unique_ptr<std::pair<ConfigOpts, OutHttp::UriSubstitutions>> m_config;
+    std::atomic_bool m_configPending {false};
     std::atomic_bool m_ready {false};
     std::atomic_bool m_stop {false};
     std::atomic_bool m_forceStop {false};
@@ -130,6 +194,8 @@ public:
 
     virtual void bind(Looper& looper) = 0;
     virtual void respond(ClientTask* ct, const std::string& s);
+    //true if the manager can be bound to the same address by each I/O thread
+    virtual bool reusePort() const { return false; }
 
     ConnectionManager(const Proto& proto) : m_proto(proto) { }
     ConnectionManager(const ConnectionManager&) = delete;
@@ -149,6 +215,8 @@ public:
     static void ev_handler(ClientTask* ct, mg_connection *client, int ev, void *ev_data);
 protected:
     static ConnectionManager* from_accepted(mg_connection* cn);
+    //counts the response and returns its HTTP status code
+    static int responseCode(ClientTask* ct);
     static void ev_handler_empty(mg_connection *client, int ev, void *ev_data);
 #define _M(x) std::make_pair(#x, METHOD_##x)
     constexpr static std::pair<const char *, int> m_methods[] = {
@@ -169,18 +237,32 @@ public:
     ConnectionBase(const ConnectionBase&) = delete;
     ConnectionBase& operator = (const ConnectionBase&) = delete;
 
+    using ReloadCallback = std::function<void()>;
+
     void setSysInfoCounter(std::unique_ptr<SysInfoCounter>& counter);
     void createSystemInfoCounter();
     void loadBlacklist(const ConfigOpts& copts);
     void createLooper(ConfigOpts& configOpts);
     void initConnectionManagers();
     void bindConnectionManagers();
+    //runs the loopers of the additional I/O threads and the main looper in the current thread
+    void serve();
 
-    bool ready() const { return m_looperReady && m_looper->ready(); }
-    void stop(bool force = false) { m_stop = true; assert(m_looper); m_looper->stop(force); }
+    bool ready() const;
+    void stop(bool force = false);
     bool stopped() { return m_stop; }
 
-    BlackList& getBlackList() { return *m_blackList; }
+    //the callback is called by the main I/O thread after reload()
+    void setReloadCallback(ReloadCallback callback) { m_reloadCallback = callback; }
+    //it is safe to call it from a signal handler
+    void reload() { m_reload = true; }
+    //it is called by the main I/O thread
+    void checkReload();
+    //applies the options that do not require restart to the blacklist and the loopers
+    void reconfigure(const ConfigOpts& copts);
+
+    //the blacklist can be replaced by reconfigure()
+    std::shared_ptr<BlackList> getBlackList() { return std::atomic_load(&m_blackList); }
     SysInfoCounter& getSysInfoCounter() { assert(m_sysInfo); return *m_sysInfo; }
     Looper& getLooper() { assert(m_looper); return *m_looper; }
     ConfigOpts& getCopts() { assert(m_looper); return m_looper->getCopts(); }
@@ -189,14 +271,23 @@ public:
     static ConnectionBase* from(mg_mgr* mgr);
 private:
     static void checkRoutes(graft::ConnectionManager& cm);
+    //returns the content of the rules file, empty if there is no file
+    static std::string readBlacklistRules(const IPFilterOpts& ipfilter);
+    static std::unique_ptr<BlackList> createBlacklist(const IPFilterOpts& ipfilter, const std::string& rules);
 
     std::atomic_bool m_stop{false};
+    std::atomic_bool m_reload{false};
+    ReloadCallback m_reloadCallback;
 
     //the order of members is important because of destruction order.
-    std::unique_ptr<BlackList> m_blackList;
+    std::shared_ptr<BlackList> m_blackList;
+    //the rules the blacklist is built from, the blacklist is not rebuilt on reload while they are the same
+    std::string m_blackListRules;
     std::unique_ptr<SysInfoCounter> m_sysInfo;
     std::atomic_bool m_looperReady{false};
     std::unique_ptr<Looper> m_looper;
+    //the loopers of the additional I/O threads
+    std::vector<std::unique_ptr<Looper>> m_extraLoopers;
     std::map<ConnectionManager::Proto, std::unique_ptr<ConnectionManager>> m_conManagers;
 };
 
@@ -215,27 +306,159 @@ public:
 
 } //namespace details
 
+class HttpConnectionManager;
+
+//////////////
+/// \brief The HttpClientConnection class
+/// It is bound to an accepted HTTP connection for its whole lifetime (mg_connection::user_data).
+/// Several requests can be received over a keep-alive connection, and pipelined requests can be
+/// processed concurrently. The responses are kept in the order of the requests and
+/// sent as soon as all previous responses have been sent.
+///
+class HttpClientConnection
+{
+public:
+    HttpClientConnection(HttpConnectionManager* manager, mg_connection* client)
+        : m_manager(manager), m_client(client)
+    { }
+    HttpClientConnection(const HttpClientConnection&) = delete;
+    HttpClientConnection& operator = (const HttpClientConnection&) = delete;
+
+    static HttpClientConnection* from(mg_connection* client);
+
+    HttpConnectionManager* getManager() const { return m_manager; }
+    //true when no more requests are accepted on the connection
+    bool closing() const { return m_closing; }
+    //registers a request in the order of arrival, ct can be nullptr if the request is answered at once
+    void addRequest(const http_message& hm, ClientTask* ct, const ConfigOpts& opts);
+    //sets the response for the request of ct and sends all responses that are ready in order
+    void setResponse(ClientTask* ct, int code, const std::string& body, bool error, bool close = false);
+
+    void ev_handler(mg_connection* client, int ev, void *ev_data);
+private:
+    struct Slot
+    {
+        ClientTask* ct;
+        bool keepAlive;
+        bool ready;
+        std::string response;
+    };
+
+    void flush();
+
+    HttpConnectionManager* m_manager;
+    mg_connection* m_client;
+    std::deque<Slot> m_slots;
+    int m_requestCnt = 0;
+    bool m_closing = false;
+};
+
 class HttpConnectionManager final : public ConnectionManager
 {
 public:
     HttpConnectionManager() : ConnectionManager("HTTP") { }
 
     void bind(Looper& looper) override;
+    void respond(ClientTask* ct, const std::string& s) override;
+    bool reusePort() const override { return true; }
 
 private:
+    friend class HttpClientConnection;
+
     static void ev_handler_http(mg_connection *client, int ev, void *ev_data);
+    void onRequest(HttpClientConnection* conn, mg_connection *client, http_message* hm);
     static int translateMethod(const char *method, std::size_t len);
     static HttpConnectionManager* from_accepted(mg_connection* cn);
 };
 
+class CoapConnectionManager;
+
+//////////////
+/// \brief The CoapClientConnection class
+/// It is bound to the UDP pseudo-connection that mongoose creates for each CoAP peer (mg_connection::user_data).
+/// The response to a confirmable request is piggybacked on its ACK if it is ready in time, otherwise the request
+/// is acknowledged by an empty ACK and the response is sent as a confirmable message, retransmitted until acknowledged.
+/// Large requests are assembled from Block1 transfers, large responses are served by Block2 blocks.
+/// The recent exchanges are kept to answer duplicated messages.
+///
+class CoapClientConnection
+{
+public:
+    CoapClientConnection(CoapConnectionManager* manager, mg_connection* client);
+    CoapClientConnection(const CoapClientConnection&) = delete;
+    CoapClientConnection& operator = (const CoapClientConnection&) = delete;
+
+    static CoapClientConnection* from(mg_connection* client);
+
+    //sets the response for the request of ct and sends it
+    void setResponse(ClientTask* ct, int code, const std::string& body, bool error);
+
+    void ev_handler(mg_connection* client, int ev, void *ev_data);
+private:
+    struct Exchange
+    {
+        uint16_t msgId;
+        std::string token;
+        std::string uri; //path and query, identifies the resource of Block2 requests
+        bool confirmable;
+        ClientTask* ct = nullptr;
+        bool ready = false;
+        bool acked = false; //the request is acknowledged by an empty ACK, the response goes separately
+        uint8_t codeClass = 0;
+        uint8_t codeDetail = 0;
+        bool json = true;
+        //shared by the exchanges of the blocks of the response, they are sliced out of it
+        std::shared_ptr<const std::string> body;
+        std::string etag; //of a block-wise response
+        bool hasBlock1 = false;
+        uint32_t block1 = 0; //Block1 option to echo
+        bool block2 = false; //Block2 option requested
+        uint32_t block2Num = 0;
+        unsigned szx;
+        double time;
+        //separate confirmable response
+        uint16_t respMsgId = 0;
+        int retransmits = 0;
+        double resendTime = 0; //0 if the response is not waiting for ACK
+    };
+
+    struct Block1Transfer
+    {
+        uint32_t next = 0;
+        std::string body;
+        double time = 0;
+    };
+
+    void onRequest(const mg_coap_message& cm);
+    void onAck(const mg_coap_message& cm);
+    void onTimer();
+    //serves the next block of a response to this peer, the response is found by the token or the ETag of the request
+    bool serveCached(Exchange& ex, const std::string& etag);
+    void reply(Exchange& ex, uint8_t codeClass, uint8_t codeDetail, const std::string& body = std::string(), bool json = false);
+    void reply(Exchange& ex, uint8_t codeClass, uint8_t codeDetail, std::shared_ptr<const std::string> body, bool json);
+    void send(Exchange& ex);
+    void trim(double now);
+    void schedule();
+
+    CoapConnectionManager* m_manager;
+    mg_connection* m_client;
+    std::deque<Exchange> m_exchanges;
+    //Block1 transfers being assembled, by uri
+    std::map<std::string, Block1Transfer> m_block1;
+    uint16_t m_nextMsgId;
+};
+
 class CoapConnectionManager final : public ConnectionManager
 {
 public:
     CoapConnectionManager() : ConnectionManager("COAP") { }
 
     void bind(Looper& looper) override;
+    void respond(ClientTask* ct, const std::string& s) override;
 
 private:
+    friend class CoapClientConnection;
+
     static void ev_handler_coap(mg_connection *client, int ev, void *ev_data);
     static int translateMethod(int i);
     static CoapConnectionManager* from_accepted(mg_connection* cn);
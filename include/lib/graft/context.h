@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include "lib/graft/uuid_generator.h"
+
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 
@@ -11,12 +13,16 @@
 #include <thread>
 #include <mutex>
 #include <map>
+#include <string_view>
+#include <typeinfo>
+#include <memory_resource>
 #include <vector>
 #include <chrono>
 #include <any>
 
 #include "lib/graft/graft_utility.hpp"
 #include "lib/graft/graft_constants.h"
+#include "lib/graft/small_any.h"
 
 namespace graft { class ConfigOpts; }
 namespace graft::request::system_info { class Counter; }
@@ -50,6 +56,57 @@ public:
     }
 };
 
+//////////////
+/// \brief The GlobalId class
+/// Binary id of a global context entry, such as a decoded payment id.
+/// The hash is computed once, so the keys built from the same id for several tags do not rehash it.
+///
+class GlobalId
+{
+public:
+    explicit GlobalId(std::string id) : m_id(std::move(id)), m_hash(std::hash<std::string_view>()(m_id)) { }
+
+    const std::string& id() const { return m_id; }
+    std::size_t hash() const { return m_hash; }
+private:
+    std::string m_id;
+    std::size_t m_hash;
+};
+
+//////////////
+/// \brief The GlobalKey class
+/// Typed key of the global context: a namespace tag and a binary id, such as a payment id.
+/// The key bytes and the hash are built once; the value type is fixed at compile time.
+/// The key starts with '\0', so it does not clash with the string keys.
+///
+template<typename T>
+class GlobalKey
+{
+public:
+    using value_type = T;
+
+    template<typename Tag>
+    GlobalKey(Tag tag, const GlobalId& id)
+    {
+        static_assert(std::is_enum<Tag>::value, "the tag should be an enum");
+        m_key.reserve(2 + id.id().size());
+        m_key += '\0';
+        m_key += static_cast<char>(tag);
+        m_key += id.id();
+        //mixes the tag into the hash of the id, the same key always gets the same hash
+        m_hash = id.hash() ^ (static_cast<std::size_t>(tag) * static_cast<std::size_t>(0x9E3779B97F4A7C15ull));
+    }
+
+    template<typename Tag>
+    GlobalKey(Tag tag, std::string_view id) : GlobalKey(tag, GlobalId(std::string(id))) { }
+
+    const std::string& key() const { return m_key; }
+    std::size_t hash() const { return m_hash; }
+private:
+    std::string m_key;
+    std::size_t m_hash;
+};
+
 using SysInfoCounter = request::system_info::Counter;
 
 class Context
@@ -57,48 +114,111 @@ class Context
 public:
     class Local
     {
+    public:
+        //////////////
+        /// \brief The Slot class
+        /// Typed key of the local context. Its id is resolved once, when the slot is created,
+        /// so that the access by a slot is indexing with no string compares and no type checks.
+        /// Slots with the same name share the id; the ids are dense, in the order of creation.
+        ///
+        template<typename T>
+        class Slot
+        {
+        public:
+            explicit Slot(const char* name) : m_id(registerSlot(name, typeid(T))) { }
+            uint32_t id() const { return m_id; }
+        private:
+            uint32_t m_id;
+        };
+
     private:
-        using ContextMap = std::map<std::string, std::any>;
-        ContextMap m_map;
+        using Any = detail::SmallAny;
+
+        struct Entry
+        {
+            std::pmr::string key;
+            Any value;
+        };
+
+        //the values are few, a linear search is faster than a tree or a hash table
+        std::pmr::memory_resource* m_resource;
+        std::pmr::vector<Entry> m_entries;
+        std::pmr::vector<Any> m_slots;
+
+        static uint32_t registerSlot(const char* name, const std::type_info& type);
+
+        Any* find(const std::string& key)
+        {
+            for(auto& e : m_entries)
+            {
+                if(std::string_view(e.key) == key) return &e.value;
+            }
+            return nullptr;
+        }
+        const Any* find(const std::string& key) const
+        {
+            return const_cast<Local*>(this)->find(key);
+        }
+        //adds an empty value if there is no key
+        Any& at(const std::string& key)
+        {
+            Any* value = find(key);
+            if(value) return *value;
+            m_entries.push_back(Entry{std::pmr::string(key, m_resource), Any()});
+            return m_entries.back().value;
+        }
+
+        template<typename T>
+        void set(Any& any, T&& v)
+        {
+            using V = std::decay_t<T>;
+            if constexpr (std::is_nothrow_constructible<V, T&&>::value)
+            {
+                any.emplace<V>(m_resource, std::forward<T>(v));
+            }
+            else
+            {//the previous value is kept if the construction throws
+                V tmp(std::forward<T>(v));
+                any.emplace<V>(m_resource, std::move(tmp));
+            }
+        }
 
         class Proxy
         {
         public:
-            Proxy(ContextMap& map, const std::string& key)
-                : m_map(map), m_key(key) { }
+            Proxy(Local& local, const std::string& key)
+                : m_local(local), m_key(key) { }
 
             template<typename T>
             Proxy& operator =(T&& v)
             {
-                static_assert(std::is_nothrow_move_constructible<T>::value,
+                static_assert(std::is_nothrow_move_constructible<std::decay_t<T>>::value,
                               "not move constructible");
 
-                std::any tmp(std::forward<T>(v));
-                auto it = m_map.find(m_key);
-                if(it == m_map.end())
-                {
-                    m_map.emplace(m_key, std::move(tmp));
-                }
-                else
-                {
-                    it->second = std::move(tmp);
-                }
+                m_local.set(m_local.at(m_key), std::forward<T>(v));
                 return *this;
             }
 
             template<typename T>
             operator T& () const
             {
-                return std::any_cast<T&>(m_map[m_key]);
+                Any* value = m_local.find(m_key);
+                if(!value) throw std::bad_any_cast();
+                return value->cast<T>();
             }
 
         private:
-            ContextMap& m_map;
+            Local& m_local;
             const std::string& m_key;
         };
 
     public:
-        Local() = default;
+        //the values are allocated by resource
+        explicit Local(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : m_resource(resource)
+            , m_entries(resource)
+            , m_slots(resource)
+        { }
         ~Local() = default;
         Local(const Local&) = delete;
         Local(Local&&) = delete;
@@ -106,30 +226,74 @@ public:
         template<typename T>
         T const& operator[](const std::string& key) const
         {
-            auto it = m_map.find(key);
-            return std::any_cast<T&>(it->second);
+            const Any* value = find(key);
+            if(!value) throw std::bad_any_cast();
+            return const_cast<Any*>(value)->cast<T>();
         }
 
         template<typename T>
         T operator[](const std::string& key) const
         {
-            auto it = m_map.find(key);
-            return std::any_cast<T>(it->second);
+            const Any* value = find(key);
+            if(!value) throw std::bad_any_cast();
+            return const_cast<Any*>(value)->cast<T>();
         }
 
         Proxy operator[](const std::string& key)
         {
-            return Proxy(m_map, key);
+            return Proxy(*this, key);
         }
 
         bool hasKey(const std::string& key)
         {
-            return (m_map.find(key) != m_map.end());
+            return find(key) != nullptr;
         }
         void remove(const std::string& key)
         {
-            m_map.erase(key);
+            for(auto it = m_entries.begin(); it != m_entries.end(); ++it)
+            {
+                if(std::string_view(it->key) != key) continue;
+                if(it != m_entries.end() - 1) *it = std::move(m_entries.back());
+                m_entries.pop_back();
+                return;
+            }
+        }
+
+        //typed slots
+        template<typename T>
+        bool has(const Slot<T>& slot) const
+        {
+            return slot.id() < m_slots.size() && m_slots[slot.id()].has_value();
+        }
+        //returns nullptr if the slot is not set
+        template<typename T>
+        T* find(const Slot<T>& slot)
+        {
+            if(!has(slot)) return nullptr;
+            return m_slots[slot.id()].template get<T>();
+        }
+        //throws std::bad_any_cast if the slot is not set
+        template<typename T>
+        T& get(const Slot<T>& slot)
+        {
+            T* value = find(slot);
+            if(!value) throw std::bad_any_cast();
+            return *value;
+        }
+        template<typename T, typename V>
+        T& set(const Slot<T>& slot, V&& v)
+        {
+            if(m_slots.size() <= slot.id()) m_slots.resize(slot.id() + 1);
+            Any& any = m_slots[slot.id()];
+            set(any, T(std::forward<V>(v)));
+            return *any.template get<T>();
+        }
+        template<typename T>
+        void remove(const Slot<T>& slot)
+        {
+            if(slot.id() < m_slots.size()) m_slots[slot.id()].reset();
         }
+
         void setError(const char* str, Status status = Status::InternalError)
         {
             m_error = str;
@@ -260,6 +424,50 @@ public:
             return m_map.remove(key);
         }
 
+        //typed keys
+        template<typename T>
+        bool hasKey(const GlobalKey<T>& key)
+        {
+            return m_map.hasKey(key.hash(), key.key());
+        }
+
+        template<typename T>
+        void set(const GlobalKey<T>& key, typename GlobalKey<T>::value_type val, std::chrono::seconds ttl = std::chrono::seconds(0), GlobalContextMap::OnExpired onExpired = nullptr)
+        {
+            static_assert(std::is_nothrow_move_constructible<T>::value,
+                          "not move constructible");
+            std::any tmp(std::move(val));
+            m_map.addOrUpdate(key.hash(), key.key(), std::move(tmp), ttl, onExpired);
+        }
+
+        //returns defval if there is no key
+        template<typename T>
+        T get(const GlobalKey<T>& key, typename GlobalKey<T>::value_type defval) const
+        {
+            m_map.apply(key.hash(), key.key(), [&defval](std::any& any)->bool
+            {
+                if(T* value = std::any_cast<T>(&any)) defval = *value;
+                return true;
+            });
+            return defval;
+        }
+
+        template<typename T>
+        bool apply(const GlobalKey<T>& key, std::function<bool(T&)> f)
+        {
+            return m_map.apply(key.hash(), key.key(), [&f](std::any& any)->bool
+            {
+                T* value = std::any_cast<T>(&any);
+                return value && f(*value);
+            });
+        }
+
+        template<typename T>
+        void remove(const GlobalKey<T>& key)
+        {
+            m_map.remove(key.hash(), key.key());
+        }
+
         bool createGroup(const std::string& gname)
         {
             return m_map.createGroup(gname);
@@ -302,15 +510,7 @@ public:
         {
             GroupPtr gptr = getGroup(gname);
             if(!gptr) return false;
-            NodePtr nptr = gptr->get(key);
-            if(!nptr) return false;
-
-            std::lock_guard<decltype(nptr->m)> lk(nptr->m);
-            std::any& any = nptr->data->second;
-            any = std::any(std::forward<T>(val));
-            nptr->ttl = ttl;
-            nptr->onExpired = onExpired;
-            return true;
+            return gptr->set(key, std::any(std::forward<T>(val)), ttl, onExpired);
         }
 
         //This method has exactly the same functionality as get<T> method, in some cases the repformance might be better (?)
@@ -323,7 +523,7 @@ public:
             if(!nptr) return std::forward<T>(defval);
 
             std::lock_guard<decltype(nptr->m)> lk(nptr->m);
-            return std::any_cast<T>(nptr->data->second);
+            return std::any_cast<T>(nptr->data.second);
         }
 
         bool groupForEach(const std::string& gname, std::function<bool(const std::string& key, std::any& any)> f)
@@ -352,10 +552,10 @@ public:
     };
 
     using uuid_t = boost::uuids::uuid;
-    Context(GlobalContextMap& map)
-        : global(map)
+    Context(GlobalContextMap& map, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : local(resource)
+        , global(map)
         , m_uuid(boost::uuids::nil_generator()())
-        , m_nextUuid(boost::uuids::nil_generator()())
     {
     }
 
@@ -368,17 +568,26 @@ public:
 
     uuid_t getId(bool generateIfNil = true) const
     {
-        if(generateIfNil && m_uuid.is_nil()) m_uuid = boost::uuids::random_generator()();
+        if(generateIfNil && m_uuid.is_nil()) m_uuid = generateUuid();
         return m_uuid;
     }
-    void setNextTaskId(uuid_t uuid) { m_nextUuid = uuid; }
-    uuid_t getNextTaskId() const { return m_nextUuid; }
+    void setNextTaskId(uuid_t uuid) { m_nextUuids.assign(1, uuid); }
+    //several postponed tasks can be resumed with the same input
+    void addNextTaskId(uuid_t uuid) { m_nextUuids.push_back(uuid); }
+    uuid_t getNextTaskId() const { return m_nextUuids.empty()? boost::uuids::nil_generator()() : m_nextUuids.front(); }
+    const std::vector<uuid_t>& getNextTaskIds() const { return m_nextUuids; }
+    //it is called in the I/O thread if the task completes without Ok, e.g. its forward has failed or its client is lost;
+    //the returned postponed tasks are resumed with the error as the input, see Input::resp_code
+    using FailureHandler = std::function<std::vector<uuid_t>()>;
+    void setOnFailure(FailureHandler handler) { m_onFailure = std::move(handler); }
+    FailureHandler takeOnFailure() { FailureHandler handler; handler.swap(m_onFailure); return handler; }
 
     HandlerAPI* handlerAPI() { return GlobalFriend::handlerAPI(global); }
 
 private:
     bool m_setXCallbackHeader = false;
     mutable uuid_t m_uuid;
-    uuid_t m_nextUuid;
+    std::vector<uuid_t> m_nextUuids;
+    FailureHandler m_onFailure;
 };
 }//namespace graft
@@ -0,0 +1,101 @@
+
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace graft::detail {
+
+//////////////
+/// \brief The DispatchTableT class
+/// Transition table of a state machine, compiled from a list of rows into a direct-indexed
+/// [state][status] array. A cell refers to the transitions that match it, in the order of the rows.
+/// A transition is taken if its guard passes; the chain of a cell is cut after its first unguarded
+/// transition, as the rest are never reached.
+/// State and Status are enums with values in [0, StateCount) and [0, StatusCount).
+///
+template<typename State, size_t StateCount, typename Status, size_t StatusCount, typename Arg>
+class DispatchTableT
+{
+public:
+    using Statuses = std::vector<Status>;
+    using Guard = std::function<bool (const Arg& arg)>;
+    using Action = std::function<void (const Arg& arg)>;
+
+    struct Row
+    {
+        State start;
+        Statuses statuses; //empty means any status
+        State end;
+        Guard guard;
+        Action action;
+    };
+
+    struct Transition
+    {
+        Guard guard;
+        Action action;
+        State end;
+    };
+
+    DispatchTableT() = default;
+    explicit DispatchTableT(const std::vector<Row>& rows) { compile(rows); }
+
+    void compile(const std::vector<Row>& rows)
+    {
+        m_transitions.clear();
+        for(size_t state = 0; state < StateCount; ++state)
+        {
+            for(size_t status = 0; status < StatusCount; ++status)
+            {
+                Cell& cell = m_cells[state][status];
+                cell.begin = m_transitions.size();
+                for(auto& r : rows)
+                {
+                    if(static_cast<size_t>(r.start) != state || !matches(r.statuses, status)) continue;
+                    m_transitions.push_back(Transition{r.guard, r.action, r.end});
+                    if(!r.guard) break;
+                }
+                cell.end = m_transitions.size();
+            }
+        }
+    }
+
+    //returns nullptr if no transition matches
+    const Transition* find(State state, Status status, const Arg& arg) const
+    {
+        assert(static_cast<size_t>(state) < StateCount && static_cast<size_t>(status) < StatusCount);
+        const Cell& cell = m_cells[static_cast<size_t>(state)][static_cast<size_t>(status)];
+        for(uint32_t i = cell.begin; i < cell.end; ++i)
+        {
+            const Transition& t = m_transitions[i];
+            if(!t.guard || t.guard(arg)) return &t;
+        }
+        return nullptr;
+    }
+
+private:
+    struct Cell
+    {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+
+    static bool matches(const Statuses& statuses, size_t status)
+    {
+        if(statuses.empty()) return true;
+        for(auto s : statuses)
+        {
+            if(static_cast<size_t>(s) == status) return true;
+        }
+        return false;
+    }
+
+    std::array<std::array<Cell, StatusCount>, StateCount> m_cells;
+    std::vector<Transition> m_transitions;
+};
+
+}
@@ -3,7 +3,9 @@
 
 #include "lib/graft/context.h"
 
+#include <boost/functional/hash.hpp>
 #include <deque>
+#include <unordered_map>
 
 namespace graft::detail {
 
@@ -47,4 +49,130 @@ public:
     ExpiringListT(int life_time_ms) : m_delta( std::chrono::milliseconds(life_time_ms) ) { }
 };
 
+struct IdentityKey
+{
+    template<typename T>
+    const T& operator()(const T& v) const { return v; }
+};
+
+///////////////////////////////////
+/// \brief The IndexedExpiringListT class
+/// The same as ExpiringListT, but the entries are indexed by a hash map and linked in a FIFO in the order of expiration,
+/// add, extract and expire are O(1).
+/// An entry is identified by KeyOf(value), adding of an existing key replaces the entry and renews its lifetime.
+/// The capacity is bounded if it is not 0, on overflow either the oldest entry is evicted or the new one is rejected.
+///
+template<typename Value = Context::uuid_t, typename Key = Value, typename KeyOf = IdentityKey,
+         typename Hash = boost::hash<Key>, typename Clock = std::chrono::steady_clock>
+class IndexedExpiringListT
+{
+public:
+    enum class Overflow
+    {
+        EvictOldest,
+        RejectNew,
+    };
+
+    IndexedExpiringListT(int life_time_ms, size_t capacity = 0, Overflow overflow = Overflow::EvictOldest)
+        : m_delta( std::chrono::milliseconds(life_time_ms) )
+        , m_capacity(capacity)
+        , m_overflow(overflow)
+    {
+        if(m_capacity) m_index.reserve(m_capacity);
+    }
+    IndexedExpiringListT(const IndexedExpiringListT&) = delete;
+    IndexedExpiringListT& operator = (const IndexedExpiringListT&) = delete;
+
+    //returns false if the entry is rejected on overflow
+    bool add(Value value)
+    {
+        typename Clock::time_point now = Clock::now();
+        chop(now);
+        auto it = m_index.find(KeyOf()(value));
+        if(it != m_index.end())
+        {
+            unlink(it->second);
+        }
+        else
+        {
+            if(m_capacity && m_capacity <= m_index.size())
+            {
+                if(m_overflow == Overflow::RejectNew) return false;
+                erase(*m_head);
+            }
+            Key key = KeyOf()(value);
+            it = m_index.emplace(std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple()).first;
+        }
+        Node& node = it->second;
+        node.value = std::move(value);
+        node.expires = now + m_delta;
+        link(node);
+        return true;
+    }
+    bool contains(const Key& key)
+    {
+        chop();
+        return m_index.find(key) != m_index.end();
+    }
+    bool remove(const Key& key)
+    {
+        return extract(key).first;
+    }
+    std::pair<bool,Value> extract(const Key& key)
+    {
+        if(m_index.empty()) return std::make_pair(false, Value());
+        chop();
+        auto it = m_index.find(key);
+        if(it == m_index.end()) return std::make_pair(false, Value());
+        unlink(it->second);
+        auto res = std::make_pair(true, std::move(it->second.value));
+        m_index.erase(it);
+        return res;
+    }
+    size_t size() const { return m_index.size(); }
+
+private:
+    struct Node
+    {
+        Value value;
+        typename Clock::time_point expires;
+        Node* prev = nullptr;
+        Node* next = nullptr;
+    };
+
+    void link(Node& node)
+    {
+        node.prev = m_tail;
+        node.next = nullptr;
+        (m_tail? m_tail->next : m_head) = &node;
+        m_tail = &node;
+    }
+    void unlink(Node& node)
+    {
+        (node.prev? node.prev->next : m_head) = node.next;
+        (node.next? node.next->prev : m_tail) = node.prev;
+        node.prev = node.next = nullptr;
+    }
+    void chop(const typename Clock::time_point& now = Clock::now())
+    {
+        while(m_head && !(now < m_head->expires))
+        {
+            erase(*m_head);
+        }
+    }
+    void erase(Node& node)
+    {
+        unlink(node);
+        m_index.erase(m_index.find(KeyOf()(node.value)));
+    }
+
+    typename Clock::duration m_delta;
+    size_t m_capacity;
+    Overflow m_overflow;
+    //the nodes are stable in the map, the FIFO is linked through them
+    std::unordered_map<Key, Node, Hash> m_index;
+    Node* m_head = nullptr;
+    Node* m_tail = nullptr;
+};
+
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 namespace graft
 {
 
@@ -11,13 +13,16 @@ namespace graft
     EXP(Error) \
     EXP(Drop) \
     EXP(Busy) \
+    EXP(CircuitOpen) /*the upstream circuit breaker is open*/ \
     EXP(InternalError) \
     EXP(Postpone) \
     EXP(Stop) //for timer events
 
 #define EXP_TO_ENUM(x) x,
 #define EXP_TO_STR(x) #x,
+#define EXP_TO_ONE(x) +1
 
 enum class Status : int { GRAFT_STATUS_LIST(EXP_TO_ENUM) };
+constexpr size_t StatusCount = 0 GRAFT_STATUS_LIST(EXP_TO_ONE);
 
 }//namespace graft
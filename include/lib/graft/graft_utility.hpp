@@ -9,346 +9,332 @@
 #include <mutex>
 #include <map>
 #include <shared_mutex>
+#include <cstdint>
 
 namespace graft
 {
     namespace ch = std::chrono;
 
-    template <typename T>
-    class TSList
+    //////////////
+    /// \brief The TimingWheel class
+    /// Hierarchical timing wheel of intrusive hooks, the time is in integer ticks.
+    /// There are Levels wheels of 64 slots, the level of a hook is chosen by its distance from the
+    /// current tick and the slot by the bits of its time; a slot of a higher level is cascaded to
+    /// the lower levels when the lower bits of the current tick wrap. So that scheduling, cancelling
+    /// and firing are O(1) per hook, advancing is O(1) per tick. The times beyond the top level are
+    /// clamped, the owner is expected to check the real time of the fired hook and reschedule it.
+    /// It is not thread safe.
+    ///
+    template <typename Owner, int Levels = 4>
+    class TimingWheel
     {
     public:
-        struct node
+        struct Hook
         {
-            using OnExpired = std::function<void(T&)>;
+            Hook* prev = nullptr;
+            Hook* next = nullptr;
+            int64_t time = 0;
+            Owner* owner = nullptr;
 
-            mutable std::mutex m;
-            std::shared_ptr<T> data;
-            std::shared_ptr<node> next;
-            ch::seconds ttl;
-            ch::seconds expires;
-            OnExpired onExpired = nullptr;
-
-            node() : expires(ch::seconds::max()), ttl(ch::seconds(0)) {}
-
-            node(T const& value)
-                : expires(ch::seconds::max())
-                , ttl(ch::seconds(0))
-                , data(std::make_shared<T>(value)) {}
-
-            node(T const& value, std::chrono::seconds ttl, const OnExpired& onExpired = nullptr)
-                : ttl(ttl), data(std::make_shared<T>(value)), onExpired(onExpired) { update_time(); }
-
-            void update_time()
+            bool linked() const { return prev != nullptr; }
+            void unlink()
             {
-                expires = (ttl == ch::seconds(0)) ?
-                    ch::seconds::max() : ch::time_point_cast<ch::seconds>(
-                        ch::steady_clock::now()
-                    ).time_since_epoch() + ttl;
-            }
-
-            bool expired(std::chrono::seconds now_sec)
-            {
-                return expires <= now_sec;
-            }
-
-            bool operator <=(const node& rhs) const
-            {
-                return expires <= rhs.expires;
+                prev->next = next;
+                next->prev = prev;
+                prev = next = nullptr;
             }
         };
 
-        using func = std::function<bool(T&)>;
-        using NodePtr = std::shared_ptr<node>;
-        //return true to continue
-        using FuncNode = std::function<bool(NodePtr& node_ptr)>;
-        using OnExpired = typename node::OnExpired;
-
-        TSList() {}
-        ~TSList()
-        {
-            removeIf([](T const&) { return true; });
-        }
-
-        TSList(TSList const& other) = delete;
-        TSList(TSList&& other) = delete;
-        TSList& operator=(TSList const& other) = delete;
-
-        void pushFront(T const& value, ch::seconds ttl = ch::seconds(0), OnExpired onExpired = nullptr)
+        explicit TimingWheel(int64_t now) : m_now(now)
         {
-            std::shared_ptr<node> new_node = std::make_shared<node>(value, ttl, onExpired);
-
-            std::lock_guard<std::mutex> lk(head->m);
-            new_node->next = std::move(head->next);
-            head->next = std::move(new_node);
-        }
-
-        void forEach(func f, bool timeUpdate = false)
-        {
-            node* current = head.get();
-            std::unique_lock<std::mutex> lk(head->m);
-
-            while (node* const next = current->next.get())
+            for(auto& level : m_slots)
             {
-                std::unique_lock<std::mutex> next_lk(next->m);
-                lk.unlock();
-
-                if (timeUpdate)
-                    next->update_time();
-
-                f(*next->data);
-                current = next;
-                lk = std::move(next_lk);
+                for(auto& head : level) head.prev = head.next = &head;
             }
         }
 
-        void forEachNode(FuncNode f)
-        {
-            NodePtr* current = &head;
-            std::unique_lock<std::mutex> lk((*current)->m);
-
-            while (NodePtr* next = &(*current)->next)
-            {
-                if(!*next) break;
-                std::unique_lock<std::mutex> next_lk((*next)->m);
-                lk.unlock();
+        TimingWheel(const TimingWheel&) = delete;
+        TimingWheel& operator=(const TimingWheel&) = delete;
 
-                if(!f(*next)) return;
-                current = next;
-                lk = std::move(next_lk);
-            }
-        }
+        int64_t now() const { return m_now; }
 
-        std::shared_ptr<T> findFirstOf(func p)
+        //the time in the past fires at the next tick
+        void schedule(Hook& hook, int64_t time)
         {
-            node const *current = head.get();
-            std::unique_lock<std::mutex> lk(head->m);
-            while (node* const next = current->next.get())
-            {
-                std::unique_lock<std::mutex> next_lk(next->m);
-                lk.unlock();
-                if (p(*next->data))
-                {
-                    next->update_time();
-                    return next->data;
-                }
-                current = next;
-                lk = std::move(next_lk);
-            }
-            return std::shared_ptr<T>();
+            if(hook.linked()) hook.unlink();
+            hook.time = time;
+            link(hook, m_now + 1);
         }
 
-        bool findAndApplyFirstOf(func p, func f)
+        void cancel(Hook& hook)
         {
-            node const *current = head.get();
-            std::unique_lock<std::mutex> lk(head->m);
-            while (node* const next = current->next.get())
-            {
-                std::unique_lock<std::mutex> next_lk(next->m);
-                lk.unlock();
-                if (p(*next->data))
-                {
-                    next->update_time();
-                    return f(*next->data);
-                }
-                current = next;
-                lk = std::move(next_lk);
-            }
-            return false;
+            if(hook.linked()) hook.unlink();
         }
 
-        void removeIf(func p)
+        //advances to now, the owners of the fired hooks are appended to due, the hooks are unlinked
+        void advance(int64_t now, std::vector<Owner*>& due)
         {
-            node *current = head.get();
-            std::unique_lock<std::mutex> lk(head->m);
-            while (node* const next = current->next.get())
+            while(m_now < now)
             {
-                std::unique_lock<std::mutex> next_lk(next->m);
-                if (p(*next->data))
-                {
-                    std::shared_ptr<node> old_next = std::move(current->next);
-                    current->next = std::move(next->next);
-                    next_lk.unlock();
-                }
-                else
+                const int64_t tick = ++m_now;
+                for(int level = Levels - 1; 0 < level; --level)
                 {
-                    lk.unlock();
-                    current = next;
-                    lk = std::move(next_lk);
-                }
-            }
-        }
-
-        void  safe_cleanup(std::vector<std::function<void()>>& res)
-        {
-            ch::seconds now_sec = ch::time_point_cast<ch::seconds>(
-                            ch::steady_clock::now()
-                        ).time_since_epoch();
-            node *current = head.get();
-            std::unique_lock<std::mutex> lk(head->m);
-            while (node* const next = current->next.get())
-            {
-                std::unique_lock<std::mutex> next_lk(next->m);
-                if (next->expired(now_sec))
-                {
-                    if(next->onExpired)
+                    if(tick & ((int64_t(1) << (SlotBits * level)) - 1)) continue;
+                    Hook& head = m_slots[level][(tick >> (SlotBits * level)) & SlotMask];
+                    while(head.next != &head)
                     {
-                        auto makeCall = [](std::shared_ptr<T>&& ptr, OnExpired&& onExp )->std::function<void()>
-                        {
-                            return [ptr,onExp]()->void { onExp(*ptr); };
-                        };
-                        res.push_back(makeCall(std::move(next->data), std::move(next->onExpired)));
+                        Hook& hook = *head.next;
+                        hook.unlink();
+                        link(hook, tick);
                     }
-
-                    std::shared_ptr<node> old_next = std::move(current->next);
-                    current->next = std::move(next->next);
                 }
-                else
+                Hook& head = m_slots[0][tick & SlotMask];
+                while(head.next != &head)
                 {
-                    current = next;
-                    lk = std::move(next_lk);
+                    Hook& hook = *head.next;
+                    hook.unlink();
+                    due.push_back(hook.owner);
                 }
             }
         }
 
-        void  unsafe_cleanup(std::vector<std::function<void()>>& res)
+        //unlinks all the hooks, their owners are appended to all
+        void clear(std::vector<Owner*>& all)
         {
-            ch::seconds now_sec = ch::time_point_cast<ch::seconds>(
-                            ch::steady_clock::now()
-                        ).time_since_epoch();
-            node *current = head.get();
-            while (node* const next = current->next.get())
+            for(auto& level : m_slots)
             {
-                if (next->expired(now_sec))
+                for(auto& head : level)
                 {
-                    if(next->onExpired)
+                    while(head.next != &head)
                     {
-                        auto makeCall = [](std::shared_ptr<T>&& ptr, OnExpired&& onExp )->std::function<void()>
-                        {
-                            return [ptr,onExp]()->void { onExp(*ptr); };
-                        };
-                        res.push_back(makeCall(std::move(next->data), std::move(next->onExpired)));
+                        Hook& hook = *head.next;
+                        hook.unlink();
+                        all.push_back(hook.owner);
                     }
-
-                    std::shared_ptr<node> old_next = std::move(current->next);
-                    current->next = std::move(next->next);
-                }
-                else
-                {
-                    current = next;
                 }
             }
         }
+
     private:
-        std::shared_ptr<node> head = std::make_shared<node>();
+        static constexpr int SlotBits = 6;
+        static constexpr int64_t SlotCount = int64_t(1) << SlotBits;
+        static constexpr int64_t SlotMask = SlotCount - 1;
+
+        //links the hook relative to the first tick that is not processed yet
+        void link(Hook& hook, int64_t base)
+        {
+            if(hook.time < base) hook.time = base;
+            const int64_t top = int64_t(1) << (SlotBits * Levels);
+            if(top <= hook.time - base) hook.time = base + top - 1;
+            int level = 0;
+            for(int64_t delta = hook.time - base; SlotCount <= delta; delta >>= SlotBits) ++level;
+
+            Hook& head = m_slots[level][(hook.time >> (SlotBits * level)) & SlotMask];
+            hook.prev = head.prev;
+            hook.next = &head;
+            head.prev->next = &hook;
+            head.prev = &hook;
+        }
+
+        int64_t m_now;
+        Hook m_slots[Levels][SlotCount];
     };
 
+    //////////////
+    /// \brief The TSHashtable class
+    /// Thread safe hash table. The keys are spread over stripes, each stripe is an open addressing
+    /// table with linear probing, guarded by its own lock, and grows independently of the others.
+    /// The slots keep the hashes so that the probing does not touch the nodes.
+    /// The entries are shared nodes with their own locks, so that the values are accessed
+    /// with the stripe unlocked; the access to an entry prolongs its ttl.
+    /// The entries with ttl are indexed by a timing wheel of seconds; the access does not touch
+    /// the wheel, a prolonged entry is rescheduled when its old time comes.
+    ///
     template <typename Key, typename Value, typename Hash=std::hash<Key> >
     class TSHashtable
     {
-    private:
-        class BucketType
-        {
-        private:
-            using BucketValue = std::pair<Key, Value>;
-            using BucketData = TSList<BucketValue>;
-            using BucketPtr = std::shared_ptr<BucketValue>;
+    public:
+        using Entry = std::pair<Key, Value>;
 
-            BucketData m_data;
+        struct node : std::enable_shared_from_this<node>
+        {
+            using OnExpired = std::function<void(Entry&)>;
 
-            BucketPtr findEntryFor(Key const& key)
-            {
-                return m_data.findFirstOf(
-                    [&](BucketValue const& item)
-                    {return item.first == key;}
-                );
-            }
-        public:
-            using node = typename BucketData::node;
-            using OnExpired = typename BucketData::OnExpired;
-            using FuncNode = typename BucketData::FuncNode;
+            mutable std::mutex m;
+            Entry data;
+            ch::seconds ttl;
+            ch::seconds expires;
+            OnExpired onExpired = nullptr;
+            //the mixed hash of the key and the link of the wheel, guarded by the wheel lock
+            std::size_t hash;
+            typename TimingWheel<node>::Hook hook;
 
-            mutable std::shared_mutex blk;
+            node(const Key& key, const Value& value, ch::seconds ttl, const OnExpired& onExpired, std::size_t hash)
+                : data(key, value), ttl(ttl), onExpired(onExpired), hash(hash) { hook.owner = this; update_time(); }
 
-            void forEachNode(FuncNode f)
+            void update_time()
             {
-                m_data.forEachNode(f);
+                expires = (ttl == ch::seconds(0)) ?
+                    ch::seconds::max() : ch::time_point_cast<ch::seconds>(
+                        ch::steady_clock::now()
+                    ).time_since_epoch() + ttl;
             }
 
-            Value valueFor(Key const& key, Value const& default_value)
+            bool expired(ch::seconds now_sec) const
             {
-                BucketPtr const found_entry = findEntryFor(key);
-                return (found_entry == nullptr) ?
-                    default_value : found_entry->second;
+                return expires <= now_sec;
             }
+        };
 
-            void addOrUpdate(Key const& key, Value const& value, ch::seconds ttl = ch::seconds(0), OnExpired onExpired = nullptr)
+        using NodePtr = std::shared_ptr<node>;
+        using OnExpired = typename node::OnExpired;
+
+    private:
+        struct Slot
+        {
+            std::size_t hash = 0;
+            NodePtr ptr;
+        };
+
+        struct alignas(64) Stripe
+        {
+            static constexpr std::size_t InitialCapacity = 8;
+
+            mutable std::shared_mutex blk;
+            std::vector<Slot> slots = std::vector<Slot>(InitialCapacity);
+            std::size_t size = 0;
+
+            std::size_t mask() const { return slots.size() - 1; }
+
+            Slot* find(std::size_t hash, const Key& key)
             {
-                BucketPtr const found_entry = findEntryFor(key);
-                if (found_entry == nullptr)
-                    m_data.pushFront(BucketValue(key,value), ttl, onExpired);
-                else
-                    found_entry->second = value;
+                for(std::size_t i = hash & mask();; i = (i + 1) & mask())
+                {
+                    Slot& slot = slots[i];
+                    if(!slot.ptr) return nullptr;
+                    //the key of a node is never changed, it is safe to compare without the node lock
+                    if(slot.hash == hash && slot.ptr->data.first == key) return &slot;
+                }
             }
 
-            void remove(Key const& key)
+            //the key should be absent
+            void insert(std::size_t hash, NodePtr&& ptr)
             {
-                m_data.removeIf(
-                    [&](BucketValue const& item)
-                    {return item.first == key;}
-                );
+                if(4 * (size + 1) > 3 * slots.size()) grow();
+                place(slots, hash, std::move(ptr));
+                ++size;
             }
 
-            bool hasKey(Key const& key)
+            //backward shift deletion, keeps the probe sequences without tombstones
+            void erase(Slot* slot)
             {
-                BucketPtr const found_entry = findEntryFor(key);
-                return (found_entry != nullptr);
+                std::size_t i = slot - slots.data();
+                for(std::size_t j = (i + 1) & mask(); slots[j].ptr; j = (j + 1) & mask())
+                {
+                    std::size_t home = slots[j].hash & mask();
+                    //move j to i, unless its home is cyclically in (i, j]
+                    bool stay = (i < j) ? (i < home && home <= j) : (i < home || home <= j);
+                    if(stay) continue;
+                    slots[i] = std::move(slots[j]);
+                    i = j;
+                }
+                slots[i] = Slot();
+                --size;
             }
 
-            bool applyFor(Key const& key, std::function<bool(Value&)> f)
+            void grow()
             {
-                return m_data.findAndApplyFirstOf(
-                    [&](BucketValue const& item)
-                        {return item.first == key;},
-                    [&](BucketValue& item)
-                        {return f(item.second);}
-                );
+                std::vector<Slot> bigger(2 * slots.size());
+                for(auto& slot : slots)
+                {
+                    if(slot.ptr) place(bigger, slot.hash, std::move(slot.ptr));
+                }
+                slots.swap(bigger);
             }
 
-            void cleanup(std::vector<std::function<void()>>& res)
+            static void place(std::vector<Slot>& slots, std::size_t hash, NodePtr&& ptr)
             {
-//                m_data.unsafe_cleanup(res);
-                m_data.safe_cleanup(res);
+                const std::size_t mask = slots.size() - 1;
+                std::size_t i = hash & mask;
+                while(slots[i].ptr) i = (i + 1) & mask;
+                slots[i].hash = hash;
+                slots[i].ptr = std::move(ptr);
             }
         };
 
-        std::vector<std::unique_ptr<BucketType>> m_buckets;
+        std::unique_ptr<Stripe[]> m_stripes;
+        std::size_t m_stripeCount;
         Hash m_hasher;
-        typename std::vector<std::unique_ptr<BucketType>>::iterator m_bit;
+        std::mutex m_wheelMutex;
+        TimingWheel<node> m_wheel{nowSeconds().count()};
+
+        static ch::seconds nowSeconds()
+        {
+            return ch::time_point_cast<ch::seconds>(ch::steady_clock::now()).time_since_epoch();
+        }
 
-        BucketType& getBucket(Key const& key) const
+        void schedule(node& n)
         {
-            const std::size_t bucket_index = m_hasher(key) % m_buckets.size();
-            return *m_buckets[bucket_index];
+            std::lock_guard<std::mutex> lk(m_wheelMutex);
+            m_wheel.schedule(n.hook, n.expires.count());
         }
 
-        BucketType& getNextBucket()
+        void cancel(node& n)
         {
-            BucketType& b = *(*m_bit);
-            if(++m_bit == m_buckets.end()) m_bit = m_buckets.begin();
-            return b;
+            std::lock_guard<std::mutex> lk(m_wheelMutex);
+            m_wheel.cancel(n.hook);
         }
 
-        void cleanup(BucketType& b)
+        //the hash is mixed, the high bits select the stripe and the low bits select the slot
+        static std::size_t mix(std::size_t hash)
         {
-            std::vector<std::function<void()>> res;
+            return static_cast<std::size_t>(static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull);
+        }
+
+        Stripe& getStripe(std::size_t mixed) const
+        {
+            return m_stripes[(static_cast<uint64_t>(mixed) >> 40) % m_stripeCount];
+        }
+
+        NodePtr findNode(std::size_t hash, const Key& key) const
+        {
+            std::size_t mixed = mix(hash);
+            Stripe& s = getStripe(mixed);
+            std::shared_lock<std::shared_mutex> lock(s.blk);
+            Slot* slot = s.find(mixed, key);
+            return slot ? slot->ptr : NodePtr();
+        }
+
+        //the lock order is stripe, node, wheel
+        void expire(const std::vector<NodePtr>& due)
+        {
+            const ch::seconds now_sec = nowSeconds();
+            std::vector<NodePtr> expired;
+            for(auto& ptr : due)
             {
-                std::unique_lock<std::shared_mutex> lock(b.blk);
-                b.cleanup(res);
+                Stripe& s = getStripe(ptr->hash);
+                std::unique_lock<std::shared_mutex> lock(s.blk);
+                Slot* slot = s.find(ptr->hash, ptr->data.first);
+                //removed or replaced meanwhile
+                if(!slot || slot->ptr != ptr) continue;
+                std::lock_guard<std::mutex> lk(ptr->m);
+                if(ptr->expired(now_sec))
+                {
+                    cancel(*ptr);
+                    s.erase(slot);
+                    expired.push_back(ptr);
+                }
+                else if(ptr->ttl != ch::seconds(0))
+                {//prolonged
+                    schedule(*ptr);
+                }
             }
-            for(auto& f : res)
+            for(auto& ptr : expired)
             {
-                f();
+                std::unique_lock<std::mutex> lk(ptr->m);
+                OnExpired onExpired = std::move(ptr->onExpired);
+                lk.unlock();
+                if(onExpired) onExpired(ptr->data);
             }
         }
 
@@ -356,7 +342,6 @@ namespace graft
         class Group
         {
         private:
-            using node = typename BucketType::node;
             using NodePtrPrivate = std::shared_ptr<node>;
             using NodeWPtr = std::weak_ptr<node>;
             using ForEachFuncPrivate = std::function<bool(const Key& key, Value& val)>;
@@ -376,7 +361,7 @@ namespace graft
                     }
 
                     std::unique_lock<std::mutex> lk(ptr->m);
-                    bool res = f(key, ptr->data->second);
+                    bool res = f(key, ptr->data.second);
                     if(!res) break;
                 }
                 return invalid_keys;
@@ -418,24 +403,10 @@ namespace graft
                     m_map.erase(it);
                 }
 
-                BucketType& b = m_table.getBucket(key);
-                std::shared_lock<std::shared_mutex> lock(b.blk);
-
-                bool res = false;
-                auto f = [this, &key, &res](NodePtr& ptr)->bool
-                {
-                    if(ptr->data->first == key)
-                    {
-                        res = true;
-                        NodeWPtr wptr = ptr;
-                        m_map.emplace(key, wptr);
-                        return false;
-                    }
-                    return true;
-                };
-                b.forEachNode(f);
-
-                return res;
+                NodePtr ptr = m_table.findNode(m_table.hash(key), key);
+                if(!ptr) return false;
+                m_map.emplace(key, NodeWPtr(ptr));
+                return true;
             }
 
             bool remove(const Key& key)
@@ -444,6 +415,26 @@ namespace graft
                 return m_map.erase(key) != 0;
             }
 
+            //sets the value of the entry of the group and its ttl, the entry is rescheduled by the ttl
+            bool set(const Key& key, Value&& value, ch::seconds ttl, const OnExpired& onExpired)
+            {
+                NodePtr ptr = get(key);
+                if(!ptr) return false;
+                //the node removed or expired meanwhile is not linked into the wheel again, the lock order is stripe, node, wheel
+                Stripe& s = m_table.getStripe(ptr->hash);
+                std::shared_lock<std::shared_mutex> lock(s.blk);
+                Slot* slot = s.find(ptr->hash, key);
+                if(!slot || slot->ptr != ptr) return false;
+                std::lock_guard<std::mutex> lk(ptr->m);
+                ptr->data.second = std::move(value);
+                ptr->ttl = ttl;
+                ptr->onExpired = onExpired;
+                ptr->update_time();
+                if(ttl != ch::seconds(0)) m_table.schedule(*ptr);
+                else m_table.cancel(*ptr);
+                return true;
+            }
+
             void forEach(ForEachFunc f)
             {
                 std::vector<Key> invalid_keys;
@@ -491,64 +482,140 @@ namespace graft
         std::map<GroupName,std::shared_ptr<Group>> m_groups;
 
     public:
-        using OnExpired = typename BucketType::OnExpired;
-
-        TSHashtable(unsigned num_buckets = 64, const Hash& h = Hash())
-            : m_buckets(num_buckets), m_hasher(h)
+        TSHashtable(unsigned num_stripes = 64, const Hash& h = Hash())
+            : m_stripes(new Stripe[num_stripes]), m_stripeCount(num_stripes), m_hasher(h)
         {
-            for (int i = 0; i < num_buckets; ++i)
-                m_buckets[i] = std::make_unique<BucketType>();
-
-            m_bit = m_buckets.begin();
         }
 
         TSHashtable(const TSHashtable& other) = delete;
         TSHashtable& operator=(const TSHashtable& other) = delete;
 
+        std::size_t hash(Key const& key) const
+        {
+            return m_hasher(key);
+        }
+
         Value valueFor(Key const& key, Value const& default_value = Value()) const
         {
-            BucketType& b = getBucket(key);
-            std::shared_lock<std::shared_mutex> lock(b.blk);
-            return b.valueFor(key, default_value);
+            return valueFor(hash(key), key, default_value);
         }
 
         void addOrUpdate(const Key& key, const Value& value, ch::seconds ttl = ch::seconds(0), OnExpired onExpired = nullptr)
         {
-            getBucket(key).addOrUpdate(key, value, ttl, onExpired);
+            addOrUpdate(hash(key), key, value, ttl, onExpired);
         }
 
         void remove(const Key& key)
         {
-            BucketType& b = getBucket(key);
-            std::shared_lock<std::shared_mutex> lock(b.blk);
-            b.remove(key);
+            remove(hash(key), key);
         }
 
         bool hasKey(Key const& key) const
         {
-            BucketType& b = getBucket(key);
-            std::shared_lock<std::shared_mutex> lock(b.blk);
-            return b.hasKey(key);
+            return hasKey(hash(key), key);
         }
 
         bool apply(Key const& key, std::function<bool(Value&)> f)
         {
-            BucketType& b = getBucket(key);
-            std::shared_lock<std::shared_mutex> lock(b.blk);
-            return b.applyFor(key, f);
+            return apply(hash(key), key, f);
         }
 
+        //the same with the hash of the key precomputed by the caller, it must be the same for every access of the key
+        Value valueFor(std::size_t hash, Key const& key, Value const& default_value) const
+        {
+            NodePtr ptr = findNode(hash, key);
+            if(!ptr) return default_value;
+            std::lock_guard<std::mutex> lk(ptr->m);
+            ptr->update_time();
+            return ptr->data.second;
+        }
+
+        void addOrUpdate(std::size_t hash, const Key& key, const Value& value, ch::seconds ttl, OnExpired onExpired)
+        {
+            std::size_t mixed = mix(hash);
+            Stripe& s = getStripe(mixed);
+            std::unique_lock<std::shared_mutex> lock(s.blk);
+            if(Slot* slot = s.find(mixed, key))
+            {
+                std::lock_guard<std::mutex> lk(slot->ptr->m);
+                slot->ptr->data.second = value;
+                slot->ptr->update_time();
+                return;
+            }
+            NodePtr ptr = std::make_shared<node>(key, value, ttl, onExpired, mixed);
+            if(ttl != ch::seconds(0)) schedule(*ptr);
+            s.insert(mixed, std::move(ptr));
+        }
+
+        void remove(std::size_t hash, const Key& key)
+        {
+            std::size_t mixed = mix(hash);
+            Stripe& s = getStripe(mixed);
+            std::unique_lock<std::shared_mutex> lock(s.blk);
+            Slot* slot = s.find(mixed, key);
+            if(!slot) return;
+            cancel(*slot->ptr);
+            s.erase(slot);
+        }
+
+        bool hasKey(std::size_t hash, Key const& key) const
+        {
+            NodePtr ptr = findNode(hash, key);
+            if(!ptr) return false;
+            std::lock_guard<std::mutex> lk(ptr->m);
+            ptr->update_time();
+            return true;
+        }
+
+        bool apply(std::size_t hash, Key const& key, std::function<bool(Value&)> f)
+        {
+            NodePtr ptr = findNode(hash, key);
+            if(!ptr) return false;
+            std::lock_guard<std::mutex> lk(ptr->m);
+            ptr->update_time();
+            return f(ptr->data.second);
+        }
+
+        std::size_t size() const
+        {
+            std::size_t res = 0;
+            for(std::size_t i = 0; i < m_stripeCount; ++i)
+            {
+                std::shared_lock<std::shared_mutex> lock(m_stripes[i].blk);
+                res += m_stripes[i].size;
+            }
+            return res;
+        }
+
+        //removes the entries expired by now, in O(expired + prolonged);
+        //all additionally sweeps all the entries
         void cleanup(bool all = false)
         {
-            BucketType* b = &getNextBucket();
-            for(BucketType* n = b;;)
+            std::vector<NodePtr> due;
+            {
+                std::vector<node*> fired;
+                std::lock_guard<std::mutex> lk(m_wheelMutex);
+                m_wheel.advance(nowSeconds().count(), fired);
+                //the fired nodes are still in the table, it holds them
+                due.reserve(fired.size());
+                for(node* n : fired) due.push_back(n->shared_from_this());
+            }
+            expire(due);
+            if(!all) return;
+
+            for(std::size_t i = 0; i < m_stripeCount; ++i)
             {
-                cleanup(*n);
-                if(!all) break;
-                n = &getNextBucket();
-                if(n == b) break;
+                Stripe& s = m_stripes[i];
+                std::vector<NodePtr> all_nodes;
+                {
+                    std::shared_lock<std::shared_mutex> lock(s.blk);
+                    for(auto& slot : s.slots)
+                    {
+                        if(slot.ptr) all_nodes.push_back(slot.ptr);
+                    }
+                }
+                expire(all_nodes);
             }
         }
     };
 }
-
@@ -11,13 +11,19 @@ struct ConfigOpts;
 class HandlerAPI
 {
 public:
+    using UpstreamCallback = std::function<void(Input& input, const std::string& err)>;
+
     virtual void sendUpstreamBlocking(Output& output, Input& input, std::string& err) = 0;
+    //sends the output to the upstream without blocking, the callback gets the response or the error;
+    //it is called in the I/O thread and should not block
+    virtual void sendUpstreamAsync(const Output& output, UpstreamCallback callback) = 0;
     virtual bool addPeriodicTask(const Router::Handler& h_worker,
                                  std::chrono::milliseconds interval_ms,
                                  std::chrono::milliseconds initial_interval_ms = std::chrono::milliseconds::max(),
                                  double random_factor = 0) = 0;
     virtual request::system_info::Counter& runtimeSysInfo() = 0;
-    virtual const ConfigOpts& configOpts() const = 0;
+    //the snapshot of the options, a reload publishes a new one and does not change the snapshots taken before
+    virtual std::shared_ptr<const ConfigOpts> configOpts() const = 0;
 };
 
 }//namespace graft
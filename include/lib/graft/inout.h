@@ -194,7 +194,7 @@ namespace graft
             return std::make_pair(body.c_str(), body.length());
         }
 
-        std::string data() const
+        const std::string& data() const
         {
             return body;
         }
@@ -211,7 +211,11 @@ namespace graft
 
         std::string port;
         std::string path;
-        static std::unordered_map<std::string, std::tuple<std::string,int,bool,double>> uri_substitutions;
+        //the request can be duplicated to the upstream, see hedge-percentile in Config.ini
+        bool idempotent = false;
+        //name -> uri, maximal number of connections, keep-alive, timeout
+        using UriSubstitutions = std::unordered_map<std::string, std::tuple<std::string,int,bool,double>>;
+        static UriSubstitutions uri_substitutions;
     };
 
     class InHttp final : public InOutHttpBase
@@ -309,7 +313,7 @@ namespace graft
             InOutHttpBase::reset();
         }
 
-        std::string data() const
+        const std::string& data() const
         {
             return body;
         }
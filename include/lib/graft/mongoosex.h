@@ -16,4 +16,8 @@ mg_connection *mg_connect_http_x(
     MG_CB(mg_event_handler_t event_handler, void *user_data), const char *url,
     const char *extra_headers, const std::string& post_data);
 
+//Similar to mg_bind, but the listening socket has SO_REUSEPORT option set, so that several managers
+//can listen on the same TCP address and the kernel distributes incoming connections between them.
+mg_connection *mg_bind_reuseport(mg_mgr *mgr, const char *address, MG_CB(mg_event_handler_t event_handler, void *user_data));
+
 } //namespace mg
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <deque>
+
+namespace graft::detail {
+
+//////////////
+/// \brief The PriorityLanesT class
+/// FIFO lanes of the items waiting for the thread pool, lane 0 has the highest priority.
+/// pop chooses the lane by smooth weighted round-robin among the non-empty lanes, so a lane gets its share
+/// by its weight and the lower ones are not starved.
+/// popLowerThan takes the newest item of the lowest lane to shed it in favor of a higher one.
+///
+template<typename T, size_t N>
+class PriorityLanesT
+{
+public:
+    explicit PriorityLanesT(const std::array<int,N>& weights) : m_weights(weights) { }
+
+    void push(size_t lane, T item)
+    {
+        assert(lane < N);
+        m_lanes[lane].emplace_back(std::move(item));
+        ++m_size;
+    }
+
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+    size_t size(size_t lane) const { return m_lanes[lane].size(); }
+
+    //the number of items in the lanes from 0 to lane inclusive
+    size_t sizeUpTo(size_t lane) const
+    {
+        size_t res = 0;
+        for(size_t i = 0; i <= lane && i < N; ++i) res += m_lanes[i].size();
+        return res;
+    }
+
+    T pop()
+    {
+        assert(!empty());
+        int total = 0;
+        size_t best = N;
+        for(size_t i = 0; i < N; ++i)
+        {
+            if(m_lanes[i].empty()) continue;
+            m_current[i] += m_weights[i];
+            total += m_weights[i];
+            if(best == N || m_current[best] < m_current[i]) best = i;
+        }
+        m_current[best] -= total;
+        return take(m_lanes[best].begin(), best);
+    }
+
+    bool popLowerThan(size_t lane, T& item)
+    {
+        for(size_t i = N; lane + 1 < i--; )
+        {
+            if(m_lanes[i].empty()) continue;
+            item = take(--m_lanes[i].end(), i);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    T take(typename std::deque<T>::iterator it, size_t lane)
+    {
+        T res = std::move(*it);
+        m_lanes[lane].erase(it);
+        --m_size;
+        if(m_lanes[lane].empty()) m_current[lane] = 0;
+        return res;
+    }
+
+    std::array<int,N> m_weights;
+    std::array<int,N> m_current{};
+    std::array<std::deque<T>,N> m_lanes;
+    size_t m_size = 0;
+};
+
+}
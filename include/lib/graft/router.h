@@ -5,6 +5,7 @@
 #include "lib/graft/context.h"
 #include "r3.h"
 
+#include <chrono>
 #include <forward_list>
 #include <functional>
 #include <string>
@@ -12,10 +13,26 @@
 #include <utility>
 #include <algorithm>
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 namespace graft {
 
+//the priority of the worker action of a route, the jobs wait for the thread pool in a lane per priority
+enum class Priority : uint8_t
+{
+    Critical, //time critical RTA traffic
+    Normal,
+    Low, //diagnostics
+    Count
+};
+
+namespace detail
+{
+//returns the dense id of the route group; the groups with the same name share the id, the ids are in the order of registration
+uint32_t registerConcurrencyGroup(const std::string& group);
+}
+
 template<typename In, typename Out>
 class RouterT
 {
@@ -42,11 +59,43 @@ public:
 
         Handler3(const Handler& worker_action) : worker_action(worker_action) { }
         Handler3(Handler&& worker_action) : worker_action(std::move(worker_action)) { }
+
+        //deadline is the longest acceptable wait for the thread pool, 0 means http-connection-timeout
+        Handler3& setPriority(Priority prio, std::chrono::milliseconds deadline_ms = std::chrono::milliseconds(0))
+        {
+            priority = prio;
+            deadline = deadline_ms;
+            return *this;
+        }
+
+        //at most limit worker actions of the route (or of the routes of the group) run at once, queue_len more wait
+        //and the rest are rejected with Busy; the group is the endpoint by default, [route-limits] of config.ini overrides it
+        Handler3& setConcurrency(size_t limit, size_t queue_len = 0, const std::string& group = std::string())
+        {
+            Concurrency c{group, limit, queue_len};
+            if(!group.empty()) c.id = detail::registerConcurrencyGroup(group);
+            concurrency = std::make_shared<const Concurrency>(std::move(c));
+            return *this;
+        }
     public:
         Handler pre_action;
         Handler worker_action;
         Handler post_action;
         std::string name;
+        Priority priority = Priority::Normal;
+        std::chrono::milliseconds deadline{0};
+
+        struct Concurrency
+        {
+            std::string group;
+            size_t limit = 0; //0 means no limit
+            size_t queue_len = 0;
+            //the dense id of the group, the task managers keep the limits by it instead of by the name
+            uint32_t id = NoId;
+            static constexpr uint32_t NoId = ~uint32_t(0);
+        };
+        //it is shared by the copies of the handler, it is set for each route by addRoute
+        std::shared_ptr<const Concurrency> concurrency;
     };
 
     struct JobParams
@@ -86,6 +135,7 @@ public:
     void addRoute(const std::string& endpoint, int methods, const Handler3& ph3)
     {
         Route r{m_endpointPrefix + endpoint, methods, ph3};
+        setConcurrencyGroup(r);
         m_routes.push_front(r);
     }
 
@@ -94,6 +144,14 @@ public:
     void addRoute(const std::string& endpoint, int methods, const Handler3&& ph3)
     {
         m_routes.push_front({m_endpointPrefix + endpoint, methods, std::move(ph3)});
+        setConcurrencyGroup(m_routes.front());
+    }
+
+    //keeps the routes whose endpoints without the prefix of the router are accepted by the predicate
+    template<typename Pred>
+    void filterRoutes(Pred pred)
+    {
+        m_routes.remove_if([this, &pred](const Route& r){ return !pred(r.endpoint.substr(m_endpointPrefix.size())); });
     }
 
 public:
@@ -109,6 +167,18 @@ private:
         Handler3 h3;
     };
 
+    //every route gets a group, so that a limit can be set in config.ini for a route that has none
+    static void setConcurrencyGroup(Route& r)
+    {
+        auto& cc = r.h3.concurrency;
+        if(cc && !cc->group.empty()) return;
+        typename Handler3::Concurrency c;
+        if(cc) c = *cc;
+        c.group = r.endpoint;
+        c.id = detail::registerConcurrencyGroup(c.group);
+        cc = std::make_shared<const typename Handler3::Concurrency>(std::move(c));
+    }
+
     std::forward_list<Route> m_routes;
     std::string m_endpointPrefix;
 
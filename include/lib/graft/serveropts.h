@@ -1,6 +1,8 @@
 #pragma once
 
+#include <map>
 #include <string>
+#include <tuple>
 #include <vector>
 #include <cassert>
 
@@ -20,7 +22,48 @@ struct IPFilterOpts
     int requests_per_sec = 0;
     int window_size_sec = 0;
     int ban_ip_sec = 0;
+    // limit of the sources tracked by the rate limiter and banned, 0 means the default
+    int max_sources = 0;
     std::string rules_filename;
+
+    bool operator == (const IPFilterOpts& o) const
+    {
+        return std::tie(requests_per_sec, window_size_sec, ban_ip_sec, max_sources, rules_filename)
+                == std::tie(o.requests_per_sec, o.window_size_sec, o.ban_ip_sec, o.max_sources, o.rules_filename);
+    }
+    bool operator != (const IPFilterOpts& o) const { return !(*this == o); }
+};
+
+struct CircuitBreakerOpts
+{
+    // share of failed requests among the latest ones that opens the breaker of an upstream, 0 disables the breaker
+    double error_rate = 0;
+    // a request slower than the value in milliseconds counts as failed, 0 means only errors count
+    int slow_ms = 0;
+    // number of the latest requests the error rate is calculated on
+    int window = 20;
+    // time in milliseconds the open breaker refuses requests before a probing one is let through
+    int open_ms = 5000;
+    // a hedged request is sent when the response to an idempotent request is not received
+    // in this percentile of the recent latencies, 0 disables hedging
+    double hedge_percentile = 0;
+    // minimal delay of a hedged request in milliseconds
+    int hedge_min_ms = 10;
+
+    bool operator == (const CircuitBreakerOpts& o) const
+    {
+        return std::tie(error_rate, slow_ms, window, open_ms, hedge_percentile, hedge_min_ms)
+                == std::tie(o.error_rate, o.slow_ms, o.window, o.open_ms, o.hedge_percentile, o.hedge_min_ms);
+    }
+    bool operator != (const CircuitBreakerOpts& o) const { return !(*this == o); }
+};
+
+struct RouteLimitOpts
+{
+    // maximal number of the worker actions of a route group running at once, 0 means no limit
+    int limit = 0;
+    // maximal number of the worker actions waiting for the limit, the rest are rejected with 503
+    int queue_len = 0;
 };
 
 struct ConfigOpts
@@ -29,16 +72,37 @@ struct ConfigOpts
     std::string http_address;
     std::string coap_address;
     double http_connection_timeout;
+    // idle timeout of client keep-alive connections in seconds, 0 means the connection is closed after a response
+    double http_keep_alive_timeout = 0;
+    // maximal number of requests over a client keep-alive connection, 0 means unlimited
+    int http_keep_alive_max_requests = 0;
     double upstream_request_timeout;
+    // idle keep-alive upstream connections are closed after the timeout in seconds, 0 means never
+    double upstream_idle_timeout = 30;
+    // idle keep-alive upstream connections are probed by TCP keep-alive after the interval in seconds, 0 means no probes
+    int upstream_probe_interval = 10;
+    // number of I/O threads, each one runs its own Looper, the HTTP port is shared by SO_REUSEPORT
+    int io_threads = 1;
     int workers_count;
     int worker_queue_len;
     int workers_expelling_interval_ms;
     std::string cryptonode_rpc_address;
+    // maximal number of keep-alive connections to the cryptonode, 0 means a new connection per request
+    int cryptonode_pool_size = 0;
+    // maximal number of requests in flight over a keep-alive cryptonode connection, 1 disables pipelining
+    int cryptonode_pipeline_depth = 1;
+    // lifetime of the cached responses of the forwarded cryptonode requests, 0 disables the cache and request coalescing
+    int forward_cache_ttl_ms = 0;
+    // maximal number of the cached responses of the forwarded cryptonode requests
+    int forward_cache_max_entries = 1024;
     int timer_poll_interval_ms;
     int log_trunc_to_size;
     std::vector<std::string> graftlet_dirs;
     int lru_timeout_ms;
     IPFilterOpts ipfilter;
+    CircuitBreakerOpts circuit_breaker;
+    // the concurrency limits of the route groups by the names, they override the limits set on registration
+    std::map<std::string, RouteLimitOpts> route_limits;
     CommonOpts common;
 
     void check_asserts() const
@@ -46,11 +110,27 @@ struct ConfigOpts
         assert(!http_address.empty());
         assert(!coap_address.empty());
         assert(0 < http_connection_timeout);
+        assert(0 <= http_keep_alive_timeout);
+        assert(0 <= http_keep_alive_max_requests);
         assert(0 < upstream_request_timeout);
+        assert(0 <= upstream_idle_timeout);
+        assert(0 <= upstream_probe_interval);
+        assert(0 <= cryptonode_pool_size);
+        assert(0 < cryptonode_pipeline_depth);
         assert(0 < workers_expelling_interval_ms);
         assert(0 < timer_poll_interval_ms);
+        assert(0 < io_threads);
         assert(0 < lru_timeout_ms);
+        assert(0 <= forward_cache_ttl_ms);
+        assert(forward_cache_ttl_ms == 0 || 0 < forward_cache_max_entries);
         assert(ipfilter.requests_per_sec == 0 || 0 < ipfilter.window_size_sec);
+        assert(0 <= circuit_breaker.error_rate && circuit_breaker.error_rate <= 1);
+        assert(circuit_breaker.error_rate == 0 || (0 < circuit_breaker.window && 0 < circuit_breaker.open_ms));
+        assert(0 <= circuit_breaker.hedge_percentile && circuit_breaker.hedge_percentile < 100);
+        for(auto& item : route_limits)
+        {
+            assert(0 <= item.second.limit && 0 <= item.second.queue_len);
+        }
     }
 };
 
@@ -0,0 +1,175 @@
+
+#pragma once
+
+#include <any>
+#include <cassert>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+namespace graft::detail {
+
+//////////////
+/// \brief The SmallAny class
+/// A move-only std::any with a larger inline buffer. The values that fit the buffer and are nothrow movable
+/// are kept inline, that covers the scalars, the enums and std::string; the others are allocated
+/// by the memory resource passed to emplace.
+///
+class SmallAny
+{
+public:
+    static constexpr size_t BufferSize = 32;
+
+    template<typename T>
+    static constexpr bool isInline = sizeof(T) <= BufferSize && alignof(T) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<T>::value;
+
+    SmallAny() = default;
+    SmallAny(const SmallAny&) = delete;
+    SmallAny& operator = (const SmallAny&) = delete;
+    SmallAny(SmallAny&& other) noexcept { other.moveTo(*this); }
+    SmallAny& operator = (SmallAny&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            other.moveTo(*this);
+        }
+        return *this;
+    }
+    ~SmallAny() { reset(); }
+
+    template<typename T, typename ...ARGS>
+    T& emplace(std::pmr::memory_resource* resource, ARGS&&... args)
+    {
+        static_assert(std::is_same<T, std::decay_t<T>>::value, "decayed type expected");
+        reset();
+        T* value;
+        if constexpr (isInline<T>)
+        {
+            value = new(m_buffer) T(std::forward<ARGS>(args)...);
+        }
+        else
+        {
+            std::pmr::polymorphic_allocator<T> alloc(resource);
+            T* p = alloc.allocate(1);
+            try
+            {
+                value = new(p) T(std::forward<ARGS>(args)...);
+            }
+            catch(...)
+            {
+                alloc.deallocate(p, 1);
+                throw;
+            }
+            m_heap.value = value;
+            m_heap.resource = resource;
+        }
+        m_ops = ops<T>();
+        return *value;
+    }
+
+    void reset()
+    {
+        if(!m_ops) return;
+        m_ops->destroy(*this);
+        m_ops = nullptr;
+    }
+
+    bool has_value() const { return m_ops; }
+
+    //returns nullptr if the value is not of type T
+    template<typename T>
+    T* get() noexcept
+    {
+        using V = std::remove_cv_t<T>;
+        if(!m_ops) return nullptr;
+        //the values set by graftlets can have another copy of ops<V>
+        if(m_ops != ops<V>() && m_ops->type() != typeid(V)) return nullptr;
+        return static_cast<T*>(value());
+    }
+
+    //throws std::bad_any_cast as std::any_cast does
+    template<typename T>
+    T& cast()
+    {
+        T* value = get<T>();
+        if(!value) throw std::bad_any_cast();
+        return *value;
+    }
+
+private:
+    struct Ops
+    {
+        bool heap;
+        const std::type_info& (*type)();
+        void (*destroy)(SmallAny& any);
+        void (*move)(SmallAny& from, SmallAny& to);
+    };
+
+    struct Heap
+    {
+        void* value;
+        std::pmr::memory_resource* resource;
+    };
+
+    template<typename T>
+    static const Ops* ops()
+    {
+        static constexpr Ops ops
+        {
+            !isInline<T>,
+            []() -> const std::type_info& { return typeid(T); },
+            [](SmallAny& any)
+            {
+                T* value = static_cast<T*>(any.value());
+                value->~T();
+                if constexpr (!isInline<T>)
+                {
+                    std::pmr::polymorphic_allocator<T>(any.m_heap.resource).deallocate(value, 1);
+                }
+            },
+            [](SmallAny& from, SmallAny& to)
+            {
+                if constexpr (isInline<T>)
+                {
+                    T* value = static_cast<T*>(from.value());
+                    new(to.m_buffer) T(std::move(*value));
+                    value->~T();
+                }
+                else
+                {
+                    to.m_heap = from.m_heap;
+                }
+            },
+        };
+        return &ops;
+    }
+
+    void* value()
+    {
+        assert(m_ops);
+        return m_ops->heap? m_heap.value : static_cast<void*>(m_buffer);
+    }
+
+    void moveTo(SmallAny& to) noexcept
+    {
+        assert(!to.m_ops);
+        if(!m_ops) return;
+        m_ops->move(*this, to);
+        to.m_ops = m_ops;
+        m_ops = nullptr;
+    }
+
+    union
+    {
+        alignas(std::max_align_t) unsigned char m_buffer[BufferSize];
+        Heap m_heap;
+    };
+    const Ops* m_ops = nullptr;
+};
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "lib/graft/router.h"
+#include "lib/graft/context.h"
+
+#include <cassert>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+namespace graft {
+
+//////////////
+/// \brief The StagedHandler class
+/// A handler of a multi-stage request, the stages are written in order as a coroutine would be and the
+/// handler resumes at the next stage each time it is called again, after Forward, Postpone or Again.
+/// The last stage is repeated. The state kept between the stages is the Frame, it lives in a typed slot
+/// of the local context of the task; it is created on the first stage and destroyed with the task,
+/// so that a stage finds the data of the previous ones without string keys and without parsing them again.
+///
+template<typename Frame>
+class StagedHandler
+{
+public:
+    using Stage = std::function<Status (const Router::vars_t&, const Input&, Context&, Output&, Frame&)>;
+
+    //the name is of the slot, it should be unique per handler
+    static Router::Handler make(const char* name, std::initializer_list<Stage> stages)
+    {
+        assert(stages.size());
+        auto shared = std::make_shared<const std::vector<Stage>>(stages);
+        Context::Local::Slot<StatePtr> slot(name);
+        return [shared, slot](const Router::vars_t& vars, const Input& input, Context& ctx, Output& output)->Status
+        {
+            //the state is not moved when the slots grow, a stage can keep references into the frame
+            StatePtr* ptr = ctx.local.find(slot);
+            State* state = ptr? ptr->get() : ctx.local.set(slot, std::make_unique<State>()).get();
+            const std::vector<Stage>& stages = *shared;
+            size_t stage = state->stage;
+            if(stage + 1 < stages.size()) ++state->stage;
+            return stages[stage](vars, input, ctx, output, state->frame);
+        };
+    }
+
+private:
+    struct State
+    {
+        size_t stage = 0;
+        Frame frame;
+    };
+    using StatePtr = std::unique_ptr<State>;
+};
+
+}//namespace graft
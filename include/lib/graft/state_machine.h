@@ -1,7 +1,7 @@
-
 #pragma once
 
 #include "lib/graft/task.h"
+#include "lib/graft/dispatch_table.h"
 
 namespace graft
 {
@@ -23,11 +23,15 @@ public:
     EXP(EXIT) \
 
     enum State { GRAFT_STATE_LIST(EXP_TO_ENUM) };
+    static constexpr size_t StateCount = 0 GRAFT_STATE_LIST(EXP_TO_ONE);
 
     using St = graft::Status;
-    using Statuses = std::initializer_list<graft::Status>;
-    using Guard = std::function<bool (BaseTaskPtr bt)>;
-    using Action = std::function<void (BaseTaskPtr bt)>;
+    using Table = detail::DispatchTableT<State, StateCount, St, StatusCount, BaseTaskPtr>;
+    using Statuses = Table::Statuses;
+    using Guard = Table::Guard;
+    using Action = Table::Action;
+    //called on each transition if set
+    using Trace = std::function<void (const BaseTaskPtr& bt, State from, State to)>;
 
     StateMachine(State initial_state = EXECUTE)
     {
@@ -35,7 +39,7 @@ public:
         init_table();
     }
 
-    void dispatch(BaseTaskPtr bt, State initial_state)
+    void dispatch(const BaseTaskPtr& bt, State initial_state)
     {
         state(initial_state);
         while(state() != EXIT)
@@ -44,23 +48,30 @@ public:
         }
     }
 
+    void setTrace(Trace trace) { m_trace = std::move(trace); }
+    //writes transitions to the log
+    static void logTrace(const BaseTaskPtr& bt, State from, State to);
+
+    //the rows the table is compiled from
+    static std::vector<Table::Row> rows();
+    const Table& table() const { return m_table; }
+
 private:
-    void init_table();
+    void init_table() { m_table.compile(rows()); }
     State state() const { return m_state; }
     State state(State state) { return m_state = state; }
-    St status(BaseTaskPtr bt) const { return bt->getLastStatus(); }
+    St status(const BaseTaskPtr& bt) const { return bt->getLastStatus(); }
 
-    void process(BaseTaskPtr bt);
+    void process(const BaseTaskPtr& bt);
 
     using H3 = Router::Handler3;
 
-    const Guard has(Router::Handler H3::* act);
-    const Guard hasnt(Router::Handler H3::* act);
+    static const Guard has(Router::Handler H3::* act);
+    static const Guard hasnt(Router::Handler H3::* act);
 
     State m_state;
-    enum columns          { smStateStart,   smStatuses, smStateEnd, smGuard,    smAction};
-    using row = std::tuple< State,          Statuses,   State,      Guard,      Action  >;
-    std::vector<row> m_table;
+    Table m_table;
+    Trace m_trace;
 };
 
 }//namespace graft
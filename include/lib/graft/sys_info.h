@@ -4,6 +4,10 @@
 #include <atomic>
 #include <cstdint>
 #include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
 
 namespace graft { class Context; }
 
@@ -16,6 +20,24 @@ using SysClockTimePoint = std::chrono::time_point<std::chrono::system_clock>;
 class Counter
 {
   public:
+    // gauges of an upstream connection pool, summed over the I/O threads
+    struct UpstreamPoolGauges
+    {
+      std::atomic<u64> active{0};     // connections waiting for responses
+      std::atomic<u64> idle{0};       // keep-alive connections ready for requests
+      std::atomic<u64> queued{0};     // requests waiting for a connection
+      std::atomic<u64> pipelined{0};  // requests sent over a busy connection
+    };
+
+    // gauges of the concurrency limit of a route group, summed over the I/O threads
+    struct RouteLimitGauges
+    {
+      std::atomic<u64> limit{0};      // worker actions allowed to run at once
+      std::atomic<u64> active{0};     // worker actions running or in the thread pool
+      std::atomic<u64> queued{0};     // worker actions waiting for the limit
+      std::atomic<u64> rejected{0};   // requests rejected with 503 beyond the queue
+    };
+
     Counter(void);
     ~Counter(void);
 
@@ -39,6 +61,26 @@ class Counter
     void count_upstrm_http_req_bytes_raw(u32 inc_delta)   { m_upstrm_http_req_bytes_raw_cnt += inc_delta; }
     void count_upstrm_http_resp_bytes_raw(u32 inc_delta)  { m_upstrm_http_resp_bytes_raw_cnt += inc_delta; }
 
+    void count_upstrm_breaker_open(void)      { ++m_upstrm_breaker_open_cnt; }
+    void count_upstrm_fast_fail(void)         { ++m_upstrm_fast_fail_cnt; }
+    void count_upstrm_hedged(void)            { ++m_upstrm_hedged_cnt; }
+
+    void count_fwd_cache_hit(void)            { ++m_fwd_cache_hit_cnt; }
+    void count_fwd_cache_miss(void)           { ++m_fwd_cache_miss_cnt; }
+    void count_fwd_cache_coalesced(void)      { ++m_fwd_cache_coalesced_cnt; }
+
+    // the heap allocations of the task memory, the task objects and the overflow of their arenas
+    void count_tsk_heap_alloc(u32 inc_delta)  { m_tsk_heap_alloc_cnt += inc_delta; }
+    void count_tsk_recycled(void)             { ++m_tsk_recycled_cnt; }
+
+    // the notifications of the I/O threads (eventfd writes) and their wake ups by them
+    void count_io_notify(void)                { ++m_io_notify_cnt; }
+    void count_io_wakeup(void)                { ++m_io_wakeup_cnt; }
+
+    // the gauges are created on the first call and live as long as the counter
+    UpstreamPoolGauges& upstream_pool(const std::string& name);
+    RouteLimitGauges& route_limit(const std::string& name);
+
     // interface for consumer
     u64 http_request_total_cnt(void)          const { return m_http_req_total_cnt; }
     u64 http_request_routed_cnt(void)         const { return m_http_req_routed_cnt; }
@@ -59,6 +101,23 @@ class Counter
     u64 upstrm_http_req_bytes_raw_cnt(void)   const { return m_upstrm_http_req_bytes_raw_cnt; }
     u64 upstrm_http_resp_bytes_raw_cnt(void)  const { return m_upstrm_http_resp_bytes_raw_cnt; }
 
+    u64 upstrm_breaker_open_cnt(void)         const { return m_upstrm_breaker_open_cnt; }
+    u64 upstrm_fast_fail_cnt(void)            const { return m_upstrm_fast_fail_cnt; }
+    u64 upstrm_hedged_cnt(void)               const { return m_upstrm_hedged_cnt; }
+
+    u64 fwd_cache_hit_cnt(void)               const { return m_fwd_cache_hit_cnt; }
+    u64 fwd_cache_miss_cnt(void)              const { return m_fwd_cache_miss_cnt; }
+    u64 fwd_cache_coalesced_cnt(void)         const { return m_fwd_cache_coalesced_cnt; }
+
+    u64 tsk_heap_alloc_cnt(void)              const { return m_tsk_heap_alloc_cnt; }
+    u64 tsk_recycled_cnt(void)                const { return m_tsk_recycled_cnt; }
+
+    u64 io_notify_cnt(void)                   const { return m_io_notify_cnt; }
+    u64 io_wakeup_cnt(void)                   const { return m_io_wakeup_cnt; }
+
+    void upstream_pools(const std::function<void(const std::string& name, const UpstreamPoolGauges& gauges)>& f) const;
+    void route_limits(const std::function<void(const std::string& name, const RouteLimitGauges& gauges)>& f) const;
+
     u32 system_uptime_sec(void) const
     {
       return std::chrono::duration_cast<std::chrono::seconds>(
@@ -85,6 +144,26 @@ class Counter
     std::atomic<u64>  m_upstrm_http_req_bytes_raw_cnt;
     std::atomic<u64>  m_upstrm_http_resp_bytes_raw_cnt;
 
+    std::atomic<u64>  m_upstrm_breaker_open_cnt;
+    std::atomic<u64>  m_upstrm_fast_fail_cnt;
+    std::atomic<u64>  m_upstrm_hedged_cnt;
+
+    std::atomic<u64>  m_fwd_cache_hit_cnt;
+    std::atomic<u64>  m_fwd_cache_miss_cnt;
+    std::atomic<u64>  m_fwd_cache_coalesced_cnt;
+
+    std::atomic<u64>  m_tsk_heap_alloc_cnt;
+    std::atomic<u64>  m_tsk_recycled_cnt;
+
+    std::atomic<u64>  m_io_notify_cnt;
+    std::atomic<u64>  m_io_wakeup_cnt;
+
+    mutable std::mutex m_upstream_pools_mutex;
+    std::map<std::string, UpstreamPoolGauges> m_upstream_pools;
+
+    mutable std::mutex m_route_limits_mutex;
+    std::map<std::string, RouteLimitGauges> m_route_limits;
+
     const SysClockTimePoint m_system_start_time;
 };
 
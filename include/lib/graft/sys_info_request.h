@@ -38,6 +38,22 @@ GRAFT_DEFINE_IO_STRUCT_INITED(Configuratioon,
     (std::string, log_categories, std::string())
 );
 
+GRAFT_DEFINE_IO_STRUCT_INITED(UpstreamPool,
+    (std::string, name, std::string()),
+    (u64, active, 0),
+    (u64, idle, 0),
+    (u64, queued, 0),
+    (u64, pipelined, 0)
+);
+
+GRAFT_DEFINE_IO_STRUCT_INITED(RouteLimit,
+    (std::string, name, std::string()),
+    (u64, limit, 0),
+    (u64, active, 0),
+    (u64, queued, 0),
+    (u64, rejected, 0)
+);
+
 GRAFT_DEFINE_IO_STRUCT_INITED(Running,
     (u64, http_request_total, 0),
     (u64, http_request_routed, 0),
@@ -58,6 +74,23 @@ GRAFT_DEFINE_IO_STRUCT_INITED(Running,
     (u64, upstrm_http_req_bytes_raw, 0),
     (u64, upstrm_http_resp_bytes_raw, 0),
 
+    (u64, upstrm_breaker_open, 0),
+    (u64, upstrm_fast_fail, 0),
+    (u64, upstrm_hedged, 0),
+
+    (u64, fwd_cache_hit, 0),
+    (u64, fwd_cache_miss, 0),
+    (u64, fwd_cache_coalesced, 0),
+
+    (u64, tsk_heap_alloc, 0),
+    (u64, tsk_recycled, 0),
+
+    (u64, io_notify, 0),
+    (u64, io_wakeup, 0),
+
+    (std::vector<UpstreamPool>, upstream_pools, std::vector<UpstreamPool>()),
+    (std::vector<RouteLimit>, route_limits, std::vector<RouteLimit>()),
+
     (u32, uptime_sec, 0)
 );
 
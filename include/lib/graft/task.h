@@ -10,9 +10,14 @@
 #include "lib/graft/router.h"
 #include "lib/graft/timer.h"
 #include "lib/graft/thread_pool.h"
+#include "lib/graft/task_pool.h"
+#include "lib/graft/priority_lanes.h"
+#include "lib/graft/sys_info.h"
 #include "misc_log_ex.h"
+#include <atomic>
 #include <future>
 #include <deque>
+#include <unordered_map>
 
 #define LOG_PRINT_CLN(level,client,x) LOG_PRINT_L##level("[" << client_addr(client) << "] " << x)
 
@@ -53,11 +58,15 @@ using GJ = GraftJob<BaseTaskPtr, TPResQueue, TaskManager>;
 //////////////
 /// \brief The GJPtr class
 /// A wrapper of GraftJob that will be moved from queue to queue with fixed size.
-/// It contains single data member of unique_ptr
+/// It contains single data member of unique_ptr, the job is allocated in the memory of its task.
 ///
 class GJPtr final
 {
-    std::unique_ptr<GJ> m_ptr = nullptr;
+    struct Deleter
+    {
+        void operator ()(GJ* gj) const;
+    };
+    std::unique_ptr<GJ, Deleter> m_ptr = nullptr;
 public:
     GJPtr(GJPtr&& rhs)
     {
@@ -75,15 +84,11 @@ public:
     GJPtr& operator = (const GJPtr&) = delete;
     ~GJPtr() = default;
 
-    template<typename ...ARGS>
-    GJPtr(ARGS&&... args) : m_ptr( new GJ( std::forward<ARGS>(args)...) )
-    {
-    }
+    GJPtr(const BaseTaskPtr& bt, TPResQueue* rq, TaskManager* manager);
 
-    template<typename ...ARGS>
-    void operator ()(ARGS... args)
+    void operator ()()
     {
-        m_ptr.get()->operator () (args...);
+        m_ptr.get()->operator () (*this);
     }
 
     GJ* operator ->()
@@ -104,9 +109,13 @@ using ThreadPoolX = tp::ThreadPoolImpl<tp::FixedFunction<void(), sizeof(GJPtr)>,
 class BaseTask : public SelfHolder<BaseTask>
 {
 public:
-    virtual ~BaseTask() { }
+    virtual ~BaseTask();
     virtual void finalize() = 0;
 
+    //the memory of the tasks created by an I/O thread is recycled by the TaskPool of the thread
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+
     void setLastStatus(Status status) { Context::LocalFriend::setLastStatus(m_ctx.local, status); }
     Status getLastStatus() const { return m_ctx.local.getLastStatus(); }
     void setError(const char* str, Status status = Status::InternalError) { m_ctx.local.setError(str, status); }
@@ -118,32 +127,43 @@ public:
     Output& getOutput() { return m_output; }
     const Router::Handler3& getHandler3() const { return m_params.h3; }
     Context& getCtx() { return m_ctx; }
+    //the timer of the periodic task, or the expiry of the postponed task
+    TimerList<BaseTaskPtr>::Timer& getTimer() { return m_timer; }
+    //the memory released with the task, or the heap if the task is not request-scoped
+    std::pmr::memory_resource* getResource() { return m_resource; }
 
     const char* getStrStatus();
     static const char* getStrStatus(Status s);
 protected:
-    BaseTask(TaskManager& manager, const Router::JobParams& prms);
+    //scoped is false for the long-living tasks, the memory they allocate is not kept till their end
+    BaseTask(TaskManager& manager, const Router::JobParams& prms, bool scoped = true);
+    //the input of the request is moved to avoid copying of possibly large bodies
+    BaseTask(TaskManager& manager, Router::JobParams&& prms, bool scoped = true);
 
     TaskManager& m_manager;
+    TaskArena m_arena;
+    std::pmr::memory_resource* m_resource;
     Router::JobParams m_params;
     Output m_output;
     Context m_ctx;
+    TimerList<BaseTaskPtr>::Timer m_timer;
 };
 
 class UpstreamTask : public BaseTask
 {
 public:
-    using PromiseItem = std::pair< std::promise<Input>, Output >;
+    using UpstreamItem = std::pair< HandlerAPI::UpstreamCallback, Output >;
 
     virtual void finalize() override;
-    PromiseItem m_pi;
+    UpstreamItem m_item;
 private:
     friend class SelfHolder<BaseTask>;
-    UpstreamTask(TaskManager& manager, PromiseItem&& pi)
+    UpstreamTask(TaskManager& manager, UpstreamItem&& item)
         : BaseTask(manager, Router::JobParams({Input(), Router::vars_t(),
                 Router::Handler3(nullptr, nullptr, nullptr)}))
-        , m_pi(std::move(pi))
+        , m_item(std::move(item))
     {
+        m_output = std::move(m_item.second);
     }
 };
 
@@ -155,7 +175,7 @@ class PeriodicTask : public BaseTask
             std::chrono::milliseconds timeout_ms,
             std::chrono::milliseconds initial_timeout_ms,
             double random_factor = 0
-    ) : BaseTask(manager, Router::JobParams({Input(), Router::vars_t(), h3}))
+    ) : BaseTask(manager, Router::JobParams({Input(), Router::vars_t(), h3}), false)
       , m_timeout_ms(timeout_ms), m_initial_timeout_ms(initial_timeout_ms)
       , m_random_factor(random_factor)
     {
@@ -180,7 +200,7 @@ public:
 class ClientTask : public BaseTask
 {
     friend class SelfHolder<BaseTask>;
-    ClientTask(ConnectionManager* connectionManager, mg_connection *client, Router::JobParams& prms);
+    ClientTask(ConnectionManager* connectionManager, mg_connection *client, Router::JobParams&& prms);
 public:
     virtual void finalize() override;
 
@@ -196,12 +216,15 @@ class UpstreamManager;
 class TaskManager : private HandlerAPI
 {
 public:
-    TaskManager(const ConfigOpts& copts, SysInfoCounter& sysInfoCounter);
+    //primary is not null for the additional I/O threads, they share the global context and the thread pool of the primary
+    TaskManager(const ConfigOpts& copts, SysInfoCounter& sysInfoCounter, TaskManager* primary = nullptr);
     virtual ~TaskManager();
     TaskManager(const TaskManager&) = delete;
     TaskManager& operator = (const TaskManager&) = delete;
 
     void sendUpstream(BaseTaskPtr bt);
+    //applies the reloaded options that do not require restart, it is called by the I/O thread
+    void reconfigure(const ConfigOpts& copts, const OutHttp::UriSubstitutions& substitutions);
     void addPeriodicTask(const Router::Handler3& h3,
                          std::chrono::milliseconds interval_ms,
                          std::chrono::milliseconds initial_interval_ms = std::chrono::milliseconds::max(),
@@ -209,7 +232,7 @@ public:
 
     ////getters
     virtual mg_mgr* getMgMgr()  = 0;
-    GlobalContextMap& getGcm() { return m_gcm; }
+    GlobalContextMap& getGcm() { return *m_gcm; }
     ConfigOpts& getCopts() { return m_copts; }
     TimerList<BaseTaskPtr>& getTimerList() { return m_timerList; }
     ThreadPoolX& getThreadPool() { return *m_threadPool; }
@@ -224,21 +247,36 @@ public:
 
     //HandlerAPI implementation
     virtual void sendUpstreamBlocking(Output& output, Input& input, std::string& err) override;
+    virtual void sendUpstreamAsync(const Output& output, UpstreamCallback callback) override;
     virtual bool addPeriodicTask(const Router::Handler& h_worker,
                                  std::chrono::milliseconds interval_ms,
                                  std::chrono::milliseconds initial_interval_ms = std::chrono::milliseconds::max(),
                                  double random_factor = 0 ) override;
     virtual request::system_info::Counter& runtimeSysInfo() override;
-    virtual const ConfigOpts& configOpts() const override;
+    virtual std::shared_ptr<const ConfigOpts> configOpts() const override;
 
     //
     void runWorkerActionFromTheThreadPool(BaseTaskPtr bt);
 
     virtual void notifyJobReady() = 0;
+    //it is called by a worker after its result is pushed, the I/O thread is notified only if it is not yet
+    void notifyJobDone()
+    {
+        if(!m_resNotified.exchange(true, std::memory_order_acq_rel)) notifyJobReady();
+    }
 
-    void cb_event(uint64_t cnt);
+    //the number of the notifications is not used, the results are taken until the queue is empty or a batch is taken
+    void cb_event(uint64_t /*cnt*/);
+    //the results left by cb_event over the batch limit, they are taken on the next iteration of the I/O thread
+    bool hasResultBacklog() const { return m_resBacklog; }
+    void processReadyJobs();
 
     void getThreadPoolInfo(uint64_t& activeWorkers, uint64_t& expelledWorkers) const;
+
+    //the managers of other I/O threads, callbacks for the postponed tasks are passed to them
+    void setPeers(const std::vector<TaskManager*>& peers) { m_peers = peers; }
+    //can be called from any thread
+    void resumeFromPeer(const Context::uuid_t& uuid, const Input& input);
 protected:
     bool canStop();
     void executePostponedTasks();
@@ -249,25 +287,48 @@ protected:
 
     ConfigOpts m_copts;
 private:
+    //the copy of m_copts for the worker threads, it is replaced atomically by reconfigure
+    std::shared_ptr<const ConfigOpts> m_coptsSnapshot;
     void Execute(BaseTaskPtr bt);
     void processForward(BaseTaskPtr bt);
     void processOk(BaseTaskPtr bt);
+    void resumeTasks(BaseTaskPtr& bt, const std::vector<Context::uuid_t>& uuids, const Input& input);
+    void failNextTasks(BaseTaskPtr& bt, const std::string& error, int code);
     void respondAndDie(BaseTaskPtr bt, const std::string& s, bool die = true);
+    using PostponedTasks = std::unordered_map<Context::uuid_t, BaseTaskPtr, UuidHash>;
     void postponeTask(BaseTaskPtr bt);
+    //removes the postponed task and cancels its expiry
+    void erasePostponedTask(PostponedTasks::iterator it);
     void upstreamDoneProcess(UpstreamSender& uss);
 
     void checkThreadPoolOverflow(BaseTaskPtr bt);
+    //posts the waiting worker actions while the input of the thread pool is not full
+    void dispatchWaitingJobs();
+    void shedJob(BaseTaskPtr bt, const std::string& reason);
+    std::chrono::milliseconds jobDeadline(const BaseTaskPtr& bt) const;
+    struct RouteLimit;
+    //the concurrency limit of the route group of the task, nullptr if the task is not of a route
+    RouteLimit* routeLimit(const BaseTaskPtr& bt);
+    void applyRouteLimit(RouteLimit& rl);
+    //the worker action of the task is done, the next waiting one of the group is moved to the lanes if admit
+    void releaseRouteLimit(const BaseTaskPtr& bt, bool admit = true);
+    //moves the waiting jobs of the group to the lanes while it is below its limit and the lanes are not full
+    void admitRouteJobs(RouteLimit& rl);
     void runPreAction(BaseTaskPtr bt);
     void runWorkerAction(BaseTaskPtr bt);
     void runPostAction(BaseTaskPtr bt);
 
     void initThreadPool(int threadCount = std::thread::hardware_concurrency(), int workersQueueSize = 32, int expellingIntervalMs = 2000);
+    void initSharedThreadPool(TaskManager& primary);
+    //traces the transitions of the state machine if the log level of "sm" allows them
+    void setTrace();
+    void processPeerCallbacks();
     bool tryProcessReadyJob();
 
     static inline size_t next_pow2(size_t val);
 
     SysInfoCounter& m_sysInfoCounter;
-    GlobalContextMap m_gcm;
+    std::shared_ptr<GlobalContextMap> m_gcm;
 
     uint64_t m_cntBaseTask = 0;
     uint64_t m_cntBaseTaskDone = 0;
@@ -276,28 +337,71 @@ private:
     uint64_t m_cntJobDone = 0;
 
     uint64_t m_threadPoolInputSize = 0;
-    std::unique_ptr<ThreadPoolX> m_threadPool;
+
+    //the worker actions wait in the lanes by the priority of their routes when the input of the thread pool is full
+    struct WaitingJob
+    {
+        BaseTaskPtr bt;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    static constexpr size_t PriorityCount = static_cast<size_t>(Priority::Count);
+    using WaitingJobs = detail::PriorityLanesT<WaitingJob, PriorityCount>;
+    WaitingJobs m_waitingJobs{{8, 4, 1}};
+    //the worker actions of a route group beyond its limit wait here before they get to the lanes;
+    //each I/O thread gets its share of the limit as of the input of the thread pool, at least 1,
+    //so the effective limit of a group is not less than the number of I/O threads
+    struct RouteLimit
+    {
+        std::shared_ptr<const Router::Handler3::Concurrency> concurrency;
+        size_t limit = 0; //0 means no limit
+        size_t queueLen = 0;
+        size_t active = 0;
+        std::deque<WaitingJob> waiting;
+        request::system_info::Counter::RouteLimitGauges* gauges = nullptr;
+    };
+    //by the id of the group, a limit is not used until its concurrency is set
+    std::deque<RouteLimit> m_routeLimits;
+    //a group has not admitted its jobs because the lanes are full
+    bool m_routeJobsBlocked = false;
+    //exponential moving averages of the worker action duration in microseconds by the lanes, they are updated by the workers;
+    //the cheap diagnostics do not make the estimated wait of the heavy RTA jobs shorter and vice versa
+    std::array<std::atomic<uint64_t>, PriorityCount> m_avgJobUs{};
+    //the jobs posted to the thread pool and not done yet by the lanes
+    std::array<uint64_t, PriorityCount> m_inflightJobs{};
+    bool m_ownThreadPool = true;
+    std::shared_ptr<ThreadPoolX> m_threadPool;
     std::unique_ptr<TPResQueue> m_resQueue;
+    //the maximal number of the results processed per wake up of the I/O thread, the connections are served in between
+    static constexpr size_t ResultBatch = 64;
+    std::atomic<bool> m_resNotified{false};
+    bool m_resBacklog = false;
     TimerList<BaseTaskPtr> m_timerList;
 
-    std::map<Context::uuid_t, BaseTaskPtr> m_postponedTasks;
+    //the expiry of a postponed task is its timer in m_timerList
+    PostponedTasks m_postponedTasks;
     std::deque<BaseTaskPtr> m_readyToResume;
-    std::priority_queue<std::pair<std::chrono::time_point<std::chrono::steady_clock>,Context::uuid_t>> m_expireTaskQueue;
     std::unique_ptr<ExpiringList> m_futurePostponeUuids;
     std::unique_ptr<UpstreamManager> m_upstreamManager;
 
-    using PromiseItem = UpstreamTask::PromiseItem;
-    using PromiseQueue = tp::MPMCBoundedQueue<PromiseItem>;
+    std::vector<TaskManager*> m_peers;
+    std::mutex m_peerCallbacksMutex;
+    std::deque<std::pair<Context::uuid_t, Input>> m_peerCallbacks;
+
+    using UpstreamItem = UpstreamTask::UpstreamItem;
+    using UpstreamQueue = tp::MPMCBoundedQueue<UpstreamItem>;
 
     using PeridicTaskItem = std::tuple<Router::Handler3, std::chrono::milliseconds, std::chrono::milliseconds, double>;
     using PeriodicTaskQueue = tp::MPMCBoundedQueue<PeridicTaskItem>;
 
-    std::unique_ptr<PromiseQueue> m_promiseQueue;
+    std::unique_ptr<UpstreamQueue> m_upstreamQueue;
     std::unique_ptr<PeriodicTaskQueue> m_periodicTaskQueue;
-    static thread_local bool io_thread;
+    static thread_local TaskManager* io_thread;
 
     friend class StateMachine;
     std::unique_ptr<StateMachine> m_stateMachine;
+
+    friend class BaseTask;
+    TaskPool m_taskPool;
 };
 
 }//namespace graft
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+namespace graft {
+
+//////////////
+/// \brief The TaskArena class
+/// Memory of a request, owned by its task: the thread pool job and the nodes of the local context.
+/// The first allocations are taken from the inline buffer, the following ones from the heap blocks
+/// of growing size. Deallocation does nothing, all the memory is released at once with the task.
+/// The arena is not thread safe; a task is handled by a single thread at a time.
+///
+class TaskArena final : public std::pmr::memory_resource
+{
+public:
+    static constexpr size_t InlineSize = 1024;
+
+    TaskArena() : m_resource(m_buffer, sizeof(m_buffer), this) { }
+    TaskArena(const TaskArena&) = delete;
+    TaskArena& operator = (const TaskArena&) = delete;
+
+    std::pmr::memory_resource* resource() { return &m_resource; }
+    //number of heap blocks taken by the arena
+    size_t heapAllocations() const { return m_heapAllocations; }
+
+private:
+    //the upstream of m_resource, it counts the heap blocks
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        ++m_heapAllocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    alignas(std::max_align_t) std::byte m_buffer[InlineSize];
+    size_t m_heapAllocations = 0;
+    std::pmr::monotonic_buffer_resource m_resource;
+};
+
+//////////////
+/// \brief The TaskPool class
+/// Free lists of the memory of destroyed tasks, a list for each size of the task classes.
+/// It belongs to an I/O thread, the tasks created and destroyed by the thread are recycled.
+///
+class TaskPool final
+{
+public:
+    //maximal number of free blocks kept for a size
+    static constexpr size_t MaxFree = 256;
+
+    TaskPool() = default;
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator = (const TaskPool&) = delete;
+    ~TaskPool()
+    {
+        for(auto& list : m_free)
+        {
+            for(void* p : list.second) ::operator delete(p);
+        }
+    }
+
+    //returns nullptr if there is no free block of the size
+    void* allocate(size_t size)
+    {
+        std::vector<void*>& list = freeList(size);
+        if(list.empty()) return nullptr;
+        void* p = list.back();
+        list.pop_back();
+        return p;
+    }
+
+    //returns false if the block is not kept
+    bool deallocate(void* p, size_t size)
+    {
+        std::vector<void*>& list = freeList(size);
+        if(MaxFree <= list.size()) return false;
+        list.push_back(p);
+        return true;
+    }
+
+private:
+    std::vector<void*>& freeList(size_t size)
+    {
+        for(auto& list : m_free)
+        {
+            if(list.first == size) return list.second;
+        }
+        m_free.emplace_back(size, std::vector<void*>());
+        m_free.back().second.reserve(MaxFree);
+        return m_free.back().second;
+    }
+
+    //there are few task classes, so the lists are looked up linearly
+    std::vector<std::pair<size_t, std::vector<void*>>> m_free;
+};
+
+}//namespace graft
@@ -36,16 +36,17 @@ public:
         return *this;
     }
 
-    //main payload
-    virtual void operator () ()
+    //main payload, self is the owner of the job, it is moved into resulting queue
+    template<typename Self>
+    void operator () (Self& self)
     {
         // Please read the comment about exceptions and noexcept specifier
         // near 'void terminate()' function in main.cpp
         m_bt->getManager().runWorkerActionFromTheThreadPool(m_bt);
 
         Watcher* save_m_watcher = m_watcher; //save m_watcher before move itself into resulting queue
-        m_rq->push(std::move(*this)); //similar to "delete this;"
-        save_m_watcher->notifyJobReady();
+        m_rq->push(std::move(self)); //similar to "delete this;"
+        save_m_watcher->notifyJobDone();
     }
 
     BT_ptr& getTask() { return m_bt; }
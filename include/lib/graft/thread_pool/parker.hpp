@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace tp
+{
+
+/**
+ * @brief The Parker class implements an event count to park idle threads.
+ * A waiter calls prepareWait, checks the condition once again and then either
+ * cancelWait or commitWait. A notifier changes the condition and then calls notify.
+ * The notification is not lost between prepareWait and commitWait.
+ * notify makes no system call if there are no waiters.
+ * On Linux the waiters block on futex.
+ */
+class Parker
+{
+public:
+    Parker() = default;
+    Parker(const Parker&) = delete;
+    Parker& operator=(const Parker&) = delete;
+
+    uint32_t prepareWait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancelWait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void commitWait(uint32_t epoch)
+    {
+        while(m_epoch.load(std::memory_order_seq_cst) == epoch)
+        {
+            wait(epoch);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void notifyOne() { notify(false); }
+    void notifyAll() { notify(true); }
+
+private:
+    void notify(bool all)
+    {
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        if(m_waiters.load(std::memory_order_seq_cst) == 0) return;
+        wake(all);
+    }
+
+#ifdef __linux__
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+    void wait(uint32_t epoch)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, epoch, nullptr, nullptr, 0);
+    }
+
+    void wake(bool all)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAKE_PRIVATE, all? INT_MAX : 1, nullptr, nullptr, 0);
+    }
+#else
+    void wait(uint32_t epoch)
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_cond.wait(lk, [this, epoch]{ return m_epoch.load(std::memory_order_seq_cst) != epoch; });
+    }
+
+    void wake(bool all)
+    {
+        {//the waiter is either before its check or in wait
+            std::lock_guard<std::mutex> lk(m_mutex);
+        }
+        if(all) m_cond.notify_all();
+        else m_cond.notify_one();
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+#endif
+
+    std::atomic<uint32_t> m_epoch{0};
+    std::atomic<uint32_t> m_waiters{0};
+};
+
+}
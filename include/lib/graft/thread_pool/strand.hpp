@@ -4,6 +4,8 @@
 
 #include <atomic>
 #include <cassert>
+#include <stdexcept>
+#include <thread>
 
 namespace tp
 {
@@ -15,6 +17,13 @@ using Strand = StrandImpl<FixedFunction<void(), 128>,
 
 /**
  * @brief The StrandImpl class implements serialized handler execution.
+ * The handlers wait in an intrusive MPSC queue (Vyukov), posting is wait-free.
+ * The count of the handlers is the token of the drain, the post that makes it non-zero
+ * schedules the drain to the thread pool. While the drain is being posted the concurrent posts
+ * wait for the result, so that a post either has its handler scheduled or throws; the failed post
+ * gives the token back to the next one. The drain runs up to batch_size handlers and then,
+ * if there are more, posts itself behind the jobs waiting in the queues of the pool,
+ * so that a busy strand does not monopolize a worker.
  * It is header only.
  */
 template <typename Task, template<typename> class Queue>
@@ -26,10 +35,15 @@ public:
     /// Constructor
     ///
     /// @param thread_pool Linked thread pool
-    /// @param queue_size Size of queue for handlers
-    StrandImpl(ThreadPool& thread_pool, size_t queue_size);
+    /// @param queue_size Maximal number of waiting handlers, 0 means unbounded
+    /// @param batch_size Maximal number of handlers run per scheduling of the strand
+    StrandImpl(ThreadPool& thread_pool, size_t queue_size = 0, size_t batch_size = 16);
+    ~StrandImpl();
 
-    /** 
+    StrandImpl(const StrandImpl&) = delete;
+    StrandImpl& operator=(const StrandImpl&) = delete;
+
+    /**
       * @brief Post handler to be executed in a sequential order in a thread pool
       *
       * @param pool Target thread pool
@@ -38,13 +52,29 @@ public:
       * @param to_any_queue If true, attempts to post into each worker queue
       * until success. Throws the exception otherwise. If false only one
       * attempt will be made.
-      * @throw std::overflow_error if worker's queue is full.
+      * @throw std::overflow_error if the strand is bounded and full.
+      * @throw std::runtime_error if worker's queue is full, the handler is not called.
       * @note All exceptions thrown by handler will be suppressed.
       */
     template <typename Handler>
     void post(Handler&& handler, bool to_any_queue = false);
 
 private:
+    struct Node
+    {
+        Node() = default;
+        template <typename Handler>
+        explicit Node(Handler&& handler) : task(std::forward<Handler>(handler)) { }
+
+        std::atomic<Node*> next{nullptr};
+        Task task;
+        //set by the post that has failed, it is published to the drain by m_state
+        bool cancelled = false;
+    };
+
+    void push(Node* node);
+    //the consumer only, returns false if the handler is cancelled
+    bool pop(Task& handler);
     void invokeCall();
 
     class StrandImplHandler
@@ -58,54 +88,165 @@ private:
         StrandImpl* m_strandImpl;
     };
 
+    typedef char Cacheline[64];
+
+    //the drain was not posted to the thread pool, the next post tries again
+    static constexpr size_t Stalled = 1;
+    //the drain is being posted, the concurrent posts wait for the result
+    static constexpr size_t Posting = 2;
+    //the unit of the count of the handlers in m_state
+    static constexpr size_t One = 4;
+
     ThreadPool& m_thread_pool;
-    Queue<Task> m_queue;
-    std::atomic<size_t> m_deferred_calls_count;
+    const size_t m_queue_size;
+    const size_t m_batch_size;
+    Cacheline pad0;
+    std::atomic<Node*> m_tail;
+    //the handlers posted and not done in units of One, and the flags of the drain
+    std::atomic<size_t> m_state;
+    //the handlers waiting, it is counted if the strand is bounded
+    std::atomic<size_t> m_size;
+    Cacheline pad1;
+    Node* m_head;
+    Cacheline pad2;
 };
 
 template <typename Task, template<typename> class Queue>
-StrandImpl<Task, Queue>::StrandImpl(ThreadPool& thread_pool, size_t queue_size)
+StrandImpl<Task, Queue>::StrandImpl(ThreadPool& thread_pool, size_t queue_size, size_t batch_size)
   : m_thread_pool(thread_pool)
-  , m_queue(queue_size)
-  , m_deferred_calls_count()
+  , m_queue_size(queue_size)
+  , m_batch_size(batch_size)
+  , m_tail(nullptr)
+  , m_state(0)
+  , m_size(0)
+  , m_head(new Node())
 {
+    assert(m_batch_size);
+    m_tail.store(m_head, std::memory_order_relaxed);
+}
+
+template <typename Task, template<typename> class Queue>
+StrandImpl<Task, Queue>::~StrandImpl()
+{
+    while(m_head)
+    {
+        Node* next = m_head->next.load(std::memory_order_relaxed);
+        delete m_head;
+        m_head = next;
+    }
+}
+
+template <typename Task, template<typename> class Queue>
+void StrandImpl<Task, Queue>::push(Node* node)
+{
+    Node* prev = m_tail.exchange(node, std::memory_order_acq_rel);
+    //the consumer cannot see the node until it is linked, it waits for the link
+    prev->next.store(node, std::memory_order_release);
+}
+
+template <typename Task, template<typename> class Queue>
+bool StrandImpl<Task, Queue>::pop(Task& handler)
+{
+    Node* next = m_head->next.load(std::memory_order_acquire);
+    //the handler is counted after it is pushed, it is here or it is being linked
+    while(!next)
+    {
+        //a producer has taken the tail but has not linked the node yet
+        std::this_thread::yield();
+        next = m_head->next.load(std::memory_order_acquire);
+    }
+    delete m_head;
+    m_head = next;
+    if(next->cancelled) return false;
+    handler = std::move(next->task);
+    return true;
 }
 
 template <typename Task, template<typename> class Queue>
 template <typename Handler>
 void StrandImpl<Task, Queue>::post(Handler&& handler, bool to_any_queue)
 {
-    m_queue.push(std::forward<Handler>(handler));
+    if(m_queue_size && m_queue_size <= m_size.fetch_add(1, std::memory_order_relaxed))
+    {
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+        throw std::overflow_error("strand queue is full");
+    }
 
-    m_thread_pool.post(StrandImplHandler(*this), to_any_queue);
+    Node* node = new Node(std::forward<Handler>(handler));
+    push(node);
+
+    //the node is linked before it is counted, the drain finds it
+    size_t state = m_state.load(std::memory_order_acquire);
+    for(;;)
+    {
+        if(state & Posting)
+        {//it is not known yet whether the drain is scheduled
+            std::this_thread::yield();
+            state = m_state.load(std::memory_order_acquire);
+            continue;
+        }
+        //the token is taken by the post that makes the count non-zero or that finds the drain stalled
+        bool token = state < One || (state & Stalled);
+        size_t next = token ? ((state + One) & ~Stalled) | Posting : state + One;
+        if(!m_state.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_acquire)) continue;
+        if(!token) return;
+        break;
+    }
+    //the drain is not running until it is posted, the node cannot be popped
+    try
+    {
+        m_thread_pool.post(StrandImplHandler(*this), to_any_queue);
+    }
+    catch(...)
+    {
+        //the handler is dropped by the drain, the caller can post it again
+        node->cancelled = true;
+        if(m_queue_size) m_size.fetch_sub(1, std::memory_order_relaxed);
+        //the token is given back at once with the posting finished
+        m_state.fetch_xor(Posting | Stalled, std::memory_order_acq_rel);
+        throw;
+    }
+    m_state.fetch_and(~Posting, std::memory_order_release);
 }
 
 template <typename Task, template<typename> class Queue>
 void StrandImpl<Task, Queue>::invokeCall()
 {
-    if (m_deferred_calls_count.fetch_add(1, std::memory_order_acq_rel))
-        return;
-
+    //the last handler can own the strand, it is destroyed after the strand is not used
     Task handler;
 
-    for (;;)
+    for(;;)
     {
-        bool res = m_queue.pop(handler);
-        assert(res);
+        for(size_t i = 0; i < m_batch_size; )
+        {
+            if(pop(handler))
+            {
+                ++i;
+                if(m_queue_size) m_size.fetch_sub(1, std::memory_order_relaxed);
+
+                try
+                {
+                    handler();
+                }
+                catch (...)
+                {
+                    // suppress all exceptions
+                }
+            }
+
+            //the strand is not touched after the last handler
+            if((m_state.fetch_sub(One, std::memory_order_acq_rel) & ~(One - 1)) == One) return;
+        }
 
         try
         {
-            handler();
+            m_thread_pool.postToQueue(StrandImplHandler(*this));
+            return;
         }
-        catch (...)
+        catch(...)
         {
-            // suppress all exceptions
-        }           
-        
-        bool has_deferred_calls = m_deferred_calls_count.fetch_sub(1, std::memory_order_acq_rel) > 1;
-
-        if (!has_deferred_calls)
-          break;
+            //the pool is full, the drain goes on here rather than stall the strand
+        }
     }
 }
 
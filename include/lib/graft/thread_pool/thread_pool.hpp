@@ -27,6 +27,9 @@ using ThreadPool = ThreadPoolImpl<FixedFunction<void(), 128>,
  * It is header only.
  * It implements both work-stealing and work-distribution balancing
  * startegies.
+ * The tasks posted from outside of the pool are distributed between the queues
+ * of the workers, the tasks posted by a worker go into its own deque.
+ * Idle workers steal from random victims and then park until a task is posted.
  * It implements cooperative scheduling strategy for tasks.
  */
 template <typename Task, template<typename> class Queue>
@@ -77,11 +80,21 @@ public:
     template <typename Handler>
     void post(Handler&& handler, bool to_any_queue = false);
 
+    /**
+     * @brief postToQueue Post job behind the jobs waiting in the queues of the workers,
+     * posted by a worker it does not go to its deque. It is for a job that gives
+     * its worker up to the others and continues later.
+     * @param handler Handler to be called from thread pool worker.
+     * @note If all the queues are full it is posted as by post.
+     */
+    template <typename Handler>
+    void postToQueue(Handler&& handler);
+
     int dump_info()
     {
         int cnt = 0;
         std::cout << "\nThread pool dump\n";
-        for(auto& worker_ptr : m_workers)
+        for(auto& worker_ptr : m_shared->workers)
         {
             std::cout << "\t";
             cnt += worker_ptr->dump();
@@ -92,6 +105,8 @@ public:
     //it is for a single thread
     void expelWorkers();
 
+    size_t getWorkersCount() const { return m_shared->workers.size(); }
+
     static uint64_t getActiveWorkersCount();
     static uint64_t getExpelledWorkersCount();
 
@@ -100,11 +115,11 @@ private:
 
     using Worker = WorkerT<Task, Queue>;
     using TimePoint = typename Worker::TimePoint;
+    using Shared = typename Worker::Shared;
     using QueuesVec = std::vector<Queue<Task>>;
     using WorkersVec = std::vector<std::shared_ptr<Worker>>;
 
-    std::unique_ptr<std::vector<Queue<Task>>> m_queues;
-    std::unique_ptr<std::vector<std::shared_ptr<Worker>>> m_workers;
+    std::unique_ptr<Shared> m_shared;
 
     std::atomic<size_t> m_next_worker = 0;
 };
@@ -119,13 +134,12 @@ inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(
     using Milliseconds = typename Worker::Milliseconds;
     Worker::defaultPeriodMs = Milliseconds(options.expellingIntervalMs());
 
-    m_queues = std::make_unique<QueuesVec>();
-    m_queues->reserve(options.threadCount());
-    m_workers = std::make_unique<WorkersVec>();
-    m_workers->reserve(options.threadCount());
+    m_shared = std::make_unique<Shared>();
 
-    QueuesVec& queues = *m_queues;
-    WorkersVec& workers = *m_workers;
+    QueuesVec& queues = m_shared->queues;
+    WorkersVec& workers = m_shared->workers;
+    queues.reserve(options.threadCount());
+    workers.reserve(options.threadCount());
 
     for(size_t i = 0; i < options.threadCount(); ++i)
     {
@@ -135,9 +149,8 @@ inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(
 
     for(size_t i = 0; i < workers.size(); ++i)
     {
-        size_t i1 = (i + 1) % workers.size();
         std::shared_ptr wrkr(workers[i]);
-        workers[i]->start(i, queues[i], queues[i1], std::move(wrkr));
+        workers[i]->start(i, *m_shared, std::move(wrkr));
     }
 }
 
@@ -147,8 +160,7 @@ inline void ThreadPoolImpl<Task, Queue>::expelWorkers()
 {
     TimePoint now = Worker::getTimePoint();
 
-    QueuesVec& queues = *m_queues;
-    WorkersVec& workers = *m_workers;
+    WorkersVec& workers = m_shared->workers;
 
     for(size_t i = 0; i < workers.size(); ++i)
     {
@@ -158,9 +170,10 @@ inline void ThreadPoolImpl<Task, Queue>::expelWorkers()
         oworker->m_thread.detach();
 
         std::shared_ptr<Worker> nworker = std::make_shared<Worker>();
-        workers[i] = nworker;
-        size_t i1 = (i + 1) % workers.size();
-        workers[i]->start(i, queues[i], queues[i1], std::move(nworker));
+        nworker->takeOver(*oworker);
+        //the other workers steal from it concurrently
+        std::atomic_store(&workers[i], nworker);
+        workers[i]->start(i, *m_shared, std::move(nworker));
 
         ++Worker::expelledCount;
     }
@@ -187,10 +200,10 @@ inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(ThreadPoolImpl<Task, Queue>&&
 template <typename Task, template<typename> class Queue>
 inline ThreadPoolImpl<Task, Queue>::~ThreadPoolImpl()
 {
-    if(!m_workers) return;
+    if(!m_shared) return;
     //it is expected that a caller of this dtor checks somehow before calling that the thread pool is empty,
     //more strictly that all jobs are done
-    for (auto& worker_ptr : *m_workers)
+    for (auto& worker_ptr : m_shared->workers)
     {
         worker_ptr->stop();
     }
@@ -208,8 +221,7 @@ ThreadPoolImpl<Task, Queue>::operator=(ThreadPoolImpl<Task, Queue>&& rhs) noexce
 {
     if (this != &rhs)
     {
-        m_queues = std::move(rhs.m_queues);
-        m_workers = std::move(rhs.m_workers);
+        m_shared = std::move(rhs.m_shared);
         m_next_worker = rhs.m_next_worker.load();
     }
     return *this;
@@ -219,14 +231,17 @@ template <typename Task, template<typename> class Queue>
 template <typename Handler>
 inline bool ThreadPoolImpl<Task, Queue>::tryPost(Handler&& handler)
 {
-    return (*m_queues)[getWorkerIdx()].push(std::forward<Handler>(handler));
+    if(Worker::tryPostLocal(*m_shared, std::forward<Handler>(handler))) return true;
+    if(!m_shared->queues[getWorkerIdx()].push(std::forward<Handler>(handler))) return false;
+    m_shared->parker.notifyOne();
+    return true;
 }
 
 template <typename Task, template<typename> class Queue>
 template <typename Handler>
 inline void ThreadPoolImpl<Task, Queue>::post(Handler&& handler, bool to_any_queue)
 {
-    int try_count = (to_any_queue)? m_workers->size() : 1;
+    int try_count = (to_any_queue)? m_shared->workers.size() : 1;
     for(int i = 0; i < try_count; ++i)
     {
         bool ok = tryPost(std::forward<Handler>(handler));
@@ -236,16 +251,22 @@ inline void ThreadPoolImpl<Task, Queue>::post(Handler&& handler, bool to_any_que
 }
 
 template <typename Task, template<typename> class Queue>
-inline size_t ThreadPoolImpl<Task, Queue>::getWorkerIdx()
+template <typename Handler>
+inline void ThreadPoolImpl<Task, Queue>::postToQueue(Handler&& handler)
 {
-    auto id = Worker::getWorkerIdForCurrentThread();
-
-    if (id > m_workers->size())
+    for(size_t i = 0; i < m_shared->queues.size(); ++i)
     {
-        id = m_next_worker.fetch_add(1, std::memory_order_relaxed) %
-             m_workers->size();
+        if(!m_shared->queues[getWorkerIdx()].push(std::forward<Handler>(handler))) continue;
+        m_shared->parker.notifyOne();
+        return;
     }
+    post(std::forward<Handler>(handler), true);
+}
 
-    return id;
+template <typename Task, template<typename> class Queue>
+inline size_t ThreadPoolImpl<Task, Queue>::getWorkerIdx()
+{
+    return m_next_worker.fetch_add(1, std::memory_order_relaxed) %
+           m_shared->queues.size();
 }
 }
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <cassert>
+
+namespace tp
+{
+
+/**
+ * @brief The WorkStealingDeque class implements Chase-Lev work-stealing deque.
+ * The owner thread pushes and pops at the bottom (LIFO), any other thread steals
+ * from the top (FIFO). The deque is unbounded, the buffer grows by the owner.
+ * It keeps pointers, the values are owned by the caller.
+ * Based on "Correct and Efficient Work-Stealing for Weak Memory Models", Le et al., 2013.
+ */
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    /**
+     * @brief WorkStealingDeque Constructor.
+     * @param size Power of 2 number - initial buffer length.
+     */
+    explicit WorkStealingDeque(size_t size = 64);
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /**
+     * @brief push Push to the bottom, the owner thread only.
+     */
+    void push(T* item);
+
+    /**
+     * @brief pop Pop from the bottom, the owner thread only.
+     * @return nullptr if empty.
+     */
+    T* pop();
+
+    /**
+     * @brief steal Pop from the top, any thread.
+     * @return nullptr if empty or lost the race.
+     */
+    T* steal();
+
+    bool empty() const;
+
+private:
+    struct Buffer
+    {
+        explicit Buffer(size_t size) : mask(size - 1), items(new std::atomic<T*>[size]) { }
+
+        size_t size() const { return mask + 1; }
+        T* get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T* item) { items[i & mask].store(item, std::memory_order_relaxed); }
+
+        const size_t mask;
+        std::unique_ptr<std::atomic<T*>[]> items;
+    };
+
+    Buffer* grow(Buffer* buffer, int64_t bottom, int64_t top);
+
+    typedef char Cacheline[64];
+
+    Cacheline pad0;
+    std::atomic<int64_t> m_top;
+    Cacheline pad1;
+    std::atomic<int64_t> m_bottom;
+    std::atomic<Buffer*> m_buffer;
+    //the buffers are freed with the deque, a thief can read a replaced buffer
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+    Cacheline pad2;
+};
+
+
+/// Implementation
+
+template <typename T>
+inline WorkStealingDeque<T>::WorkStealingDeque(size_t size)
+    : m_top(0), m_bottom(0)
+{
+    assert(size >= 2 && (size & (size - 1)) == 0);
+    m_buffers.emplace_back(std::make_unique<Buffer>(size));
+    m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+}
+
+template <typename T>
+inline typename WorkStealingDeque<T>::Buffer* WorkStealingDeque<T>::grow(Buffer* buffer, int64_t bottom, int64_t top)
+{
+    auto bigger = std::make_unique<Buffer>(2 * buffer->size());
+    for(int64_t i = top; i < bottom; ++i)
+    {
+        bigger->put(i, buffer->get(i));
+    }
+    m_buffers.emplace_back(std::move(bigger));
+    Buffer* res = m_buffers.back().get();
+    m_buffer.store(res, std::memory_order_release);
+    return res;
+}
+
+template <typename T>
+inline void WorkStealingDeque<T>::push(T* item)
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+    if(buffer->size() <= static_cast<size_t>(b - t))
+    {
+        buffer = grow(buffer, b, t);
+    }
+    buffer->put(b, item);
+    m_bottom.store(b + 1, std::memory_order_release);
+}
+
+template <typename T>
+inline T* WorkStealingDeque<T>::pop()
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if(b < t)
+    {//empty
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    T* item = buffer->get(b);
+    if(t == b)
+    {//the last one, race with thieves
+        if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            item = nullptr;
+        }
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+}
+
+template <typename T>
+inline T* WorkStealingDeque<T>::steal()
+{
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+    if(b <= t) return nullptr;
+    Buffer* buffer = m_buffer.load(std::memory_order_acquire);
+    T* item = buffer->get(t);
+    if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    return item;
+}
+
+template <typename T>
+inline bool WorkStealingDeque<T>::empty() const
+{
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    return b <= t;
+}
+
+}
@@ -1,17 +1,39 @@
 #pragma once
 
+#include "lib/graft/thread_pool/parker.hpp"
+#include "lib/graft/thread_pool/work_stealing_deque.hpp"
+
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <thread>
+#include <vector>
 #include <cassert>
 
 namespace tp
 {
 
+template <typename Task, template<typename> class Queue>
+class WorkerT;
+
+/**
+ * @brief The WorkersShared struct is the state of a thread pool shared by its workers.
+ * queues are the inputs of the workers, posted from outside of the pool.
+ * workers are replaced by expelling, they are accessed atomically.
+ */
+template <typename Task, template<typename> class Queue>
+struct WorkersShared
+{
+    std::vector<Queue<Task>> queues;
+    std::vector<std::shared_ptr<WorkerT<Task, Queue>>> workers;
+    Parker parker;
+};
+
 /**
- * @brief The WorkerT class owns task queue and executing thread.
- * In thread it tries to pop task from queue. If queue is empty then it tries
- * to steal task from the sibling worker. If steal was unsuccessful then spins
- * with one millisecond delay.
+ * @brief The WorkerT class owns work-stealing deque and executing thread.
+ * In thread it tries to pop task from its deque, then from its queue. If both are empty then it tries
+ * to steal task from the deques and the queues of the other workers starting from a random one.
+ * If steal was unsuccessful then spins for a while and then parks until a task is posted.
  */
 template <typename Task, template<typename> class Queue>
 class WorkerT
@@ -19,6 +41,7 @@ class WorkerT
 public:
     using TimePoint = std::chrono::high_resolution_clock::time_point;
     using Milliseconds = std::chrono::milliseconds;
+    using Shared = WorkersShared<Task, Queue>;
 
     static TimePoint maxTimePoint()
     {
@@ -34,26 +57,20 @@ public:
 
     /**
      * @brief WorkerT Constructor.
-     * @param queue_size Length of undelaying task queue.
      */
     WorkerT() noexcept : m_timePoint(maxTimePoint()) { }
 
-    /**
-     * @brief Move ctor implementation.
-     */
-    WorkerT(WorkerT&& rhs) noexcept;
+    ~WorkerT();
 
-    /**
-     * @brief Move assignment implementaion.
-     */
-    WorkerT& operator=(WorkerT&& rhs) noexcept;
+    WorkerT(const WorkerT&) = delete;
+    WorkerT& operator=(const WorkerT&) = delete;
 
     /**
      * @brief start Create the executing thread and start tasks execution.
      * @param id WorkerT ID.
-     * @param steal_donor Sibling worker to steal task from it.
+     * @param shared The state of the pool.
      */
-    void start(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr);
+    void start(size_t id, Shared& shared, std::shared_ptr<WorkerT>&& rwptr);
 
     /**
      * @brief stop Stop all worker's thread and stealing activity.
@@ -61,6 +78,13 @@ public:
      */
     void stop();
 
+    /**
+     * @brief takeOver Move the tasks from the deque of the expelled worker,
+     * so that they do not wait for its job. It is called before the start.
+     * @param expelled The worker replaced by this one.
+     */
+    void takeOver(WorkerT& expelled);
+
     /**
      * @brief getWorkerIdForCurrentThread Return worker ID associated with
      * current thread if exists.
@@ -68,23 +92,47 @@ public:
      */
     static size_t getWorkerIdForCurrentThread();
 
+    /**
+     * @brief getCurrent Return the worker of current thread if exists.
+     */
+    static WorkerT* getCurrent();
+
+    /**
+     * @brief tryPostLocal Push task into the deque of the worker of current thread
+     * if it is a running worker of the pool.
+     * @return false if it is not.
+     */
+    template <typename Handler>
+    static bool tryPostLocal(Shared& shared, Handler&& handler);
+
     /**
      * @brief threadFunc Executing thread function.
      * @param id WorkerT ID to be associated with this thread.
-     * @param steal_donor Sibling worker to steal task from it.
+     * @param shared The state of the pool.
      */
-
-    void threadFunc(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr);
+    void threadFunc(size_t id, Shared& shared, std::shared_ptr<WorkerT>&& rwptr);
 
     static_assert(std::atomic<uint64_t>::is_always_lock_free);
     static std::atomic<uint64_t> activeCount;
     static std::atomic<uint64_t> expelledCount;
     static std::chrono::milliseconds defaultPeriodMs;
+    //the number of failed attempts to find a task before parking
+    static constexpr int spinCount = 64;
 
     std::atomic<TimePoint> m_timePoint = maxTimePoint();
     static_assert(decltype(m_timePoint)::is_always_lock_free);
     std::atomic<bool> m_running_flag{true};
     std::thread m_thread;
+
+private:
+    bool findTask(Task& handler);
+    bool steal(Task& handler);
+    void run(Task& handler);
+
+    size_t m_id = -1u;
+    Shared* m_shared = nullptr;
+    WorkStealingDeque<Task> m_deque;
+    uint64_t m_rnd = 0;
 };
 
 
@@ -97,6 +145,12 @@ namespace detail
         static thread_local size_t tss_id = -1u;
         return &tss_id;
     }
+
+    inline void** thread_worker()
+    {
+        static thread_local void* tss_worker = nullptr;
+        return &tss_worker;
+    }
 }
 
 template <typename Task, template<typename> class Queue>
@@ -109,42 +163,46 @@ template <typename Task, template<typename> class Queue>
 std::chrono::milliseconds WorkerT<Task, Queue>::defaultPeriodMs(200);
 
 template <typename Task, template<typename> class Queue>
-inline WorkerT<Task, Queue>::WorkerT(WorkerT&& rhs) noexcept
+inline WorkerT<Task, Queue>::~WorkerT()
 {
-    *this = rhs;
-}
-
-template <typename Task, template<typename> class Queue>
-inline WorkerT<Task, Queue>& WorkerT<Task, Queue>::operator=(WorkerT&& rhs) noexcept
-{
-    if (this != &rhs)
-    {
-        m_running_flag = rhs.m_running_flag.load();
-        m_thread = std::move(rhs.m_thread);
-    }
-    return *this;
+    //the deque is drained by the thread before exit
+    assert(m_deque.empty());
 }
 
 template <typename Task, template<typename> class Queue>
 inline void WorkerT<Task, Queue>::stop()
 {
-    m_running_flag.store(false, std::memory_order_relaxed);
+    m_running_flag.store(false, std::memory_order_seq_cst);
+    m_shared->parker.notifyAll();
     m_thread.join();
 }
 
 template <typename Task, template<typename> class Queue>
-inline void WorkerT<Task, Queue>::start(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr)
+inline void WorkerT<Task, Queue>::start(size_t id, Shared& shared, std::shared_ptr<WorkerT>&& rwptr)
 {
     assert(rwptr.get() == this);
+    m_id = id;
+    m_shared = &shared;
+    m_rnd = reinterpret_cast<uintptr_t>(this) ^ (id + 1) * 0x9E3779B97F4A7C15ull;
     ++activeCount;
-    m_thread = std::thread([this,id,&queue,&steal_queue,rwptr]()
+    m_thread = std::thread([this,id,&shared,rwptr]()
     {
         std::shared_ptr<WorkerT> wptr = rwptr;
-        threadFunc(id, queue, steal_queue, std::move(wptr));
+        threadFunc(id, shared, std::move(wptr));
     });
 
 }
 
+template <typename Task, template<typename> class Queue>
+inline void WorkerT<Task, Queue>::takeOver(WorkerT& expelled)
+{
+    //the deque is not published yet, it is pushed from here; the expelled one can be popped by its thread
+    while(!expelled.m_deque.empty())
+    {
+        if(Task* task = expelled.m_deque.steal()) m_deque.push(task);
+    }
+}
+
 template <typename Task, template<typename> class Queue>
 inline size_t WorkerT<Task, Queue>::getWorkerIdForCurrentThread()
 {
@@ -152,33 +210,117 @@ inline size_t WorkerT<Task, Queue>::getWorkerIdForCurrentThread()
 }
 
 template <typename Task, template<typename> class Queue>
-inline void WorkerT<Task, Queue>::threadFunc(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr)
+inline WorkerT<Task, Queue>* WorkerT<Task, Queue>::getCurrent()
+{
+    return static_cast<WorkerT*>(*detail::thread_worker());
+}
+
+template <typename Task, template<typename> class Queue>
+template <typename Handler>
+inline bool WorkerT<Task, Queue>::tryPostLocal(Shared& shared, Handler&& handler)
+{
+    WorkerT* worker = getCurrent();
+    //an expelled worker is not the owner of the slot anymore, its deque is taken over by the new one
+    if(!worker || worker->m_shared != &shared || !worker->m_running_flag.load(std::memory_order_relaxed)) return false;
+    worker->m_deque.push(new Task(std::forward<Handler>(handler)));
+    shared.parker.notifyOne();
+    return true;
+}
+
+template <typename Task, template<typename> class Queue>
+inline void WorkerT<Task, Queue>::run(Task& handler)
+{
+    try
+    {
+        m_timePoint = getTimePoint(defaultPeriodMs);
+        handler();
+        m_timePoint = maxTimePoint();
+    }
+    catch(...)
+    {
+        throw;
+    }
+}
+
+template <typename Task, template<typename> class Queue>
+inline bool WorkerT<Task, Queue>::steal(Task& handler)
+{
+    auto& workers = m_shared->workers;
+    auto& queues = m_shared->queues;
+    const size_t count = queues.size();
+    //xorshift
+    m_rnd ^= m_rnd << 13; m_rnd ^= m_rnd >> 7; m_rnd ^= m_rnd << 17;
+    const size_t first = m_rnd % count;
+    for(size_t k = 0; k < count; ++k)
+    {
+        size_t i = (first + k) % count;
+        if(i == m_id) continue;
+        if(queues[i].pop(handler)) return true;
+        std::shared_ptr<WorkerT> victim = std::atomic_load(&workers[i]);
+        if(!victim) continue;
+        if(std::unique_ptr<Task> task{victim->m_deque.steal()})
+        {
+            handler = std::move(*task);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Task, template<typename> class Queue>
+inline bool WorkerT<Task, Queue>::findTask(Task& handler)
+{
+    if(std::unique_ptr<Task> task{m_deque.pop()})
+    {
+        handler = std::move(*task);
+        return true;
+    }
+    return m_shared->queues[m_id].pop(handler) || steal(handler);
+}
+
+template <typename Task, template<typename> class Queue>
+inline void WorkerT<Task, Queue>::threadFunc(size_t id, Shared& shared, std::shared_ptr<WorkerT>&& rwptr)
 {
     assert(rwptr.get() == this);
 
     *detail::thread_id() = id;
+    *detail::thread_worker() = this;
 
     Task handler;
 
+    int spins = 0;
     while (m_running_flag.load(std::memory_order_relaxed))
     {
-        if (queue.pop(handler) || steal_queue.pop(handler))
+        if (findTask(handler))
+        {
+            spins = 0;
+            run(handler);
+            continue;
+        }
+        if (++spins < spinCount)
         {
-            try
-            {
-                m_timePoint = getTimePoint(defaultPeriodMs);
-                handler();
-                m_timePoint = maxTimePoint();
-            }
-            catch(...)
-            {
-                throw;
-            }
+            std::this_thread::yield();
+            continue;
         }
-        else
+        spins = 0;
+        uint32_t epoch = shared.parker.prepareWait();
+        if (!m_running_flag.load(std::memory_order_seq_cst))
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            shared.parker.cancelWait();
+            break;
         }
+        if (findTask(handler))
+        {
+            shared.parker.cancelWait();
+            run(handler);
+            continue;
+        }
+        shared.parker.commitWait(epoch);
+    }
+    //the tasks posted by the worker itself
+    while (std::unique_ptr<Task> task{m_deque.pop()})
+    {
+        run(*task);
     }
     --activeCount;
 }
@@ -1,93 +1,113 @@
 #pragma once
 
+#include "lib/graft/graft_utility.hpp"
+
 #include <chrono>
-#include <queue>
 #include <functional>
-#include <iostream>
-#include <string>
+#include <vector>
+#include <cassert>
 
 namespace graft
 {
     namespace ch = std::chrono;
 
+    //////////////
+    /// \brief The TimerList class
+    /// Timers of milliseconds in a timing wheel, O(1) to push and to cancel.
+    /// The timer is kept by its owner and it is the cancellation handle; the list holds the pointer
+    /// to the owner while the timer is active, and calls ptr->getManager().onTimer(ptr) when it fires.
+    /// The time is read once per eval.
+    ///
     template<typename TR_ptr>
     class TimerList
     {
-        struct timer
+    public:
+        class Timer;
+    private:
+        using Wheel = TimingWheel<Timer>;
+    public:
+        class Timer
         {
-            ch::milliseconds timeout;
-            ch::milliseconds lap;
-            TR_ptr ptr;
-
-            timer(ch::milliseconds timeout, TR_ptr ptr)
-                : timeout(timeout)
-                , lap(ch::milliseconds::max())
-                , ptr(ptr) {}
-
-            timer() = delete;
-
-            void start()
-            {
-                lap = ch::time_point_cast<ch::milliseconds>(
-                    ch::steady_clock::now()
-                ).time_since_epoch() + timeout;
-            }
+        public:
+            Timer() { m_hook.owner = this; }
+            ~Timer() { assert(!m_hook.linked()); }
+            Timer(const Timer&) = delete;
+            Timer& operator = (const Timer&) = delete;
 
-            bool fired()
-            {
-                return lap <=
-                    ch::time_point_cast<ch::milliseconds>(
-                        ch::steady_clock::now()
-                    ).time_since_epoch();
-            }
-            void dump(const std::string &pref) const
-            {
-                std::cout << pref << " timeout: " << timeout.count()
-                    << "; lap: " << lap.count() << std::endl;
-            }
+            bool active() const { return bool(m_ptr); }
+        private:
+            friend class TimerList;
+            typename Wheel::Hook m_hook;
+            ch::milliseconds m_lap;
+            TR_ptr m_ptr;
+        };
 
-            bool operator < (const timer& other) const
+        TimerList() : m_wheel(now().count()) { }
+        ~TimerList()
+        {
+            std::vector<Timer*> all;
+            m_wheel.clear(all);
+            //the owners can be released here
+            for(Timer* t : all)
             {
-                return lap < other.lap;
+                TR_ptr ptr = std::move(t->m_ptr);
             }
-            bool operator > (const timer& other) const { return ! operator <(other); }
-        };
+        }
+        TimerList(const TimerList&) = delete;
+        TimerList& operator = (const TimerList&) = delete;
 
-        class priority_queue : public std::priority_queue<timer, std::vector<timer>, std::greater<timer>>
+        //the active timer is restarted
+        void push(Timer& timer, ch::milliseconds timeout, TR_ptr ptr)
         {
-            using base_t = std::priority_queue<timer, std::vector<timer>, std::greater<timer>>;
-        public:
-            const typename base_t::container_type& get_c() const { return base_t::c; }
-        };
-
-        priority_queue m_pq;
-
-    public:
+            timer.m_lap = now() + timeout;
+            timer.m_ptr = std::move(ptr);
+            m_wheel.schedule(timer.m_hook, timer.m_lap.count());
+        }
 
-        void push(ch::milliseconds timeout, TR_ptr ptr)
+        void cancel(Timer& timer)
         {
-            timer t(timeout, ptr);
-            t.start();
-            m_pq.emplace(std::move(t));
+            m_wheel.cancel(timer.m_hook);
+            //the owner can be released on return
+            TR_ptr ptr = std::move(timer.m_ptr);
         }
 
         void eval()
         {
-            while(!m_pq.empty())
+            const ch::milliseconds now_ms = now();
+            m_due.clear();
+            m_wheel.advance(now_ms.count(), m_due);
+            if(m_due.empty()) return;
+
+            //the owners are held, the timers are valid even if cancelled by the calls
+            std::vector<TR_ptr> holders;
+            holders.reserve(m_due.size());
+            for(Timer* t : m_due) holders.push_back(t->m_ptr);
+
+            std::vector<Timer*> due;
+            due.swap(m_due);
+            for(Timer* t : due)
             {
-                auto t = m_pq.top();
-                if(!t.fired()) break;
-                m_pq.pop();
-                t.ptr->getManager().onTimer(t.ptr);
+                if(!t->m_ptr || t->m_hook.linked()) continue; //cancelled or restarted
+                if(now_ms < t->m_lap)
+                {//beyond the range of the wheel
+                    m_wheel.schedule(t->m_hook, t->m_lap.count());
+                    continue;
+                }
+                TR_ptr ptr = std::move(t->m_ptr);
+                ptr->getManager().onTimer(ptr);
             }
         }
-        void dump(const std::string &pref) const
+
+    private:
+        static ch::milliseconds now()
         {
-            auto& vec = m_pq.get_c();
-            std::for_each(vec.begin(), vec.end(),
-                [&pref](auto& t) { t.dump(pref); }
-            );
+            return ch::time_point_cast<ch::milliseconds>(
+                ch::steady_clock::now()
+            ).time_since_epoch();
         }
+
+        Wheel m_wheel;
+        std::vector<Timer*> m_due;
     };
 }
 
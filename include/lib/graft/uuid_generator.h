@@ -0,0 +1,162 @@
+#pragma once
+
+#include <boost/uuid/uuid.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+namespace graft {
+
+namespace detail {
+
+//////////////
+/// \brief The ChaCha20 class
+/// The block function of ChaCha20 (RFC 7539) used as a CSPRNG, the key and the nonce are from std::random_device.
+///
+class ChaCha20
+{
+public:
+    static constexpr size_t BlockSize = 64;
+
+    void seed(std::random_device& rd)
+    {
+        std::array<uint32_t,8> key;
+        std::array<uint32_t,3> nonce;
+        for(auto& v : key) v = rd();
+        for(auto& v : nonce) v = rd();
+        setKey(key, 0, nonce);
+    }
+
+    //the words are little-endian as in RFC 7539 2.3
+    void setKey(const std::array<uint32_t,8>& key, uint32_t counter, const std::array<uint32_t,3>& nonce)
+    {
+        m_input = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+        std::copy(key.begin(), key.end(), m_input.begin() + 4);
+        m_input[12] = counter;
+        std::copy(nonce.begin(), nonce.end(), m_input.begin() + 13);
+    }
+
+    void block(uint8_t* out)
+    {
+        std::array<uint32_t,16> x = m_input;
+        for(int i = 0; i < 10; ++i)
+        {
+            quarterRound(x[0], x[4], x[8],  x[12]);
+            quarterRound(x[1], x[5], x[9],  x[13]);
+            quarterRound(x[2], x[6], x[10], x[14]);
+            quarterRound(x[3], x[7], x[11], x[15]);
+            quarterRound(x[0], x[5], x[10], x[15]);
+            quarterRound(x[1], x[6], x[11], x[12]);
+            quarterRound(x[2], x[7], x[8],  x[13]);
+            quarterRound(x[3], x[4], x[9],  x[14]);
+        }
+        for(size_t i = 0; i < 16; ++i) x[i] += m_input[i];
+        std::memcpy(out, x.data(), BlockSize);
+        ++m_input[12];
+    }
+
+    uint32_t counter() const { return m_input[12]; }
+
+private:
+    static uint32_t rotl(uint32_t v, int c) { return (v << c) | (v >> (32 - c)); }
+    static void quarterRound(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+    {
+        a += b; d ^= a; d = rotl(d, 16);
+        c += d; b ^= c; b = rotl(b, 12);
+        a += b; d ^= a; d = rotl(d, 8);
+        c += d; b ^= c; b = rotl(b, 7);
+    }
+
+    std::array<uint32_t,16> m_input{};
+};
+
+}//namespace detail
+
+//////////////
+/// \brief The UuidGenerator class
+/// Random (version 4) UUIDs from a thread local ChaCha20 stream, reseeded from std::random_device
+/// every ReseedBlocks blocks or every ReseedInterval, whichever comes first, so that an idle thread
+/// does not keep its key forever. boost::uuids::random_generator reads the OS entropy source for each id,
+/// this one does once per 4 * ReseedBlocks ids at most.
+///
+class UuidGenerator
+{
+public:
+    static constexpr uint32_t ReseedBlocks = 1u << 16;
+    static constexpr std::chrono::seconds ReseedInterval{60};
+
+    static UuidGenerator& local()
+    {
+        static thread_local UuidGenerator generator;
+        return generator;
+    }
+
+    boost::uuids::uuid operator()()
+    {
+        if(m_used == detail::ChaCha20::BlockSize)
+        {
+            if(m_chacha.counter() == ReseedBlocks || ReseedInterval <= std::chrono::steady_clock::now() - m_seeded) reseed();
+            m_chacha.block(m_block.data());
+            m_used = 0;
+        }
+        boost::uuids::uuid res;
+        static_assert(sizeof(res.data) == 16);
+        std::memcpy(res.data, m_block.data() + m_used, sizeof(res.data));
+        m_used += sizeof(res.data);
+        //version 4, variant RFC 4122
+        res.data[6] = (res.data[6] & 0x0F) | 0x40;
+        res.data[8] = (res.data[8] & 0x3F) | 0x80;
+        return res;
+    }
+
+private:
+    UuidGenerator() { reseed(); }
+
+    void reseed()
+    {
+        std::random_device rd;
+        m_chacha.seed(rd);
+        m_seeded = std::chrono::steady_clock::now();
+    }
+
+    detail::ChaCha20 m_chacha;
+    std::array<uint8_t, detail::ChaCha20::BlockSize> m_block;
+    size_t m_used = detail::ChaCha20::BlockSize;
+    std::chrono::steady_clock::time_point m_seeded;
+};
+
+inline boost::uuids::uuid generateUuid()
+{
+    return UuidGenerator::local()();
+}
+
+//////////////
+/// \brief The UuidHash struct
+/// The hash of the 16 bytes of a UUID as two 64 bit words, boost::hash<uuid> combines them byte by byte.
+/// The ids in the requests can be chosen by a peer, so the words are mixed with a random seed of the process.
+///
+struct UuidHash
+{
+    size_t operator()(const boost::uuids::uuid& uuid) const
+    {
+        uint64_t w[2];
+        static_assert(sizeof(w) == sizeof(uuid.data));
+        std::memcpy(w, uuid.data, sizeof(w));
+        uint64_t h = (w[0] ^ seed()) * 0x9E3779B97F4A7C15ull;
+        h ^= (w[1] + (h >> 29)) * 0xBF58476D1CE4E5B9ull;
+        return h ^ (h >> 32);
+    }
+
+private:
+    static uint64_t seed()
+    {
+        static const uint64_t value = (uint64_t(std::random_device()()) << 32) | std::random_device()();
+        return value;
+    }
+};
+
+}//namespace graft
@@ -33,6 +33,7 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <functional>
 #include <boost/optional.hpp>
 
 #include <net/http_client.h>
@@ -42,9 +43,13 @@
 
 namespace graft {
 
+class HandlerAPI;
+
 class DaemonRpcClient
 {
 public:
+    using DoneCallback = std::function<void(bool ok)>;
+
     DaemonRpcClient(const std::string &daemon_addr, const std::string &daemon_login, const std::string &daemon_pass);
     virtual ~DaemonRpcClient();
     bool get_tx_from_pool(const std::string &hash_str, cryptonote::transaction &out_tx);
@@ -54,6 +59,12 @@ public:
     bool send_supernode_stakes(const char* network_address, const char* address);
     bool send_supernode_blockchain_based_list(const char* network_address, const char* address, uint64_t last_received_block_height);
 
+    // Asynchronous versions, the requests are sent to the default cryptonode by the upstream machinery of the looper.
+    // The callbacks are called in the I/O thread and should not block.
+    void send_supernode_stakes_async(HandlerAPI &api, const char* network_address, const char* address, DoneCallback callback = nullptr);
+    void send_supernode_blockchain_based_list_async(HandlerAPI &api, const char* network_address, const char* address,
+                                                    uint64_t last_received_block_height, DoneCallback callback = nullptr);
+
 protected:
     bool init(const std::string &daemon_address, boost::optional<epee::net_utils::http::login> daemon_login);
 
@@ -189,10 +189,10 @@ public:
     uint64_t getBlockchainBasedListForAuthSample(uint64_t block_number, blockchain_based_list& list) const;
     
     /*!
-     * \brief synchronizeWithCryptonode - synchronize with cryptonode
+     * \brief synchronizeWithCryptonode - synchronize with cryptonode, the requests are sent asynchronously
      * \return
      */
-    void synchronizeWithCryptonode(const char* supernode_network_address, const char* supernode_address);
+    void synchronizeWithCryptonode(HandlerAPI &api, const char* supernode_network_address, const char* supernode_address);
 
     /*!
      * \brief getBlockchainHeight - returns current daemon block height
@@ -23,22 +23,14 @@ static const std::string MESSAGE_RTA_CANT_BUILD_AUTH_SAMPLE("Can't build auth sa
 static const std::string MESSAGE_INVALID_TRANSACTION("Can't parse transaction");
 
 //Context Keys
-static const std::string CONTEXT_KEY_SALE_DETAILS(":saledetails");
-static const std::string CONTEXT_KEY_SALE(":sale");
-static const std::string CONTEXT_KEY_STATUS(":status");
-static const std::string CONTEXT_KEY_PAY(":pay");
 static const std::string CONTEXT_KEY_SUPERNODE("supernode");
 static const std::string CONTEXT_KEY_FULLSUPERNODELIST("fsl");
 // key to maintain auth responses from supernodes for given tx id
 static const std::string CONTEXT_KEY_AUTH_RESULT_BY_TXID(":tx_id_to_auth_resp");
-// key to map tx_id -> payment_id
-static const std::string CONTEXT_KEY_PAYMENT_ID_BY_TXID(":tx_id_to_payment_id");
 // key to map tx_id -> tx
 static const std::string CONTEXT_KEY_TX_BY_TXID(":tx_id_to_tx");
 // key to store tx id in local context
 static const std::string CONTEXT_TX_ID("tx_id");
-// key to map tx_id -> amount
-static const std::string CONTEXT_KEY_AMOUNT_BY_TX_ID(":tx_id_to_amount");
 
 // key to store sale_details response coming from callback
 static const std::string CONTEXT_SALE_DETAILS_RESULT(":sale_details_result");
@@ -134,6 +126,51 @@ struct PayData
     uint64_t Amount;
 };
 
+//Typed keys of the global context
+enum class ContextTag : uint8_t
+{
+    Sale = 1,
+    SaleDetails,
+    Status,
+    Pay,
+    PaymentIdByTxId,
+    AmountByTxId
+};
+
+// decodes a 64 hex digit id (payment id, tx id) into 32 bytes once per handler, other ids are kept as they are
+inline GlobalId keyId(const std::string& id)
+{
+    auto nibble = [](char c) -> int
+    {
+        if('0' <= c && c <= '9') return c - '0';
+        if('a' <= c && c <= 'f') return c - 'a' + 10;
+        if('A' <= c && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    if(id.size() != 64) return GlobalId(id);
+    std::string bin(32, '\0');
+    for(size_t i = 0; i < bin.size(); ++i)
+    {
+        int hi = nibble(id[2*i]), lo = nibble(id[2*i + 1]);
+        if(hi < 0 || lo < 0) return GlobalId(id);
+        bin[i] = static_cast<char>(hi << 4 | lo);
+    }
+    return GlobalId(std::move(bin));
+}
+
+// payment_id -> sale data
+inline GlobalKey<SaleData> saleKey(const GlobalId& payment_id) { return GlobalKey<SaleData>(ContextTag::Sale, payment_id); }
+// payment_id -> sale details
+inline GlobalKey<std::string> saleDetailsKey(const GlobalId& payment_id) { return GlobalKey<std::string>(ContextTag::SaleDetails, payment_id); }
+// payment_id -> RTAStatus as int
+inline GlobalKey<int> statusKey(const GlobalId& payment_id) { return GlobalKey<int>(ContextTag::Status, payment_id); }
+// payment_id -> pay data
+inline GlobalKey<PayData> payKey(const GlobalId& payment_id) { return GlobalKey<PayData>(ContextTag::Pay, payment_id); }
+// tx_id -> payment_id
+inline GlobalKey<std::string> paymentIdByTxIdKey(const GlobalId& tx_id) { return GlobalKey<std::string>(ContextTag::PaymentIdByTxId, tx_id); }
+// tx_id -> amount
+inline GlobalKey<uint64_t> amountByTxIdKey(const GlobalId& tx_id) { return GlobalKey<uint64_t>(ContextTag::AmountByTxId, tx_id); }
+
 /*!
  * \brief broadcastSaleStatus -  sale (pay) status helper
  * \return
@@ -0,0 +1,86 @@
+
+#pragma once
+
+#include "lib/graft/context.h"
+#include "lib/graft/serveropts.h"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace graft::supernode::request::walletnode {
+
+//////////////
+/// \brief The ForwardCache class
+/// Keeps the responses of the idempotent requests forwarded to the cryptonode by registerForwardRequest
+/// and coalesces concurrent identical requests, so that they share one upstream call.
+/// An entry is keyed by the forwarded path and the hash of the request body. It is valid until its TTL expires
+/// or the blockchain height changes; the height is taken from the getheight responses passing through,
+/// so getheight itself is coalesced but never cached.
+/// The object is shared by all I/O threads.
+///
+class ForwardCache
+{
+public:
+    using uuid_t = Context::uuid_t;
+    using Clock = std::chrono::steady_clock;
+
+    enum class Lookup
+    {
+        Hit,  //the response is found
+        Miss, //the caller should forward the request and store the response
+        Wait, //the same request is forwarded already, the caller is resumed with its response
+    };
+
+    ForwardCache() = default;
+    ForwardCache(const ForwardCache&) = delete;
+    ForwardCache& operator = (const ForwardCache&) = delete;
+
+    //takes the options once, returns false if the cache is disabled
+    bool init(const ConfigOpts& opts);
+    static bool cacheable(const std::string& path);
+
+    //on Wait, id is registered to be resumed when the response is stored
+    Lookup lookup(const std::string& path, const std::string& body, const uuid_t& id, std::string& response);
+    //stores the response of a Miss, returns the ids of the requests waiting for it
+    std::vector<uuid_t> store(const std::string& path, const std::string& body, const std::string& response);
+    //drops the pending entry of a Miss that has failed, returns the ids of the requests waiting for it
+    std::vector<uuid_t> fail(const std::string& path, const std::string& body);
+
+    uint64_t height() const;
+    size_t size() const;
+
+private:
+    struct Entry
+    {
+        std::string request;
+        std::string response;
+        uint64_t height = 0;
+        bool pending = true;
+        Clock::time_point time; //start of the upstream call when pending, otherwise expiration time
+        std::vector<uuid_t> waiters;
+    };
+
+    static std::string makeKey(const std::string& path, const std::string& body);
+    static bool parseHeight(const std::string& response, uint64_t& height);
+    void onHeight(uint64_t height);
+    void evict();
+
+    std::once_flag m_initFlag;
+    bool m_enabled = false;
+    Clock::duration m_ttl;
+    Clock::duration m_pendingTimeout;
+    size_t m_maxEntries = 0;
+
+    mutable std::mutex m_mutex;
+    uint64_t m_height = 0;
+    std::unordered_map<std::string, Entry> m_entries;
+    //stored entries in the order of storing, with the expiration time to identify them
+    std::deque<std::pair<std::string, Clock::time_point>> m_order;
+};
+
+}
+
@@ -56,9 +56,14 @@ private:
     void addGlobalCtxCleaner();
     void initGraftlets();
     void initGraftletRouters();
+    //applies the changed configuration in place, returns false if the server should be restarted instead
+    bool reloadConfig();
 
     ConfigOpts& getCopts();
 
+    int m_argc = 0;
+    const char** m_argv = nullptr;
+    ConfigOpts* m_configOpts = nullptr;
     std::unique_ptr<graftlet::GraftletLoader> m_graftletLoader;
     std::atomic_bool m_connectionBaseReady{false};
     std::unique_ptr<ConnectionBase> m_connectionBase;
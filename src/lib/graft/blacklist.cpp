@@ -1,106 +1,292 @@
 #include "lib/graft/blacklist.h"
 #include "lib/graft/mongoosex.h"
-#include "radix_tree/radix_tree.hpp"
 #include <sstream>
 #include <fstream>
 #include <regex>
 #include <chrono>
+#include <mutex>
+#include <list>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
 
 namespace graft {
 
 namespace
 {
 
-struct Window
+using Clock = std::chrono::steady_clock;
+
+struct AddrHash
+{
+    size_t operator()(const Ip6Addr& addr) const
+    {
+        uint64_t hi, lo;
+        std::memcpy(&hi, addr.data(), sizeof(hi));
+        std::memcpy(&lo, addr.data() + sizeof(hi), sizeof(lo));
+        uint64_t h = (hi * 0x9E3779B97F4A7C15ULL) ^ lo;
+        h ^= h >> 29; h *= 0xBF58476D1CE4E5B9ULL; h ^= h >> 32;
+        return h;
+    }
+};
+
+//addr is in host order
+Ip6Addr mapV4(in_addr_t addr)
+{
+    Ip6Addr res{};
+    res[10] = res[11] = 0xFF;
+    res[12] = addr >> 24; res[13] = addr >> 16; res[14] = addr >> 8; res[15] = addr;
+    return res;
+}
+
+bool isV4(const Ip6Addr& addr)
+{
+    return std::all_of(addr.begin(), addr.begin() + 10, [](uint8_t b){ return b == 0; })
+            && addr[10] == 0xFF && addr[11] == 0xFF;
+}
+
+//zeroes the bits beyond the first len ones
+Ip6Addr maskAddr(Ip6Addr addr, int len)
+{
+    assert(0 <= len && len <= 128);
+    int n = len / 8;
+    if(n < 16)
+    {
+        addr[n] &= static_cast<uint8_t>(0xFF00 >> (len % 8));
+        std::fill(addr.begin() + n + 1, addr.end(), 0);
+    }
+    return addr;
+}
+
+//returns false if ip is not a valid address, on success maxLen is 32 for IPv4 and 128 for IPv6
+bool parseAddr(const char* ip, Ip6Addr& addr, int& maxLen)
+{
+    if(std::strchr(ip, ':'))
+    {
+        maxLen = 128;
+        return inet_pton(AF_INET6, ip, addr.data()) == 1;
+    }
+    in_addr addr4;
+    if(inet_pton(AF_INET, ip, &addr4) != 1) return false;
+    maxLen = 32;
+    addr = mapV4(ntohl(addr4.s_addr));
+    return true;
+}
+
+//////////////
+/// \brief The PrefixTable class
+/// Longest prefix match over IPv6 prefixes (IPv4 ones are mapped, so their lengths are 96 more).
+/// It keeps a hash table of the prefixes for each present prefix length, a lookup probes them
+/// from the longest length down, so its cost is bounded by the number of distinct lengths in the rules.
+///
+class PrefixTable
 {
-    std::chrono::steady_clock::time_point m_tpStart;
-    int m_count;
+public:
+    using Allow = BlackList::Allow;
+
+    void insert(const Ip6Addr& addr, int len, Allow allow)
+    {
+        auto it = std::find_if(m_levels.begin(), m_levels.end(), [len](const Level& l){ return l.first <= len; });
+        if(it == m_levels.end() || it->first != len)
+        {
+            it = m_levels.emplace(it, len, Prefixes());
+        }
+        it->second[maskAddr(addr, len)] = allow;
+    }
+
+    void erase(const Ip6Addr& addr, int len)
+    {
+        auto it = std::find_if(m_levels.begin(), m_levels.end(), [len](const Level& l){ return l.first == len; });
+        if(it == m_levels.end()) return;
+        it->second.erase(maskAddr(addr, len));
+        if(it->second.empty()) m_levels.erase(it);
+    }
+
+    //returns nullptr if no prefix matches
+    const Allow* find(const Ip6Addr& addr) const
+    {
+        for(auto& level : m_levels)
+        {
+            auto it = level.second.find(maskAddr(addr, level.first));
+            if(it != level.second.end()) return &it->second;
+        }
+        return nullptr;
+    }
+
+    void clear() { m_levels.clear(); }
 
-    Window(std::chrono::steady_clock::time_point now, int count = 1) : m_tpStart(now), m_count(count) { }
+private:
+    using Prefixes = std::unordered_map<Ip6Addr, Allow, AddrHash>;
+    using Level = std::pair<int, Prefixes>;
+    //in descending order of the prefix lengths
+    std::vector<Level> m_levels;
 };
 
-class IpMap
+//////////////
+/// \brief The RateLimiter class
+/// Token bucket per source; a bucket holds up to requests_per_sec * window_size_sec tokens and is refilled
+/// with requests_per_sec tokens a second. A request takes a token, the source without tokens is triggered.
+/// The IPv6 sources are aggregated by /64 prefixes, as a single host usually owns the whole prefix.
+/// The state is split into shards with their own locks, selected by the hash of the source.
+/// Each shard keeps its sources in the order of last access; a source idle for the window has a full bucket,
+/// that is the same as untracked one, so it is dropped from the front, that gives O(1) amortized expiry.
+/// The number of tracked and banned sources is limited, the oldest ones are evicted to keep memory bounded
+/// under floods from many distinct addresses.
+///
+class RateLimiter
 {
 public:
-    IpMap(int requests_per_sec, int window_size_sec)
+    static constexpr size_t Shards = 16;
+    static constexpr size_t DefaultMaxSources = 1 << 16;
+
+    RateLimiter(int requests_per_sec, int window_size_sec, int ban_ip_sec, size_t max_sources)
         : m_requestsPerSec(requests_per_sec)
-        , m_wndSizeSec(window_size_sec)
+        , m_capacity(static_cast<double>(requests_per_sec) * window_size_sec)
         , m_wndSize(std::chrono::seconds(window_size_sec))
+        , m_banTimeout(std::chrono::seconds(ban_ip_sec))
+        , m_maxPerShard(std::max(size_t(1), (max_sources? max_sources : DefaultMaxSources) / Shards))
     { }
 
+    static Ip6Addr sourceKey(const Ip6Addr& addr)
+    {
+        return isV4(addr)? addr : maskAddr(addr, 64);
+    }
+
+    //returns false if the source is banned or has been banned by the request
+    bool process(const Ip6Addr& addr)
+    {
+        Ip6Addr key = sourceKey(addr);
+        Shard& shard = shardOf(key);
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        unban(shard, now);
+        if(shard.bans.count(key)) return false;
+        if(!inc(shard, key, now)) return true;
+        ban(shard, key, now);
+        return false;
+    }
+
     //return true if triggered
-    bool inc(in_addr_t addr, bool networkOrder)
+    bool active(const Ip6Addr& addr)
+    {
+        Ip6Addr key = sourceKey(addr);
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        return inc(shard, key, Clock::now());
+    }
+
+    size_t getCnt()
     {
-        if(networkOrder) addr = htonl(addr);
-        auto now = std::chrono::steady_clock::now();
-        auto it = m_ipwnd.find(addr);
-        bool triggered = false;
-        if(it != m_ipwnd.end())
+        size_t cnt = 0;
+        auto now = Clock::now();
+        for(auto& shard : m_shards)
         {
-            while(true)
+            std::lock_guard<std::mutex> lk(shard.mutex);
+            expire(shard, now);
+            cnt += shard.index.size();
+        }
+        return cnt;
+    }
+
+private:
+    struct Source
+    {
+        Ip6Addr key;
+        double tokens;
+        Clock::time_point last;
+    };
+
+    using Sources = std::list<Source>;
+
+    struct Shard
+    {
+        std::mutex mutex;
+        //in the order of last access
+        Sources sources;
+        std::unordered_map<Ip6Addr, Sources::iterator, AddrHash> index;
+        std::unordered_map<Ip6Addr, Clock::time_point, AddrHash> bans;
+        //in the order of banning, that is the order of expiration
+        std::deque<std::pair<Clock::time_point, Ip6Addr>> banOrder;
+    };
+
+    Shard& shardOf(const Ip6Addr& key)
+    {
+        return m_shards[(AddrHash()(key) >> 56) % Shards];
+    }
+
+    void expire(Shard& shard, Clock::time_point now)
+    {
+        while(!shard.sources.empty() && shard.sources.front().last + m_wndSize <= now)
+        {
+            shard.index.erase(shard.sources.front().key);
+            shard.sources.pop_front();
+        }
+    }
+
+    bool inc(Shard& shard, const Ip6Addr& key, Clock::time_point now)
+    {
+        expire(shard, now);
+        auto it = shard.index.find(key);
+        if(it == shard.index.end())
+        {
+            if(m_maxPerShard <= shard.index.size())
             {
-                Window& wnd = it->second;
-                auto tp_end = wnd.m_tpStart + m_wndSize;
-                if(tp_end + m_wndSize < now)
-                {//too old data
-                    wnd = Window(now);
-                    break;
-                }
-                if(tp_end + one_sec < now)
-                {
-                    auto secs = std::chrono::duration_cast<std::chrono::seconds>(now - tp_end);
-                    wnd.m_count -= secs.count() * m_requestsPerSec;
-                    if(wnd.m_count <= 0)
-                    {
-                        wnd = Window(now);
-                        break;
-                    }
-                    wnd.m_tpStart += std::chrono::seconds(secs.count());
-                }
-                if(m_wndSizeSec * m_requestsPerSec < ++wnd.m_count) triggered = true;
-                break;
+                shard.index.erase(shard.sources.front().key);
+                shard.sources.pop_front();
             }
+            shard.sources.push_back(Source{key, m_capacity, now});
+            it = shard.index.emplace(key, std::prev(shard.sources.end())).first;
         }
         else
         {
-            auto res = m_ipwnd.emplace(std::make_pair(addr, Window(now)));
-            it = res.first;
+            Source& src = *it->second;
+            std::chrono::duration<double> elapsed = now - src.last;
+            src.tokens = std::min(m_capacity, src.tokens + elapsed.count() * m_requestsPerSec);
+            src.last = now;
+            shard.sources.splice(shard.sources.end(), shard.sources, it->second);
         }
 
-        removeItAndNeighbor(it, triggered, now);
-
-        return triggered;
+        Source& src = *it->second;
+        if(1 <= src.tokens)
+        {
+            src.tokens -= 1;
+            return false;
+        }
+        //the triggered source starts from scratch
+        shard.sources.erase(it->second);
+        shard.index.erase(it);
+        return true;
     }
 
-    size_t getCnt() { return m_ipwnd.size(); }
-
-private:
-    using IpWnd = std::map<in_addr_t, Window>;
-
-    const std::chrono::steady_clock::duration one_sec = std::chrono::seconds(1);
-
-    int m_requestsPerSec;
-    int m_wndSizeSec;
-    std::chrono::steady_clock::duration m_wndSize;
-    //host order
-    IpWnd m_ipwnd;
-
-    void removeItAndNeighbor(IpWnd::iterator it, bool triggered, std::chrono::steady_clock::time_point now)
+    void ban(Shard& shard, const Ip6Addr& key, Clock::time_point now)
     {
-        //remove data if triggered, and position to neighbor
-        if(triggered)
+        if(m_maxPerShard <= shard.bans.size())
         {
-            it = m_ipwnd.erase(it);
+            shard.bans.erase(shard.banOrder.front().second);
+            shard.banOrder.pop_front();
         }
-        else ++it;
-        if(it == m_ipwnd.end()) it = m_ipwnd.begin();
+        auto until = (m_banTimeout.count() == 0)? Clock::time_point::max() : now + m_banTimeout;
+        shard.bans.emplace(key, until);
+        shard.banOrder.emplace_back(until, key);
+    }
 
-        if(it != m_ipwnd.end())
-        {//remove neighbor if old
-            Window& wnd = it->second;
-            if(wnd.m_tpStart + m_wndSize + m_wndSize <= now) m_ipwnd.erase(it);
+    void unban(Shard& shard, Clock::time_point now)
+    {
+        while(!shard.banOrder.empty() && shard.banOrder.front().first <= now)
+        {
+            shard.bans.erase(shard.banOrder.front().second);
+            shard.banOrder.pop_front();
         }
     }
+
+    int m_requestsPerSec;
+    double m_capacity;
+    Clock::duration m_wndSize;
+    Clock::duration m_banTimeout;
+    size_t m_maxPerShard;
+    std::array<Shard, Shards> m_shards;
 };
 
 } // namespace
@@ -108,122 +294,83 @@ private:
 class BlackListImpl : public BlackListTest
 {
 public:
-    BlackListImpl(int requests_per_sec, int window_size_sec, int ban_ip_sec)
+    BlackListImpl(int requests_per_sec, int window_size_sec, int ban_ip_sec, size_t max_sources)
         : banEnabled(requests_per_sec != 0)
-        , m_ipmap(requests_per_sec, window_size_sec)
-        , m_banTimeout(std::chrono::seconds(ban_ip_sec))
+        , m_limiter(requests_per_sec, window_size_sec, ban_ip_sec, max_sources)
     { }
 
     virtual ~BlackListImpl() override = default;
 
-    //radix table entry
-    struct RtEntry
-    {
-        //host order
-        in_addr_t m_addr = 0;
-        int m_prefixLen = 0;
-
-        //
-        in_addr_t operator [] (int n) const
-        {
-            return (m_addr & (0x80000000 >> n))? 1 : 0;
-        }
-
-        bool operator == (const RtEntry &rhs) const
-        {
-            return m_prefixLen == rhs.m_prefixLen && m_addr == rhs.m_addr;
-        }
-
-        bool operator< (const RtEntry &rhs) const
-        {
-            if (m_addr == rhs.m_addr)
-                return m_prefixLen < rhs.m_prefixLen;
-            else
-                return m_addr < rhs.m_addr;
-        }
-    };
-
 private:
-    using Table = radix_tree<RtEntry, Allow>;
-
-    Table m_table;
+    //the rules are not changed while serving, so processIp reads them without locking;
+    //the rate limiter locks its shards itself
+    PrefixTable m_table;
     Allow m_defaultAllow = true;
     std::ostringstream m_warns;
 
     bool banEnabled;
-    IpMap m_ipmap;
-    std::chrono::steady_clock::duration m_banTimeout;
-    std::deque< std::pair<std::chrono::steady_clock::time_point, in_addr_t> > m_bannedIPs;
-
-    void unban()
-    {
-        auto now = std::chrono::steady_clock::now();
-        while(!m_bannedIPs.empty())
-        {
-            auto& item = m_bannedIPs.front();
-            if(now < item.first) break;
-            removeEntry(item.second, false);
-            m_bannedIPs.pop_front();
-        }
-    }
-
-    void ban(in_addr_t addr)
-    {
-        addEntry(addr, false, false, 32);
-
-        if(m_banTimeout.count() == 0) return;
-        m_bannedIPs.emplace_back( std::make_pair(
-                                      std::chrono::steady_clock::now() + m_banTimeout,
-                                      addr ) );
-    }
+    RateLimiter m_limiter;
 
     void addRule(Allow allow, const char* ip, int len, int line)
     {
-        assert(0 < len && len <= 32);
-        in_addr addr;
-        if(inet_aton(ip, &addr) == 0)
+        Ip6Addr addr;
+        int maxLen;
+        if(!parseAddr(ip, addr, maxLen))
         {
             m_warns << "error: invalid address " << ip << " at line " << line << '\n';
             throw std::runtime_error("invalid address error; addRule");
         }
-        addr.s_addr = ntohl(addr.s_addr);
-
-        in_addr_t mask = -1;
-        if(len < 32)
+        if(len < 0) len = maxLen;
+        if(len == 0 || maxLen < len)
         {
-            mask = ~((1 << (32 - len)) - 1);
+            m_warns << "error: invalid mask length " << len << " at line " << line << '\n';
+            throw std::runtime_error("invalid mask");
         }
-        addr.s_addr &= mask;
+        len += 128 - maxLen;
+        addr = maskAddr(addr, len);
 
-        if(find(addr.s_addr, false).first)
+        if(m_table.find(addr))
         {
             m_warns << "warning: the rule at line " << line << " is superceded by one of previous rule\n";
             return;
         }
 
-        RtEntry entry{addr.s_addr, len};
-        m_table.insert(std::make_pair(entry,allow));
+        m_table.insert(addr, len, allow);
     }
-public:
-    virtual bool processIp(in_addr_t addr, bool networkOrder = true) override
+
+    Ip6Addr toAddr(const char* ip, int* maxLen = nullptr)
     {
-        if(banEnabled && m_banTimeout.count() != 0)
+        Ip6Addr addr;
+        int len;
+        if(!parseAddr(ip, addr, len))
         {
-            unban();
+            std::stringstream ss;
+            ss << "invalid address " << ip;
+            throw std::runtime_error(ss.str());
         }
+        if(maxLen) *maxLen = len;
+        return addr;
+    }
+
+    std::pair<bool, Allow> find(const Ip6Addr& addr)
+    {
+        const Allow* allow = m_table.find(addr);
+        if(!allow) return std::make_pair(false, m_defaultAllow);
+        return std::make_pair(true, *allow);
+    }
 
+public:
+    virtual bool processIp(in_addr_t addr, bool networkOrder = true) override
+    {
         if(networkOrder) addr = ntohl(addr);
-        if(!find(addr, false).second) return false;
+        return processIp(mapV4(addr));
+    }
 
+    virtual bool processIp(const Ip6Addr& addr) override
+    {
+        if(!find(addr).second) return false;
         if(!banEnabled) return true;
-
-        bool triggered = m_ipmap.inc( addr, false);
-        if(triggered)
-        {
-            ban(addr);
-            return false;
-        }
-        return true;
+        return m_limiter.process(addr);
     }
 
     virtual std::string getWarnings() override
@@ -233,60 +380,39 @@ public:
 
     virtual void addEntry(const char* ip, int len, Allow allow) override
     {
-        assert(0<len && len<=32);
-        in_addr addr;
-        int res = inet_aton(ip,&addr);
-        assert(res);
-        addEntry(addr.s_addr, true, allow, len);
+        int maxLen;
+        Ip6Addr addr = toAddr(ip, &maxLen);
+        if(len < 0) len = maxLen;
+        assert(0 < len && len <= maxLen);
+        m_table.insert(addr, len + 128 - maxLen, allow);
     }
     virtual void addEntry(in_addr_t addr, bool networkOrder, Allow allow, int len) override
     {
         assert(0<len && len<=32);
         if(networkOrder) addr = ntohl(addr);
-        RtEntry entry{ addr, len };
-        m_table.insert(std::make_pair(entry,allow));
+        m_table.insert(mapV4(addr), len + 96, allow);
     }
 
     virtual void removeEntry(const char* ip) override
     {
-        in_addr addr;
-        int res = inet_aton(ip,&addr);
-        assert(res);
-        removeEntry(addr.s_addr, true);
+        m_table.erase(toAddr(ip), 128);
     }
 
     virtual void removeEntry(in_addr_t addr, bool networkOrder = true) override
     {
         if(networkOrder) addr = ntohl(addr);
-
-        RtEntry entry{ addr, 32 };
-        m_table.erase(entry);
+        m_table.erase(mapV4(addr), 128);
     }
 
     virtual std::pair<bool, Allow> find(in_addr_t addr, bool networkOrder) override
     {
         if(networkOrder) addr = ntohl(addr);
-
-        RtEntry entry{addr, 32};
-
-        Table::iterator it = m_table.longest_match(entry);
-        if (it == m_table.end())
-        {
-            return std::make_pair(false, m_defaultAllow);
-        }
-        return std::make_pair(true, it->second);
+        return find(mapV4(addr));
     }
 
     virtual std::pair<bool, Allow> find(const char* ip) override
     {
-        in_addr addr;
-        if(!inet_aton(ip, &addr))
-        {
-            std::stringstream ss;
-            ss << "invalid address " << ip << " in find()";
-            throw std::runtime_error(ss.str());
-        }
-        return find(addr.s_addr, true);
+        return find(toAddr(ip));
     }
 
     virtual void readRules(const char* filepath)
@@ -332,7 +458,7 @@ public:
                 m_warns << "warning: all rules are superseded starting from line " << line << '\n';
                 break;
             }
-            std::regex regex(R"(^(allow|deny)\s+(all|((\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3})(/(\d{1,2}))?))$)");
+            std::regex regex(R"(^(allow|deny)\s+(all|((\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3}|[0-9a-fA-F:]*:[0-9a-fA-F:.]*)(/(\d{1,3}))?))$)");
             std::smatch m;
             if(!std::regex_match(s, m, regex))
             {
@@ -351,15 +477,10 @@ public:
             {
                 assert(4 < m.size());
                 std::string ip = m[4];
-                int prefix_len = 32;
+                int prefix_len = -1;
                 if(6 < m.size() && m[6].matched)
                 {
                     prefix_len = std::stoi(m[6]);
-                    if(prefix_len == 0 || 32 < prefix_len)
-                    {
-                        m_warns << "error: invalid mask length " << prefix_len << " at line " << line << '\n';
-                        throw std::runtime_error("invalid mask");
-                    }
                 }
                 addRule(allow, ip.c_str(), prefix_len, line);
             }
@@ -369,57 +490,23 @@ public:
     //for testing
     virtual bool active(in_addr_t addr) override
     {
-        return m_ipmap.inc(addr, false);
+        return m_limiter.active(mapV4(addr));
     }
 
     virtual size_t activeCnt() override
     {
-        return m_ipmap.getCnt();
+        return m_limiter.getCnt();
     }
 };
 
-std::unique_ptr<BlackList> BlackList::Create(int requests_per_sec, int window_size_sec, int ban_ip_sec)
+std::unique_ptr<BlackList> BlackList::Create(int requests_per_sec, int window_size_sec, int ban_ip_sec, size_t max_sources)
 {
-    return std::make_unique<BlackListImpl>(requests_per_sec, window_size_sec, ban_ip_sec);
+    return std::make_unique<BlackListImpl>(requests_per_sec, window_size_sec, ban_ip_sec, max_sources);
 }
 
-std::unique_ptr<BlackListTest> BlackListTest::Create(int requests_per_sec, int window_size_sec, int ban_ip_sec)
+std::unique_ptr<BlackListTest> BlackListTest::Create(int requests_per_sec, int window_size_sec, int ban_ip_sec, size_t max_sources)
 {
-    return std::make_unique<BlackListImpl>(requests_per_sec, window_size_sec, ban_ip_sec);
+    return std::make_unique<BlackListImpl>(requests_per_sec, window_size_sec, ban_ip_sec, max_sources);
 }
 
 } //namespace graft
-
-template<>
-inline int radix_length<graft::BlackListImpl::RtEntry>(const graft::BlackListImpl::RtEntry &entry)
-{
-    return entry.m_prefixLen;
-}
-
-template<>
-inline graft::BlackListImpl::RtEntry radix_substr<graft::BlackListImpl::RtEntry>(const graft::BlackListImpl::RtEntry &entry, int begin, int num)
-{
-    assert(num + begin <= 32);
-    in_addr_t mask;
-    if (num == 32) mask = 0;
-    else mask = 1 << num;
-    mask  -= 1;
-    mask <<= 32 - num - begin;
-
-    graft::BlackListImpl::RtEntry res;
-    res.m_addr = (entry.m_addr & mask) << begin;
-    res.m_prefixLen = num;
-    return res;
-}
-
-template<>
-inline graft::BlackListImpl::RtEntry radix_join(const graft::BlackListImpl::RtEntry& entry1, const graft::BlackListImpl::RtEntry& entry2)
-{
-    graft::BlackListImpl::RtEntry res;
-
-    res.m_addr = entry1.m_addr;
-    res.m_addr |= entry2.m_addr >> entry1.m_prefixLen;
-    res.m_prefixLen  = entry1.m_prefixLen + entry2.m_prefixLen;
-
-    return res;
-}
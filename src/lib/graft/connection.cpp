@@ -5,6 +5,10 @@
 #include "lib/graft/graft_exception.h"
 
 #include <boost/uuid/uuid_io.hpp>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <netinet/tcp.h>
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "supernode.connection"
@@ -25,6 +29,21 @@ std::string client_host(mg_connection* client)
     return inet_ntoa(client->sa.sin.sin_addr);
 }
 
+//returns false if the client address is refused by blackList
+static bool processClientIp(BlackList& blackList, mg_connection* client)
+{
+#if MG_ENABLE_IPV6
+    if(client->sa.sa.sa_family == AF_INET6)
+    {
+        Ip6Addr addr;
+        static_assert(sizeof(addr) == sizeof(client->sa.sin6.sin6_addr), "");
+        std::memcpy(addr.data(), &client->sa.sin6.sin6_addr, addr.size());
+        return blackList.processIp(addr);
+    }
+#endif
+    return blackList.processIp(client->sa.sin.sin_addr.s_addr);
+}
+
 void* getUserData(mg_mgr* mgr) { return mgr->user_data; }
 void* getUserData(mg_connection* nc) { return nc->user_data; }
 mg_mgr* getMgr(mg_connection* nc) { return nc->mgr; }
@@ -41,6 +60,18 @@ void UpstreamStub::setConnection(mg_connection* upstream)
     assert(m_onCloseCallback);
     upstream->user_data = this;
     upstream->handler = static_ev_handler<UpstreamStub>;
+    mg_set_timer(upstream, (0 < m_idleTimeout)? mg_time() + m_idleTimeout : 0);
+    if(0 < m_probeInterval)
+    {//the failed probes end in an error on the socket, MG_EV_CLOSE follows
+        int on = 1;
+        setsockopt(upstream->sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+#ifdef TCP_KEEPIDLE
+        int cnt = ProbeCount;
+        setsockopt(upstream->sock, IPPROTO_TCP, TCP_KEEPIDLE, &m_probeInterval, sizeof(m_probeInterval));
+        setsockopt(upstream->sock, IPPROTO_TCP, TCP_KEEPINTVL, &m_probeInterval, sizeof(m_probeInterval));
+        setsockopt(upstream->sock, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+#endif
+    }
 }
 
 void UpstreamStub::ev_handler(mg_connection *upstream, int ev, void *ev_data)
@@ -54,13 +85,31 @@ void UpstreamStub::ev_handler(mg_connection *upstream, int ev, void *ev_data)
         upstream->handler = static_empty_ev_handler;
         m_onCloseCallback(upstream);
     } break;
-    default:
+    case MG_EV_POLL:
+    case MG_EV_SEND:
+        break;
+    case MG_EV_TIMER:
     {
-        assert(ev == MG_EV_POLL);
+        LOG_PRINT_CLN(2,upstream,"Stub connection idle timeout");
+        close(upstream);
+    } break;
+    default:
+    {//nothing is expected on an idle connection, it cannot be reused
+        LOG_PRINT_CLN(2,upstream,"Stub connection unexpected event " << ev);
+        close(upstream);
     } break;
     }
 }
 
+void UpstreamStub::close(mg_connection *upstream)
+{
+    //the connection is released at once, so that it is not taken before MG_EV_CLOSE
+    mg_set_timer(upstream, 0);
+    upstream->flags |= MG_F_CLOSE_IMMEDIATELY;
+    upstream->handler = static_empty_ev_handler;
+    m_onCloseCallback(upstream);
+}
+
 
 void UpstreamSender::send(TaskManager &manager, const std::string& def_uri)
 {
@@ -115,7 +164,7 @@ void UpstreamSender::send(TaskManager &manager, const std::string& def_uri)
         extra_headers = "Content-Type: application/json\r\n";
     }
     std::string& body = output.body;
-    if(m_upstream)
+    if(m_upstream && !m_pipelined)
     {
         m_upstream->user_data = this;
         m_upstream->handler = static_ev_handler<UpstreamSender>;
@@ -129,13 +178,80 @@ void UpstreamSender::send(TaskManager &manager, const std::string& def_uri)
         m_upstream = upstream;
         m_upstream->user_data = this;
     }
-    mg_set_timer(m_upstream, mg_time() + m_timeout);
+    //the timer of a pipelined request starts when it takes the connection over
+    if(!m_pipelined)
+    {
+        armTimer();
+    }
 
     auto& rsi = manager.runtimeSysInfo();
     rsi.count_upstrm_http_req();
     rsi.count_upstrm_http_req_bytes_raw(url.size() + extra_headers.size() + body.size());
 }
 
+void UpstreamSender::attach(uint64_t connectionId)
+{
+    assert(m_pipelined && m_upstream);
+    m_pipelined = false;
+    m_connectioId = connectionId;
+    m_upstream->user_data = this;
+    m_upstream->handler = static_ev_handler<UpstreamSender>;
+    armTimer();
+}
+
+void UpstreamSender::abort(const std::string& error)
+{
+    assert(m_pipelined);
+    setError(Status::Error, error);
+    settle(false);
+    m_upstream = nullptr;
+    m_onDone(*this, 0, m_upstream);
+    releaseItself();
+}
+
+void UpstreamSender::reject(const std::string& error)
+{
+    assert(!m_upstream);
+    setError(Status::CircuitOpen, error);
+    m_onDone(*this, 0, nullptr);
+    releaseItself();
+}
+
+void UpstreamSender::setHedge(double delay, OnHedge onHedge)
+{
+    assert(!m_upstream && !m_hedge && delay < m_timeout);
+    m_hedgeDelay = delay;
+    m_onHedge = onHedge;
+    m_hedge = std::make_shared<HedgeGroup>();
+}
+
+void UpstreamSender::joinHedge(UpstreamSender& primary)
+{
+    assert(primary.m_hedge && !m_hedge);
+    m_hedge = primary.m_hedge;
+    ++m_hedge->pending;
+}
+
+bool UpstreamSender::settle(bool ok)
+{
+    if(!m_hedge) return true;
+    --m_hedge->pending;
+    if(!m_hedge->settled && (ok || m_hedge->pending == 0))
+    {
+        m_hedge->settled = true;
+        return true;
+    }
+    m_superseded = true;
+    return false;
+}
+
+void UpstreamSender::armTimer()
+{
+    m_start = Clock::now();
+    double timeout = (m_onHedge && m_hedgeDelay < m_timeout)? m_hedgeDelay : m_timeout;
+    mg_set_timer(m_upstream, mg_time() + timeout);
+}
+
 void UpstreamSender::ev_handler(mg_connection *upstream, int ev, void *ev_data)
 {
     assert(upstream == this->m_upstream);
@@ -149,6 +265,7 @@ void UpstreamSender::ev_handler(mg_connection *upstream, int ev, void *ev_data)
             std::ostringstream ss;
             ss << "cryptonode connect failed: " << strerror(err);
             setError(Status::Error, ss.str().c_str());
+            settle(false);
             upstream->handler = static_empty_ev_handler;
             m_upstream = nullptr;
             m_onDone(*this, m_connectioId, m_upstream);
@@ -159,7 +276,11 @@ void UpstreamSender::ev_handler(mg_connection *upstream, int ev, void *ev_data)
     {
         mg_set_timer(upstream, 0);
         http_message* hm = static_cast<http_message*>(ev_data);
-        m_bt->getInput() = Input(*hm, client_host(upstream));
+        //the task belongs to the winner of the hedged requests
+        if(settle(true))
+        {
+            m_bt->getInput() = Input(*hm, client_host(upstream));
+        }
 
         ConnectionBase* conBase = ConnectionBase::from(upstream->mgr);
         assert(conBase);
@@ -179,6 +300,7 @@ void UpstreamSender::ev_handler(mg_connection *upstream, int ev, void *ev_data)
     {
         mg_set_timer(upstream, 0);
         setError(Status::Error, "cryptonode connection unexpectedly closed");
+        settle(false);
         upstream->handler = static_empty_ev_handler;
         m_upstream = nullptr;
         m_onDone(*this, m_connectioId, m_upstream);
@@ -187,7 +309,16 @@ void UpstreamSender::ev_handler(mg_connection *upstream, int ev, void *ev_data)
     case MG_EV_TIMER:
     {
         mg_set_timer(upstream, 0);
+        if(m_onHedge)
+        {//the request is late, duplicate it and wait for the rest of the timeout
+            OnHedge onHedge;
+            onHedge.swap(m_onHedge);
+            mg_set_timer(upstream, mg_time() + m_timeout - m_hedgeDelay);
+            onHedge(*this);
+            break;
+        }
         setError(Status::Error, "cryptonode request timout");
+        settle(false);
         upstream->flags |= MG_F_CLOSE_IMMEDIATELY;
         upstream->handler = static_empty_ev_handler;
         m_upstream = nullptr;
@@ -205,27 +336,37 @@ ConnectionBase::~ConnectionBase()
     //It could be possible that m_looper uses the counters in its dtor.
     //Thus we should ensure that m_looper should be destroyed before m_sysInfo.
     //Following is explicit destruction order to be independent on the members order..
+    //The loopers of the additional I/O threads use the global context of m_looper.
+    m_extraLoopers.clear();
     m_looper.reset();
     m_sysInfo.reset();
 }
 
 ConnectionBase* ConnectionBase::from(mg_mgr *mgr)
 {
-    void* user_data = getUserData(mgr);
-    assert(user_data);
-    return static_cast<ConnectionBase*>(user_data);
+    return &Looper::from(mgr).getConnectionBase();
 }
 
-void ConnectionBase::loadBlacklist(const ConfigOpts& copts)
+std::string ConnectionBase::readBlacklistRules(const IPFilterOpts& ipfilter)
 {
+    if(ipfilter.rules_filename.empty()) return std::string();
+    std::ifstream ifs(ipfilter.rules_filename);
+    if(!ifs.is_open())
+    {
+        throw graft::exit_error("Cannot load blacklist, 'cannot open file: " + ipfilter.rules_filename + "'");
+    }
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    return oss.str();
+}
 
-    const IPFilterOpts& ipfilter = copts.ipfilter;
-
-    assert(!m_blackList);
-    m_blackList = BlackList::Create(
+std::unique_ptr<BlackList> ConnectionBase::createBlacklist(const IPFilterOpts& ipfilter, const std::string& rules)
+{
+    std::unique_ptr<BlackList> blackList = BlackList::Create(
                 ipfilter.requests_per_sec,
                 ipfilter.window_size_sec,
-                ipfilter.ban_ip_sec);
+                ipfilter.ban_ip_sec,
+                ipfilter.max_sources);
 
     if(!ipfilter.rules_filename.empty())
     {
@@ -233,13 +374,14 @@ void ConnectionBase::loadBlacklist(const ConfigOpts& copts)
         std::string error;
         try
         {
-            m_blackList->readRules(ipfilter.rules_filename.c_str());
+            std::istringstream iss(rules);
+            blackList->readRules(iss);
         }
         catch(std::exception& e)
         {
             error = e.what();
         }
-        std::string warns = m_blackList->getWarnings();
+        std::string warns = blackList->getWarnings();
         if(!warns.empty())
         {
             LOG_PRINT_L1("Blacklist warnings :\n" << warns);
@@ -249,6 +391,14 @@ void ConnectionBase::loadBlacklist(const ConfigOpts& copts)
             throw graft::exit_error("Cannot load blacklist, '" + error + "'");
         }
     }
+    return blackList;
+}
+
+void ConnectionBase::loadBlacklist(const ConfigOpts& copts)
+{
+    assert(!m_blackList);
+    m_blackListRules = readBlacklistRules(copts.ipfilter);
+    m_blackList = createBlacklist(copts.ipfilter, m_blackListRules);
 }
 
 void ConnectionBase::setSysInfoCounter(std::unique_ptr<SysInfoCounter>& counter)
@@ -267,9 +417,89 @@ void ConnectionBase::createLooper(ConfigOpts& configOpts)
 {
     assert(m_sysInfo && !m_looper);
     m_looper = std::make_unique<Looper>(configOpts, *this);
+    for(int i = 1; i < configOpts.io_threads; ++i)
+    {
+        m_extraLoopers.emplace_back(std::make_unique<Looper>(configOpts, *this, m_looper.get()));
+    }
+    if(!m_extraLoopers.empty())
+    {//a callback can be received by an I/O thread other than one that has postponed the task
+        std::vector<Looper*> loopers{ m_looper.get() };
+        for(auto& looper : m_extraLoopers) loopers.push_back(looper.get());
+        for(Looper* looper : loopers)
+        {
+            std::vector<TaskManager*> peers;
+            std::copy_if(loopers.begin(), loopers.end(), std::back_inserter(peers), [looper](Looper* l){ return l != looper; });
+            looper->setPeers(peers);
+        }
+    }
     m_looperReady = true;
 }
 
+bool ConnectionBase::ready() const
+{
+    if(!m_looperReady || !m_looper->ready()) return false;
+    return std::all_of(m_extraLoopers.begin(), m_extraLoopers.end(), [](auto& looper){ return looper->ready(); });
+}
+
+void ConnectionBase::stop(bool force)
+{
+    m_stop = true;
+    assert(m_looper);
+    m_looper->stop(force);
+    for(auto& looper : m_extraLoopers)
+    {
+        looper->stop(force);
+    }
+}
+
+void ConnectionBase::checkReload()
+{
+    if(!m_reload.exchange(false)) return;
+    if(m_reloadCallback) m_reloadCallback();
+}
+
+void ConnectionBase::reconfigure(const ConfigOpts& copts)
+{
+    //the blacklist is rebuilt only if the options or the rules have changed, otherwise the bans and the rates would be lost
+    try
+    {
+        std::string rules = readBlacklistRules(copts.ipfilter);
+        if(copts.ipfilter != getCopts().ipfilter || rules != m_blackListRules)
+        {
+            std::shared_ptr<BlackList> blackList = createBlacklist(copts.ipfilter, rules);
+            std::atomic_store(&m_blackList, blackList);
+            m_blackListRules.swap(rules);
+        }
+    }
+    catch(std::exception& ex)
+    {//the current blacklist remains
+        LOG_PRINT_L0(ex.what());
+    }
+
+    m_looper->reconfigure(copts, OutHttp::uri_substitutions);
+    for(auto& looper : m_extraLoopers)
+    {
+        looper->reconfigure(copts, OutHttp::uri_substitutions);
+    }
+}
+
+void ConnectionBase::serve()
+{
+    std::vector<std::thread> threads;
+    for(auto& looper : m_extraLoopers)
+    {
+        Looper* ptr = looper.get();
+        threads.emplace_back([ptr]{ ptr->serve(); });
+    }
+
+    m_looper->serve();
+
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+}
+
 ConnectionManager* ConnectionBase::getConMgr(const ConnectionManager::Proto& proto)
 {
     auto it = m_conManagers.find(proto);
@@ -295,6 +525,11 @@ void ConnectionBase::bindConnectionManagers()
         cm->enableRouting();
         checkRoutes(*cm);
         cm->bind(getLooper());
+        if(!cm->reusePort()) continue;
+        for(auto& looper : m_extraLoopers)
+        {
+            cm->bind(*looper);
+        }
     }
 }
 
@@ -315,11 +550,20 @@ void ConnectionBase::checkRoutes(graft::ConnectionManager& cm)
 }
 
 
-Looper::Looper(const ConfigOpts& copts, ConnectionBase& connectionBase)
-    : TaskManager(copts, connectionBase.getSysInfoCounter())
+Looper::Looper(const ConfigOpts& copts, ConnectionBase& connectionBase, Looper* primary)
+    : TaskManager(copts, connectionBase.getSysInfoCounter(), primary)
     , m_mgr(std::make_unique<mg_mgr>())
+    , m_connectionBase(connectionBase)
+    , m_main(primary == nullptr)
+{
+    mg_mgr_init(m_mgr.get(), this, cb_event);
+}
+
+Looper& Looper::from(mg_mgr *mgr)
 {
-    mg_mgr_init(m_mgr.get(), &connectionBase, cb_event);
+    void* user_data = getUserData(mgr);
+    assert(user_data);
+    return *static_cast<Looper*>(user_data);
 }
 
 
@@ -335,12 +579,15 @@ void Looper::serve()
     m_ready = true;
     for (;;)
     {
-        mg_mgr_poll(m_mgr.get(), m_copts.timer_poll_interval_ms);
+        mg_mgr_poll(m_mgr.get(), hasResultBacklog()? 0 : m_copts.timer_poll_interval_ms);
+        if(hasResultBacklog()) processReadyJobs();
         if(m_forceStop)
         {
             if(canStop()) break;
             continue;
         }
+        if(m_main) m_connectionBase.checkReload();
+        if(m_configPending) applyConfig();
         getTimerList().eval();
         checkUpstreamBlockingIO();
         checkPeriodicTaskIO();
@@ -361,14 +608,35 @@ void Looper::stop(bool force)
     if(force) m_forceStop = true;
 }
 
+void Looper::reconfigure(const ConfigOpts& copts, const OutHttp::UriSubstitutions& substitutions)
+{
+    std::lock_guard<std::mutex> lk(m_configMutex);
+    m_config = std::make_unique<std::pair<ConfigOpts, OutHttp::UriSubstitutions>>(copts, substitutions);
+    m_configPending = true;
+}
+
+void Looper::applyConfig()
+{
+    std::unique_ptr<std::pair<ConfigOpts, OutHttp::UriSubstitutions>> config;
+    {
+        std::lock_guard<std::mutex> lk(m_configMutex);
+        config.swap(m_config);
+        m_configPending = false;
+    }
+    if(!config) return;
+    TaskManager::reconfigure(config->first, config->second);
+}
+
 void Looper::notifyJobReady()
 {
+    runtimeSysInfo().count_io_notify();
     mg_notify(m_mgr.get());
 }
 
 void Looper::cb_event(mg_mgr *mgr, uint64_t cnt)
 {
-    TaskManager& tm = ConnectionBase::from(mgr)->getLooper();
+    TaskManager& tm = Looper::from(mgr);
+    tm.runtimeSysInfo().count_io_wakeup();
     tm.cb_event(cnt);
 }
 
@@ -385,7 +653,7 @@ void ConnectionManager::ev_handler_empty(mg_connection *client, int ev, void *ev
 void ConnectionManager::ev_handler(ClientTask* ct, mg_connection *client, int ev, void *ev_data)
 {
     assert(ct->m_client == client);
-    assert(&ct->getManager() == &ConnectionBase::from(client->mgr)->getLooper());
+    assert(&ct->getManager() == &Looper::from(client->mgr));
     switch (ev)
     {
     case MG_EV_CLOSE:
@@ -406,7 +674,9 @@ void HttpConnectionManager::bind(Looper& looper)
 
     const ConfigOpts& opts = looper.getCopts();
 
-    mg_connection *nc_http = mg_bind(mgr, opts.http_address.c_str(), ev_handler_http);
+    //several I/O threads listen on the same port, the kernel balances the connections between them
+    mg_connection *nc_http = (1 < opts.io_threads)? mg::mg_bind_reuseport(mgr, opts.http_address.c_str(), ev_handler_http)
+                                                  : mg_bind(mgr, opts.http_address.c_str(), ev_handler_http);
     if(!nc_http)
     {
         std::ostringstream oss;
@@ -472,189 +742,797 @@ void HttpConnectionManager::ev_handler_http(mg_connection *client, int ev, void
 
     switch (ev)
     {
-    case MG_EV_HTTP_REQUEST:
+    case MG_EV_ACCEPT:
     {
-        conBase->getLooper().runtimeSysInfo().count_http_request_total();
+        if(conBase->stopped())
+        {
+            LOG_PRINT_CLN(2,client,"Shutdown in progress; connection refused.");
+            client->handler = ev_handler_empty;
+            client->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
 
-        mg_set_timer(client, 0);
+        if(!processClientIp(*conBase->getBlackList(), client))
+        {
+            LOG_PRINT_CLN(2,client,"The address is in the black-list; closing connection");
+            client->handler = ev_handler_empty;
+            client->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
 
-        struct http_message *hm = (struct http_message *) ev_data;
+        const ConfigOpts& opts = Looper::from(client->mgr).getCopts();
 
-        conBase->getLooper().runtimeSysInfo().count_http_req_bytes_raw(hm->message.len);
+        HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
+        client->user_data = new HttpClientConnection(httpcm, client);
+        client->handler = static_ev_handler<HttpClientConnection>;
 
-        std::string uri(hm->uri.p, hm->uri.len);
+        mg_set_timer(client, mg_time() + opts.http_connection_timeout);
+        break;
+    }
+    default:
+        break;
+    }
+}
 
-        int method = translateMethod(hm->method.p, hm->method.len);
-        if (method < 0) return;
+void HttpConnectionManager::onRequest(HttpClientConnection* conn, mg_connection *client, http_message* hm)
+{
+    Looper& looper = Looper::from(client->mgr);
+    const ConfigOpts& opts = looper.getCopts();
 
-        const sockaddr_in& remote_address = client->sa.sin;
-        uint16_t remote_port = static_cast<uint16_t>(remote_address.sin_port);
-        char remote_address_host_str[INET_ADDRSTRLEN];
-        if (!inet_ntop(AF_INET, &(remote_address.sin_addr), remote_address_host_str, sizeof remote_address_host_str))
-            *remote_address_host_str = '\0';
+    looper.runtimeSysInfo().count_http_request_total();
 
-        std::string s_method(hm->method.p, hm->method.len);
-        LOG_PRINT_CLN(1,client,"New HTTP client. uri:" << std::string(hm->uri.p, hm->uri.len) << " method:" << s_method
-            << " remote: " << remote_address_host_str << ":" << remote_port);
+    looper.runtimeSysInfo().count_http_req_bytes_raw(hm->message.len);
 
-        HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
-        Router::JobParams prms;
-        if (httpcm->matchRoute(uri, method, prms))
-        {
-            conBase->getLooper().runtimeSysInfo().count_http_request_routed();
+    std::string uri(hm->uri.p, hm->uri.len);
 
-            mg_str& body = hm->body;
-            prms.input = Input(*hm, client_host(client));
+    int method = translateMethod(hm->method.p, hm->method.len);
+    if (method < 0) return;
 
-            prms.input.port = remote_port;
+    const sockaddr_in& remote_address = client->sa.sin;
+    uint16_t remote_port = static_cast<uint16_t>(remote_address.sin_port);
+    char remote_address_host_str[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &(remote_address.sin_addr), remote_address_host_str, sizeof remote_address_host_str))
+        *remote_address_host_str = '\0';
 
-            LOG_PRINT_CLN(2,client,"Matching Route found; body = " << std::string(body.p, body.len));
-            BaseTask* bt = BaseTask::Create<ClientTask>(httpcm, client, prms).get();
-            assert(dynamic_cast<ClientTask*>(bt));
-            ClientTask* ptr = static_cast<ClientTask*>(bt);
+    std::string s_method(hm->method.p, hm->method.len);
+    LOG_PRINT_CLN(1,client,"New HTTP client. uri:" << std::string(hm->uri.p, hm->uri.len) << " method:" << s_method
+        << " remote: " << remote_address_host_str << ":" << remote_port);
 
-            client->user_data = ptr;
-            client->handler = static_ev_handler<ClientTask>;
+    Router::JobParams prms;
+    if (matchRoute(uri, method, prms))
+    {
+        looper.runtimeSysInfo().count_http_request_routed();
 
-            conBase->getLooper().onNewClient(ptr->getSelf());
-        }
-        else
-        {
-            conBase->getLooper().runtimeSysInfo().count_http_request_unrouted();
+        mg_str& body = hm->body;
+        prms.input = Input(*hm, client_host(client));
 
-            LOG_PRINT_CLN(2,client,"Matching Route not found; closing connection");
-            mg_http_send_error(client, 500, "invalid parameter");
-            client->flags |= MG_F_SEND_AND_CLOSE;
-        }
-        break;
+        prms.input.port = remote_port;
+
+        LOG_PRINT_CLN(2,client,"Matching Route found; body = " << std::string(body.p, body.len));
+        BaseTask* bt = BaseTask::Create<ClientTask>(this, client, std::move(prms)).get();
+        assert(dynamic_cast<ClientTask*>(bt));
+        ClientTask* ptr = static_cast<ClientTask*>(bt);
+
+        conn->addRequest(*hm, ptr, opts);
+
+        looper.onNewClient(ptr->getSelf());
     }
-    case MG_EV_ACCEPT:
+    else
     {
-        if(conBase->stopped())
-        {
-            LOG_PRINT_CLN(2,client,"Shutdown in progress; connection refused.");
-            client->flags |= MG_F_CLOSE_IMMEDIATELY;
-            break;
-        }
+        looper.runtimeSysInfo().count_http_request_unrouted();
+
+        LOG_PRINT_CLN(2,client,"Matching Route not found; closing connection");
+        conn->addRequest(*hm, nullptr, opts);
+        conn->setResponse(nullptr, 500, "invalid parameter", true, true);
+    }
+}
+
+namespace
+{
+
+const char* http_status_message(int code)
+{
+    switch(code)
+    {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "OK";
+    }
+}
+
+//HTTP/1.1 connections are persistent by default, HTTP/1.0 ones only on explicit request
+bool http_keep_alive_requested(const http_message& hm)
+{
+    bool http10 = mg_vcasecmp(&hm.proto, "HTTP/1.0") == 0;
+    mg_str* connection = mg_get_http_header(const_cast<http_message*>(&hm), "Connection");
+    if(!connection) return !http10;
+    if(mg_vcasecmp(connection, "close") == 0) return false;
+    if(mg_vcasecmp(connection, "keep-alive") == 0) return true;
+    return !http10;
+}
+
+} //namespace
+
+HttpClientConnection* HttpClientConnection::from(mg_connection* client)
+{
+    void* user_data = getUserData(client);
+    assert(user_data);
+    return static_cast<HttpClientConnection*>(user_data);
+}
+
+void HttpClientConnection::addRequest(const http_message& hm, ClientTask* ct, const ConfigOpts& opts)
+{
+    assert(!m_closing);
+    ++m_requestCnt;
+    bool keepAlive = 0 < opts.http_keep_alive_timeout && http_keep_alive_requested(hm)
+            && (opts.http_keep_alive_max_requests == 0 || m_requestCnt < opts.http_keep_alive_max_requests);
+    //requests following the last one on the connection are ignored
+    if(!keepAlive) m_closing = true;
+    m_slots.emplace_back(Slot{ct, keepAlive, false, std::string()});
+}
+
+void HttpClientConnection::setResponse(ClientTask* ct, int code, const std::string& body, bool error, bool close)
+{
+    auto it = std::find_if(m_slots.begin(), m_slots.end(), [ct](const Slot& slot){ return !slot.ready && slot.ct == ct; });
+    assert(it != m_slots.end());
+    Slot& slot = *it;
+    if(close)
+    {
+        slot.keepAlive = false;
+        m_closing = true;
+    }
+
+    std::ostringstream oss;
+    oss << "HTTP/1.1 " << code << ' ' << http_status_message(code) << "\r\n"
+        << "Content-Type: " << (error? "text/plain" : "application/json") << "\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: " << (slot.keepAlive? "keep-alive" : "close") << "\r\n\r\n";
+    slot.ready = true;
+    slot.ct = nullptr;
+    if(it == m_slots.begin())
+    {//nothing to wait for, the body is sent without intermediate copy
+        std::string head = oss.str();
+        mg_send(m_client, head.c_str(), head.size());
+        mg_send(m_client, body.c_str(), body.size());
+    }
+    else
+    {//it waits for the responses to the previous requests
+        slot.response = oss.str();
+        slot.response += body;
+    }
+
+    flush();
+}
 
-        if(!conBase->getBlackList().processIp( client->sa.sin.sin_addr.s_addr ))
+void HttpClientConnection::flush()
+{
+    while(!m_slots.empty() && m_slots.front().ready)
+    {
+        Slot& slot = m_slots.front();
+        if(!slot.response.empty())
         {
-            LOG_PRINT_CLN(2,client,"The address is in the black-list; closing connection");
-            client->flags |= MG_F_CLOSE_IMMEDIATELY;
-            break;
+            mg_send(m_client, slot.response.c_str(), slot.response.size());
+        }
+        bool keepAlive = slot.keepAlive;
+        m_slots.pop_front();
+        if(!keepAlive)
+        {//the rest of the slots cannot exist, these requests were not accepted
+            assert(m_slots.empty());
+            m_client->flags |= MG_F_SEND_AND_CLOSE;
+            return;
         }
+    }
 
-        const ConfigOpts& opts = conBase->getLooper().getCopts();
+    if(!m_slots.empty()) return;
 
-        mg_set_timer(client, mg_time() + opts.http_connection_timeout);
-        break;
+    Looper& looper = Looper::from(m_client->mgr);
+    if(looper.stopped())
+    {
+        m_closing = true;
+        m_client->flags |= MG_F_SEND_AND_CLOSE;
+        return;
     }
+    //the connection is idle now
+    const ConfigOpts& opts = looper.getCopts();
+    mg_set_timer(m_client, mg_time() + opts.http_keep_alive_timeout);
+}
+
+void HttpClientConnection::ev_handler(mg_connection* client, int ev, void *ev_data)
+{
+    assert(client == m_client);
+    switch (ev)
+    {
+    case MG_EV_HTTP_REQUEST:
+    {
+        mg_set_timer(client, 0);
+        if(m_closing)
+        {
+            LOG_PRINT_CLN(2,client,"The connection is closing; request ignored");
+            break;
+        }
+        m_manager->onRequest(this, client, static_cast<http_message*>(ev_data));
+    } break;
     case MG_EV_TIMER:
     {
         LOG_PRINT_CLN(1,client,"Client timeout; closing connection");
         mg_set_timer(client, 0);
-        client->handler = ev_handler_empty; //without this we will get MG_EV_HTTP_REQUEST
+        m_closing = true; //without this we will get MG_EV_HTTP_REQUEST
         client->flags |= MG_F_CLOSE_IMMEDIATELY;
-        break;
-    }
+    } break;
+    case MG_EV_CLOSE:
+    {
+        mg_set_timer(client, 0);
+        //the tasks still waiting for responses continue without the client
+        for(Slot& slot : m_slots)
+        {
+            if(slot.ct) slot.ct->m_client = nullptr;
+        }
+        client->handler = static_empty_ev_handler;
+        client->user_data = nullptr;
+        delete this;
+    } break;
     default:
         break;
     }
 }
 
-void CoapConnectionManager::ev_handler_coap(mg_connection *client, int ev, void *ev_data)
+namespace
+{
+
+//RFC 7252 and RFC 7959 (block-wise transfer)
+enum CoapOption
+{
+    COAP_OPT_ETAG = 4,
+    COAP_OPT_URI_PATH = 11,
+    COAP_OPT_CONTENT_FORMAT = 12,
+    COAP_OPT_URI_QUERY = 15,
+    COAP_OPT_BLOCK2 = 23,
+    COAP_OPT_BLOCK1 = 27,
+    COAP_OPT_SIZE2 = 28,
+};
+
+constexpr uint32_t COAP_FORMAT_TEXT = 0;
+constexpr uint32_t COAP_FORMAT_JSON = 50;
+constexpr double COAP_ACK_TIMEOUT = 2;
+constexpr int COAP_MAX_RETRANSMIT = 4;
+//a confirmable request is acknowledged by an empty ACK if its response is not ready in this time
+constexpr double COAP_PIGGYBACK_TIMEOUT = COAP_ACK_TIMEOUT / 2;
+//the exchanges are kept this time to answer duplicates and Block2 requests, an idle peer is closed after it
+constexpr double COAP_EXCHANGE_LIFETIME = 60;
+constexpr size_t COAP_MAX_EXCHANGES = 64;
+constexpr uint32_t COAP_DEFAULT_SZX = 6; //1024 byte blocks
+constexpr size_t COAP_MAX_BODY_SIZE = 1 << 20;
+
+size_t coap_block_size(uint32_t szx)
+{
+    return size_t(16) << szx;
+}
+
+uint32_t coap_uint(const mg_str& value)
 {
-    uint32_t res;
-    std::string uri;
-    struct mg_coap_message *cm = (struct mg_coap_message *) ev_data;
+    uint32_t res = 0;
+    for(size_t i = 0; i < value.len && i < 4; ++i)
+    {
+        res = (res << 8) | static_cast<uint8_t>(value.p[i]);
+    }
+    return res;
+}
 
-    if (ev >= MG_COAP_EVENT_BASE)
-      if (!cm || cm->code_class != MG_COAP_CODECLASS_REQUEST) return;
+//the shortest big-endian form, zero is encoded as empty value
+std::string coap_uint(uint32_t value)
+{
+    std::string res;
+    for(; value; value >>= 8)
+    {
+        res.insert(res.begin(), static_cast<char>(value & 0xFF));
+    }
+    return res;
+}
 
+std::string coap_etag(const std::string& body)
+{
+    uint64_t hash = std::hash<std::string>()(body);
+    return std::string(reinterpret_cast<const char*>(&hash), sizeof(hash));
+}
+
+uint32_t coap_block(uint32_t num, bool more, uint32_t szx)
+{
+    return (num << 4) | (more? 0x08 : 0) | (szx & 0x07);
+}
+
+//maps the HTTP status code to the CoAP response code
+std::pair<uint8_t, uint8_t> coap_code(int code)
+{
+    switch(code)
+    {
+    case 200: return std::make_pair(2, 5); //2.05 Content
+    case 400: return std::make_pair(4, 0); //4.00 Bad Request
+    case 503: return std::make_pair(5, 3); //5.03 Service Unavailable
+    default: return std::make_pair(5, 0);  //5.00 Internal Server Error
+    }
+}
+
+} //namespace
+
+void CoapConnectionManager::ev_handler_coap(mg_connection *client, int ev, void *ev_data)
+{
     switch (ev)
     {
     case MG_EV_ACCEPT:
-    {
+    {//mongoose creates a pseudo-connection for each remote address of the UDP listener
         ConnectionBase* conBase = ConnectionBase::from(client->mgr);
         if(conBase->stopped())
         {
             LOG_PRINT_CLN(2,client,"Shutdown in progress; connection refused.");
+            client->handler = ev_handler_empty;
             client->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
         }
+
+        if(!processClientIp(*conBase->getBlackList(), client))
+        {
+            LOG_PRINT_CLN(2,client,"The address is in the black-list; closing connection");
+            client->handler = ev_handler_empty;
+            client->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
+
+        CoapConnectionManager* coapcm = CoapConnectionManager::from_accepted(client);
+        client->user_data = new CoapClientConnection(coapcm, client);
+        client->handler = static_ev_handler<CoapClientConnection>;
     } break;
+    default:
+        break;
+    }
+}
 
-    case MG_EV_COAP_CON:
-        res = mg_coap_send_ack(client, cm->msg_id);
-        // No break
-    case MG_EV_COAP_NOC:
+void CoapConnectionManager::respond(ClientTask* ct, const std::string& s)
+{
+    if(ct->m_client == nullptr)
+    {//the peer has gone already
+        if(ct->getLastStatus() != Status::Again)
+            ct->getManager().onClientDone(ct->getSelf());
+        return;
+    }
+
+    int code = responseCode(ct);
+
+    auto& client = ct->m_client;
+    LOG_PRINT_CLN(2, client, "Reply to client: " << s);
+    CoapClientConnection::from(client)->setResponse(ct, code, s, Status::Ok != ct->getLastStatus());
+
+    LOG_PRINT_CLN(2, client, "Client request finished with result " << ct->getStrStatus());
+    if(ct->getLastStatus() != Status::Again)
+        ct->getManager().onClientDone(ct->getSelf());
+    client = nullptr;
+}
+
+CoapClientConnection::CoapClientConnection(CoapConnectionManager* manager, mg_connection* client)
+    : m_manager(manager)
+    , m_client(client)
+    , m_nextMsgId(static_cast<uint16_t>(std::random_device()()))
+{
+}
+
+CoapClientConnection* CoapClientConnection::from(mg_connection* client)
+{
+    void* user_data = getUserData(client);
+    assert(user_data);
+    return static_cast<CoapClientConnection*>(user_data);
+}
+
+void CoapClientConnection::onRequest(const mg_coap_message& cm)
+{
+    double now = mg_time();
+    auto it = std::find_if(m_exchanges.begin(), m_exchanges.end(), [&cm](const Exchange& ex){ return ex.msgId == cm.msg_id; });
+    if(it != m_exchanges.end())
+    {//retransmission of the request, the response is repeated if it has been piggybacked
+        LOG_PRINT_CLN(2,m_client,"Duplicated CoAP message " << cm.msg_id);
+        Exchange& ex = *it;
+        if(!ex.confirmable) return;
+        if(ex.acked) mg_coap_send_ack(m_client, ex.msgId);
+        else if(ex.ready) send(ex);
+        return;
+    }
+
+    trim(now);
+    m_exchanges.emplace_back();
+    Exchange& ex = m_exchanges.back();
+    ex.msgId = cm.msg_id;
+    ex.token.assign(cm.token.p, cm.token.len);
+    ex.confirmable = (cm.msg_type == MG_COAP_MSG_CON);
+    ex.szx = COAP_DEFAULT_SZX;
+    ex.time = now;
+
+    std::string path, query, etag;
+    for(const mg_coap_option* opt = cm.options; opt; opt = opt->next)
     {
-        struct mg_coap_option *opt = cm->options;
-#define COAP_OPT_URI 11
-        for (; opt; opt = opt->next)
+        switch(opt->number)
         {
-            if (opt->number = COAP_OPT_URI)
-            {
-                uri += "/";
-                uri += std::string(opt->value.p, opt->value.len);
-            }
+        case COAP_OPT_ETAG:
+            etag.assign(opt->value.p, opt->value.len);
+            break;
+        case COAP_OPT_URI_PATH:
+            path += '/';
+            path.append(opt->value.p, opt->value.len);
+            break;
+        case COAP_OPT_URI_QUERY:
+            if(!query.empty()) query += '&';
+            query.append(opt->value.p, opt->value.len);
+            break;
+        case COAP_OPT_BLOCK2:
+        {//the block size requested by the peer is used if it is not larger than ours
+            uint32_t block2 = coap_uint(opt->value);
+            ex.block2 = true;
+            ex.block2Num = block2 >> 4;
+            ex.szx = std::min(block2 & 0x07, COAP_DEFAULT_SZX);
+        } break;
+        case COAP_OPT_BLOCK1:
+            ex.hasBlock1 = true;
+            ex.block1 = coap_uint(opt->value);
+            break;
+        default:
+            break;
         }
+    }
+    if(path.empty()) path = "/";
+    ex.uri = query.empty()? path : path + '?' + query;
 
-        int method = translateMethod(cm->code_detail - 1);
+    //the next blocks of a response are served from the previous exchange, the handler is not run again
+    if(0 < ex.block2Num)
+    {
+        if(!serveCached(ex, etag)) reply(ex, 4, 8); //4.08 Request Entity Incomplete
+        return;
+    }
 
-        CoapConnectionManager* coapcm = CoapConnectionManager::from_accepted(client);
-        Router::JobParams prms;
-        if (coapcm->matchRoute(uri, method, prms))
+    if(cm.code_detail < 1 || 4 < cm.code_detail)
+    {
+        reply(ex, 4, 5); //4.05 Method Not Allowed
+        return;
+    }
+    int method = CoapConnectionManager::translateMethod(cm.code_detail - 1);
+
+    std::string body(cm.payload.p, cm.payload.len);
+    if(ex.hasBlock1)
+    {
+        uint32_t num = ex.block1 >> 4;
+        bool more = ex.block1 & 0x08;
+        uint32_t szx = ex.block1 & 0x07;
+        Block1Transfer& transfer = m_block1[ex.uri];
+        if(num == 0) transfer = Block1Transfer();
+        transfer.time = now;
+        if(num != transfer.next || (more && body.size() != coap_block_size(szx)))
+        {
+            m_block1.erase(ex.uri);
+            reply(ex, 4, 8); //4.08 Request Entity Incomplete
+            return;
+        }
+        if(COAP_MAX_BODY_SIZE < transfer.body.size() + body.size())
         {
-            mg_str& body = cm->payload;
-            prms.input.load(body.p, body.len);
+            m_block1.erase(ex.uri);
+            reply(ex, 4, 13); //4.13 Request Entity Too Large
+            return;
+        }
+        transfer.body += body;
+        ++transfer.next;
+        if(more)
+        {
+            reply(ex, 2, 31); //2.31 Continue
+            return;
+        }
+        body = std::move(transfer.body);
+        m_block1.erase(ex.uri);
+    }
+
+    Router::JobParams prms;
+    if(!m_manager->matchRoute(path, method, prms))
+    {
+        LOG_PRINT_CLN(2,m_client,"Matching Route not found; uri:" << ex.uri);
+        reply(ex, 4, 4); //4.04 Not Found
+        return;
+    }
+
+    LOG_PRINT_CLN(1,m_client,"New CoAP client. uri:" << ex.uri << " method:" << CoapConnectionManager::m_methods[cm.code_detail - 1].first);
+    prms.input.load(body);
+    prms.input.uri = path;
+    prms.input.query_string = query;
+    prms.input.host = client_host(m_client);
+    prms.input.port = static_cast<uint16_t>(m_client->sa.sin.sin_port);
+
+    BaseTask* bt = BaseTask::Create<ClientTask>(m_manager, m_client, std::move(prms)).get();
+    assert(dynamic_cast<ClientTask*>(bt));
+    ClientTask* ptr = static_cast<ClientTask*>(bt);
+    ex.ct = ptr;
+
+    Looper::from(m_client->mgr).onNewClient(ptr->getSelf());
+    schedule();
+}
+
+bool CoapClientConnection::serveCached(Exchange& ex, const std::string& etag)
+{
+    //the exchanges are of this peer only
+    auto it = std::find_if(m_exchanges.rbegin(), m_exchanges.rend(), [&ex, &etag](const Exchange& prev)
+    {
+        return &prev != &ex && prev.ready && prev.body && prev.uri == ex.uri
+                && (prev.token == ex.token || !etag.empty() && prev.etag == etag);
+    });
+    if(it == m_exchanges.rend()) return false;
+    ex.etag = it->etag;
+    reply(ex, it->codeClass, it->codeDetail, it->body, it->json);
+    return true;
+}
 
-            BaseTask* rb_ptr = BaseTask::Create<ClientTask>(coapcm, client, prms).get();
-            assert(dynamic_cast<ClientTask*>(rb_ptr));
-            ClientTask* ptr = static_cast<ClientTask*>(rb_ptr);
+void CoapClientConnection::setResponse(ClientTask* ct, int code, const std::string& body, bool error)
+{
+    auto it = std::find_if(m_exchanges.begin(), m_exchanges.end(), [ct](const Exchange& ex){ return ex.ct == ct; });
+    assert(it != m_exchanges.end());
+    it->ct = nullptr;
+    auto coapCode = coap_code(code);
+    reply(*it, coapCode.first, coapCode.second, body, !error);
+    schedule();
+}
+
+void CoapClientConnection::reply(Exchange& ex, uint8_t codeClass, uint8_t codeDetail, const std::string& body, bool json)
+{
+    reply(ex, codeClass, codeDetail, body.empty()? nullptr : std::make_shared<const std::string>(body), json);
+}
 
-            client->user_data = ptr;
-            client->handler = static_ev_handler<ClientTask>;
+void CoapClientConnection::reply(Exchange& ex, uint8_t codeClass, uint8_t codeDetail, std::shared_ptr<const std::string> body, bool json)
+{
+    ex.ready = true;
+    ex.codeClass = codeClass;
+    ex.codeDetail = codeDetail;
+    ex.body = std::move(body);
+    ex.json = json;
+    if(ex.acked || !ex.confirmable)
+    {//separate response
+        ex.respMsgId = m_nextMsgId++;
+    }
+    if(ex.acked)
+    {
+        ex.retransmits = 0;
+        ex.resendTime = mg_time() + COAP_ACK_TIMEOUT;
+    }
+    send(ex);
+}
 
-            ConnectionBase* conBase = ConnectionBase::from(client->mgr);
-            conBase->getLooper().onNewClient(ptr->getSelf());
+void CoapClientConnection::send(Exchange& ex)
+{
+    assert(ex.ready);
+    mg_coap_message cm;
+    memset(&cm, 0, sizeof(cm));
+    if(ex.confirmable && !ex.acked)
+    {//piggybacked response
+        cm.msg_type = MG_COAP_MSG_ACK;
+        cm.msg_id = ex.msgId;
+    }
+    else
+    {
+        cm.msg_type = ex.confirmable? MG_COAP_MSG_CON : MG_COAP_MSG_NOC;
+        cm.msg_id = ex.respMsgId;
+    }
+    cm.code_class = ex.codeClass;
+    cm.code_detail = ex.codeDetail;
+    cm.token.p = ex.token.data();
+    cm.token.len = ex.token.size();
+
+    //the options must be added in ascending order, the values should be alive until the message is sent
+    std::string contentFormat, block2, block1, size2;
+    static const std::string empty;
+    const std::string& body = ex.body? *ex.body : empty;
+    const char* payload = body.data();
+    size_t payloadLen = body.size();
+    size_t blockSize = coap_block_size(ex.szx);
+    bool blockwise = ex.block2 || blockSize < body.size();
+    if(blockwise && !body.empty())
+    {//the peer checks that the blocks are of the same response
+        if(ex.etag.empty()) ex.etag = coap_etag(body);
+        mg_coap_add_option(&cm, COAP_OPT_ETAG, &ex.etag[0], ex.etag.size());
+    }
+    if(!body.empty())
+    {
+        contentFormat = coap_uint(ex.json? COAP_FORMAT_JSON : COAP_FORMAT_TEXT);
+        mg_coap_add_option(&cm, COAP_OPT_CONTENT_FORMAT, &contentFormat[0], contentFormat.size());
+    }
+    if(blockwise)
+    {
+        size_t offset = std::min(ex.block2Num * blockSize, body.size());
+        payload += offset;
+        payloadLen = std::min(blockSize, body.size() - offset);
+        bool more = offset + payloadLen < body.size();
+        block2 = coap_uint(coap_block(ex.block2Num, more, ex.szx));
+        mg_coap_add_option(&cm, COAP_OPT_BLOCK2, &block2[0], block2.size());
+    }
+    if(ex.hasBlock1)
+    {
+        block1 = coap_uint(ex.block1);
+        mg_coap_add_option(&cm, COAP_OPT_BLOCK1, &block1[0], block1.size());
+    }
+    if(blockwise && ex.block2Num == 0)
+    {
+        size2 = coap_uint(body.size());
+        mg_coap_add_option(&cm, COAP_OPT_SIZE2, &size2[0], size2.size());
+    }
+    cm.payload.p = payload;
+    cm.payload.len = payloadLen;
+
+    uint32_t res = mg_coap_send_message(m_client, &cm);
+    mg_coap_free_options(&cm);
+    if(res != 0)
+    {
+        LOG_PRINT_CLN(1,m_client,"Cannot compose CoAP message, error flags " << res);
+    }
+}
+
+void CoapClientConnection::onAck(const mg_coap_message& cm)
+{
+    auto it = std::find_if(m_exchanges.begin(), m_exchanges.end(), [&cm](const Exchange& ex)
+    {
+        return ex.resendTime != 0 && ex.respMsgId == cm.msg_id;
+    });
+    if(it == m_exchanges.end()) return;
+    if(cm.msg_type == MG_COAP_MSG_RST)
+    {
+        LOG_PRINT_CLN(2,m_client,"CoAP response " << cm.msg_id << " is rejected");
+    }
+    it->resendTime = 0;
+    schedule();
+}
+
+void CoapClientConnection::onTimer()
+{
+    double now = mg_time();
+    for(Exchange& ex : m_exchanges)
+    {
+        if(ex.ct && ex.confirmable && !ex.acked && ex.time + COAP_PIGGYBACK_TIMEOUT <= now)
+        {//the peer should not retransmit the request while it is processed
+            mg_coap_send_ack(m_client, ex.msgId);
+            ex.acked = true;
         }
-        break;
+        if(ex.resendTime != 0 && ex.resendTime <= now)
+        {
+            if(COAP_MAX_RETRANSMIT <= ex.retransmits)
+            {
+                LOG_PRINT_CLN(1,m_client,"CoAP response " << ex.respMsgId << " is not acknowledged");
+                ex.resendTime = 0;
+                continue;
+            }
+            ++ex.retransmits;
+            ex.resendTime = now + COAP_ACK_TIMEOUT * (1 << ex.retransmits);
+            send(ex);
+        }
+    }
+
+    trim(now);
+    if(m_exchanges.empty() && m_block1.empty())
+    {
+        LOG_PRINT_CLN(2,m_client,"CoAP peer is idle; closing connection");
+        m_client->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+    schedule();
+}
+
+void CoapClientConnection::trim(double now)
+{
+    size_t excess = (COAP_MAX_EXCHANGES < m_exchanges.size())? m_exchanges.size() - COAP_MAX_EXCHANGES : 0;
+    for(auto it = m_exchanges.begin(); it != m_exchanges.end();)
+    {
+        bool done = it->ready && it->resendTime == 0;
+        if(done && (0 < excess || it->time + COAP_EXCHANGE_LIFETIME <= now))
+        {
+            it = m_exchanges.erase(it);
+            if(0 < excess) --excess;
+        }
+        else ++it;
+    }
+    for(auto it = m_block1.begin(); it != m_block1.end();)
+    {
+        if(it->second.time + COAP_EXCHANGE_LIFETIME <= now) it = m_block1.erase(it);
+        else ++it;
+    }
+}
+
+void CoapClientConnection::schedule()
+{
+    double next = 0;
+    auto earliest = [&next](double time){ if(next == 0 || time < next) next = time; };
+    for(const Exchange& ex : m_exchanges)
+    {
+        if(ex.ct && ex.confirmable && !ex.acked) earliest(ex.time + COAP_PIGGYBACK_TIMEOUT);
+        if(ex.resendTime != 0) earliest(ex.resendTime);
+        if(ex.ready && ex.resendTime == 0) earliest(ex.time + COAP_EXCHANGE_LIFETIME);
+    }
+    for(const auto& it : m_block1)
+    {
+        earliest(it.second.time + COAP_EXCHANGE_LIFETIME);
     }
+    if(next == 0) next = mg_time() + COAP_EXCHANGE_LIFETIME;
+    mg_set_timer(m_client, next);
+}
+
+void CoapClientConnection::ev_handler(mg_connection* client, int ev, void *ev_data)
+{
+    assert(client == m_client);
+    switch (ev)
+    {
+    case MG_EV_COAP_CON:
+    case MG_EV_COAP_NOC:
+    {
+        mg_coap_message* cm = static_cast<mg_coap_message*>(ev_data);
+        if(cm->code_class == MG_COAP_CODECLASS_REQUEST && cm->code_detail != 0)
+        {
+            onRequest(*cm);
+        }
+        else if(ev == MG_EV_COAP_CON && cm->code_class == 0 && cm->code_detail == 0)
+        {//CoAP ping
+            mg_coap_message rst;
+            memset(&rst, 0, sizeof(rst));
+            rst.msg_type = MG_COAP_MSG_RST;
+            rst.msg_id = cm->msg_id;
+            mg_coap_send_message(client, &rst);
+        }
+    } break;
     case MG_EV_COAP_ACK:
     case MG_EV_COAP_RST:
+        onAck(*static_cast<mg_coap_message*>(ev_data));
+        break;
+    case MG_EV_TIMER:
+        onTimer();
         break;
+    case MG_EV_CLOSE:
+    {
+        mg_set_timer(client, 0);
+        //the tasks still waiting for responses continue without the peer
+        for(Exchange& ex : m_exchanges)
+        {
+            if(ex.ct) ex.ct->m_client = nullptr;
+        }
+        client->handler = static_empty_ev_handler;
+        client->user_data = nullptr;
+        delete this;
+    } break;
     default:
         break;
     }
 }
 
-void ConnectionManager::respond(ClientTask* ct, const std::string& s)
+int ConnectionManager::responseCode(ClientTask* ct)
 {
-    if(ct->m_client == nullptr)
-    {//it is possible that a client has closed connection already
-        if(ct->getLastStatus() != Status::Again)
-            ct->getManager().onClientDone(ct->getSelf());
-        return;
-    }
-
     int code = 0;
-    auto& ctx = ct->getCtx();
     auto& rsi = ct->getManager().runtimeSysInfo();
 
-    switch(ctx.local.getLastStatus())
+    switch(ct->getLastStatus())
     {
         case Status::Again:
         case Status::Ok:              { code = 200; rsi.count_http_resp_status_ok(); }    break;
         case Status::InternalError:
         case Status::Error:           { code = 500; rsi.count_http_resp_status_error(); } break;
-        case Status::Busy:            { code = 503; rsi.count_http_resp_status_busy(); }  break;
+        case Status::Busy:
+        case Status::CircuitOpen:     { code = 503; rsi.count_http_resp_status_busy(); }  break;
         case Status::Drop:            { code = 400; rsi.count_http_resp_status_drop(); }  break;
         default:                      assert(false);                                      break;
     }
+    return code;
+}
+
+void ConnectionManager::respond(ClientTask* ct, const std::string& s)
+{
+    if(ct->m_client == nullptr)
+    {//it is possible that a client has closed connection already
+        if(ct->getLastStatus() != Status::Again)
+            ct->getManager().onClientDone(ct->getSelf());
+        return;
+    }
+
+    int code = responseCode(ct);
+    auto& rsi = ct->getManager().runtimeSysInfo();
 
     auto& client = ct->m_client;
     LOG_PRINT_CLN(2, client, "Reply to client: " << s);
-    if(Status::Ok == ctx.local.getLastStatus())
+    if(Status::Ok == ct->getLastStatus())
     {
         mg_send_head(client, code, s.size(), "Content-Type: application/json\r\nConnection: close");
         mg_send(client, s.c_str(), s.size());
@@ -673,5 +1551,33 @@ void ConnectionManager::respond(ClientTask* ct, const std::string& s)
     client = nullptr;
 }
 
+void HttpConnectionManager::respond(ClientTask* ct, const std::string& s)
+{
+    if(ct->m_client == nullptr)
+    {//it is possible that a client has closed connection already
+        if(ct->getLastStatus() != Status::Again)
+            ct->getManager().onClientDone(ct->getSelf());
+        return;
+    }
+
+    int code = responseCode(ct);
+    auto& rsi = ct->getManager().runtimeSysInfo();
+
+    auto& client = ct->m_client;
+    LOG_PRINT_CLN(2, client, "Reply to client: " << s);
+    bool ok = Status::Ok == ct->getLastStatus();
+    if(ok)
+    {
+        rsi.count_http_resp_bytes_raw(s.size());
+    }
+    //the response is sent as soon as the responses to the previous pipelined requests have been sent
+    HttpClientConnection::from(client)->setResponse(ct, code, s, !ok);
+
+    LOG_PRINT_CLN(2, client, "Client request finished with result " << ct->getStrStatus());
+    if(ct->getLastStatus() != Status::Again)
+        ct->getManager().onClientDone(ct->getSelf());
+    client = nullptr;
+}
+
 }//namespace graft
 
@@ -5,5 +5,19 @@
 
 namespace graft {
 
+uint32_t Context::Local::registerSlot(const char* name, const std::type_info& type)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::pair<uint32_t, const std::type_info*>> slots;
+
+    std::lock_guard<std::mutex> lk(mutex);
+    auto res = slots.emplace(name, std::make_pair(uint32_t(slots.size()), &type));
+    if(*res.first->second.second != type)
+    {
+        throw std::logic_error(std::string("the local context slot '") + name + "' is registered with another type");
+    }
+    return res.first->second.first;
+}
+
 }
 
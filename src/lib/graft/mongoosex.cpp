@@ -72,4 +72,48 @@ mg_connection *mg_connect_http_x(mg_connection *nc,
                                  post_data);
 }
 
+mg_connection *mg_bind_reuseport(mg_mgr *mgr, const char *address, MG_CB(mg_event_handler_t event_handler, void *user_data))
+{
+    mg_str host = MG_NULL_STR;
+    unsigned int port = 0;
+    if (mg_parse_uri(mg_mk_str(address), NULL, NULL, &host, &port, NULL, NULL, NULL) < 0) return NULL;
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (host.len == 0)
+    {
+        sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    }
+    else
+    {
+        std::string s_host(host.p, host.len);
+        if (inet_pton(AF_INET, s_host.c_str(), &sa.sin_addr) != 1) return NULL;
+    }
+
+    sock_t sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET) return NULL;
+
+    int on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *) &on, sizeof(on)) != 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char *) &on, sizeof(on)) != 0 ||
+        bind(sock, (const sockaddr *) &sa, sizeof(sa)) != 0 ||
+        listen(sock, SOMAXCONN) != 0)
+    {
+        closesocket(sock);
+        return NULL;
+    }
+
+    mg_connection *nc = mg_add_sock(mgr, sock, MG_CB(event_handler, user_data));
+    if (nc == NULL)
+    {
+        closesocket(sock);
+        return NULL;
+    }
+    nc->sa.sin = sa;
+    nc->flags |= MG_F_LISTENING;
+    return nc;
+}
+
 } //namespace mg
@@ -1,4 +1,5 @@
 #include "lib/graft/requesttools.h"
+#include "lib/graft/uuid_generator.h"
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/uuid/uuid.hpp>
@@ -8,8 +9,7 @@ namespace graft {
 
 std::string generatePaymentID()
 {
-    boost::uuids::random_generator gen;
-    boost::uuids::uuid id = gen();
+    boost::uuids::uuid id = generateUuid();
     return boost::uuids::to_string(id);
 }
 
@@ -1,9 +1,20 @@
 
 #include "lib/graft/router.h"
 
+#include <mutex>
+
 namespace graft
 {
 
+uint32_t detail::registerConcurrencyGroup(const std::string& group)
+{
+    static std::mutex mutex;
+    static std::map<std::string, uint32_t> groups;
+
+    std::lock_guard<std::mutex> lk(mutex);
+    return groups.emplace(group, uint32_t(groups.size())).first->second;
+}
+
 template<typename In, typename Out>
 bool RouterT<In,Out>::Root::arm()
 {
@@ -18,6 +18,16 @@ Counter::Counter(void)
 , m_upstrm_http_resp_err_cnt(0)
 , m_upstrm_http_req_bytes_raw_cnt(0)
 , m_upstrm_http_resp_bytes_raw_cnt(0)
+, m_upstrm_breaker_open_cnt(0)
+, m_upstrm_fast_fail_cnt(0)
+, m_upstrm_hedged_cnt(0)
+, m_fwd_cache_hit_cnt(0)
+, m_fwd_cache_miss_cnt(0)
+, m_fwd_cache_coalesced_cnt(0)
+, m_tsk_heap_alloc_cnt(0)
+, m_tsk_recycled_cnt(0)
+, m_io_notify_cnt(0)
+, m_io_wakeup_cnt(0)
 , m_system_start_time(std::chrono::system_clock::now())
 {
 }
@@ -26,5 +36,34 @@ Counter::~Counter(void)
 {
 }
 
+Counter::UpstreamPoolGauges& Counter::upstream_pool(const std::string& name)
+{
+    std::lock_guard<std::mutex> lk(m_upstream_pools_mutex);
+    return m_upstream_pools[name];
+}
+
+void Counter::upstream_pools(const std::function<void(const std::string& name, const UpstreamPoolGauges& gauges)>& f) const
+{
+    std::lock_guard<std::mutex> lk(m_upstream_pools_mutex);
+    for(auto& pair : m_upstream_pools)
+    {
+        f(pair.first, pair.second);
+    }
 }
 
+Counter::RouteLimitGauges& Counter::route_limit(const std::string& name)
+{
+    std::lock_guard<std::mutex> lk(m_route_limits_mutex);
+    return m_route_limits[name];
+}
+
+void Counter::route_limits(const std::function<void(const std::string& name, const RouteLimitGauges& gauges)>& f) const
+{
+    std::lock_guard<std::mutex> lk(m_route_limits_mutex);
+    for(auto& pair : m_route_limits)
+    {
+        f(pair.first, pair.second);
+    }
+}
+
+}
@@ -43,10 +43,47 @@ Status handler(const Vars& vars, const Input& input, Ctx& ctx, Output& output)
     ri.upstrm_http_req_bytes_raw  = rsi.upstrm_http_req_bytes_raw_cnt();
     ri.upstrm_http_resp_bytes_raw = rsi.upstrm_http_resp_bytes_raw_cnt();
 
+    ri.upstrm_breaker_open = rsi.upstrm_breaker_open_cnt();
+    ri.upstrm_fast_fail    = rsi.upstrm_fast_fail_cnt();
+    ri.upstrm_hedged       = rsi.upstrm_hedged_cnt();
+
+    ri.fwd_cache_hit       = rsi.fwd_cache_hit_cnt();
+    ri.fwd_cache_miss      = rsi.fwd_cache_miss_cnt();
+    ri.fwd_cache_coalesced = rsi.fwd_cache_coalesced_cnt();
+
+    ri.tsk_heap_alloc      = rsi.tsk_heap_alloc_cnt();
+    ri.tsk_recycled        = rsi.tsk_recycled_cnt();
+
+    ri.io_notify           = rsi.io_notify_cnt();
+    ri.io_wakeup           = rsi.io_wakeup_cnt();
+
+    rsi.upstream_pools([&ri](const std::string& name, const Counter::UpstreamPoolGauges& gauges)
+    {
+        UpstreamPool pool;
+        pool.name = name;
+        pool.active = gauges.active;
+        pool.idle = gauges.idle;
+        pool.queued = gauges.queued;
+        pool.pipelined = gauges.pipelined;
+        ri.upstream_pools.emplace_back(std::move(pool));
+    });
+
+    rsi.route_limits([&ri](const std::string& name, const Counter::RouteLimitGauges& gauges)
+    {
+        RouteLimit rl;
+        rl.name = name;
+        rl.limit = gauges.limit;
+        rl.active = gauges.active;
+        rl.queued = gauges.queued;
+        rl.rejected = gauges.rejected;
+        ri.route_limits.emplace_back(std::move(rl));
+    });
+
     ri.uptime_sec = rsi.system_uptime_sec();
 
     auto& cfg = out.configuration;
-    const ConfigOpts& co = ctx.handlerAPI()->configOpts();
+    std::shared_ptr<const ConfigOpts> snapshot = ctx.handlerAPI()->configOpts();
+    const ConfigOpts& co = *snapshot;
 
     cfg.config_filename = co.config_filename;
     cfg.http_address = co.http_address;
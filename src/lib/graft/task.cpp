@@ -5,59 +5,26 @@
 #include "lib/graft/state_machine.h"
 #include "lib/graft/handler_api.h"
 #include "lib/graft/expiring_list.h"
+#include "lib/graft/circuit_breaker.h"
 #include "lib/graft/sys_info.h"
 #include "lib/graft/common/utils.h"
 
 #include <boost/uuid/uuid_io.hpp>
+#include <list>
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "supernode.task"
 
 namespace graft {
 
-thread_local bool TaskManager::io_thread = false;
+thread_local TaskManager* TaskManager::io_thread = nullptr;
 
-void StateMachine::process(BaseTaskPtr bt)
+void StateMachine::process(const BaseTaskPtr& bt)
 {
-    static const char *state_strs[] = { GRAFT_STATE_LIST(EXP_TO_STR) };
-
-    St cur_stat = status(bt);
-
-    for(auto& r : m_table)
-    {
-        if(m_state != std::get<smStateStart>(r)) continue;
-
-        Statuses& ss = std::get<smStatuses>(r);
-        if(ss.size()!=0)
-        {
-            bool res = false;
-            for(auto s : ss)
-            {
-                if(s == cur_stat)
-                {
-                    res = true;
-                    break;
-                }
-            }
-            if(!res) continue;
-        }
-
-        Guard& g = std::get<smGuard>(r);
-        if(g && !g(bt)) continue;
-
-        Action& a = std::get<smAction>(r);
-        if(a) a(bt);
-
-        State prev_state = m_state;
-        m_state = std::get<smStateEnd>(r);
-
-        mlog_current_log_category = "sm";
-        LOG_PRINT_RQS_BT(3,bt, "sm: " << state_strs[int(prev_state)] << "->" << state_strs[int(m_state)] );
-        mlog_current_log_category.clear();
-
-        return;
-    }
+    const Table::Transition* t = m_table.find(m_state, status(bt), bt);
+    if(!t)
     {
+        static const char *state_strs[] = { GRAFT_STATE_LIST(EXP_TO_STR) };
         bool is_periodic = (dynamic_cast<PeriodicTask*>(bt.get()) != nullptr);
         std::ostringstream oss;
         oss << (is_periodic? "periodic;" : "") << " state " << state_strs[int(m_state)] << " status " << bt->getStrStatus();
@@ -65,11 +32,27 @@ void StateMachine::process(BaseTaskPtr bt)
         oss << "{" << !!h3.pre_action << "," << !!h3.worker_action << "," << !!h3.post_action << "}";
         throw std::runtime_error("State machine table is not complete." + oss.str());
     }
+
+    if(t->action) t->action(bt);
+
+    State prev_state = m_state;
+    m_state = t->end;
+
+    if(m_trace) m_trace(bt, prev_state, m_state);
+}
+
+void StateMachine::logTrace(const BaseTaskPtr& bt, State from, State to)
+{
+    static const char *state_strs[] = { GRAFT_STATE_LIST(EXP_TO_STR) };
+
+    mlog_current_log_category = "sm";
+    LOG_PRINT_RQS_BT(3,bt, "sm: " << state_strs[int(from)] << "->" << state_strs[int(to)] );
+    mlog_current_log_category.clear();
 }
 
 const StateMachine::Guard StateMachine::has(Router::Handler H3::* act)
 {
-    return [act](BaseTaskPtr bt)->bool
+    return [act](const BaseTaskPtr& bt)->bool
     {
         return (bt->getHandler3().*act != nullptr);
     };
@@ -77,75 +60,76 @@ const StateMachine::Guard StateMachine::has(Router::Handler H3::* act)
 
 const StateMachine::Guard StateMachine::hasnt(Router::Handler H3::* act)
 {
-    return [act](BaseTaskPtr bt)->bool
+    return [act](const BaseTaskPtr& bt)->bool
     {
         return (bt->getHandler3().*act == nullptr);
     };
 }
 
-void StateMachine::init_table()
+std::vector<StateMachine::Table::Row> StateMachine::rows()
 {
 
-    const Action run_forward = [](BaseTaskPtr bt)
+    const Action run_forward = [](const BaseTaskPtr& bt)
     {
         bt->getManager().processForward(bt);
     };
 
-    const Action run_response = [](BaseTaskPtr bt)
+    const Action run_response = [](const BaseTaskPtr& bt)
     {
         assert(St::Again == bt->getLastStatus());
         bt->getManager().respondAndDie(bt, bt->getOutput().data(), false);
     };
 
-    const Action run_error_response = [](BaseTaskPtr bt)
+    const Action run_error_response = [](const BaseTaskPtr& bt)
     {
         assert(St::Error == bt->getLastStatus() ||
                St::InternalError == bt->getLastStatus() ||
+               St::CircuitOpen == bt->getLastStatus() ||
                St::Stop == bt->getLastStatus());
         bt->getManager().respondAndDie(bt, bt->getOutput().data());
     };
 
-    const Action run_drop = [](BaseTaskPtr bt)
+    const Action run_drop = [](const BaseTaskPtr& bt)
     {
         assert(St::Drop == bt->getLastStatus());
         bt->getManager().respondAndDie(bt, "Job done Drop."); //TODO: Expect HTTP Error Response
     };
 
-    const Action run_ok_response = [](BaseTaskPtr bt)
+    const Action run_ok_response = [](const BaseTaskPtr& bt)
     {
         assert(St::Ok == bt->getLastStatus());
         bt->getManager().processOk(bt);
     };
 
-    const Action run_postpone = [](BaseTaskPtr bt)
+    const Action run_postpone = [](const BaseTaskPtr& bt)
     {
         assert(St::Postpone == bt->getLastStatus());
         bt->getManager().postponeTask(bt);
     };
 
-    const Action check_overflow = [](BaseTaskPtr bt)
+    const Action check_overflow = [](const BaseTaskPtr& bt)
     {
         bt->getManager().checkThreadPoolOverflow(bt);
     };
 
-    const Action run_preaction = [](BaseTaskPtr bt)
+    const Action run_preaction = [](const BaseTaskPtr& bt)
     {
         bt->getManager().runPreAction(bt);
     };
 
-    const Action run_workeraction = [](BaseTaskPtr bt)
+    const Action run_workeraction = [](const BaseTaskPtr& bt)
     {
         bt->getManager().runWorkerAction(bt);
     };
 
-    const Action run_postaction = [](BaseTaskPtr bt)
+    const Action run_postaction = [](const BaseTaskPtr& bt)
     {
         bt->getManager().runPostAction(bt);
     };
 
 #define ANY { }
 
-    m_table = std::vector<row>(
+    return std::vector<Table::Row>(
     {
 //      Start                   Status          Target              Guard               Action
         {EXECUTE,               ANY,            PRE_ACTION,         nullptr,            check_overflow },
@@ -155,7 +139,7 @@ void StateMachine::init_table()
         {CHK_PRE_ACTION,        {St::Again},    PRE_ACTION,         nullptr,            run_response },
         {CHK_PRE_ACTION,        {St::Ok},       WORKER_ACTION,      has(&H3::pre_action), nullptr },
         {CHK_PRE_ACTION,        {St::Forward},  POST_ACTION,        has(&H3::pre_action), nullptr },
-        {CHK_PRE_ACTION,        {St::Error, St::InternalError, St::Stop},
+        {CHK_PRE_ACTION,        {St::Error, St::InternalError, St::CircuitOpen, St::Stop},
                                                 EXIT,               has(&H3::pre_action), run_error_response },
         {CHK_PRE_ACTION,        {St::Drop},     EXIT,               has(&H3::pre_action), run_drop },
         {CHK_PRE_ACTION,        {St::None, St::Ok, St::Forward, St::Postpone},
@@ -170,7 +154,7 @@ void StateMachine::init_table()
         {CHK_POST_ACTION,       {St::Again},    POST_ACTION,        nullptr,            run_response },
         {CHK_POST_ACTION,       {St::Forward},  EXIT,               nullptr,            run_forward },
         {CHK_POST_ACTION,       {St::Ok},       EXIT,               nullptr,            run_ok_response },
-        {CHK_POST_ACTION,       {St::Error, St::InternalError, St::Stop},
+        {CHK_POST_ACTION,       {St::Error, St::InternalError, St::CircuitOpen, St::Stop},
                                                 EXIT,               nullptr,            run_error_response },
         {CHK_POST_ACTION,       {St::Drop},     EXIT,               nullptr,            run_drop },
         {CHK_POST_ACTION,       {St::Postpone}, EXIT,               nullptr,            run_postpone },
@@ -195,14 +179,25 @@ public:
     ~Uuid_Input() = default;
     bool operator == (const Uuid_Input& ui) const { return first == ui.first; }
 
+    const Context::uuid_t& getUuid() const { return first; }
+
     std::shared_ptr<Input>& getInputPtr() { return second; }
 };
 
-class ExpiringList : public detail::ExpiringListT< Uuid_Input >
+struct Uuid_InputKey
+{
+    const Context::uuid_t& operator()(const Uuid_Input& ui) const { return ui.getUuid(); }
+};
+
+class ExpiringList : public detail::IndexedExpiringListT< Uuid_Input, Context::uuid_t, Uuid_InputKey, UuidHash >
 {
 public:
+    //the answers that came before their tasks are postponed are kept for a connection timeout;
+    //under a flood the oldest of them are evicted
+    static constexpr size_t capacity = 1 << 16;
+
     ExpiringList(int life_time_ms)
-        : detail::ExpiringListT< Uuid_Input >( life_time_ms )
+        : detail::IndexedExpiringListT< Uuid_Input, Context::uuid_t, Uuid_InputKey, UuidHash >( life_time_ms, capacity )
     { }
 };
 
@@ -223,7 +218,7 @@ public:
 
     void send(BaseTaskPtr bt)
     {
-        ConnItem* connItem = &m_default;
+        ConnItem* connItem = m_default.get();
         {//find connItem
             const std::string& uri = bt->getOutput().uri;
             if(!uri.empty() && uri[0] == '$')
@@ -235,16 +230,18 @@ public:
                     oss << "cannot find uri substitution '" << uri << "'";
                     throw std::runtime_error(oss.str());
                 }
-                connItem = &it->second;
+                connItem = it->second.get();
+            }
+            else if(!uri.empty())
+            {//explicit uri, the connections of the cryptonode cannot be used
+                connItem = &m_direct;
             }
         }
-        if(connItem->m_maxConnections != 0 && connItem->m_idleConnections.empty() && connItem->m_connCnt == connItem->m_maxConnections)
+        if(!dispatch(connItem, bt))
         {
             connItem->m_taskQueue.push_back(bt);
-            return;
         }
-
-        createUpstreamSender(connItem, bt);
+        connItem->updateGauges();
     }
 private:
     uint64_t m_cntUpstreamSender = 0;
@@ -255,19 +252,47 @@ private:
     public:
         using Active = bool;
         using ConnectionId = uint64_t;
+        using Gauges = request::system_info::Counter::UpstreamPoolGauges;
 
         ConnItem() = default;
-        ConnItem(int uriId, const std::string& uri, int maxConnections, bool keepAlive, double timeout)
+        ConnItem(int uriId, const std::string& uri, int maxConnections, bool keepAlive, double timeout, int pipelineDepth = 1)
             : m_uriId(uriId)
             , m_uri(uri)
             , m_maxConnections(maxConnections)
             , m_keepAlive(keepAlive)
             , m_timeout(timeout)
+            , m_pipelineDepth(keepAlive? pipelineDepth : 1)
+        {
+        }
+
+        //the options other than the timeout cannot be changed while the connections are in use
+        bool sameOptions(const std::string& uri, int maxConnections, bool keepAlive, int pipelineDepth) const
         {
+            return m_uri == uri && m_maxConnections == maxConnections && m_keepAlive == keepAlive
+                    && m_pipelineDepth == size_t(keepAlive? pipelineDepth : 1);
         }
+
+        //true if a request is in flight or waits in the queue
+        bool inUse() const
+        {
+            return m_connCnt != int(m_idleConnections.size()) || m_pipelinedCnt != 0 || !m_taskQueue.empty();
+        }
+
+        void closeIdle()
+        {//the connection is erased by onCloseIdle
+            while(!m_idleConnections.empty())
+            {
+                m_upstreamStub.close(m_idleConnections.begin()->first);
+            }
+        }
+
+        bool canConnect() const
+        {
+            return m_maxConnections == 0 || !m_idleConnections.empty() || m_connCnt < m_maxConnections;
+        }
+
         std::pair<ConnectionId, mg_connection*> getConnection()
         {
-            //TODO: something wrong with (m_connCnt <= m_maxConnections)
             assert(m_maxConnections == 0 || m_connCnt <= m_maxConnections);
             std::pair<ConnectionId, mg_connection*> res = std::make_pair(0,nullptr);
             if(!m_keepAlive)
@@ -292,23 +317,83 @@ private:
             return res;
         }
 
-        void releaseActive(ConnectionId connectionId, mg_connection* client)
+        //the connection is known when the request is sent over it
+        void setActive(ConnectionId connectionId, mg_connection* client)
         {
-            assert(m_keepAlive || ((connectionId == 0) && (client == nullptr)));
             if(!m_keepAlive) return;
             auto it = m_activeConnections.find(connectionId);
             assert(it != m_activeConnections.end());
+            it->second = client;
+        }
+
+        //returns the active connection with the least pipelined requests that can take one more
+        std::pair<ConnectionId, mg_connection*> getPipelineConnection() const
+        {
+            std::pair<ConnectionId, mg_connection*> res = std::make_pair(0,nullptr);
+            if(m_pipelineDepth <= 1) return res;
+            size_t min = m_pipelineDepth - 1;
+            for(auto& pair : m_activeConnections)
+            {
+                if(pair.second == nullptr) continue;
+                auto it = m_pipelines.find(pair.first);
+                size_t cnt = (it == m_pipelines.end())? 0 : it->second.size();
+                if(cnt < min)
+                {
+                    min = cnt;
+                    res = pair;
+                }
+            }
+            return res;
+        }
+
+        void addPipelined(ConnectionId connectionId, const UpstreamSender::Ptr& uss)
+        {
+            m_pipelines[connectionId].push_back(uss);
+            ++m_pipelinedCnt;
+        }
+
+        //returns the pipelined requests that cannot be completed because the connection is lost
+        std::deque<UpstreamSender::Ptr> releaseActive(ConnectionId connectionId, mg_connection* client)
+        {
+            std::deque<UpstreamSender::Ptr> orphans;
+            assert(m_keepAlive || ((connectionId == 0) && (client == nullptr)));
+            if(!m_keepAlive)
+            {
+                --m_connCnt;
+                return orphans;
+            }
+            //a pipelined request has been aborted
+            if(connectionId == 0) return orphans;
+            auto it = m_activeConnections.find(connectionId);
+            assert(it != m_activeConnections.end());
             assert(it->second == nullptr || client == nullptr || it->second == client);
+            auto pit = m_pipelines.find(connectionId);
             if(client != nullptr)
             {
+                if(pit != m_pipelines.end())
+                {//the connection is passed to the next pipelined request
+                    UpstreamSender::Ptr next = pit->second.front();
+                    pit->second.pop_front();
+                    if(pit->second.empty()) m_pipelines.erase(pit);
+                    --m_pipelinedCnt;
+                    next->attach(connectionId);
+                    return orphans;
+                }
                 m_idleConnections.emplace(client, it->first);
                 m_upstreamStub.setConnection(client);
             }
             else
             {
                 --m_connCnt;
+                if(pit != m_pipelines.end())
+                {
+                    orphans.swap(pit->second);
+                    m_pipelines.erase(pit);
+                    m_pipelinedCnt -= orphans.size();
+                }
             }
             m_activeConnections.erase(it);
+            return orphans;
         }
 
         void onCloseIdle(mg_connection* client)
@@ -318,6 +403,17 @@ private:
             assert(it != m_idleConnections.end());
             --m_connCnt;
             m_idleConnections.erase(it);
+            updateGauges();
+        }
+
+        void updateGauges()
+        {
+            if(!m_gauges) return;
+            size_t active = m_keepAlive? m_activeConnections.size() : m_connCnt;
+            update(m_gauges->active, m_reported.active, active);
+            update(m_gauges->idle, m_reported.idle, m_idleConnections.size());
+            update(m_gauges->queued, m_reported.queued, m_taskQueue.size());
+            update(m_gauges->pipelined, m_reported.pipelined, m_pipelinedCnt);
         }
 
         ConnectionId m_newId = 0;
@@ -329,86 +425,315 @@ private:
         int m_maxConnections;
         std::deque<BaseTaskPtr> m_taskQueue;
         bool m_keepAlive = false;
+        size_t m_pipelineDepth = 1;
+        size_t m_pipelinedCnt = 0;
         std::map<mg_connection*, ConnectionId> m_idleConnections;
         std::map<ConnectionId, mg_connection*> m_activeConnections;
+        std::map<ConnectionId, std::deque<UpstreamSender::Ptr>> m_pipelines;
         UpstreamStub m_upstreamStub;
+        //the breaker and the latencies are of this I/O thread only
+        detail::CircuitBreaker m_breaker;
+        //the item is replaced by reconfigure(), it completes the requests and closes the connections
+        bool m_retired = false;
+        //the gauges are shared by the I/O threads, the values of this item are added to them
+        Gauges* m_gauges = nullptr;
+        struct { size_t active = 0, idle = 0, queued = 0, pipelined = 0; } m_reported;
+    private:
+        static void update(std::atomic<uint64_t>& gauge, size_t& reported, size_t value)
+        {
+            if(value == reported) return;
+            gauge += value;
+            gauge -= reported;
+            reported = value;
+        }
     };
 
     void onDone(UpstreamSender& uss, ConnItem* connItem, ConnItem::ConnectionId connectionId, mg_connection* client)
     {
         ++m_cntUpstreamSenderDone;
-        m_onDoneCallback(uss);
-        connItem->releaseActive(connectionId, client);
-        if(connItem->m_taskQueue.empty()) return;
-        BaseTaskPtr bt = connItem->m_taskQueue.front(); connItem->m_taskQueue.pop_front();
-        createUpstreamSender(connItem, bt);
+        if(connItem->m_breaker.onResult(Status::Ok == uss.getStatus(), uss.elapsed()))
+        {
+            m_manager.runtimeSysInfo().count_upstrm_breaker_open();
+        }
+        if(!uss.superseded())
+        {
+            m_onDoneCallback(uss);
+        }
+        std::deque<UpstreamSender::Ptr> orphans = connItem->releaseActive(connectionId, client);
+        for(auto& orphan : orphans)
+        {
+            orphan->abort("cryptonode connection closed before the response to a pipelined request");
+        }
+        while(!connItem->m_taskQueue.empty())
+        {
+            BaseTaskPtr bt = connItem->m_taskQueue.front();
+            if(!dispatch(connItem, bt))
+            {
+                break;
+            }
+            connItem->m_taskQueue.pop_front();
+        }
+        if(connItem->m_retired)
+        {
+            connItem->closeIdle();
+        }
+        connItem->updateGauges();
     }
 
     void init()
     {
-        int uriId = 0;
         const ConfigOpts& opts = m_manager.getCopts();
-        m_default = ConnItem(uriId++, opts.cryptonode_rpc_address.c_str(), 0, false, opts.upstream_request_timeout);
+
+        m_default = makeItem("cryptonode", opts.cryptonode_rpc_address, opts.cryptonode_pool_size, 0 < opts.cryptonode_pool_size,
+                             opts.upstream_request_timeout, opts.cryptonode_pipeline_depth);
+        m_direct = ConnItem(m_uriId++, "", 0, false, opts.upstream_request_timeout);
+        //the explicit uris are different upstreams, they are not judged together
+        initItem(&m_direct, "direct", false);
 
         for(auto& subs : OutHttp::uri_substitutions)
         {
             double timeout = std::get<3>(subs.second);
             if(timeout < 1e-5) timeout = opts.upstream_request_timeout;
-            auto res = m_conn2item.emplace(subs.first, ConnItem(uriId, std::get<0>(subs.second), std::get<1>(subs.second), std::get<2>(subs.second), timeout));
+            auto res = m_conn2item.emplace(subs.first, makeItem("$" + subs.first, std::get<0>(subs.second), std::get<1>(subs.second),
+                                                                std::get<2>(subs.second), timeout));
             assert(res.second);
-            ConnItem* connItem = &res.first->second;
-            connItem->m_upstreamStub.setCallback([connItem](mg_connection* client){ connItem->onCloseIdle(client); });
         }
     }
 
-    void createUpstreamSender(ConnItem* connItem, BaseTaskPtr bt)
+public:
+    //applies the options of m_manager changed by a reload,
+    //an item is replaced if its connections cannot be reused, the requests in flight are completed by the old one
+    void reconfigure(const OutHttp::UriSubstitutions& substitutions, bool resetBreakers)
+    {
+        const ConfigOpts& opts = m_manager.getCopts();
+
+        auto update = [&](std::unique_ptr<ConnItem>& connItem, const std::string& name, const std::string& uri,
+                int maxConnections, bool keepAlive, double timeout, int pipelineDepth)
+        {
+            if(!connItem->sameOptions(uri, maxConnections, keepAlive, pipelineDepth))
+            {
+                retire(std::move(connItem));
+                connItem = makeItem(name, uri, maxConnections, keepAlive, timeout, pipelineDepth);
+                return;
+            }
+            connItem->m_timeout = timeout;
+            connItem->m_upstreamStub.setIdleTimeout(opts.upstream_idle_timeout);
+            connItem->m_upstreamStub.setProbeInterval(opts.upstream_probe_interval);
+            if(resetBreakers) initBreaker(connItem.get());
+        };
+
+        update(m_default, "cryptonode", opts.cryptonode_rpc_address, opts.cryptonode_pool_size, 0 < opts.cryptonode_pool_size,
+               opts.upstream_request_timeout, opts.cryptonode_pipeline_depth);
+        m_direct.m_timeout = opts.upstream_request_timeout;
+
+        for(auto it = m_conn2item.begin(); it != m_conn2item.end();)
+        {
+            if(substitutions.count(it->first))
+            {
+                ++it;
+                continue;
+            }
+            retire(std::move(it->second));
+            it = m_conn2item.erase(it);
+        }
+        for(auto& subs : substitutions)
+        {
+            double timeout = std::get<3>(subs.second);
+            if(timeout < 1e-5) timeout = opts.upstream_request_timeout;
+            std::unique_ptr<ConnItem>& connItem = m_conn2item[subs.first];
+            if(!connItem)
+            {
+                connItem = makeItem("$" + subs.first, std::get<0>(subs.second), std::get<1>(subs.second), std::get<2>(subs.second), timeout);
+                continue;
+            }
+            update(connItem, "$" + subs.first, std::get<0>(subs.second), std::get<1>(subs.second), std::get<2>(subs.second), timeout, 1);
+        }
+    }
+
+    //destroys the retired items that have completed their requests
+    void releaseRetired()
+    {
+        m_retired.remove_if([](const std::unique_ptr<ConnItem>& connItem){ return !connItem->inUse(); });
+    }
+
+private:
+    std::unique_ptr<ConnItem> makeItem(const std::string& name, const std::string& uri, int maxConnections, bool keepAlive,
+                                       double timeout, int pipelineDepth = 1)
+    {
+        auto connItem = std::make_unique<ConnItem>(m_uriId++, uri, maxConnections, keepAlive, timeout, pipelineDepth);
+        initItem(connItem.get(), name);
+        return connItem;
+    }
+
+    void initItem(ConnItem* connItem, const std::string& name, bool breaker = true)
     {
-        auto onDoneAct = [this, connItem](UpstreamSender& uss, uint64_t connectionId, mg_connection* client)
+        connItem->m_upstreamStub.setCallback([connItem](mg_connection* client){ connItem->onCloseIdle(client); });
+        connItem->m_upstreamStub.setIdleTimeout(m_manager.getCopts().upstream_idle_timeout);
+        connItem->m_upstreamStub.setProbeInterval(m_manager.getCopts().upstream_probe_interval);
+        connItem->m_gauges = &m_manager.runtimeSysInfo().upstream_pool(name);
+        if(breaker)
+        {
+            initBreaker(connItem);
+        }
+    }
+
+    void initBreaker(ConnItem* connItem)
+    {
+        const CircuitBreakerOpts& cb = m_manager.getCopts().circuit_breaker;
+        connItem->m_breaker = detail::CircuitBreaker(cb.error_rate, std::chrono::milliseconds(cb.slow_ms), cb.window,
+                                                     std::chrono::milliseconds(cb.open_ms));
+    }
+
+    //the queued requests are sent by the retired item, so that they are not reordered
+    void retire(std::unique_ptr<ConnItem> connItem)
+    {
+        connItem->m_retired = true;
+        connItem->closeIdle();
+        connItem->updateGauges();
+        m_retired.push_back(std::move(connItem));
+    }
+
+    UpstreamSender::OnDone makeOnDone(ConnItem* connItem)
+    {
+        return [this, connItem](UpstreamSender& uss, uint64_t connectionId, mg_connection* client)
         {
             onDone(uss, connItem, connectionId, client);
         };
+    }
+
+    //returns false if the request cannot be sent now and should wait in the queue
+    bool dispatch(ConnItem* connItem, BaseTaskPtr bt)
+    {
+        if(!connItem->m_breaker.allow())
+        {
+            reject(bt);
+            return true;
+        }
+        if(connItem->canConnect())
+        {
+            createUpstreamSender(connItem, bt);
+        }
+        else if(!pipeline(connItem, bt))
+        {
+            return false;
+        }
+        connItem->m_breaker.onSend();
+        return true;
+    }
+
+    //fails the request at once while the breaker is open, so that the caller can shed load
+    void reject(BaseTaskPtr bt)
+    {
+        m_manager.runtimeSysInfo().count_upstrm_fast_fail();
+        auto onDone = [this](UpstreamSender& uss, uint64_t, mg_connection*){ m_onDoneCallback(uss); };
+        UpstreamSender::Ptr uss = UpstreamSender::Create(bt, onDone, 0.0);
+        uss->reject("upstream circuit breaker is open");
+    }
+
+    //returns the delay in seconds after which the request is duplicated, 0 if it should not be
+    double hedgeDelay(ConnItem* connItem, BaseTaskPtr& bt)
+    {
+        const CircuitBreakerOpts& cb = m_manager.getCopts().circuit_breaker;
+        if(cb.hedge_percentile <= 0 || connItem == &m_direct) return 0;
+        if(!bt->getOutput().idempotent || bt->getCtx().isCallbackSet()) return 0;
+        auto latency = connItem->m_breaker.percentile(cb.hedge_percentile);
+        if(latency == latency.zero()) return 0;
+        double delay = std::max(std::chrono::duration<double>(latency).count(), cb.hedge_min_ms / 1000.0);
+        return (delay < connItem->m_timeout)? delay : 0;
+    }
+
+    void hedge(ConnItem* connItem, UpstreamSender& primary)
+    {
+        if(!connItem->canConnect() || connItem->m_breaker.state() != detail::CircuitBreaker::State::Closed) return;
+        m_manager.runtimeSysInfo().count_upstrm_hedged();
+        createUpstreamSender(connItem, primary.getTask(), &primary);
+        connItem->updateGauges();
+    }
 
+    //the request of primary is duplicated if it is not null
+    void createUpstreamSender(ConnItem* connItem, BaseTaskPtr bt, UpstreamSender* primary = nullptr)
+    {
         ++m_cntUpstreamSender;
         UpstreamSender::Ptr uss;
+        ConnItem::ConnectionId connectionId = 0;
         if(connItem->m_keepAlive)
         {
             auto res = connItem->getConnection();
-            uss = UpstreamSender::Create(bt, onDoneAct, res.first, res.second, connItem->m_timeout);
+            connectionId = res.first;
+            uss = UpstreamSender::Create(bt, makeOnDone(connItem), res.first, res.second, connItem->m_timeout);
         }
         else
         {
-            uss = UpstreamSender::Create(bt, onDoneAct, connItem->m_timeout);
+            connItem->getConnection();
+            uss = UpstreamSender::Create(bt, makeOnDone(connItem), connItem->m_timeout);
+        }
+        if(primary)
+        {
+            uss->joinHedge(*primary);
+        }
+        else if(double delay = hedgeDelay(connItem, bt))
+        {
+            uss->setHedge(delay, [this, connItem](UpstreamSender& uss){ hedge(connItem, uss); });
         }
 
-        const std::string& uri = (connItem != &m_default || bt->getOutput().uri.empty())? connItem->m_uri : bt->getOutput().uri;
+        const std::string& uri = (connItem == &m_direct)? bt->getOutput().uri : connItem->m_uri;
         uss->send(m_manager, uri);
+        connItem->setActive(connectionId, uss->getUpstream());
+    }
+
+    //sends the request over a busy keep-alive connection if pipelining is enabled
+    bool pipeline(ConnItem* connItem, BaseTaskPtr bt)
+    {
+        auto res = connItem->getPipelineConnection();
+        if(!res.second) return false;
+
+        ++m_cntUpstreamSender;
+        UpstreamSender::Ptr uss = UpstreamSender::Create(bt, makeOnDone(connItem), res.second, connItem->m_timeout);
+        connItem->addPipelined(res.first, uss);
+        uss->send(m_manager, connItem->m_uri);
+        return true;
     }
 
-    using Uri2ConnItem = std::map<std::string, ConnItem>;
+    using Uri2ConnItem = std::map<std::string, std::unique_ptr<ConnItem>>;
 
     OnDoneCallback m_onDoneCallback;
 
-    ConnItem m_default;
+    int m_uriId = 0;
+    std::unique_ptr<ConnItem> m_default;
+    //requests with explicit uri
+    ConnItem m_direct;
     Uri2ConnItem m_conn2item;
+    std::list<std::unique_ptr<ConnItem>> m_retired;
     TaskManager& m_manager; //TODO: should be removed, and be independent of TaskManager
 };
 
-TaskManager::TaskManager(const ConfigOpts& copts, SysInfoCounter& sysInfoCounter)
+TaskManager::TaskManager(const ConfigOpts& copts, SysInfoCounter& sysInfoCounter, TaskManager* primary)
     : m_copts(copts)
+    , m_coptsSnapshot(std::make_shared<const ConfigOpts>(copts))
     , m_sysInfoCounter(sysInfoCounter)
-    , m_gcm(this)
+    , m_gcm(primary? primary->m_gcm : std::make_shared<GlobalContextMap>(static_cast<HandlerAPI*>(this)))
     , m_futurePostponeUuids(std::make_unique<ExpiringList>(1000 * copts.http_connection_timeout))
     , m_stateMachine(std::make_unique<StateMachine>())
 {
     copts.check_asserts();
 
+    setTrace();
+
     // TODO: validate options, throw exception if any mandatory options missing
-    initThreadPool(copts.workers_count, copts.worker_queue_len, copts.workers_expelling_interval_ms);
+    if(primary)
+    {
+        initSharedThreadPool(*primary);
+    }
+    else
+    {
+        initThreadPool(copts.workers_count, copts.worker_queue_len, copts.workers_expelling_interval_ms);
+    }
 }
 
 TaskManager::~TaskManager()
 {
-
+    //the tasks destroyed after the pool are not recycled
+    if(io_thread == this) io_thread = nullptr;
 }
 
 inline size_t TaskManager::next_pow2(size_t val)
@@ -426,7 +751,7 @@ bool TaskManager::addPeriodicTask(const Router::Handler& h_worker,
                                   std::chrono::milliseconds initial_interval_ms,
                                   double random_factor)
 {
-    if(io_thread)
+    if(io_thread == this)
     {//it is called from pre_action or post_action, and we can call requestAddPeriodicTask directly
         addPeriodicTask({nullptr, h_worker, nullptr}, interval_ms, initial_interval_ms, random_factor);
         return true;
@@ -446,9 +771,9 @@ request::system_info::Counter& TaskManager::runtimeSysInfo()
     return m_sysInfoCounter;
 }
 
-const ConfigOpts& TaskManager::configOpts() const
+std::shared_ptr<const ConfigOpts> TaskManager::configOpts() const
 {
-    return m_copts;
+    return std::atomic_load(&m_coptsSnapshot);
 }
 
 void TaskManager::checkPeriodicTaskIO()
@@ -470,11 +795,19 @@ void TaskManager::checkPeriodicTaskIO()
 void TaskManager::sendUpstreamBlocking(Output& output, Input& input, std::string& err)
 {
     if(io_thread) throw std::logic_error("the function sendUpstreamBlocking should not be called in IO thread");
-    std::promise<Input> promise;
-    std::future<Input> future = promise.get_future();
-    std::pair< std::promise<Input>, Output> pair = std::make_pair( std::move(promise), output);
-    m_promiseQueue->push( std::move(pair) );
-    notifyJobReady();
+    auto promise = std::make_shared<std::promise<Input>>();
+    std::future<Input> future = promise->get_future();
+    sendUpstreamAsync(output, [promise](Input& input, const std::string& err)
+    {
+        if(err.empty())
+        {
+            promise->set_value(std::move(input));
+        }
+        else
+        {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error(err)));
+        }
+    });
     err.clear();
     try
     {
@@ -486,17 +819,63 @@ void TaskManager::sendUpstreamBlocking(Output& output, Input& input, std::string
     }
 }
 
+void TaskManager::sendUpstreamAsync(const Output& output, UpstreamCallback callback)
+{
+    assert(callback);
+    if(io_thread == this)
+    {
+        UpstreamTask::Ptr bt = BaseTask::Create<UpstreamTask>(*this, std::make_pair(std::move(callback), output));
+        sendUpstream(bt);
+        return;
+    }
+    if(!m_upstreamQueue->push( std::make_pair(callback, output) ))
+    {
+        Input input;
+        callback(input, "upstream queue overflow");
+        return;
+    }
+    notifyJobReady();
+}
+
 void TaskManager::checkUpstreamBlockingIO()
 {
     while(true)
     {
-        PromiseItem pi;
-        bool res = m_promiseQueue->pop(pi);
+        UpstreamItem item;
+        bool res = m_upstreamQueue->pop(item);
         if(!res) break;
-        UpstreamTask::Ptr bt = BaseTask::Create<UpstreamTask>(*this, std::move(pi));
+        UpstreamTask::Ptr bt = BaseTask::Create<UpstreamTask>(*this, std::move(item));
         assert(m_upstreamManager);
         m_upstreamManager->send(bt);
     }
+    m_upstreamManager->releaseRetired();
+}
+
+void TaskManager::reconfigure(const ConfigOpts& copts, const OutHttp::UriSubstitutions& substitutions)
+{
+    copts.check_asserts();
+    bool resetBreakers = (m_copts.circuit_breaker != copts.circuit_breaker);
+    m_copts = copts;
+    //the workers read the options concurrently, they get the new ones with the next snapshot
+    std::atomic_store(&m_coptsSnapshot, std::make_shared<const ConfigOpts>(copts));
+    //the log levels can be changed by the reload
+    setTrace();
+    assert(m_upstreamManager);
+    m_upstreamManager->reconfigure(substitutions, resetBreakers);
+    for(RouteLimit& rl : m_routeLimits)
+    {
+        if(!rl.concurrency) continue;
+        applyRouteLimit(rl);
+        admitRouteJobs(rl);
+    }
+    dispatchWaitingJobs();
+}
+
+void TaskManager::setTrace()
+{
+    //the transitions are traced only if they are logged, otherwise tracing costs nothing
+    bool trace = ELPP->vRegistry()->allowed(el::Level::Trace, "sm");
+    m_stateMachine->setTrace(trace? StateMachine::Trace(StateMachine::logTrace) : nullptr);
 }
 
 void TaskManager::sendUpstream(BaseTaskPtr bt)
@@ -507,13 +886,28 @@ void TaskManager::sendUpstream(BaseTaskPtr bt)
 
 void TaskManager::onTimer(BaseTaskPtr bt)
 {
-    assert(dynamic_cast<PeriodicTask*>(bt.get()));
+    if(!dynamic_cast<PeriodicTask*>(bt.get()))
+    {//expiry of the postponed task
+        auto it = m_postponedTasks.find(bt->getCtx().getId());
+        if(it == m_postponedTasks.end() || it->second != bt) return;
+        m_postponedTasks.erase(it);
+        LOG_PRINT_RQS_BT(2,bt,"postponed task with uuid '" << bt->getCtx().getId() << "' expired.");
+        std::string msg = "Postpone task response timeout";
+        bt->setError(msg.c_str(), Status::Error);
+        respondAndDie(bt, msg);
+        return;
+    }
     bt->setLastStatus(Status::None);
     Execute(bt);
 }
 
 void TaskManager::respondAndDie(BaseTaskPtr bt, const std::string& s, bool die)
 {
+    if(die && Status::Ok != bt->getLastStatus())
+    {
+        const bool unavailable = (Status::Busy == bt->getLastStatus() || Status::CircuitOpen == bt->getLastStatus());
+        failNextTasks(bt, bt->getCtx().local.getLastError(), unavailable? 503 : 500);
+    }
     ClientTask* ct = dynamic_cast<ClientTask*>(bt.get());
     if(ct)
     {
@@ -529,7 +923,7 @@ void TaskManager::respondAndDie(BaseTaskPtr bt, const std::string& s, bool die)
     {
         auto it = m_postponedTasks.find(uuid);
         if (it != m_postponedTasks.end())
-            m_postponedTasks.erase(it);
+            erasePostponedTask(it);
     }
 
     if(die)
@@ -538,14 +932,16 @@ void TaskManager::respondAndDie(BaseTaskPtr bt, const std::string& s, bool die)
 
 void TaskManager::schedule(PeriodicTask* pt)
 {
-    m_timerList.push(pt->getTimeout(), pt->getSelf());
+    m_timerList.push(pt->getTimer(), pt->getTimeout(), pt->getSelf());
 }
 
 bool TaskManager::canStop()
 {
     return (m_cntBaseTask == m_cntBaseTaskDone)
             && (!m_upstreamManager->busy())
-            && (m_cntJobSent == m_cntJobDone);
+            && (m_cntJobSent == m_cntJobDone)
+            && m_waitingJobs.empty()
+            && std::all_of(m_routeLimits.begin(), m_routeLimits.end(), [](const RouteLimit& rl){ return rl.waiting.empty(); });
 }
 
 bool TaskManager::tryProcessReadyJob()
@@ -555,9 +951,12 @@ bool TaskManager::tryProcessReadyJob()
     if(!res) return res;
     ++m_cntJobDone;
     BaseTaskPtr bt = gj->getTask();
+    --m_inflightJobs[static_cast<size_t>(bt->getParams().h3.priority)];
 
     LOG_PRINT_RQS_BT(2,bt,"worker_action completed with result " << bt->getStrStatus());
+    releaseRouteLimit(bt);
     m_stateMachine->dispatch(bt, StateMachine::State::WORKER_ACTION_DONE);
+    dispatchWaitingJobs();
     return true;
 }
 
@@ -571,12 +970,166 @@ void TaskManager::checkThreadPoolOverflow(BaseTaskPtr bt)
     auto& params = bt->getParams();
 
     assert(m_cntJobDone <= m_cntJobSent);
-    if(params.h3.worker_action && m_cntJobSent - m_cntJobDone == m_threadPoolInputSize)
-    {//check overflow
-        bt->getCtx().local.setError("Service Unavailable", Status::Busy);
-        respondAndDie(bt,"Thread pool overflow");
-    }
     assert(m_cntJobSent - m_cntJobDone <= m_threadPoolInputSize);
+    if(!params.h3.worker_action) return;
+
+    RouteLimit* rl = routeLimit(bt);
+    if(rl && rl->limit && rl->limit <= rl->active && rl->queueLen <= rl->waiting.size())
+    {
+        ++rl->gauges->rejected;
+        shedJob(bt, "Route concurrency limit");
+        return;
+    }
+
+    const uint64_t inflight = m_cntJobSent - m_cntJobDone;
+    if(inflight < m_threadPoolInputSize && m_waitingJobs.empty()) return;
+
+    const size_t lane = static_cast<size_t>(params.h3.priority);
+    //the jobs in the thread pool and the waiting jobs of the same and higher priority are ahead of this one,
+    //each is estimated by the average of its lane
+    uint64_t aheadUs = 0;
+    for(size_t i = 0; i < PriorityCount; ++i)
+    {
+        const uint64_t ahead = m_inflightJobs[i] + (i <= lane? m_waitingJobs.size(i) : 0);
+        aheadUs += ahead * m_avgJobUs[i].load(std::memory_order_relaxed);
+    }
+    const std::chrono::microseconds wait(aheadUs / std::max<size_t>(1, m_threadPool->getWorkersCount()));
+    if(jobDeadline(bt) < wait)
+    {
+        shedJob(bt, "Deadline cannot be met");
+        return;
+    }
+
+    if(m_waitingJobs.size() < m_threadPoolInputSize) return;
+    //the waiting jobs are full, lower priority job is shed in favor of this one
+    WaitingJob victim;
+    if(m_waitingJobs.popLowerThan(lane, victim))
+    {
+        //the lanes are full, the next job of the group of the victim waits for a room in them
+        releaseRouteLimit(victim.bt, false);
+        shedJob(victim.bt, "Thread pool overflow");
+        return;
+    }
+    shedJob(bt, "Thread pool overflow");
+}
+
+std::chrono::milliseconds TaskManager::jobDeadline(const BaseTaskPtr& bt) const
+{
+    std::chrono::milliseconds deadline = bt->getParams().h3.deadline;
+    if(deadline.count()) return deadline;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::duration<double>(m_copts.http_connection_timeout));
+}
+
+void TaskManager::shedJob(BaseTaskPtr bt, const std::string& reason)
+{
+    LOG_PRINT_RQS_BT(1,bt,"job of priority " << int(bt->getParams().h3.priority) << " is shed: " << reason);
+    bt->getCtx().local.setError("Service Unavailable", Status::Busy);
+    respondAndDie(bt, reason);
+}
+
+void TaskManager::dispatchWaitingJobs()
+{
+    assert(m_cntJobDone <= m_cntJobSent);
+    auto now = std::chrono::steady_clock::now();
+    for(;;)
+    {
+        while(!m_waitingJobs.empty() && m_cntJobSent - m_cntJobDone < m_threadPoolInputSize)
+        {
+            WaitingJob job = m_waitingJobs.pop();
+            if(job.deadline < now)
+            {//the client is not waiting anymore
+                releaseRouteLimit(job.bt, false);
+                shedJob(job.bt, "Deadline exceeded");
+                continue;
+            }
+            ++m_cntJobSent;
+            ++m_inflightJobs[static_cast<size_t>(job.bt->getParams().h3.priority)];
+            m_threadPool->post(
+                        GJPtr( job.bt, m_resQueue.get(), this ),
+                        true
+                        );
+        }
+        //the room in the lanes is given to the groups that are below their limits
+        if(!m_routeJobsBlocked || m_threadPoolInputSize <= m_waitingJobs.size()) break;
+        m_routeJobsBlocked = false;
+        const size_t waiting = m_waitingJobs.size();
+        for(RouteLimit& rl : m_routeLimits)
+        {
+            if(rl.concurrency) admitRouteJobs(rl);
+        }
+        if(m_waitingJobs.size() == waiting) break;
+    }
+}
+
+TaskManager::RouteLimit* TaskManager::routeLimit(const BaseTaskPtr& bt)
+{
+    auto& concurrency = bt->getParams().h3.concurrency;
+    if(!concurrency || concurrency->id == Router::Handler3::Concurrency::NoId) return nullptr;
+    //the references to the limits are kept on growth
+    if(m_routeLimits.size() <= concurrency->id) m_routeLimits.resize(concurrency->id + 1);
+    RouteLimit& rl = m_routeLimits[concurrency->id];
+    if(!rl.concurrency)
+    {
+        rl.concurrency = concurrency;
+        rl.gauges = &runtimeSysInfo().route_limit(concurrency->group);
+        applyRouteLimit(rl);
+    }
+    return &rl;
+}
+
+void TaskManager::applyRouteLimit(RouteLimit& rl)
+{
+    size_t limit = rl.concurrency->limit, queueLen = rl.concurrency->queue_len;
+    auto it = m_copts.route_limits.find(rl.concurrency->group);
+    if(it != m_copts.route_limits.end())
+    {
+        limit = it->second.limit;
+        queueLen = it->second.queue_len;
+    }
+    //the gauge is shared by the I/O threads, it shows the configured limit rather than the sum of the shares
+    rl.gauges->limit = limit;
+    const size_t ioThreads = std::max(1, m_copts.io_threads);
+    if(limit) limit = std::max(size_t(1), limit / ioThreads);
+    queueLen /= ioThreads;
+
+    rl.limit = limit;
+    rl.queueLen = queueLen;
+}
+
+void TaskManager::releaseRouteLimit(const BaseTaskPtr& bt, bool admit)
+{
+    RouteLimit* rl = routeLimit(bt);
+    if(!rl) return;
+    assert(rl->active);
+    --rl->active;
+    --rl->gauges->active;
+    if(admit) admitRouteJobs(*rl);
+    else if(!rl->waiting.empty()) m_routeJobsBlocked = true;
+}
+
+void TaskManager::admitRouteJobs(RouteLimit& rl)
+{
+    auto now = std::chrono::steady_clock::now();
+    while(!rl.waiting.empty() && (!rl.limit || rl.active < rl.limit))
+    {
+        if(m_threadPoolInputSize <= m_waitingJobs.size())
+        {
+            m_routeJobsBlocked = true;
+            break;
+        }
+        WaitingJob job = std::move(rl.waiting.front());
+        rl.waiting.pop_front();
+        --rl.gauges->queued;
+        if(job.deadline < now)
+        {
+            shedJob(job.bt, "Deadline exceeded");
+            continue;
+        }
+        ++rl.active;
+        ++rl.gauges->active;
+        const size_t lane = static_cast<size_t>(job.bt->getParams().h3.priority);
+        m_waitingJobs.push(lane, std::move(job));
+    }
 }
 
 void TaskManager::runPreAction(BaseTaskPtr bt)
@@ -597,8 +1150,10 @@ void TaskManager::runPreAction(BaseTaskPtr bt)
         mlog_current_log_category.clear();
 
         bt->setLastStatus(status);
+        //the output becomes the input of the next action only if there is one, it is not copied in vain;
+        //on Forward the next action is post_action, the upstream request is made of the output
         if(Status::Ok == status && (params.h3.worker_action || params.h3.post_action)
-                || Status::Forward == status)
+                || Status::Forward == status && params.h3.post_action)
         {
             params.input.assign(output);
         }
@@ -624,11 +1179,28 @@ void TaskManager::runWorkerAction(BaseTaskPtr bt)
 
     if(params.h3.worker_action)
     {
-        ++m_cntJobSent;
-        m_threadPool->post(
-                    GJPtr( bt, m_resQueue.get(), this ),
-                    true
-                    );
+        WaitingJob job{bt, std::chrono::steady_clock::now() + jobDeadline(bt)};
+        RouteLimit* rl = routeLimit(bt);
+        if(rl)
+        {
+            if(rl->limit && rl->limit <= rl->active)
+            {
+                if(rl->queueLen <= rl->waiting.size())
+                {
+                    ++rl->gauges->rejected;
+                    shedJob(bt, "Route concurrency limit");
+                    return;
+                }
+                rl->waiting.emplace_back(std::move(job));
+                ++rl->gauges->queued;
+                return;
+            }
+            ++rl->active;
+            ++rl->gauges->active;
+        }
+        const size_t lane = static_cast<size_t>(params.h3.priority);
+        m_waitingJobs.push(lane, std::move(job));
+        dispatchWaitingJobs();
     }
 }
 
@@ -645,12 +1217,19 @@ void TaskManager::runWorkerActionFromTheThreadPool(BaseTaskPtr bt)
         // Please read the comment about exceptions and noexcept specifier
         // near 'void terminate()' function in main.cpp
 
+        auto begin = std::chrono::steady_clock::now();
         mlog_current_log_category = params.h3.name;
         Status status = params.h3.worker_action(params.vars, params.input, ctx, output);
         mlog_current_log_category.clear();
+        {//the average is approximate, concurrent updates can be lost
+            uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+            std::atomic<uint64_t>& avgJobUs = m_avgJobUs[static_cast<size_t>(params.h3.priority)];
+            uint64_t avg = avgJobUs.load(std::memory_order_relaxed);
+            avgJobUs.store(avg? (7*avg + us)/8 : us, std::memory_order_relaxed);
+        }
 
         bt->setLastStatus(status);
-        if(Status::Ok == status && params.h3.post_action || Status::Forward == status)
+        if((Status::Ok == status || Status::Forward == status) && params.h3.post_action)
         {
             params.input.assign(output);
         }
@@ -729,19 +1308,58 @@ void TaskManager::postponeTask(BaseTaskPtr bt)
     }
 
     assert(m_postponedTasks.find(uuid) == m_postponedTasks.end());
-    m_postponedTasks[uuid] = bt;
+    m_postponedTasks.emplace(uuid, bt);
     std::chrono::duration<double> timeout(m_copts.http_connection_timeout);
-    std::chrono::steady_clock::time_point tpoint = std::chrono::steady_clock::now()
-            + std::chrono::duration_cast<std::chrono::steady_clock::duration>( timeout );
-    m_expireTaskQueue.push(std::make_pair(
-                                    tpoint,
-                                    uuid)
-                                );
+    m_timerList.push(bt->getTimer(), std::chrono::duration_cast<std::chrono::milliseconds>(timeout), bt);
     LOG_PRINT_RQS_BT(2,bt,"task with uuid '" << uuid << "' postponed.");
 }
 
+void TaskManager::resumeFromPeer(const Context::uuid_t& uuid, const Input& input)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_peerCallbacksMutex);
+        m_peerCallbacks.emplace_back(uuid, input);
+    }
+    notifyJobReady();
+}
+
+void TaskManager::processPeerCallbacks()
+{
+    std::deque<std::pair<Context::uuid_t, Input>> callbacks;
+    {
+        std::lock_guard<std::mutex> lk(m_peerCallbacksMutex);
+        if(m_peerCallbacks.empty()) return;
+        callbacks.swap(m_peerCallbacks);
+    }
+
+    for(auto& item : callbacks)
+    {
+        Context::uuid_t& uuid = item.first;
+        auto it = m_postponedTasks.find(uuid);
+        if(it == m_postponedTasks.end())
+        {//maybe the task will be postponed later
+            m_futurePostponeUuids->add(Uuid_Input(uuid, std::move(item.second)));
+            continue;
+        }
+        LOG_PRINT_L2("resuming task with uuid '" << uuid << "' by callback from another I/O thread.");
+        BaseTaskPtr& bt_next = it->second;
+        bt_next->getInput() = std::move(item.second);
+
+        m_readyToResume.push_back(bt_next);
+        erasePostponedTask(it);
+    }
+}
+
+void TaskManager::erasePostponedTask(PostponedTasks::iterator it)
+{
+    m_timerList.cancel(it->second->getTimer());
+    m_postponedTasks.erase(it);
+}
+
 void TaskManager::executePostponedTasks()
 {
+    processPeerCallbacks();
+
     while(!m_readyToResume.empty())
     {
         BaseTaskPtr& bt = m_readyToResume.front();
@@ -750,33 +1368,13 @@ void TaskManager::executePostponedTasks()
         Execute(bt);
         m_readyToResume.pop_front();
     }
-
-    if(m_expireTaskQueue.empty()) return;
-
-    auto now = std::chrono::steady_clock::now();
-    while(!m_expireTaskQueue.empty())
-    {
-        auto& pair = m_expireTaskQueue.top();
-        if(now <= pair.first) break;
-
-        auto it = m_postponedTasks.find(pair.second);
-        if(it != m_postponedTasks.end())
-        {
-            BaseTaskPtr& bt = it->second;
-            Context::uuid_t uuid = bt->getCtx().getId();
-            LOG_PRINT_RQS_BT(2,bt,"postponed task with uuid '" << uuid << "' expired.");
-            std::string msg = "Postpone task response timeout";
-            bt->setError(msg.c_str(), Status::Error);
-            respondAndDie(bt, msg);
-        }
-
-        m_expireTaskQueue.pop();
-    }
 }
 
 void TaskManager::expelWorkers()
 {
     if(getCopts().workers_expelling_interval_ms == 0) return;
+    //only the owner can expel the workers
+    if(!m_ownThreadPool) return;
     m_threadPool->expelWorkers();
 }
 
@@ -796,28 +1394,50 @@ void TaskManager::processForward(BaseTaskPtr bt)
 
 void TaskManager::processOk(BaseTaskPtr bt)
 {
-    Context::uuid_t nextUuid = bt->getCtx().getNextTaskId();
-    if(!nextUuid.is_nil())
+    resumeTasks(bt, bt->getCtx().getNextTaskIds(), bt->getInput());
+    respondAndDie(bt, bt->getOutput().data());
+}
+
+void TaskManager::resumeTasks(BaseTaskPtr& bt, const std::vector<Context::uuid_t>& uuids, const Input& input)
+{
+    for(const Context::uuid_t& nextUuid : uuids)
     {
+        if(nextUuid.is_nil()) continue;
         auto it = m_postponedTasks.find(nextUuid);
         if(it == m_postponedTasks.end())
         {
             LOG_PRINT_RQS_BT(2,bt,"attempt to resume task with uuid '" << nextUuid << "' failed, maybe it is not postponed yet.");
-            Input input = bt->getInput();
-            m_futurePostponeUuids->add(Uuid_Input(nextUuid, std::move(input)));
+            //the task can be postponed by another I/O thread
+            for(TaskManager* peer : m_peers)
+            {
+                peer->resumeFromPeer(nextUuid, input);
+            }
+            m_futurePostponeUuids->add(Uuid_Input(nextUuid, input));
         }
         else
         {
             LOG_PRINT_RQS_BT(2,bt,"resuming task with uuid '" << nextUuid << "'.");
             //redirect callback input to postponed task
             BaseTaskPtr& bt_next = it->second;
-            bt_next->getInput() = bt->getInput();
+            bt_next->getInput() = input;
 
             m_readyToResume.push_back(bt_next);
-            m_postponedTasks.erase(it);
+            erasePostponedTask(it);
         }
     }
-    respondAndDie(bt, bt->getOutput().data());
+}
+
+void TaskManager::failNextTasks(BaseTaskPtr& bt, const std::string& error, int code)
+{
+    Context::FailureHandler onFailure = bt->getCtx().takeOnFailure();
+    if(!onFailure) return;
+    std::vector<Context::uuid_t> uuids = onFailure();
+    if(uuids.empty()) return;
+    LOG_PRINT_RQS_BT(2,bt,"the task has failed, " << uuids.size() << " task(s) waiting for it resumed with the error.");
+    Input input;
+    input.resp_code = code;
+    input.body = error;
+    resumeTasks(bt, uuids, input);
 }
 
 void TaskManager::addPeriodicTask(
@@ -845,7 +1465,7 @@ void TaskManager::onClientDone(BaseTaskPtr bt)
 void TaskManager::initThreadPool(int threadCount, int workersQueueSize, int expellingIntervalMs)
 {
     if(threadCount <= 0) threadCount = std::thread::hardware_concurrency();
-    threadCount = std::max(size_t(2), next_pow2(threadCount));
+    threadCount = std::max(2, threadCount);
     if(workersQueueSize <= 0) workersQueueSize = 32;
 
     tp::ThreadPoolOptions th_op;
@@ -854,14 +1474,16 @@ void TaskManager::initThreadPool(int threadCount, int workersQueueSize, int expe
     th_op.setExpellingIntervalMs(expellingIntervalMs);
     graft::ThreadPoolX thread_pool(th_op);
 
-    const size_t maxinputSize = th_op.threadCount()*th_op.queueSize();
+    //the input of the thread pool is divided between the I/O threads
+    const size_t maxinputSize = std::max(size_t(1), th_op.threadCount()*th_op.queueSize() / std::max(1, m_copts.io_threads));
     size_t resQueueSize = next_pow2( maxinputSize );
     graft::TPResQueue resQueue(resQueueSize);
 
-    m_threadPool = std::make_unique<ThreadPoolX>(std::move(thread_pool));
+    m_threadPool = std::make_shared<ThreadPoolX>(std::move(thread_pool));
     m_resQueue = std::make_unique<TPResQueue>(std::move(resQueue));
     m_threadPoolInputSize = maxinputSize;
-    m_promiseQueue = std::make_unique<PromiseQueue>( threadCount );
+    //the asynchronous upstream requests are limited by the input of the thread pool rather than by the workers
+    m_upstreamQueue = std::make_unique<UpstreamQueue>( resQueueSize );
     //TODO: it is not clear how many items we need in PeriodicTaskQueue, maybe we should make it dynamically but this requires additional synchronization
     m_periodicTaskQueue = std::make_unique<PeriodicTaskQueue>(2*threadCount);
     m_upstreamManager = std::make_unique<UpstreamManager>(*this, [this](UpstreamSender& uss){ onUpstreamDone(uss); } );
@@ -871,25 +1493,45 @@ void TaskManager::initThreadPool(int threadCount, int workersQueueSize, int expe
                  << " queue size each. The output queue size is " << resQueueSize);
 }
 
+void TaskManager::initSharedThreadPool(TaskManager& primary)
+{
+    m_ownThreadPool = false;
+    m_threadPool = primary.m_threadPool;
+    m_threadPoolInputSize = primary.m_threadPoolInputSize;
+    m_resQueue = std::make_unique<TPResQueue>(next_pow2(m_threadPoolInputSize));
+
+    size_t threadCount = m_threadPool->getWorkersCount();
+    m_upstreamQueue = std::make_unique<UpstreamQueue>( next_pow2(m_threadPoolInputSize) );
+    m_periodicTaskQueue = std::make_unique<PeriodicTaskQueue>(2*threadCount);
+    m_upstreamManager = std::make_unique<UpstreamManager>(*this, [this](UpstreamSender& uss){ onUpstreamDone(uss); } );
+}
+
 void TaskManager::setIOThread(bool current)
 {
-    io_thread = current;
+    io_thread = current? this : nullptr;
+}
+
+void TaskManager::cb_event(uint64_t /*cnt*/)
+{
+    processReadyJobs();
 }
 
-void TaskManager::cb_event(uint64_t cnt)
+void TaskManager::processReadyJobs()
 {
     //When multiple threads write to the output queue of the thread pool.
     //It is possible that a hole appears when a thread has not completed to set
     //the cell data in the queue. The hole leads to failure of pop operations.
     //Thus, it is better to process as many cells as we can without waiting when
     //the cell will be filled, instead of basing on the counter.
-    //We cannot lose any cell because a notification follows the hole completion.
-
-    while(true)
-    {
-        bool res = tryProcessReadyJob();
-        if(!res) break;
-    }
+    //We cannot lose any cell because a notification follows the hole completion;
+    //the flag is reset before the pops, a result pushed after them notifies again.
+
+    m_resNotified.exchange(false, std::memory_order_acq_rel);
+    size_t cnt = 0;
+    while(cnt < ResultBatch && tryProcessReadyJob()) ++cnt;
+    m_resBacklog = (cnt == ResultBatch);
+    //the workers do not notify, the I/O thread comes back without waiting
+    if(m_resBacklog) m_resNotified.store(true, std::memory_order_release);
 }
 
 void TaskManager::onUpstreamDone(UpstreamSender& uss)
@@ -902,32 +1544,30 @@ void TaskManager::upstreamDoneProcess(UpstreamSender& uss)
 {
     if(Status::Ok == uss.getStatus())
         runtimeSysInfo().count_upstrm_http_resp_ok();
-    else
+    else if(Status::CircuitOpen != uss.getStatus()) //the request rejected by the circuit breaker is not sent
         runtimeSysInfo().count_upstrm_http_resp_err();
 
     BaseTaskPtr bt = uss.getTask();
     UpstreamTask* ust = dynamic_cast<UpstreamTask*>(bt.get());
     if(ust)
     {
+        static const std::string no_error;
         try
         {
-            if(Status::Ok != uss.getStatus())
-            {
-                throw std::runtime_error(uss.getError().c_str());
-            }
-            ust->m_pi.first.set_value(bt->getInput());
+            ust->m_item.first(bt->getInput(), (Status::Ok == uss.getStatus())? no_error : uss.getError());
         }
-        catch(std::exception&)
+        catch(std::exception& ex)
         {
-            ust->m_pi.first.set_exception(std::current_exception());
+            LOG_PRINT_L1("upstream callback failed: " << ex.what());
         }
+        ust->finalize();
         return;
     }
     if(Status::Ok != uss.getStatus())
     {
         bt->setError(uss.getError().c_str(), uss.getStatus());
         LOG_PRINT_RQS_BT(2,bt, "CryptoNode done with error: " << uss.getError().c_str());
-        assert(Status::Error == bt->getLastStatus()); //Status::Error only possible value now
+        assert(Status::Error == bt->getLastStatus() || Status::CircuitOpen == bt->getLastStatus());
         respondAndDie(bt, bt->getOutput().data());
 
         return;
@@ -938,17 +1578,73 @@ void TaskManager::upstreamDoneProcess(UpstreamSender& uss)
         LOG_PRINT_RQS_BT(2,bt, "CryptoNode answered : '" << make_dump_output( bt->getInput().body, getCopts().log_trunc_to_size ) << "'");
         if(!bt->getSelf())
         {//it is possible that a client has closed connection already
+            failNextTasks(bt, "client connection closed", 500);
             return;
         }
         Execute(bt);
     }
 }
 
-BaseTask::BaseTask(TaskManager& manager, const Router::JobParams& params)
+BaseTask::BaseTask(TaskManager& manager, const Router::JobParams& params, bool scoped)
     : m_manager(manager)
+    , m_resource(scoped? m_arena.resource() : std::pmr::new_delete_resource())
     , m_params(params)
-    , m_ctx(manager.getGcm())
+    , m_ctx(manager.getGcm(), m_resource)
+{
+}
+
+BaseTask::BaseTask(TaskManager& manager, Router::JobParams&& params, bool scoped)
+    : m_manager(manager)
+    , m_resource(scoped? m_arena.resource() : std::pmr::new_delete_resource())
+    , m_params(std::move(params))
+    , m_ctx(manager.getGcm(), m_resource)
+{
+}
+
+BaseTask::~BaseTask()
+{
+    size_t heapAllocations = m_arena.heapAllocations();
+    if(heapAllocations) m_manager.runtimeSysInfo().count_tsk_heap_alloc(heapAllocations);
+}
+
+void* BaseTask::operator new(size_t size)
+{
+    TaskManager* manager = TaskManager::io_thread;
+    if(manager)
+    {
+        void* p = manager->m_taskPool.allocate(size);
+        if(p)
+        {
+            manager->m_sysInfoCounter.count_tsk_recycled();
+            return p;
+        }
+        manager->m_sysInfoCounter.count_tsk_heap_alloc(1);
+    }
+    return ::operator new(size);
+}
+
+void BaseTask::operator delete(void* p, size_t size)
+{
+    TaskManager* manager = TaskManager::io_thread;
+    if(manager && manager->m_taskPool.deallocate(p, size)) return;
+    ::operator delete(p);
+}
+
+GJPtr::GJPtr(const BaseTaskPtr& bt, TPResQueue* rq, TaskManager* manager)
+{
+    std::pmr::polymorphic_allocator<GJ> alloc(bt->getResource());
+    GJ* gj = alloc.allocate(1);
+    m_ptr.reset(new(gj) GJ(bt, rq, manager));
+}
+
+void GJPtr::Deleter::operator ()(GJ* gj) const
 {
+    //the job can be in the memory of its task, the task is kept till the job is destroyed
+    BaseTaskPtr bt = std::move(gj->getTask());
+    assert(bt);
+    std::pmr::polymorphic_allocator<GJ> alloc(bt->getResource());
+    gj->~GJ();
+    alloc.deallocate(gj, 1);
 }
 
 const char* BaseTask::getStrStatus(Status s)
@@ -992,8 +1688,8 @@ std::chrono::milliseconds PeriodicTask::getTimeout()
     return std::chrono::milliseconds(v);
 }
 
-ClientTask::ClientTask(ConnectionManager* connectionManager, mg_connection *client, Router::JobParams& prms)
-    : BaseTask(ConnectionBase::from( getMgr(client) )->getLooper(), prms)
+ClientTask::ClientTask(ConnectionManager* connectionManager, mg_connection *client, Router::JobParams&& prms)
+    : BaseTask(Looper::from( getMgr(client) ), std::move(prms))
     , m_connectionManager(connectionManager)
     , m_client(client)
 {
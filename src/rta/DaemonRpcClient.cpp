@@ -28,6 +28,7 @@
 //
 
 #include "rta/DaemonRpcClient.h"
+#include "lib/graft/handler_api.h"
 #include <rpc/core_rpc_server_commands_defs.h>
 #include <storages/http_abstract_invoke.h>
 #include <cryptonote_basic/cryptonote_format_utils.h>
@@ -38,6 +39,41 @@ using namespace std;
 
 namespace graft {
 
+namespace {
+
+bool parse_tx_entry(const cryptonote::COMMAND_RPC_GET_TRANSACTIONS::entry &entry, cryptonote::transaction &out_tx)
+{
+    cryptonote::blobdata bd;
+    crypto::hash tx_hash, tx_prefix_hash;
+    if (!epee::string_tools::parse_hexstr_to_binbuff(entry.as_hex, bd)) {
+        LOG_ERROR("failed to parse tx from hex");
+        return false;
+    }
+
+    if (!cryptonote::parse_and_validate_tx_from_blob(bd, out_tx, tx_hash, tx_prefix_hash)) {
+        LOG_ERROR("failed to parse tx from blob");
+        return false;
+    }
+    return true;
+}
+
+template<typename Request>
+Output make_output(const std::string &path, const Request &req)
+{
+    Output output;
+    output.path = path;
+    epee::serialization::store_t_to_json(req, output.body);
+    return output;
+}
+
+template<typename Response>
+bool parse_response(const Input &input, const std::string &err, Response &res)
+{
+    return err.empty() && epee::serialization::load_t_from_json(res, input.body);
+}
+
+} // namespace
+
 DaemonRpcClient::DaemonRpcClient(const std::string &daemon_addr, const std::string &daemon_login, const std::string &daemon_pass)
     :  m_rpc_timeout(std::chrono::seconds(30))
 {
@@ -114,15 +150,7 @@ bool DaemonRpcClient::get_tx(const string &hash_str, cryptonote::transaction &ou
 
     // LOG_ERROR("2 block num: " << block_num);
 
-    cryptonote::blobdata bd;
-    crypto::hash tx_hash, tx_prefix_hash;
-    if (!epee::string_tools::parse_hexstr_to_binbuff(res_tx.txs[0].as_hex, bd)) {
-        LOG_ERROR("failed to parse tx from hex");
-        return false;
-    }
-
-    if (!cryptonote::parse_and_validate_tx_from_blob(bd, out_tx, tx_hash, tx_prefix_hash)) {
-        LOG_ERROR("failed to parse tx from blob");
+    if (!parse_tx_entry(res_tx.txs[0], out_tx)) {
         return false;
     }
 
@@ -204,6 +232,46 @@ bool DaemonRpcClient::send_supernode_blockchain_based_list(const char* network_a
     return true;
 }
 
+void DaemonRpcClient::send_supernode_stakes_async(HandlerAPI &api, const char* network_address, const char* id, DoneCallback callback)
+{
+    epee::json_rpc::request<cryptonote::COMMAND_RPC_SUPERNODE_GET_STAKES::request> req = AUTO_VAL_INIT(req);
+    req.jsonrpc = "2.0";
+    req.id = epee::serialization::storage_entry(0);
+    req.method = "send_supernode_stakes";
+    req.params.network_address = network_address;
+    req.params.supernode_public_id = id;
+    api.sendUpstreamAsync(make_output("/json_rpc/rta", req), [callback](Input &input, const std::string &err)
+    {
+        epee::json_rpc::response<cryptonote::COMMAND_RPC_SUPERNODE_GET_STAKES::response, std::string> res = AUTO_VAL_INIT(res);
+        bool r = parse_response(input, err, res);
+        if (!r)
+            MWARNING("/json_rpc/rta/send_supernode_stakes error " << err);
+        if (callback)
+            callback(r);
+    });
+}
+
+void DaemonRpcClient::send_supernode_blockchain_based_list_async(HandlerAPI &api, const char* network_address, const char* id,
+                                                                 uint64_t last_received_block_height, DoneCallback callback)
+{
+    epee::json_rpc::request<cryptonote::COMMAND_RPC_SUPERNODE_GET_BLOCKCHAIN_BASED_LIST::request> req = AUTO_VAL_INIT(req);
+    req.jsonrpc = "2.0";
+    req.id = epee::serialization::storage_entry(0);
+    req.method = "send_supernode_blockchain_based_list";
+    req.params.network_address = network_address;
+    req.params.supernode_public_id = id;
+    req.params.last_received_block_height = last_received_block_height;
+    api.sendUpstreamAsync(make_output("/json_rpc/rta", req), [callback](Input &input, const std::string &err)
+    {
+        epee::json_rpc::response<cryptonote::COMMAND_RPC_SUPERNODE_GET_BLOCKCHAIN_BASED_LIST::response, std::string> res = AUTO_VAL_INIT(res);
+        bool r = parse_response(input, err, res);
+        if (!r)
+            MWARNING("/json_rpc/rta/send_supernode_blockchain_based_list error " << err);
+        if (callback)
+            callback(r);
+    });
+}
+
 bool DaemonRpcClient::init(const string &daemon_address, boost::optional<epee::net_utils::http::login> daemon_login)
 {
     return m_http_client.set_server(daemon_address, daemon_login);
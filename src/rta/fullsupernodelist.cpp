@@ -551,16 +551,16 @@ bool check_timeout_expired(boost::posix_time::ptime& next_recv_time)
 
 }
 
-void FullSupernodeList::synchronizeWithCryptonode(const char* network_address, const char* address)
+void FullSupernodeList::synchronizeWithCryptonode(HandlerAPI &api, const char* network_address, const char* address)
 {
     if (check_timeout_expired(m_next_recv_stakes))
     {
-        m_rpc_client.send_supernode_stakes(network_address, address);
+        m_rpc_client.send_supernode_stakes_async(api, network_address, address);
     }
 
     if (check_timeout_expired(m_next_recv_blockchain_based_list))
     {
-        m_rpc_client.send_supernode_blockchain_based_list(network_address, address, m_blockchain_based_list_max_block_number);
+        m_rpc_client.send_supernode_blockchain_based_list_async(api, network_address, address, getBlockchainBasedListMaxBlockNumber());
     }
 }
 
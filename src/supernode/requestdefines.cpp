@@ -120,9 +120,10 @@ Status errorCustomError(const std::string& message, int code, Output& output)
 
 void cleanPaySaleData(const std::string& payment_id, Context& ctx)
 {
-    ctx.global.remove(payment_id + CONTEXT_KEY_PAY);
-    ctx.global.remove(payment_id + CONTEXT_KEY_SALE);
-    ctx.global.remove(payment_id + CONTEXT_KEY_STATUS);
+    const GlobalId payment_key_id = keyId(payment_id);
+    ctx.global.remove(payKey(payment_key_id));
+    ctx.global.remove(saleKey(payment_key_id));
+    ctx.global.remove(statusKey(payment_key_id));
 }
 
 void buildBroadcastSaleStatusOutput(const std::string& payment_id, int status, const SupernodePtr& supernode, Output& output)
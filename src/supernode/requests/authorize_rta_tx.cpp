@@ -285,7 +285,8 @@ Status handleTxAuthRequest(const Router::vars_t& vars, const graft::Input& /*inp
     // store tx amount in global context
     MDEBUG("storing amount for payment: " << authReq.payment_id
            << ", tx_id: " << tx_id_str << ", amount: " << authReq.amount);
-    ctx.global.set(tx_id_str + CONTEXT_KEY_AMOUNT_BY_TX_ID, authReq.amount, RTA_TX_TTL);
+    const GlobalId tx_key_id = keyId(tx_id_str);
+    ctx.global.set(amountByTxIdKey(tx_key_id), authReq.amount, RTA_TX_TTL);
     // check if we have a fee assigned by sender wallet
     uint64 amount = 0;
     if (!supernode->getAmountFromTx(tx, amount)) {
@@ -310,7 +311,7 @@ Status handleTxAuthRequest(const Router::vars_t& vars, const graft::Input& /*inp
     // store tx
     ctx.global.set(authResponse.tx_id + CONTEXT_KEY_TX_BY_TXID, tx, RTA_TX_TTL);
     // TODO: remove it when payment id will be in tx.extra
-    ctx.global.set(authResponse.tx_id + CONTEXT_KEY_PAYMENT_ID_BY_TXID, authReq.payment_id, RTA_TX_TTL);
+    ctx.global.set(paymentIdByTxIdKey(tx_key_id), authReq.payment_id, RTA_TX_TTL);
 
     // store payment id in local ctx for the logging purposes
     ctx.local["payment_id"] = authReq.payment_id;
@@ -403,7 +404,8 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
         }
 
 
-        std::string ctx_payment_id_key = rtaAuthResp.tx_id + CONTEXT_KEY_PAYMENT_ID_BY_TXID;
+        const GlobalId tx_key_id = keyId(rtaAuthResp.tx_id);
+        auto ctx_payment_id_key = paymentIdByTxIdKey(tx_key_id);
 
         if (!ctx.global.hasKey(ctx_payment_id_key)) {
             LOG_ERROR("no payment_id for tx: " << rtaAuthResp.tx_id);
@@ -451,13 +453,14 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
 
         // store result in context
         ctx.global.set(ctx_tx_to_auth_resp, authResult, RTA_TX_TTL);
-        if (!ctx.global.hasKey(rtaAuthResp.tx_id + CONTEXT_KEY_AMOUNT_BY_TX_ID)) {
+        const auto ctx_amount_key = amountByTxIdKey(tx_key_id);
+        if (!ctx.global.hasKey(ctx_amount_key)) {
             std::string msg = std::string("no amount found for tx id: ") + rtaAuthResp.tx_id;
             LOG_ERROR(msg);
             return errorCustomError(msg, ERROR_INTERNAL_ERROR, output);
         }
 
-        uint64_t tx_amount = ctx.global.get(rtaAuthResp.tx_id + CONTEXT_KEY_AMOUNT_BY_TX_ID, uint64_t(0));
+        uint64_t tx_amount = ctx.global.get(ctx_amount_key, uint64_t(0));
 
         size_t rta_votes_to_approve = tx_amount / COIN > 100 ? 4 : 2;
 
@@ -480,7 +483,7 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
 
             // tx rejected by auth sample, broadcast status;
             ctx.global[__FUNCTION__] = RtaAuthResponseHandlerState::StatusBroadcastReply;
-            ctx.global.set(payment_id + CONTEXT_KEY_STATUS, static_cast<int> (RTAStatus::Fail), RTA_TX_TTL);
+            ctx.global.set(statusKey(keyId(payment_id)), static_cast<int> (RTAStatus::Fail), RTA_TX_TTL);
             buildBroadcastSaleStatusOutput(payment_id, static_cast<int> (RTAStatus::Fail), supernode, output);
             return Status::Forward;
         } else if (authResult.approved.size() >= rta_votes_to_approve) {
@@ -557,12 +560,12 @@ Status handleCryptonodeTxPushResponse(const Router::vars_t& vars, const graft::I
     }
 
     // obtain payment id for given tx_id
-    std::string payment_id = ctx.global.get(tx_id + CONTEXT_KEY_PAYMENT_ID_BY_TXID, std::string());
+    std::string payment_id = ctx.global.get(paymentIdByTxIdKey(keyId(tx_id)), std::string());
     if (payment_id.empty()) {
         LOG_ERROR("Internal error, payment id not found for tx id: " << tx_id);
     }
 
-    RTAStatus status = static_cast<RTAStatus>(ctx.global.get(payment_id + CONTEXT_KEY_STATUS, int(RTAStatus::None)));
+    RTAStatus status = static_cast<RTAStatus>(ctx.global.get(statusKey(keyId(payment_id)), int(RTAStatus::None)));
     if (status == RTAStatus::None) {
         LOG_ERROR("can't find status for payment_id: " << payment_id);
         return errorInvalidParams(output);
@@ -712,6 +715,8 @@ void registerAuthorizeRtaTxRequests(graft::Router &router)
 {
     Router::Handler3 request_handler(nullptr, authorizeRtaTxRequestHandler, nullptr);
     Router::Handler3 response_handler(nullptr, authorizeRtaTxResponseHandler, nullptr);
+    request_handler.setPriority(Priority::Critical);
+    response_handler.setPriority(Priority::Critical);
     router.addRoute(PATH_REQUEST, METHOD_POST, request_handler);
     LOG_PRINT_L1("route " << PATH_REQUEST << " registered");
     router.addRoute(PATH_RESPONSE, METHOD_POST, response_handler);
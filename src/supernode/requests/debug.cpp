@@ -266,7 +266,8 @@ Status getBlockchainBasedList(const Router::vars_t& vars, const graft::Input& in
 
 void __registerDebugRequests(Router &router)
 {
-#define _HANDLER(h) {nullptr, graft::supernode::request::debug::h, nullptr}
+    //the debug requests are diagnostics, they share one worker at most
+#define _HANDLER(h) Router::Handler3(nullptr, graft::supernode::request::debug::h, nullptr).setPriority(Priority::Low).setConcurrency(1, 8, "debug")
     // /debug/supernode_list/0 -> do not include inactive items
     // /debug/supernode_list/1 -> include inactive items
     router.addRoute("/debug/supernode_list/{all:[0-1]}", METHOD_GET, _HANDLER(getSupernodeList));
@@ -1,5 +1,8 @@
 
 #include "supernode/requests/forward.h"
+#include "supernode/requests/forward_cache.h"
+#include "lib/graft/handler_api.h"
+#include "lib/graft/sys_info.h"
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "supernode.forwardrequest"
@@ -51,29 +54,84 @@ void registerForward(Router& router)
 
 void registerForwardRequest(Router& router)
 {
-    auto forward = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    auto cache = std::make_shared<ForwardCache>();
+    graft::Context::Local::Slot<std::string> request_slot("forward.request");
+
+    auto forward = [cache, request_slot](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
     {
-        if(ctx.local.getLastStatus() == graft::Status::None)
+        auto it = vars.equal_range("forward");
+        if(it.first == vars.end())
         {
-            auto it = vars.equal_range("forward");
-            auto& path = it.first->second;
-            if(it.first == vars.end())
-            {
-                throw std::runtime_error("cannot find 'forward' var");
-            }
-            if(++it.first != it.second)
+            throw std::runtime_error("cannot find 'forward' var");
+        }
+        auto& path = it.first->second;
+        if(++it.first != it.second)
+        {
+            throw std::runtime_error("multiple 'forward' vars found");
+        }
+
+        switch(ctx.local.getLastStatus())
+        {
+        case graft::Status::None:
+        {
+            if(ForwardCache::cacheable(path) && cache->init(*ctx.handlerAPI()->configOpts()))
             {
-                throw std::runtime_error("multiple 'forward' vars found");
+                auto& rsi = ctx.handlerAPI()->runtimeSysInfo();
+                std::string response;
+                switch(cache->lookup(path, input.body, ctx.getId(), response))
+                {
+                case ForwardCache::Lookup::Hit:
+                {
+                    rsi.count_fwd_cache_hit();
+                    output.body = std::move(response);
+                    return graft::Status::Ok;
+                }
+                case ForwardCache::Lookup::Wait:
+                {
+                    //resumed by the request that is forwarded already
+                    rsi.count_fwd_cache_coalesced();
+                    return graft::Status::Postpone;
+                }
+                case ForwardCache::Lookup::Miss:
+                {
+                    rsi.count_fwd_cache_miss();
+                    ctx.local.set(request_slot, input.body);
+                    //the requests waiting for this one get its error
+                    ctx.setOnFailure([cache, path, request = input.body]{ return cache->fail(path, request); });
+                } break;
+                }
             }
             output.body = input.body;
             output.path = path;
+            output.idempotent = ForwardCache::cacheable(path);
             return graft::Status::Forward;
         }
-        if(ctx.local.getLastStatus() == graft::Status::Forward)
+        case graft::Status::Forward:
+        {
+            if(const std::string* request = ctx.local.find(request_slot))
+            {
+                ctx.setOnFailure(nullptr);
+                for(auto& uuid : cache->store(path, *request, input.body))
+                {
+                    ctx.addNextTaskId(uuid);
+                }
+            }
+            output.body = input.body;
+            return graft::Status::Ok;
+        }
+        case graft::Status::Postpone:
         {
+            //the input is the response to the coalesced request or its error
+            if(500 <= input.resp_code)
+            {
+                ctx.local.setError(input.body.c_str(), graft::Status::Error);
+                return graft::Status::Error;
+            }
             output.body = input.body;
             return graft::Status::Ok;
         }
+        default: break;
+        }
         return graft::Status::Error;
     };
 
@@ -0,0 +1,190 @@
+
+#include "supernode/requests/forward_cache.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <misc_log_ex.h>
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.forwardcache"
+
+namespace graft::supernode::request::walletnode {
+
+bool ForwardCache::init(const ConfigOpts& opts)
+{
+    std::call_once(m_initFlag, [this, &opts]
+    {
+        m_enabled = 0 < opts.forward_cache_ttl_ms;
+        m_ttl = std::chrono::milliseconds(opts.forward_cache_ttl_ms);
+        m_pendingTimeout = std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(opts.upstream_request_timeout));
+        m_maxEntries = opts.forward_cache_max_entries;
+    });
+    return m_enabled;
+}
+
+bool ForwardCache::cacheable(const std::string& path)
+{
+    //the responses of these requests depend on the request and the blockchain state only;
+    //getheight is not cached but coalesced
+    return path == "getblocks.bin" || path == "gethashes.bin" || path == "get_outs.bin"
+            || path == "gettransactions" || path == "getheight";
+}
+
+std::string ForwardCache::makeKey(const std::string& path, const std::string& body)
+{
+    return path + ':' + std::to_string(std::hash<std::string>()(body));
+}
+
+bool ForwardCache::parseHeight(const std::string& response, uint64_t& height)
+{
+    static const std::string tag = "\"height\"";
+    std::string::size_type pos = response.find(tag);
+    if(pos == std::string::npos) return false;
+    pos += tag.size();
+    while(pos < response.size() && std::isspace(static_cast<unsigned char>(response[pos]))) ++pos;
+    if(pos == response.size() || response[pos] != ':') return false;
+    ++pos;
+    while(pos < response.size() && std::isspace(static_cast<unsigned char>(response[pos]))) ++pos;
+    if(pos == response.size() || !std::isdigit(static_cast<unsigned char>(response[pos]))) return false;
+    height = std::strtoull(response.c_str() + pos, nullptr, 10);
+    return true;
+}
+
+ForwardCache::Lookup ForwardCache::lookup(const std::string& path, const std::string& body, const uuid_t& id, std::string& response)
+{
+    std::string key = makeKey(path, body);
+    Clock::time_point now = Clock::now();
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto it = m_entries.find(key);
+    if(it == m_entries.end())
+    {
+        Entry& entry = m_entries[key];
+        entry.request = body;
+        entry.height = m_height;
+        entry.time = now;
+        return Lookup::Miss;
+    }
+
+    Entry& entry = it->second;
+    //on hash collision the request is forwarded without caching
+    if(entry.request != body) return Lookup::Miss;
+
+    if(entry.pending)
+    {
+        if(now < entry.time + m_pendingTimeout)
+        {
+            entry.waiters.push_back(id);
+            return Lookup::Wait;
+        }
+        //the upstream call has failed, the caller takes it over along with the waiters
+        LOG_PRINT_L2("forwarded request '" << path << "' is not answered in time, it will be repeated");
+        entry.height = m_height;
+        entry.time = now;
+        return Lookup::Miss;
+    }
+
+    if(entry.height == m_height && now < entry.time)
+    {
+        response = entry.response;
+        return Lookup::Hit;
+    }
+
+    //out of date
+    entry.response.clear();
+    entry.pending = true;
+    entry.height = m_height;
+    entry.time = now;
+    return Lookup::Miss;
+}
+
+std::vector<ForwardCache::uuid_t> ForwardCache::store(const std::string& path, const std::string& body, const std::string& response)
+{
+    std::vector<uuid_t> waiters;
+    uint64_t height = 0;
+    bool isHeight = (path == "getheight" && parseHeight(response, height));
+    std::string key = makeKey(path, body);
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if(isHeight) onHeight(height);
+
+    auto it = m_entries.find(key);
+    if(it == m_entries.end() || !it->second.pending || it->second.request != body) return waiters;
+
+    Entry& entry = it->second;
+    waiters.swap(entry.waiters);
+    //getheight is coalesced only, it is the source of the height;
+    //if the height has changed during the upstream call, the response can be out of date
+    if(path == "getheight" || response.empty() || entry.height != m_height)
+    {
+        m_entries.erase(it);
+        return waiters;
+    }
+
+    entry.response = response;
+    entry.pending = false;
+    entry.time = Clock::now() + m_ttl;
+    m_order.emplace_back(key, entry.time);
+    evict();
+    return waiters;
+}
+
+std::vector<ForwardCache::uuid_t> ForwardCache::fail(const std::string& path, const std::string& body)
+{
+    std::vector<uuid_t> waiters;
+    std::string key = makeKey(path, body);
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto it = m_entries.find(key);
+    if(it == m_entries.end() || !it->second.pending || it->second.request != body) return waiters;
+
+    waiters.swap(it->second.waiters);
+    m_entries.erase(it);
+    return waiters;
+}
+
+void ForwardCache::onHeight(uint64_t height)
+{
+    if(height == m_height) return;
+    LOG_PRINT_L2("blockchain height changed from " << m_height << " to " << height << ", forward cache dropped");
+    m_height = height;
+    //the pending entries are kept for their waiters unless the upstream call has failed
+    Clock::time_point now = Clock::now();
+    for(auto it = m_entries.begin(); it != m_entries.end();)
+    {
+        if(it->second.pending && now < it->second.time + m_pendingTimeout) ++it;
+        else it = m_entries.erase(it);
+    }
+    m_order.clear();
+}
+
+void ForwardCache::evict()
+{
+    while(!m_order.empty() && (m_maxEntries < m_entries.size() || m_maxEntries < m_order.size()))
+    {
+        auto& front = m_order.front();
+        auto it = m_entries.find(front.first);
+        if(it != m_entries.end() && !it->second.pending && it->second.time == front.second)
+        {
+            m_entries.erase(it);
+        }
+        m_order.pop_front();
+    }
+}
+
+uint64_t ForwardCache::height() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_height;
+}
+
+size_t ForwardCache::size() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_entries.size();
+}
+
+}
+
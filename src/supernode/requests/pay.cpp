@@ -59,7 +59,8 @@ Status processAuthorizationRequest(const std::string &tx_hex, const PayRequest &
            << ", auth sample: " << authSample);
 
     // map tx_id -> payment id
-    ctx.global.set(epee::string_tools::pod_to_hex(tx_hash) + CONTEXT_KEY_PAYMENT_ID_BY_TXID,
+    // the binary hash is the decoded tx id, no need to go through hex
+    ctx.global.set(paymentIdByTxIdKey(GlobalId(std::string(reinterpret_cast<const char*>(&tx_hash), sizeof(tx_hash)))),
                    pay_request.PaymentID, RTA_TX_TTL);
 
     // send multicast to /cryptonode/authorize_rta_tx_request
@@ -84,8 +85,9 @@ Status processAuthorizationRequest(const std::string &tx_hex, const PayRequest &
     ctx.local["payment_id"] = pay_request.PaymentID;
     // TODO: what is the purpose of PayData?
     PayData data(pay_request.Address, pay_request.BlockNumber, pay_request.Amount);
-    ctx.global[pay_request.PaymentID + CONTEXT_KEY_PAY] = data;
-    ctx.global[pay_request.PaymentID + CONTEXT_KEY_STATUS] = static_cast<int>(RTAStatus::InProgress);
+    const GlobalId payment_key_id = keyId(pay_request.PaymentID);
+    ctx.global.set(payKey(payment_key_id), data);
+    ctx.global.set(statusKey(payment_key_id), static_cast<int>(RTAStatus::InProgress));
 
     output.load(cryptonode_req);
     output.path = "/json_rpc/rta";
@@ -116,7 +118,7 @@ Status handleClientPayRequest(const Router::vars_t& vars, const graft::Input& in
         return errorInvalidAddress(output);
     }
 
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    int current_status = ctx.global.get(statusKey(keyId(in.PaymentID)), static_cast<int>(RTAStatus::None));
     if (errorFinishedPayment(current_status, output)) {
         return Status::Error;
     }
@@ -207,7 +209,7 @@ Status handleWaitingTxReply(const Router::vars_t& vars, const graft::Input& inpu
         return errorInvalidAddress(output);
     }
 
-    int current_status = ctx.global.get(payData.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    int current_status = ctx.global.get(statusKey(keyId(payData.PaymentID)), static_cast<int>(RTAStatus::None));
     if (errorFinishedPayment(current_status, output)) {
         return Status::Error;
     }
@@ -233,11 +235,13 @@ Status handleTxAuthReply(const Router::vars_t& vars, const graft::Input& input,
     MulticastResponseFromCryptonodeJsonRpc resp;
     std::string payment_id = ctx.local["payment_id"];
 
+    const GlobalId payment_key_id = keyId(payment_id);
+
     JsonRpcErrorResponse error;
     if (!input.get(resp) || resp.error.code != 0 || resp.result.status != STATUS_OK) {
 
-        ctx.global.remove(payment_id + CONTEXT_KEY_PAY);
-        ctx.global.remove(payment_id + CONTEXT_KEY_STATUS);
+        ctx.global.remove(payKey(payment_key_id));
+        ctx.global.remove(statusKey(payment_key_id));
 
         error.error.code = ERROR_INTERNAL_ERROR;
         error.error.message = "Error multicasting request";
@@ -249,7 +253,7 @@ Status handleTxAuthReply(const Router::vars_t& vars, const graft::Input& input,
     SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
     MDEBUG("pay multicasted for payment: " << payment_id);
 
-    int status = ctx.global.get(payment_id + CONTEXT_KEY_STATUS, static_cast<int>((RTAStatus::InProgress)));
+    int status = ctx.global.get(statusKey(payment_key_id), static_cast<int>((RTAStatus::InProgress)));
     buildBroadcastSaleStatusOutput(payment_id, status, supernode, output);
     MDEBUG("broadcasting status for payment:  " << payment_id);
     MDEBUG(__FUNCTION__ << " end");
@@ -331,6 +335,7 @@ Status payClientHandler(const Router::vars_t& vars, const graft::Input& input,
 void registerPayRequest(Router &router)
 {
     Router::Handler3 clientHandler(nullptr, payClientHandler, nullptr);
+    clientHandler.setPriority(Priority::Critical);
     router.addRoute("/pay", METHOD_POST, clientHandler);
 }
 
@@ -28,7 +28,7 @@ Status payStatusHandler(const Router::vars_t& vars, const graft::Input& input,
 
     MDEBUG("requested status for payment: " << in.PaymentID);
 
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    int current_status = ctx.global.get(statusKey(keyId(in.PaymentID)), static_cast<int>(RTAStatus::None));
     if (in.PaymentID.empty() || current_status == 0)
     {
         MWARNING("no status for payment: " << in.PaymentID);
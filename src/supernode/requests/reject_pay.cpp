@@ -11,12 +11,13 @@ Status rejectPayHandler(const Router::vars_t& vars, const graft::Input& input,
                         graft::Context& ctx, graft::Output& output)
 {
     RejectPayRequest in = input.get<RejectPayRequest>();
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    const GlobalId payment_key_id = keyId(in.PaymentID);
+    int current_status = ctx.global.get(statusKey(payment_key_id), static_cast<int>(RTAStatus::None));
     if (in.PaymentID.empty() || current_status == 0)
     {
         return errorInvalidPaymentID(output);
     }
-    ctx.global[in.PaymentID + CONTEXT_KEY_STATUS] = static_cast<int>(RTAStatus::RejectedByWallet);
+    ctx.global.set(statusKey(payment_key_id), static_cast<int>(RTAStatus::RejectedByWallet));
     // TODO: Reject Pay: Add broadcast and another business logic
     RejectPayResponse out;
     out.Result = STATUS_OK;
@@ -76,9 +76,10 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
     // what needs to be multicasted to auth sample ?
     // 1. payment_id
     // 2. SaleData
+    const GlobalId payment_key_id = keyId(payment_id);
     if (!in.SaleDetails.empty())
     {
-        ctx.global.set(payment_id + CONTEXT_KEY_SALE_DETAILS, in.SaleDetails, SALE_TTL);
+        ctx.global.set(saleDetailsKey(payment_key_id), in.SaleDetails, SALE_TTL);
     }
 
     // generate auth sample
@@ -91,8 +92,8 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
     // here we need to perform two actions:
     // 1. multicast sale over auth sample
     // 2. broadcast sale status
-    ctx.global.set(payment_id + CONTEXT_KEY_SALE, data, SALE_TTL);
-    ctx.global.set(payment_id + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::Waiting), SALE_TTL);
+    ctx.global.set(saleKey(payment_key_id), data, SALE_TTL);
+    ctx.global.set(statusKey(payment_key_id), static_cast<int>(RTAStatus::Waiting), SALE_TTL);
 
     // store SaleData, payment_id and status in local context, so when we got reply from cryptonode, we just pass it to client
     ctx.local["sale_data"]  = data;
@@ -145,7 +146,7 @@ Status handleSaleMulticastReply(const Router::vars_t& vars, const graft::Input&
     SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
 
     std::string payment_id = ctx.local["payment_id"];
-    int status = ctx.global.get(payment_id + CONTEXT_KEY_STATUS, static_cast<int>((RTAStatus::Waiting)));
+    int status = ctx.global.get(statusKey(keyId(payment_id)), static_cast<int>((RTAStatus::Waiting)));
 
     buildBroadcastSaleStatusOutput(payment_id, status, supernode, output);
     MINFO("sale multicast sent, broadcasting sale status: "
@@ -252,11 +253,13 @@ Status saleCryptonodeHandler(const Router::vars_t& vars, const graft::Input& inp
 
     // TODO: should be signed by sender??
 
-    if (!ctx.global.hasKey(payment_id + CONTEXT_KEY_SALE)) {
+    const GlobalId payment_key_id = keyId(payment_id);
+    const auto sale_key = saleKey(payment_key_id);
+    if (!ctx.global.hasKey(sale_key)) {
         // TODO: clenup after payment done;
-        ctx.global[payment_id + CONTEXT_KEY_SALE] = sdm.sale_data;
-        ctx.global[payment_id + CONTEXT_KEY_STATUS] = sdm.status;
-        ctx.global[payment_id + CONTEXT_KEY_SALE_DETAILS] = sdm.details;
+        ctx.global.set(sale_key, sdm.sale_data);
+        ctx.global.set(statusKey(payment_key_id), sdm.status);
+        ctx.global.set(saleDetailsKey(payment_key_id), sdm.details);
     } else {
         MWARNING("payment " << payment_id << " already known");
     }
@@ -271,8 +274,10 @@ Status saleCryptonodeHandler(const Router::vars_t& vars, const graft::Input& inp
 void registerSaleRequest(graft::Router &router)
 {
     Router::Handler3 h1(nullptr, saleClientHandler, nullptr);
+    h1.setPriority(Priority::Critical);
     router.addRoute("/sale", METHOD_POST, h1);
     Router::Handler3 h2(nullptr, saleCryptonodeHandler, nullptr);
+    h2.setPriority(Priority::Critical);
     router.addRoute("/cryptonode/sale", METHOD_POST, h2);
 }
 
@@ -4,6 +4,7 @@
 #include "supernode/requestdefines.h"
 #include "lib/graft/jsonrpc.h"
 #include "lib/graft/router.h"
+#include "lib/graft/staged_handler.h"
 #include "rta/fullsupernodelist.h"
 #include "rta/supernode.h"
 #include "lib/graft/common/utils.h"
@@ -20,6 +21,14 @@ GRAFT_DEFINE_JSON_RPC_REQUEST(SaleDetailsRequestJsonRpc, SaleDetailsRequest);
 // json-rpc response to POS
 GRAFT_DEFINE_JSON_RPC_RESPONSE_RESULT(SaleDetailsResponseJsonRpc, SaleDetailsResponse);
 
+// the state of a client request between its stages
+struct SaleDetailsFrame
+{
+    std::string payment_id;
+};
+
+struct NoFrame { };
+
 
 
 
@@ -31,15 +40,17 @@ bool prepareSaleDetailsResponse(const SaleDetailsRequest &req, graft::Context &c
     SaleDetailsResponseJsonRpc out;
 
 
-    if (!ctx.global.hasKey(req.PaymentID + CONTEXT_KEY_SALE)) {
+    const GlobalId payment_key_id = keyId(req.PaymentID);
+    const auto sale_key = saleKey(payment_key_id);
+    if (!ctx.global.hasKey(sale_key)) {
         error.code = ERROR_PAYMENT_ID_INVALID;
         error.message = std::string("sale data missing for payment: ") + req.PaymentID;
         LOG_ERROR(__FUNCTION__ << " " << error.message);
         return false;
     }
 
-    resp.Details = ctx.global.get(req.PaymentID + CONTEXT_KEY_SALE_DETAILS, std::string());
-    SaleData sale_data = ctx.global.get(req.PaymentID + CONTEXT_KEY_SALE, SaleData());
+    resp.Details = ctx.global.get(saleDetailsKey(payment_key_id), std::string());
+    SaleData sale_data = ctx.global.get(sale_key, SaleData());
 
     uint64_t total_fee = static_cast<uint64_t>(std::round(sale_data.Amount * AUTHSAMPLE_FEE_PERCENTAGE / 100.0));
 
@@ -55,7 +66,7 @@ bool prepareSaleDetailsResponse(const SaleDetailsRequest &req, graft::Context &c
 }
 
 Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input,
-                           graft::Context& ctx, graft::Output& output)
+                           graft::Context& ctx, graft::Output& output, SaleDetailsFrame& frame)
 {
     // in case we have sale data locally, just return it to the client;
     // in case we don't have:
@@ -79,7 +90,8 @@ Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input
         return errorInvalidPaymentID(output);
     }
 
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    const GlobalId payment_key_id = keyId(in.PaymentID);
+    int current_status = ctx.global.get(statusKey(payment_key_id), static_cast<int>(RTAStatus::None));
 
     if (errorFinishedPayment(current_status, output))
     {
@@ -106,7 +118,7 @@ Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input
         return  errorBuildAuthSample(output);
     }
     // we have sale details locally, easy way
-    bool have_data_locally = ctx.global.hasKey(in.PaymentID + CONTEXT_KEY_SALE_DETAILS);
+    bool have_data_locally = ctx.global.hasKey(saleDetailsKey(payment_key_id));
 
     if (have_data_locally) {
         MDEBUG("found sale details locally for payment id: " << in.PaymentID << ", auth sample: " << authSample);
@@ -140,7 +152,7 @@ Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input
 
 
         // store payment id so we can cache sale_details from remote supernode
-        ctx.local["payment_id"] = in.PaymentID;
+        frame.payment_id = in.PaymentID;
         Output innerOut;
         in.callback_uri = "/cryptonode/callback/sale_details/" + boost::uuids::to_string(ctx.getId());
         innerOut.loadT<serializer::JSON_B64>(in);
@@ -171,7 +183,7 @@ Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input
 // this function called in "Postponed" state.
 // returns output to the waiting client
 Status handleSaleDetailsResponse(const Router::vars_t& vars, const graft::Input& input,
-                           graft::Context& ctx, graft::Output& output)
+                           graft::Context& ctx, graft::Output& output, SaleDetailsFrame& frame)
 {
 
     MDEBUG(__FUNCTION__ << " begin");
@@ -202,7 +214,7 @@ Status handleSaleDetailsResponse(const Router::vars_t& vars, const graft::Input&
 
     UnicastRequest unicastReq = in.params;
     SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
-    std::string payment_id = ctx.local["payment_id"];
+    const std::string& payment_id = frame.payment_id;
     MDEBUG("received sale details from remote supernode: " << unicastReq.sender_address
            << ", payment: " << payment_id);
 
@@ -299,7 +311,7 @@ Status handleSaleDetailsUnicastRequest(const Router::vars_t& vars, const graft::
         return sendOkResponseToCryptonode(output); // cryptonode doesn't care about any errors, it's job is only deliver request
     }
 
-    if (ctx.global.hasKey(sdr.PaymentID + CONTEXT_KEY_SALE_DETAILS)) {
+    if (ctx.global.hasKey(saleDetailsKey(keyId(sdr.PaymentID)))) {
         MDEBUG("sale details found for payment: " << sdr.PaymentID
                << ", auth sample: " << authSample);
 
@@ -342,29 +354,22 @@ Status handleSaleDetailsUnicastRequest(const Router::vars_t& vars, const graft::
 // 2) callbacks with response
 // 3) requests from remote cryptonode
 
-// handles client requests
-Status saleDetailsClientHandler(const Router::vars_t& vars, const graft::Input& input,
-                                graft::Context& ctx, graft::Output& output)
+// handles client requests, the stages are:
+// 1. request from client
+// 2. unicast to cryptonode delivered
+// 3. response from remote supernode (random auth sample member)
+Router::Handler makeSaleDetailsClientHandler()
 {
-
-    enum class ClientHandlerState : int {
-        ClientRequest = 0,      // request from client (initial state)
-        UnicastAcknowledge,     // unicast to cryptonode delivered
-        CallbackFromAuthSample, // response from remote supernode (random auth sample member)
-    };
-
-    ClientHandlerState state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : ClientHandlerState::ClientRequest;
-    MDEBUG(__FUNCTION__ << " state: " << int(state) << ", task_id: " << boost::uuids::to_string(ctx.getId()));
-    switch (state) {
-    case ClientHandlerState::ClientRequest:
-        ctx.local[__FUNCTION__] = ClientHandlerState::UnicastAcknowledge;
-        return handleClientRequest(vars, input, ctx, output);
-    case ClientHandlerState::UnicastAcknowledge:
-        ctx.local[__FUNCTION__] = ClientHandlerState::CallbackFromAuthSample;
-        return handleUnicastAcknowledge(vars, input, ctx, output);
-    case ClientHandlerState::CallbackFromAuthSample:
-        return handleSaleDetailsResponse(vars, input, ctx, output);
-    }
+    using Staged = StagedHandler<SaleDetailsFrame>;
+    return Staged::make("sale_details.client",
+    {
+        handleClientRequest,
+        [](const Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output, SaleDetailsFrame&)
+        {
+            return handleUnicastAcknowledge(vars, input, ctx, output);
+        },
+        handleSaleDetailsResponse,
+    });
 }
 
 // handles callback with response from remote supernode
@@ -389,45 +394,43 @@ Status saleDetailsCallbackHandler(const Router::vars_t& vars, const graft::Input
 }
 
 
-// handles unicast requests from remote cryptonode.
-Status saleDetailsUnicastHandler(const Router::vars_t& vars, const graft::Input& input,
-                                 graft::Context& ctx, graft::Output& output)
+// handles unicast requests from remote cryptonode, the stages are:
+// 1. request comes from cryptonode, send unicast callback
+// 2. unicast callback sent to cryptonode, cryptonode accepted it
+// 3. send ok as reply to initial request
+Router::Handler makeSaleDetailsUnicastHandler()
 {
-    enum class State: int {
-        ClientRequest = 0,    // requests comes from cryptonode
-        CallbackToClient,     // unicast callback sent to cryptonode
-        CallbackAcknowledge,  // cryptonode accepted callbacks,
-    };
-
-    State state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : State::ClientRequest;
-
-    switch (state) {
-    case State::ClientRequest:
-        ctx.local[__FUNCTION__] = State::CallbackToClient;
-        return handleSaleDetailsUnicastRequest(vars, input, ctx, output); // send Unicast callback
-    case State::CallbackToClient:
-        ctx.local[__FUNCTION__] = State::CallbackAcknowledge;
-        return sendOkResponseToCryptonode(output);                       //  cryptonode accepted uncast callback,
-    case State::CallbackAcknowledge:
-        ctx.local[__FUNCTION__] = State::CallbackAcknowledge;
-        return sendOkResponseToCryptonode(output);                       // send ok as reply to initial request
-    }
+    using Staged = StagedHandler<NoFrame>;
+    return Staged::make("sale_details.unicast",
+    {
+        [](const Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output, NoFrame&)
+        {
+            return handleSaleDetailsUnicastRequest(vars, input, ctx, output);
+        },
+        [](const Router::vars_t&, const graft::Input&, graft::Context&, graft::Output& output, NoFrame&)
+        {
+            return sendOkResponseToCryptonode(output);
+        },
+    });
 }
 
 
 void registerSaleDetailsRequest(Router &router)
 {
     // client requests
-    Router::Handler3 clientHandler(nullptr, saleDetailsClientHandler, nullptr);
+    Router::Handler3 clientHandler(nullptr, makeSaleDetailsClientHandler(), nullptr);
+    clientHandler.setPriority(Priority::Critical);
     router.addRoute("/sale_details", METHOD_POST, clientHandler);
 
     // unicast callbacks from remote supernode (responses)
     Router::Handler3 callbackHandler(nullptr, saleDetailsCallbackHandler, nullptr);
+    callbackHandler.setPriority(Priority::Critical);
     router.addRoute("/cryptonode/callback/sale_details/{id:[0-9a-fA-F-]+}",
                     METHOD_POST, callbackHandler);
 
     // unicast requests from remote supernode (requests)
-    Router::Handler3 unicastRequestHandler(nullptr, saleDetailsUnicastHandler, nullptr);
+    Router::Handler3 unicastRequestHandler(nullptr, makeSaleDetailsUnicastHandler(), nullptr);
+    unicastRequestHandler.setPriority(Priority::Critical);
     router.addRoute("/cryptonode/sale_details/",
                     METHOD_POST, unicastRequestHandler);
 }
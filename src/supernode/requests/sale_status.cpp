@@ -31,7 +31,7 @@ Status saleStatusHandler(const Router::vars_t& vars, const graft::Input& input,
 
     const SaleStatusRequest &in = req.params;
     MDEBUG("requested status for payment: " << in.PaymentID);
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    int current_status = ctx.global.get(statusKey(keyId(in.PaymentID)), static_cast<int>(RTAStatus::None));
     if (in.PaymentID.empty() || current_status == 0)
     {
         MWARNING("no status for payment: " << in.PaymentID);
@@ -84,9 +84,10 @@ Status updateSaleStatusHandler(const Router::vars_t& vars, const graft::Input& i
         return Status::Error;
     } else {
         // TODO: complete state chart for status transitions
-        RTAStatus currentStatus = static_cast<RTAStatus>(ctx.global.get(ussb.PaymentID + CONTEXT_KEY_STATUS, int(RTAStatus::None)));
+        const auto status_key = statusKey(keyId(ussb.PaymentID));
+        RTAStatus currentStatus = static_cast<RTAStatus>(ctx.global.get(status_key, int(RTAStatus::None)));
         if (!isFiniteRtaStatus(currentStatus)) {
-            ctx.global.set(ussb.PaymentID + CONTEXT_KEY_STATUS, ussb.Status, RTA_TX_TTL);
+            ctx.global.set(status_key, ussb.Status, RTA_TX_TTL);
             MDEBUG("sale status updated for payment: " << ussb.PaymentID << " to: " << ussb.Status);
         } else {
             MWARNING("status already in finite state for payment: " << ussb.PaymentID
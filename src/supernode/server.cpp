@@ -10,6 +10,7 @@
 #include <boost/program_options.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include <regex>
+#include <algorithm>
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "supernode.server"
@@ -159,6 +160,9 @@ bool GraftServer::init(int argc, const char** argv, ConfigOpts& configOpts)
 
     bool res = initConfigOption(argc, argv, configOpts);
     if(!res) return false;
+    m_argc = argc;
+    m_argv = argv;
+    m_configOpts = &configOpts;
 
     m_connectionBase->loadBlacklist(configOpts);
     m_connectionBase->createLooper(configOpts);
@@ -184,7 +188,7 @@ void GraftServer::serve()
     LOG_PRINT_L0("Starting server on: [http] " << getCopts().http_address << ", [coap] " << getCopts().coap_address
                  << ", version: " << GRAFT_SUPERNODE_VERSION_FULL);
 
-    m_connectionBase->getLooper().serve();
+    m_connectionBase->serve();
 }
 
 GraftServer::RunRes GraftServer::run()
@@ -205,15 +209,22 @@ GraftServer::RunRes GraftServer::run()
         stop(true);
         res = RunRes::SignalTerminate;
     };
-    //restart
-    hup_handler = [this, &res](int sig_num)
+    //reload, restart if required
+    hup_handler = [this](int sig_num)
     {
+        m_connectionBase->reload();
+    };
+    m_connectionBase->setReloadCallback([this, &res]()
+    {
+        if(reloadConfig()) return;
         stop();
         res = RunRes::SignalRestart;
-    };
+    });
 
     serve();
 
+    m_connectionBase->setReloadCallback(nullptr);
+
     switch(res)
     {
     case RunRes::SignalShutdown: LOG_PRINT_L0("Server shutdown"); break;
@@ -387,6 +398,28 @@ void initGraftletDirs(int argc, const char** argv, const std::string& dirs_opt,
     }
 }
 
+//returns the name of a changed option that requires restart, the listeners and the thread pool are created once
+std::string restartOption(const ConfigOpts& live, const ConfigOpts& loaded)
+{
+#define CHECK(opt) if(live.opt != loaded.opt) return #opt
+    CHECK(http_address);
+    CHECK(coap_address);
+    CHECK(io_threads);
+    CHECK(workers_count);
+    CHECK(worker_queue_len);
+    CHECK(workers_expelling_interval_ms);
+    CHECK(cryptonode_rpc_address);
+    CHECK(forward_cache_ttl_ms);
+    CHECK(forward_cache_max_entries);
+    CHECK(lru_timeout_ms);
+    CHECK(graftlet_dirs);
+    CHECK(common.testnet);
+    CHECK(common.data_dir);
+    CHECK(common.wallet_public_address);
+#undef CHECK
+    return std::string();
+}
+
 void parseSubstitutionItem(const std::string& name, const std::string& val, std::string& uri, int& cnt, bool& keepAlive, double& timeout)
 {
     std::string s = trim_comments(val);
@@ -410,14 +443,65 @@ void parseSubstitutionItem(const std::string& name, const std::string& val, std:
     timeout = std::stod(m[7]);
 }
 
+void parseRouteLimitItem(const std::string& name, const std::string& val, int& limit, int& queue_len)
+{
+    std::string s = trim_comments(val);
+    std::regex regex(R"(^\s*(\d+)\s*(,\s*(\d+)\s*)?$)");
+    std::smatch m;
+    if(!std::regex_match(s, m, regex))
+    {
+        std::ostringstream oss;
+        oss << "invalid [route-limits] format line with name '" << name << "' : '" << val << "'";
+        throw graft::exit_error(oss.str());
+    }
+    limit = std::stoi(m[1]);
+    queue_len = m[3].matched? std::stoi(m[3]) : 0;
+}
+
 } //namespace details
 
+bool GraftServer::reloadConfig()
+{
+    assert(m_configOpts);
+    ConfigOpts& configOpts = *m_configOpts;
+    const ConfigOpts live = getCopts();
+    OutHttp::UriSubstitutions substitutions = OutHttp::uri_substitutions;
+
+    LOG_PRINT_L0("Reloading configuration");
+    bool res = false;
+    try
+    {
+        res = initConfigOption(m_argc, m_argv, configOpts);
+    }
+    catch(std::exception& ex)
+    {
+        LOG_PRINT_L0("Cannot reload configuration, " << ex.what());
+    }
+    if(!res)
+    {//the live configuration remains
+        configOpts = live;
+        OutHttp::uri_substitutions.swap(substitutions);
+        return true;
+    }
+
+    std::string option = details::restartOption(live, configOpts);
+    if(!option.empty())
+    {
+        LOG_PRINT_L0("Option '" << option << "' cannot be changed in place");
+        return false;
+    }
+
+    m_connectionBase->reconfigure(configOpts);
+    LOG_PRINT_L0("Configuration reloaded");
+    return true;
+}
+
 void usage(const boost::program_options::options_description& desc)
 {
     std::string sigmsg = "Supported signals:\n"
             "  INT  - Shutdown server gracefully closing all pending tasks.\n"
             "  TEMP - Shutdown server even if there are pending tasks.\n"
-            "  HUP  - Restart server with updated configuration parameters.\n";
+            "  HUP  - Reload configuration parameters, restart server if the listeners or the thread pool are changed.\n";
 
     std::cout << desc << "\n" << sigmsg << "\n";
 }
@@ -527,10 +611,15 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
     configOpts.coap_address = server_conf.get<std::string>("coap-address");
     configOpts.timer_poll_interval_ms = server_conf.get<int>("timer-poll-interval-ms");
     configOpts.http_connection_timeout = server_conf.get<double>("http-connection-timeout");
+    configOpts.http_keep_alive_timeout = server_conf.get<double>("http-keep-alive-timeout", 0);
+    configOpts.http_keep_alive_max_requests = server_conf.get<int>("http-keep-alive-max-requests", 0);
+    configOpts.io_threads = server_conf.get<int>("io-threads", 1);
     configOpts.workers_count = server_conf.get<int>("workers-count");
     configOpts.worker_queue_len = server_conf.get<int>("worker-queue-len");
     configOpts.workers_expelling_interval_ms = server_conf.get<int>("workers-expelling-interval-ms", 1000);
     configOpts.upstream_request_timeout = server_conf.get<double>("upstream-request-timeout");
+    configOpts.upstream_idle_timeout = server_conf.get<double>("upstream-idle-timeout", 30);
+    configOpts.upstream_probe_interval = server_conf.get<int>("upstream-probe-interval", 10);
     configOpts.lru_timeout_ms = server_conf.get<int>("lru-timeout-ms");
     configOpts.common.data_dir = server_conf.get<std::string>("data-dir");
     configOpts.common.wallet_public_address = server_conf.get<std::string>("wallet-public-address", "");
@@ -545,6 +634,7 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
         ipfilter.window_size_sec = ipfilter_conf.get<int>("window-size-sec", 0);
         ipfilter.requests_per_sec = ipfilter_conf.get<int>("requests-per-sec", 0);
         ipfilter.ban_ip_sec = ipfilter_conf.get<int>("ban-ip-sec", 0);
+        ipfilter.max_sources = ipfilter_conf.get<int>("max-sources", 0);
         //ipfilter.rules_filename
         ipfilter.rules_filename = ipfilter_conf.get<std::string>("rules", "");
         if(!ipfilter.rules_filename.empty())
@@ -561,6 +651,20 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
         }
     }
 
+    //circuit-breaker
+    auto opt_breaker = config.get_child_optional("circuit-breaker");
+    if(opt_breaker)
+    {
+        CircuitBreakerOpts& breaker = configOpts.circuit_breaker;
+        const auto breaker_conf = opt_breaker.get();
+        breaker.error_rate = breaker_conf.get<double>("error-rate", 0);
+        breaker.slow_ms = breaker_conf.get<int>("slow-ms", 0);
+        breaker.window = breaker_conf.get<int>("window", 20);
+        breaker.open_ms = breaker_conf.get<int>("open-ms", 5000);
+        breaker.hedge_percentile = breaker_conf.get<double>("hedge-percentile", 0);
+        breaker.hedge_min_ms = breaker_conf.get<int>("hedge-min-ms", 10);
+    }
+
     //configOpts.graftlet_dirs
     const boost::property_tree::ptree& graftlets_conf = config.get_child("graftlets");
     boost::optional<std::string> dirs_opt  = graftlets_conf.get_optional<std::string>("dirs");
@@ -568,6 +672,10 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
 
     const boost::property_tree::ptree& cryptonode_conf = config.get_child("cryptonode");
     configOpts.cryptonode_rpc_address = cryptonode_conf.get<std::string>("rpc-address");
+    configOpts.cryptonode_pool_size = cryptonode_conf.get<int>("pool-size", 0);
+    configOpts.cryptonode_pipeline_depth = cryptonode_conf.get<int>("pipeline-depth", 1);
+    configOpts.forward_cache_ttl_ms = cryptonode_conf.get<int>("forward-cache-ttl-ms", 0);
+    configOpts.forward_cache_max_entries = cryptonode_conf.get<int>("forward-cache-max-entries", 1024);
 
     const boost::property_tree::ptree& log_conf = config.get_child("logging");
     boost::optional<int> log_trunc_to_size  = log_conf.get_optional<int>("trunc-to-size");
@@ -585,6 +693,18 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
         graft::OutHttp::uri_substitutions.emplace(std::move(name), std::make_tuple(std::move(uri), cnt, keepAlive, timeout));
     });
 
+    //route-limits
+    configOpts.route_limits.clear();
+    auto opt_route_limits = config.get_child_optional("route-limits");
+    if(opt_route_limits)
+    {
+        for(auto& item : opt_route_limits.get())
+        {
+            RouteLimitOpts& rl = configOpts.route_limits[item.first];
+            details::parseRouteLimitItem(item.first, item.second.data(), rl.limit, rl.queue_len);
+        }
+    }
+
     prepareDataDir(configOpts);
 
     return true;
@@ -612,9 +732,11 @@ void GraftServer::addGlobalCtxCleaner()
         graft::Context::GlobalFriend::cleanup(ctx.global);
         return graft::Status::Ok;
     };
+    //the expiry is indexed by a timing wheel of seconds, a call costs O(expired)
+    int interval_ms = std::min(m_connectionBase->getCopts().lru_timeout_ms, 1000);
     m_connectionBase->getLooper().addPeriodicTask(
                 graft::Router::Handler3(nullptr, cleaner, nullptr),
-                std::chrono::milliseconds(m_connectionBase->getCopts().lru_timeout_ms)
+                std::chrono::milliseconds(interval_ms)
                 );
 }
 
@@ -9,6 +9,8 @@
 #include "rta/fullsupernodelist.h"
 #include "lib/graft/graft_exception.h"
 
+#include <set>
+
 #include <boost/property_tree/ini_parser.hpp>
 //#include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -151,9 +153,10 @@ void Supernode::startSupernodePeriodicTasks()
             return graft::Status::Error;
         }
 
-        if (FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr()))
+        FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr());
+        if (fsl && ctx.handlerAPI())
         {
-            fsl->synchronizeWithCryptonode(supernode->networkAddress().c_str(), supernode->idKeyAsString().c_str());
+            fsl->synchronizeWithCryptonode(*ctx.handlerAPI(), supernode->networkAddress().c_str(), supernode->idKeyAsString().c_str());
         }
 
         return graft::Status::Ok;
@@ -205,19 +208,23 @@ void Supernode::setHttpRouters(ConnectionManager& httpcm)
 
 void Supernode::setCoapRouters(ConnectionManager& coapcm)
 {
-    Router coap_router("/coap");
-    auto coap_test = [](const Router::vars_t&, const Input&, Context&, Output&)->Status
+    using namespace graft::supernode::request;
+
+    //supernode-to-supernode messages are served over CoAP by the same handlers as over HTTP;
+    //the other RTA requests are not exposed over UDP
+    static const std::set<std::string> allowed =
     {
-        std::cout << "blah" << std::endl;
-        return Status::Ok;
+        "/cryptonode/sale",
+        "/cryptonode/update_sale_status",
+        "/cryptonode/sale_details/",
+        "/cryptonode/callback/sale_details/{id:[0-9a-fA-F-]+}",
+        "/cryptonode/authorize_rta_tx_request",
+        "/cryptonode/authorize_rta_tx_response",
     };
-    Router::Handler3 h3_test(coap_test, nullptr, nullptr);
-
-    coap_router.addRoute("/test", METHOD_GET, h3_test);
-    coap_router.addRoute("/test1", METHOD_GET, h3_test);
-    coap_router.addRoute("/test2", METHOD_GET, h3_test);
-
-    coapcm.addRouter(coap_router);
+    Router dapi_router("/dapi/v2.0");
+    registerRTARequests(dapi_router);
+    dapi_router.filterRoutes([](const std::string& endpoint){ return allowed.count(endpoint) != 0; });
+    coapcm.addRouter(dapi_router);
 }
 
 void Supernode::loadStakeWallets()
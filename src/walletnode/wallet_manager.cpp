@@ -22,7 +22,6 @@ namespace
 {
 
 const unsigned int WALLET_MEMORY_CACHE_TTL_SECONDS       = 10 * 60; //TODO: move to config
-const unsigned int WALLET_TRANSACTIONS_QUEUE_SIZE        = 256; //TODO: move to config
 const uint64_t     WALLET_DISK_CACHE_FLUSH_DELAY_SECONDS = 3600; //TODO: move to config
 const char*        WALLETS_DIR_PREFIX                    = "wallets"; //TODO: move to config
 
@@ -170,7 +169,7 @@ struct WalletManager::WalletHolder
 
   WalletHolder(ThreadPoolX& thread_pool, bool testnet)
     : wallet(testnet? cryptonote::TESTNET : cryptonote::MAINNET)
-    , strand(thread_pool, WALLET_TRANSACTIONS_QUEUE_SIZE)
+    , strand(thread_pool) //unbounded, the operations of a busy wallet wait instead of being dropped
   {
   }
 };
@@ -2,6 +2,8 @@
 #include "lib/graft/blacklist.h"
 #include <chrono>
 #include <thread>
+#include <sstream>
+#include <arpa/inet.h>
 #include "fixture.h"
 
 TEST(Blacklist, common)
@@ -64,6 +66,35 @@ TEST(Blacklist, common)
     EXPECT_EQ( bl->find("10.16.12.5"), std::make_pair(true, true));
 }
 
+TEST(Blacklist, ipv6)
+{
+    auto bl = graft::BlackListTest::Create(100, 5, 120);
+
+    std::istringstream iss("deny 2001:db8::1 ;; single address\n allow 2001:db8::/32\n allow 10.1.0.0/16\n deny ::ffff:10.0.0.0/104\n deny all");
+    bl->readRules(iss);
+    EXPECT_EQ( bl->getWarnings(), "");
+
+    EXPECT_EQ( bl->find("2001:db8::1"), std::make_pair(true, false));
+    EXPECT_EQ( bl->find("2001:db8::2"), std::make_pair(true, true));
+    EXPECT_EQ( bl->find("2001:db8:ffff::2"), std::make_pair(true, true));
+    EXPECT_EQ( bl->find("2001:db9::1"), std::make_pair(false, false));
+    //IPv4 and mapped IPv4 addresses are the same
+    EXPECT_EQ( bl->find("10.2.3.4"), std::make_pair(true, false));
+    EXPECT_EQ( bl->find("::ffff:10.2.3.4"), std::make_pair(true, false));
+    EXPECT_EQ( bl->find("10.1.3.4"), std::make_pair(true, true));
+    EXPECT_EQ( bl->find("::ffff:10.1.3.4"), std::make_pair(true, true));
+
+    bl->addEntry("2001:db8:1::", 48, false);
+    EXPECT_EQ( bl->find("2001:db8:1::5"), std::make_pair(true, false));
+    bl->addEntry("2001:db8:1::5", -1, true);
+    EXPECT_EQ( bl->find("2001:db8:1::5"), std::make_pair(true, true));
+    bl->removeEntry("2001:db8:1::5");
+    EXPECT_EQ( bl->find("2001:db8:1::5"), std::make_pair(true, false));
+
+    std::istringstream bad("allow 2001:db8::/129");
+    EXPECT_THROW( bl->readRules(bad), std::runtime_error);
+}
+
 TEST(Blacklist, activity)
 {
     //returns triggered, seconds, active calls count
@@ -111,42 +142,116 @@ TEST(Blacklist, activity)
     }
 
     {
-        //                   400 460 470 480 490 500  501
-        std::vector<int> vec{400, 60, 10, 10, 10, 10, 101,1,1,1};
+        //the bucket is refilled with 100 tokens a second
+        //tokens              100 200  -1
+        std::vector<int> vec{400,300,1,1};
         bool triggered; int seconds, cnt;
         std::tie(triggered, seconds, cnt) = act_per_sec(*bl, 1, vec);
 
         EXPECT_EQ(triggered, true);
-        EXPECT_EQ(seconds, 7);
-        EXPECT_EQ(cnt, 601);
+        EXPECT_EQ(seconds, 2);
+        EXPECT_NEAR(cnt, 601, 1);
         EXPECT_EQ(20, bl->activeCnt());
     }
 
     {
-        //                   400 460 470 480 490 500 410 320 230 140  50  10  501
-        std::vector<int> vec{400, 60, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 491, 1,1,1};
+        //the source idle for the window is forgotten, its bucket would be full anyway
+        //tokens              490   -   -   -   -   - 500  -1
+        std::vector<int> vec{10, 0, 0, 0, 0, 0, 600, 1};
         bool triggered; int seconds, cnt;
         std::tie(triggered, seconds, cnt) = act_per_sec(*bl, 1, vec);
 
         EXPECT_EQ(triggered, true);
-        EXPECT_EQ(seconds, 13);
-        EXPECT_EQ(cnt, 1051);
-        EXPECT_EQ(0, bl->activeCnt()); //random IPs become old on 10th second
+        EXPECT_EQ(seconds, 7);
+        EXPECT_EQ(cnt, 511);
+        EXPECT_EQ(0, bl->activeCnt()); //random IPs are idle for the window
     }
 
     {
-        //                   10 110 210 310 400 500 500 501
-        std::vector<int> vec{10,100,100,100, 90,100,100,101,1,1};
+        //sustained rate over the limit
+        //tokens              300 200 100   0  -1
+        std::vector<int> vec{200,200,200,200,200,200};
         bool triggered; int seconds, cnt;
         std::tie(triggered, seconds, cnt) = act_per_sec(*bl, 1, vec);
 
         EXPECT_EQ(triggered, true);
-        EXPECT_EQ(seconds, 8);
-        EXPECT_EQ(cnt, 701);
+        EXPECT_EQ(seconds, 5);
+        EXPECT_NEAR(cnt, 901, 1);
         EXPECT_EQ(0, bl->activeCnt());
     }
 }
 
+TEST(Blacklist, bounded)
+{
+    auto bl = graft::BlackListTest::Create(1, 100, 0, 1024);
+    for(in_addr_t addr = 1; addr <= 100000; ++addr)
+    {
+        bl->active(addr);
+    }
+    EXPECT_LE(bl->activeCnt(), 1024);
+
+    //the hosts of an IPv6 /64 share the limit
+    for(int i = 0; i < 100; ++i)
+    {
+        std::ostringstream oss;
+        oss << "2001:db8:0:1::" << std::hex << i + 1;
+        graft::Ip6Addr addr;
+        inet_pton(AF_INET6, oss.str().c_str(), addr.data());
+        EXPECT_TRUE(bl->processIp(addr));
+    }
+    graft::Ip6Addr addr;
+    inet_pton(AF_INET6, "2001:db8:0:1:ffff::1", addr.data());
+    EXPECT_EQ(bl->processIp(addr), false);
+    inet_pton(AF_INET6, "2001:db8:0:2::1", addr.data());
+    EXPECT_EQ(bl->processIp(addr), true);
+}
+
+TEST(Blacklist, DISABLED_benchmark)
+{
+    constexpr int sources = 100000;
+    constexpr int rounds = 10;
+
+    auto bl = graft::BlackListTest::Create(100, 5, 120);
+    std::istringstream iss("deny 192.168.0.0/16\n deny 2001:db8:dead::/48\n allow 10.0.0.0/8");
+    bl->readRules(iss);
+
+    std::vector<graft::Ip6Addr> addrs6(sources);
+    for(int i = 0; i < sources; ++i)
+    {
+        graft::Ip6Addr& addr = addrs6[i];
+        addr = graft::Ip6Addr{0x20, 0x01, 0x0d, 0xb8};
+        addr[4] = i >> 16; addr[5] = i >> 8; addr[6] = i;
+        addr[15] = 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int allowed = 0;
+    for(int r = 0; r < rounds; ++r)
+    {
+        for(int i = 0; i < sources; ++i)
+        {
+            if(bl->processIp(htonl(0x0A000000 + i))) ++allowed;
+        }
+    }
+    std::chrono::duration<double> v4 = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(allowed, sources * rounds);
+
+    start = std::chrono::steady_clock::now();
+    allowed = 0;
+    for(int r = 0; r < rounds; ++r)
+    {
+        for(auto& addr : addrs6)
+        {
+            if(bl->processIp(addr)) ++allowed;
+        }
+    }
+    std::chrono::duration<double> v6 = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(allowed, sources * rounds);
+
+    std::cout << sources << " distinct sources: IPv4 " << size_t(sources * rounds / v4.count())
+              << " accepts/s, IPv6 " << size_t(sources * rounds / v6.count()) << " accepts/s\n";
+}
+
 TEST_F(GraftServerTest, ban)
 {
     m_copts.ipfilter.requests_per_sec = 3;
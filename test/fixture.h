@@ -10,6 +10,7 @@
 #include <gtest/gtest.h>
 #include <thread>
 #include <atomic>
+#include <map>
 
 namespace detail
 {
@@ -17,18 +18,24 @@ namespace detail
 class GSTest : public graft::GraftServer
 {
 public:
-    GSTest(graft::Router& httpRouter, bool ignoreInitConfig)
+    GSTest(graft::Router& httpRouter, bool ignoreInitConfig, graft::Router* coapRouter = nullptr)
         : m_httpRouter(httpRouter)
+        , m_coapRouter(coapRouter)
         , m_ignoreInitConfig(ignoreInitConfig)
     { }
     bool ready() const { return graft::GraftServer::ready(); }
     void stop() { graft::GraftServer::stop(); }
+    //the same as SIGHUP
+    void reload() { graft::GraftServer::getConnectionBase().reload(); }
     graft::GlobalContextMap& getContext() { return graft::GraftServer::getLooper().getGcm(); }
     graft::Looper& getLooper() { return graft::GraftServer::getLooper(); }
+    //makes the next loads of the configuration fail as if config.ini could not be parsed
+    std::atomic_bool failInitConfig{false};
 
 protected:
     virtual bool initConfigOption(int argc, const char** argv, graft::ConfigOpts& configOpts) override
     {
+        if(failInitConfig) throw std::runtime_error("invalid configuration");
         if(m_ignoreInitConfig) return true; //prevents loading parameters from command line and config.ini
         return graft::GraftServer::initConfigOption(argc, argv, configOpts);
     }
@@ -36,9 +43,15 @@ protected:
     {
         graft::ConnectionManager* httpcm = getConMgr("HTTP");
         httpcm->addRouter(m_httpRouter);
+        if(m_coapRouter)
+        {
+            graft::ConnectionManager* coapcm = getConMgr("COAP");
+            coapcm->addRouter(*m_coapRouter);
+        }
     }
 private:
     graft::Router& m_httpRouter;
+    graft::Router* m_coapRouter;
     bool m_ignoreInitConfig;
 };
 
@@ -67,6 +80,8 @@ protected:
         using on_http_t = bool (const http_message *hm, int& status_code, std::string& headers, std::string& data);
         std::function<on_http_t> on_http = nullptr;
         static std::function<on_http_t> http_echo;
+        //if set, returns the delay of the response in milliseconds, the loop is not blocked meanwhile
+        std::function<int (const http_message *hm)> reply_delay_ms = nullptr;
 
         void run()
         {
@@ -94,6 +109,7 @@ protected:
         std::thread th;
         std::atomic_bool ready;
         std::atomic_bool stop;
+        std::map<mg_connection*, std::string> delayed;
 
         void x_run()
         {
@@ -130,6 +146,16 @@ protected:
                 std::string headers, data;
                 bool res = onHttpRequest(hm, status_code, headers, data);
                 if(!res) break;
+                if(int delay = reply_delay_ms? reply_delay_ms(hm) : 0)
+                {
+                    //mg_send_head cannot be postponed, so the whole response is kept
+                    std::string& reply = delayed[client];
+                    reply = "HTTP/1.1 " + std::to_string(status_code) + " OK\r\nContent-Length: " + std::to_string(data.size());
+                    if(!headers.empty()) reply += "\r\n" + headers;
+                    reply += "\r\n\r\n" + data;
+                    mg_set_timer(client, mg_time() + delay / 1000.0);
+                    break;
+                }
                 mg_send_head(client, status_code, data.size(), headers.c_str());
                 mg_send(client, data.c_str(), data.size());
                 if(!keepAlive)
@@ -139,6 +165,7 @@ protected:
             } break;
             case MG_EV_CLOSE:
             {
+                delayed.erase(client);
                 onClose();
             } break;
             case MG_EV_ACCEPT:
@@ -148,6 +175,17 @@ protected:
             case MG_EV_TIMER:
             {
                 mg_set_timer(client, 0);
+                auto it = delayed.find(client);
+                if(it != delayed.end())
+                {
+                    mg_send(client, it->second.c_str(), it->second.size());
+                    delayed.erase(it);
+                    if(!keepAlive)
+                    {
+                        client->flags |= MG_F_SEND_AND_CLOSE;
+                    }
+                    break;
+                }
                 client->handler = ev_handler_empty_s; //without this we will get MG_EV_HTTP_REQUEST
                 client->flags |= MG_F_CLOSE_IMMEDIATELY;
              } break;
@@ -163,6 +201,7 @@ public:
     public:
         graft::ConfigOpts m_copts;
         graft::Router m_router;
+        graft::Router m_coapRouter;
 
         graft::Looper& getLooper() const { assert(m_gserver); return m_gserver->getLooper(); }
         graft::GlobalContextMap& getGcm() const { assert(m_gserver); return m_gserver->getContext(); }
@@ -170,7 +209,7 @@ public:
         MainServer()
         {
             m_copts.http_address = "127.0.0.1:9084";
-            m_copts.coap_address = "127.0.0.1:9086";
+            m_copts.coap_address = "udp://127.0.0.1:9086";
             m_copts.http_connection_timeout = 1;
             m_copts.upstream_request_timeout = 1;
             m_copts.workers_count = 0;
@@ -189,25 +228,37 @@ public:
                 std::this_thread::sleep_for(std::chrono::milliseconds(10));
             }
         }
+        //applies m_copts as if they were reloaded from config.ini
+        void reload() { assert(m_gserver); m_gserver->reload(); }
+        //the next reloads fail as if config.ini could not be parsed
+        void failReload(bool fail) { assert(m_gserver); m_gserver->failInitConfig = fail; }
+        //the server has returned from run(), for example to be restarted
+        bool finished() const { return m_finished; }
+        graft::GraftServer::RunRes runRes() const { assert(m_finished); return m_runRes; }
+
         void stop_and_wait_for()
         {
             m_gserver->stop();
             m_th.join();
             m_gserver_created = false;
             m_gserver.reset();
+            m_finished = false;
         }
 
     private:
         std::atomic_bool m_gserver_created{false};
+        std::atomic_bool m_finished{false};
+        graft::GraftServer::RunRes m_runRes = graft::GraftServer::RunRes::UnexpectedOk;
         std::unique_ptr<detail::GSTest> m_gserver{nullptr};
         std::thread m_th;
 
         void x_run()
         {
-            m_gserver = std::make_unique<detail::GSTest>(m_router, true);
+            m_gserver = std::make_unique<detail::GSTest>(m_router, true, &m_coapRouter);
             m_gserver_created = true;
             m_gserver->init(start_args.argc, start_args.argv, m_copts);
-            m_gserver->run();
+            m_runRes = m_gserver->run();
+            m_finished = true;
         }
     };
 public:
@@ -317,6 +368,174 @@ public:
         std::string m_message;
     };
 
+public:
+    //CoAP client (its objects are created in the main thread)
+    //The requests are sent to the same peer, the large bodies are transferred block-wise;
+    //the blocks of a response are requested with the same token.
+    class CoapClient
+    {
+    public:
+        size_t block_size = 1024;
+        //the number of the first block of the response to request
+        uint32_t block2_start = 0;
+
+        CoapClient()
+        {
+            mg_mgr_init(&m_mgr, nullptr, nullptr);
+        }
+
+        //returns false on timeout
+        bool serve(const std::string& address, const std::string& path, const std::string& body = std::string(),
+                   bool confirmable = true, int timeout_ms = 3000)
+        {
+            if(!client)
+            {
+                client = mg_connect(&m_mgr, ("udp://" + address).c_str(), graft::static_ev_handler<CoapClient>);
+                assert(client);
+                client->user_data = this;
+                mg_set_protocol_coap(client);
+            }
+            m_body.clear();
+            uint32_t szx = 0;
+            while((size_t(16) << szx) < block_size) ++szx;
+
+            size_t offset = 0;
+            uint32_t block1_num = 0, block2_num = block2_start;
+            bool body_sent = false;
+            m_token = std::to_string(m_msg_id + 1);
+            std::string etag;
+            while(true)
+            {
+                mg_coap_message cm;
+                memset(&cm, 0, sizeof(cm));
+                cm.msg_type = confirmable? MG_COAP_MSG_CON : MG_COAP_MSG_NOC;
+                cm.code_class = MG_COAP_CODECLASS_REQUEST;
+                cm.code_detail = body.empty()? 1 : 2; //GET or POST
+                cm.msg_id = ++m_msg_id;
+                cm.token.p = m_token.data();
+                cm.token.len = m_token.size();
+
+                //the option values should be alive until the message is sent
+                std::deque<std::string> values;
+                for(size_t pos = 1; pos <= path.size();)
+                {
+                    size_t end = path.find('/', pos);
+                    if(end == std::string::npos) end = path.size();
+                    values.push_back(path.substr(pos, end - pos));
+                    mg_coap_add_option(&cm, 11, &values.back()[0], values.back().size());
+                    pos = end + 1;
+                }
+                std::string part;
+                bool more1 = false;
+                if(!body_sent)
+                {
+                    bool block1 = block_size < body.size();
+                    part = block1? body.substr(offset, block_size) : body;
+                    more1 = block1 && offset + part.size() < body.size();
+                }
+                if(0 < block2_num)
+                {//the block size of the response is kept
+                    values.push_back(encode((block2_num << 4) | m_szx2));
+                    mg_coap_add_option(&cm, 23, &values.back()[0], values.back().size());
+                }
+                if(!body_sent && block_size < body.size())
+                {
+                    values.push_back(encode((block1_num << 4) | (more1? 0x08 : 0) | szx));
+                    mg_coap_add_option(&cm, 27, &values.back()[0], values.back().size());
+                }
+                cm.payload.p = part.data();
+                cm.payload.len = part.size();
+
+                m_done = false;
+                mg_coap_send_message(client, &cm);
+                mg_coap_free_options(&cm);
+                auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+                while(!m_done && std::chrono::steady_clock::now() < end)
+                {
+                    mg_mgr_poll(&m_mgr, 1);
+                }
+                if(!m_done) return false;
+
+                if(more1)
+                {
+                    if(m_resp_code != 231) return true;
+                    offset += part.size();
+                    ++block1_num;
+                    continue;
+                }
+                body_sent = true;
+                m_body += m_payload;
+                //the blocks should be of the same response
+                if(m_body.size() != m_payload.size() && etag != m_etag) return false;
+                etag = m_etag;
+                if(!m_more) return true;
+                block2_num = m_body.size() >> (4 + m_szx2);
+            }
+        }
+
+        //the response code as class * 100 + detail, e.g. 205
+        int get_resp_code(){ return m_resp_code; }
+        std::string get_body(){ return m_body; }
+        bool get_separate(){ return m_separate; }
+
+        ~CoapClient()
+        {
+            mg_mgr_free(&m_mgr);
+        }
+    public:
+        void ev_handler(mg_connection* client, int ev, void *ev_data)
+        {
+            assert(client == this->client);
+            switch(ev)
+            {
+            case MG_EV_COAP_CON:
+            case MG_EV_COAP_NOC:
+            case MG_EV_COAP_ACK:
+            {
+                mg_coap_message* cm = static_cast<mg_coap_message*>(ev_data);
+                if(ev == MG_EV_COAP_CON) mg_coap_send_ack(client, cm->msg_id);
+                if(cm->code_class == 0 && cm->code_detail == 0) break; //empty ACK, the response goes separately
+                if(std::string(cm->token.p, cm->token.len) != m_token) break;
+                m_separate = (ev != MG_EV_COAP_ACK);
+                m_resp_code = cm->code_class * 100 + cm->code_detail;
+                m_payload = std::string(cm->payload.p, cm->payload.len);
+                m_more = false;
+                m_etag.clear();
+                for(mg_coap_option* opt = cm->options; opt; opt = opt->next)
+                {
+                    if(opt->number == 4) m_etag.assign(opt->value.p, opt->value.len);
+                    if(opt->number == 23 && 0 < opt->value.len)
+                    {
+                        m_more = opt->value.p[opt->value.len - 1] & 0x08;
+                        m_szx2 = opt->value.p[opt->value.len - 1] & 0x07;
+                    }
+                }
+                m_done = true;
+            } break;
+            }
+        }
+    private:
+        static std::string encode(uint32_t value)
+        {
+            std::string res;
+            for(; value; value >>= 8) res.insert(res.begin(), static_cast<char>(value & 0xFF));
+            return res;
+        }
+
+        mg_mgr m_mgr;
+        mg_connection* client = nullptr;
+        uint16_t m_msg_id = 0;
+        std::string m_token;
+        bool m_done = false;
+        bool m_more = false;
+        uint32_t m_szx2 = 0;
+        bool m_separate = false;
+        int m_resp_code = 0;
+        std::string m_payload;
+        std::string m_etag;
+        std::string m_body;
+    };
+
 public:
     static std::string run_cmdline_read(const std::string& cmdl)
     {
@@ -5,6 +5,8 @@
 #include "lib/graft/inout.h"
 #include "lib/graft/handler_api.h"
 #include "lib/graft/expiring_list.h"
+#include "lib/graft/priority_lanes.h"
+#include "lib/graft/staged_handler.h"
 #include "supernode/requests.h"
 #include "supernode/requests/sale.h"
 #include "supernode/requests/sale_status.h"
@@ -17,8 +19,12 @@
 #include "fixture.h"
 
 #include <misc_log_ex.h>
+#include <boost/filesystem.hpp>
 
 #include <deque>
+#include <unordered_set>
+#include <random>
+#include <fstream>
 
 GRAFT_DEFINE_IO_STRUCT(Payment,
       (uint64, amount),
@@ -311,6 +317,79 @@ TEST(Context, stress)
     });
 }
 
+TEST(Context, localSlots)
+{
+    using Slot = graft::Context::Local::Slot<std::string>;
+    static Slot slot("test.slot");
+    static graft::Context::Local::Slot<int> slot_int("test.slot_int");
+    //the slots with the same name share the id
+    EXPECT_EQ( Slot("test.slot").id(), slot.id() );
+    EXPECT_NE( slot_int.id(), slot.id() );
+    EXPECT_THROW( graft::Context::Local::Slot<int>("test.slot"), std::logic_error );
+
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+    EXPECT_FALSE( ctx.local.has(slot) );
+    EXPECT_EQ( ctx.local.find(slot), nullptr );
+    EXPECT_THROW( ctx.local.get(slot), std::bad_any_cast );
+
+    ctx.local.set(slot, "abc");
+    ctx.local.set(slot_int, 5);
+    EXPECT_EQ( ctx.local.get(slot), "abc" );
+    ctx.local.get(slot) += "d";
+    ++ctx.local.get(slot_int);
+    EXPECT_EQ( *ctx.local.find(slot), "abcd" );
+    EXPECT_EQ( ctx.local.get(slot_int), 6 );
+    ctx.local.remove(slot);
+    EXPECT_FALSE( ctx.local.has(slot) );
+    EXPECT_TRUE( ctx.local.has(slot_int) );
+
+    //the values that do not fit the inline buffer are allocated from the resource
+    using Big = std::array<uint64_t, 16>;
+    Big big; big.fill(7);
+    ctx.local["big"] = big;
+    ctx.local["small"] = 1;
+    Big& b = ctx.local["big"];
+    EXPECT_EQ( b, big );
+    //the wrong type or the missing key does not add the value
+    EXPECT_THROW( { int& i = ctx.local["big"]; (void)i; }, std::bad_any_cast );
+    EXPECT_THROW( { int& i = ctx.local["none"]; (void)i; }, std::bad_any_cast );
+    EXPECT_FALSE( ctx.local.hasKey("none") );
+    ctx.local["big"] = 2;
+    int i = ctx.local["big"];
+    EXPECT_EQ( i, 2 );
+}
+
+TEST(Context, DISABLED_localBenchmark)
+{
+    static graft::Context::Local::Slot<int> slot("test.bench");
+    const std::string key = "test.bench";
+    const int N = 1000000;
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+    ctx.local[key] = 0;
+    ctx.local.set(slot, 0);
+
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; ++i)
+    {
+        int& v = ctx.local[key];
+        ++v;
+    }
+    auto mid = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; ++i)
+    {
+        ++ctx.local.get(slot);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    int v = ctx.local[key];
+    EXPECT_EQ( v, N );
+    EXPECT_EQ( ctx.local.get(slot), N );
+    auto ns = [N](auto d) { return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / double(N); };
+    std::cout << "local context access: by key " << ns(mid - begin) << " ns, by slot " << ns(end - mid) << " ns\n";
+}
+
 TEST(Context, multithreaded)
 {
     graft::GlobalContextMap m;
@@ -413,6 +492,131 @@ TEST(Context, multithreaded)
     EXPECT_EQ(sum, g_count-main_count);
 }
 
+TEST(Context, DISABLED_hashtableBenchmark)
+{
+    using Table = graft::TSHashtable<uint64_t, uint64_t>;
+    const uint64_t key_cnt = 1000000;
+    const int op_cnt = 200000;
+    Table table;
+
+    auto begin = std::chrono::steady_clock::now();
+    for(uint64_t k = 0; k < key_cnt; ++k)
+    {
+        table.addOrUpdate(k, k);
+    }
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_EQ(table.size(), key_cnt);
+    std::cout << "insert " << key_cnt << " keys: "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << " ms\n";
+
+    for(int thread_cnt : {1, 2, 4, 8, 16, 32})
+    {
+        std::atomic<uint64_t> misses(0);
+        std::vector<std::thread> threads;
+        auto begin = std::chrono::steady_clock::now();
+        for(int t = 0; t < thread_cnt; ++t)
+        {
+            threads.emplace_back([&table, &misses, t, key_cnt, op_cnt]()
+            {
+                uint64_t x = 88172645463325252ull + t, miss = 0;
+                for(int i = 0; i < op_cnt; ++i)
+                {
+                    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                    uint64_t k = x % key_cnt;
+                    //one write per 8 reads
+                    if(i % 8 == 0) table.addOrUpdate(k, k);
+                    else if(table.valueFor(k, ~0ull) != k) ++miss;
+                }
+                misses += miss;
+            });
+        }
+        for(auto& th : threads) th.join();
+        auto end = std::chrono::steady_clock::now();
+        EXPECT_EQ(misses, 0);
+        double sec = std::chrono::duration<double>(end - begin).count();
+        std::cout << thread_cnt << " threads: " << thread_cnt * op_cnt / sec / 1e6 << " Mops/s\n";
+    }
+    EXPECT_EQ(table.size(), key_cnt);
+}
+
+TEST(Context, hashtableCollisions)
+{//the erasure in the middle of the probe chains and between the grows keeps the rest of the keys reachable
+    //few distinct hashes make long chains that wrap around the end of the slots
+    struct Hash
+    {
+        std::size_t operator()(uint64_t key) const { return key % 7; }
+    };
+    using Table = graft::TSHashtable<uint64_t, uint64_t, Hash>;
+    Table table(1);
+    std::map<uint64_t, uint64_t> model;
+
+    auto check = [&table, &model](uint64_t key_cnt)
+    {
+        EXPECT_EQ(table.size(), model.size());
+        for(uint64_t k = 0; k < key_cnt; ++k)
+        {
+            auto it = model.find(k);
+            if(it == model.end())
+            {
+                EXPECT_FALSE(table.hasKey(k)) << k;
+                continue;
+            }
+            EXPECT_TRUE(table.hasKey(k)) << k;
+            EXPECT_EQ(table.valueFor(k, ~0ull), it->second) << k;
+        }
+    };
+
+    //erase from the middle of the chains of the full table
+    const uint64_t key_cnt = 200;
+    for(uint64_t k = 0; k < key_cnt; ++k)
+    {
+        table.addOrUpdate(k, k + 1);
+        model[k] = k + 1;
+    }
+    check(key_cnt);
+    for(uint64_t k = 3; k < key_cnt; k += 5)
+    {
+        table.remove(k);
+        model.erase(k);
+    }
+    check(key_cnt);
+
+    //erase and insert in turn, so that the table grows between the erasures
+    std::mt19937_64 rnd(11);
+    const uint64_t wide_cnt = 4 * key_cnt;
+    for(int i = 0; i < 4000; ++i)
+    {
+        uint64_t k = rnd() % wide_cnt;
+        if(rnd() % 3 == 0)
+        {
+            table.remove(k);
+            model.erase(k);
+        }
+        else
+        {
+            table.addOrUpdate(k, i);
+            model[k] = i;
+        }
+        if(i % 500 == 0) check(wide_cnt);
+    }
+    check(wide_cnt);
+
+    //erase all, the chains are emptied from the middle too
+    for(uint64_t k = 0; k < wide_cnt; k += 2)
+    {
+        table.remove(k);
+        model.erase(k);
+    }
+    check(wide_cnt);
+    for(uint64_t k = 1; k < wide_cnt; k += 2)
+    {
+        table.remove(k);
+        model.erase(k);
+    }
+    check(wide_cnt);
+    EXPECT_EQ(table.size(), 0);
+}
+
 TEST(Context, expiration)
 {
     graft::GlobalContextMap m;
@@ -439,6 +643,207 @@ TEST(Context, expiration)
     EXPECT_EQ(res, cmp_res);
 }
 
+TEST(Context, groupSetTtl)
+{//the ttl set by a group expires the entry without the sweep of all the entries
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+
+    int expired = 0;
+    auto onExpired = [&expired](std::pair<std::string, std::any>& v){ ++expired; };
+    ctx.global["a"] = 1;
+    EXPECT_EQ(ctx.global.createGroup("G"), true);
+    EXPECT_EQ(ctx.global.groupAddKey("G","a"), true);
+    EXPECT_EQ(ctx.global.groupSet<int>("G","a",2,std::chrono::seconds(1),onExpired), true);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    graft::Context::GlobalFriend::cleanup(ctx.global);
+    EXPECT_EQ(expired, 1);
+    EXPECT_EQ(ctx.global.hasKey("a"), false);
+}
+
+TEST(Context, groupSetRemoved)
+{//the ttl set by a group to a removed entry does not link it into the wheel again
+    using Table = graft::TSHashtable<std::string, int>;
+    Table table;
+    table.addOrUpdate("a", 1);
+    EXPECT_EQ(table.createGroup("G"), true);
+    Table::GroupPtr group = table.getGroup("G");
+    EXPECT_EQ(group->add("a"), true);
+
+    int expired = 0;
+    {
+        //the node is still held by somebody when it is removed
+        Table::NodePtr ptr = group->get("a");
+        table.remove("a");
+        EXPECT_EQ(group->set("a", 2, std::chrono::seconds(1), [&expired](Table::Entry&){ ++expired; }), false);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    table.cleanup();
+    EXPECT_EQ(expired, 0);
+    EXPECT_EQ(table.hasKey("a"), false);
+}
+
+TEST(Context, timingWheel)
+{
+    struct Item
+    {
+        graft::TimingWheel<Item, 3>::Hook hook;
+        int64_t time = 0;
+        int64_t fired = -1;
+    };
+    const int64_t start = 1000003;
+    graft::TimingWheel<Item, 3> wheel(start);
+    std::vector<Item> items(5000);
+    std::mt19937_64 rnd(7);
+    for(auto& item : items)
+    {
+        item.hook.owner = &item;
+        //up to the top of 3 levels and beyond it
+        item.time = start + rnd() % 300000;
+        wheel.schedule(item.hook, item.time);
+    }
+    //the cancelled do not fire
+    for(size_t i = 0; i < items.size(); i += 10)
+    {
+        wheel.cancel(items[i].hook);
+    }
+
+    std::vector<Item*> due;
+    for(int64_t now = start; now < start + 300000; now += 1 + rnd() % 50)
+    {
+        due.clear();
+        wheel.advance(now, due);
+        for(Item* item : due)
+        {
+            EXPECT_EQ(item->fired, -1);
+            item->fired = now;
+            //the clamped are rescheduled by the owner
+            if(wheel.now() < item->time) { item->fired = -1; wheel.schedule(item->hook, item->time); }
+        }
+    }
+    due.clear();
+    wheel.advance(start + 300000, due);
+    for(Item* item : due) item->fired = start + 300000;
+
+    for(size_t i = 0; i < items.size(); ++i)
+    {
+        const Item& item = items[i];
+        if(i % 10 == 0) { EXPECT_EQ(item.fired, -1); continue; }
+        //fired at the first advance that reached the time
+        EXPECT_LE(item.time, item.fired);
+        EXPECT_LT(item.fired - item.time, 50);
+    }
+}
+
+TEST(TimerList, pushCancelEval)
+{
+    struct Item;
+    struct Manager;
+    using ItemPtr = std::shared_ptr<Item>;
+    struct Item
+    {
+        Item(Manager& manager) : manager(manager) { }
+        Manager& manager;
+        graft::TimerList<ItemPtr>::Timer timer;
+        std::chrono::steady_clock::time_point lap;
+        Manager& getManager() { return manager; }
+    };
+    struct Manager
+    {
+        //the expected and the actual times
+        std::vector<std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point>> fired;
+        void onTimer(ItemPtr item) { fired.emplace_back(item->lap, std::chrono::steady_clock::now()); }
+    };
+
+    Manager manager;
+    std::weak_ptr<Item> cancelled;
+    {
+        graft::TimerList<ItemPtr> timers;
+        std::vector<std::weak_ptr<Item>> items;
+        for(int i = 0; i < 100; ++i)
+        {
+            auto item = std::make_shared<Item>(manager);
+            auto timeout = std::chrono::milliseconds(i % 50);
+            item->lap = std::chrono::steady_clock::now() + timeout;
+            timers.push(item->timer, timeout, item);
+            EXPECT_TRUE(item->timer.active());
+            //the list keeps the items
+            items.push_back(item);
+        }
+        for(int i = 0; i < 100; i += 10)
+        {
+            timers.cancel(items[i].lock()->timer);
+            EXPECT_TRUE(items[i].expired());
+        }
+        //the restarted fires once, at the new time
+        auto restarted = items[1].lock();
+        timers.push(restarted->timer, std::chrono::milliseconds(60), restarted);
+        restarted->lap = std::chrono::steady_clock::now() + std::chrono::milliseconds(60);
+        restarted.reset();
+        //this one outlives the run
+        auto pending = items[2].lock();
+        timers.push(pending->timer, std::chrono::hours(10), pending);
+        cancelled = pending;
+        pending.reset();
+
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while(std::chrono::steady_clock::now() < end)
+        {
+            timers.eval();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(manager.fired.size(), 89);
+        for(auto& pair : manager.fired)
+        {
+            EXPECT_LE(pair.first - std::chrono::milliseconds(1), pair.second);
+        }
+        EXPECT_FALSE(cancelled.expired());
+    }
+    //the list releases the pending on destruction
+    EXPECT_TRUE(cancelled.expired());
+}
+
+TEST(Context, globalKeys)
+{
+    enum class Tag : uint8_t { A = 1, B };
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+
+    graft::GlobalKey<int> a(Tag::A, "id"), a1(Tag::A, "id");
+    graft::GlobalKey<std::string> b(Tag::B, "id");
+    EXPECT_EQ( a.hash(), a1.hash() );
+    EXPECT_NE( a.key(), b.key() );
+
+    EXPECT_FALSE( ctx.global.hasKey(a) );
+    EXPECT_EQ( ctx.global.get(a, -1), -1 );
+    ctx.global.set(a, 5);
+    ctx.global.set(b, "five", std::chrono::seconds(10));
+    EXPECT_TRUE( ctx.global.hasKey(a1) );
+    EXPECT_EQ( ctx.global.get(a1, -1), 5 );
+    EXPECT_EQ( ctx.global.get(b, std::string()), "five" );
+    std::function<bool(int&)> f = [](int& v)->bool { ++v; return true; };
+    EXPECT_TRUE( ctx.global.apply(a, f) );
+    EXPECT_EQ( ctx.global.get(a, -1), 6 );
+    //the typed keys do not clash with the string keys
+    ctx.global["id"] = std::string("string");
+    EXPECT_EQ( ctx.global.get(a, -1), 6 );
+    ctx.global.remove(a);
+    EXPECT_FALSE( ctx.global.hasKey(a) );
+    EXPECT_TRUE( ctx.global.hasKey(b) );
+    EXPECT_TRUE( ctx.global.hasKey("id") );
+
+    //the keys built from a shared id find the entries of the keys built from the same bytes
+    const graft::GlobalId id(std::string("\x01\x00\xff", 3));
+    graft::GlobalKey<int> c(Tag::A, id), c1(Tag::A, std::string_view("\x01\x00\xff", 3));
+    graft::GlobalKey<int> d(Tag::B, id);
+    EXPECT_EQ( c.hash(), c1.hash() );
+    EXPECT_EQ( c.key(), c1.key() );
+    EXPECT_NE( c.hash(), d.hash() );
+    ctx.global.set(c, 7);
+    EXPECT_EQ( ctx.global.get(c1, -1), 7 );
+    EXPECT_FALSE( ctx.global.hasKey(d) );
+}
+
 TEST(Context, groupSimple)
 {
     graft::GlobalContextMap m;
@@ -516,6 +921,246 @@ TEST(ExpiringList, common)
     EXPECT_EQ(el.remove(8), false);
 }
 
+TEST(ExpiringList, indexed)
+{
+    using List = graft::detail::IndexedExpiringListT<int>;
+    List el(200); //lifetime 200 ms
+    for(int i = 0; i< 5; ++i)
+    {
+        el.add(i); //0ms - 200ms
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); //100ms
+    for(int i = 5; i< 10; ++i)
+    {
+        el.add(i); //100ms - 300ms
+    }
+    el.add(4); //renewed, 100ms - 300ms
+    EXPECT_EQ(el.size(), 10);
+    EXPECT_EQ(el.remove(3), true);
+    EXPECT_EQ(el.contains(3), false);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); //200ms
+    EXPECT_EQ(el.remove(2), false);
+    EXPECT_EQ(el.contains(4), true);
+    EXPECT_EQ(el.remove(7), true);
+    EXPECT_EQ(el.size(), 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); //300ms
+    EXPECT_EQ(el.remove(8), false);
+
+    List evict(1000, 3);
+    for(int i = 0; i< 5; ++i)
+    {
+        EXPECT_EQ(evict.add(i), true);
+    }
+    EXPECT_EQ(evict.size(), 3);
+    EXPECT_EQ(evict.contains(1), false);
+    EXPECT_EQ(evict.extract(2), std::make_pair(true, 2));
+
+    List reject(1000, 3, List::Overflow::RejectNew);
+    for(int i = 0; i< 5; ++i)
+    {
+        EXPECT_EQ(reject.add(i), i < 3);
+    }
+    EXPECT_EQ(reject.contains(0), true);
+    EXPECT_EQ(reject.contains(3), false);
+}
+
+TEST(ExpiringList, DISABLED_Benchmark)
+{
+    auto measure = [](auto& el, size_t count, size_t lookups)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; ++i) el.add(i);
+        auto added = std::chrono::steady_clock::now();
+        std::mt19937_64 rnd(count);
+        size_t found = 0;
+        for(size_t i = 0; i < lookups; ++i)
+        {
+            if(el.remove(rnd() % (2*count))) ++found;
+        }
+        auto end = std::chrono::steady_clock::now();
+        using ns = std::chrono::duration<double, std::nano>;
+        std::cout << "  add " << ns(added - begin).count() / count << " ns"
+                  << ", lookup " << ns(end - added).count() / lookups << " ns"
+                  << " (" << found << " of " << lookups << " found)\n";
+    };
+
+    for(size_t count : {10000, 1000000})
+    {
+        //the deque is searched linearly, the number of lookups is limited to keep the test short
+        size_t lookups = std::max<size_t>(100, 10000000 / count);
+        std::cout << count << " entries\n deque:\n";
+        {
+            graft::detail::ExpiringListT<size_t> el(60000);
+            measure(el, count, lookups);
+        }
+        std::cout << " indexed:\n";
+        {
+            graft::detail::IndexedExpiringListT<size_t> el(60000);
+            measure(el, count, lookups);
+        }
+    }
+}
+
+TEST(PriorityLanes, weighted)
+{
+    graft::detail::PriorityLanesT<int, 3> lanes({8, 4, 1});
+    for(int i = 0; i < 100; ++i)
+    {
+        for(size_t lane = 0; lane < 3; ++lane)
+        {
+            lanes.push(lane, int(lane)*1000 + i);
+        }
+    }
+    EXPECT_EQ(lanes.size(), 300);
+    EXPECT_EQ(lanes.sizeUpTo(1), 200);
+
+    //the shares are by the weights, each lane is FIFO
+    std::array<int,3> cnt{}, next{};
+    for(int i = 0; i < 130; ++i)
+    {
+        int v = lanes.pop();
+        int lane = v / 1000;
+        EXPECT_EQ(v % 1000, next[lane]++);
+        ++cnt[lane];
+    }
+    EXPECT_EQ(cnt[0], 80);
+    EXPECT_EQ(cnt[1], 40);
+    EXPECT_EQ(cnt[2], 10);
+
+    //the newest of the lowest lane is shed first
+    int victim = -1;
+    EXPECT_EQ(lanes.popLowerThan(0, victim), true);
+    EXPECT_EQ(victim, 2099);
+    EXPECT_EQ(lanes.popLowerThan(2, victim), false);
+
+    //the lower lanes are not starved when the higher are empty
+    while(lanes.size(0)) lanes.pop();
+    cnt = {};
+    for(int i = 0; i < 50; ++i) ++cnt[lanes.pop() / 1000];
+    EXPECT_NEAR(cnt[1], 40, 1);
+    EXPECT_NEAR(cnt[2], 10, 1);
+    while(!lanes.empty()) lanes.pop();
+    EXPECT_EQ(lanes.popLowerThan(0, victim), false);
+}
+
+TEST(StagedHandler, stages)
+{
+    struct Frame
+    {
+        std::string request;
+        int calls = 0;
+    };
+    using Staged = graft::StagedHandler<Frame>;
+    graft::Router::Handler handler = Staged::make("test.staged",
+    {
+        [](const graft::Router::vars_t&, const graft::Input& input, graft::Context& ctx, graft::Output& output, Frame& frame)
+        {
+            frame.request = input.data();
+            ++frame.calls;
+            //the frame stays in place when the slots of the context grow
+            static graft::Context::Local::Slot<int> other("test.staged.other");
+            ctx.local.set(other, 1);
+            output.body = "forward";
+            return graft::Status::Forward;
+        },
+        [](const graft::Router::vars_t&, const graft::Input&, graft::Context&, graft::Output& output, Frame& frame)
+        {
+            ++frame.calls;
+            output.body = frame.request + " answered";
+            return graft::Status::Again;
+        },
+        [](const graft::Router::vars_t&, const graft::Input&, graft::Context&, graft::Output& output, Frame& frame)
+        {
+            ++frame.calls;
+            output.body = std::to_string(frame.calls);
+            return graft::Status::Ok;
+        },
+    });
+
+    graft::GlobalContextMap m;
+    graft::Router::vars_t vars;
+    graft::Input input; input.load(std::string("request"));
+    graft::Output output;
+    graft::Context ctx(m);
+    EXPECT_EQ(handler(vars, input, ctx, output), graft::Status::Forward);
+    EXPECT_EQ(output.body, "forward");
+    EXPECT_EQ(handler(vars, graft::Input(), ctx, output), graft::Status::Again);
+    EXPECT_EQ(output.body, "request answered");
+    EXPECT_EQ(handler(vars, graft::Input(), ctx, output), graft::Status::Ok);
+    EXPECT_EQ(output.body, "3");
+    //the last stage is repeated
+    EXPECT_EQ(handler(vars, graft::Input(), ctx, output), graft::Status::Ok);
+    EXPECT_EQ(output.body, "4");
+
+    //another task starts from the first stage
+    graft::Context ctx1(m);
+    EXPECT_EQ(handler(vars, input, ctx1, output), graft::Status::Forward);
+}
+
+TEST(Uuid, generator)
+{
+    std::unordered_set<boost::uuids::uuid, graft::UuidHash> ids;
+    const int count = 100000;
+    for(int i = 0; i < count; ++i)
+    {
+        boost::uuids::uuid id = graft::generateUuid();
+        EXPECT_EQ(id.version(), boost::uuids::uuid::version_random_number_based);
+        EXPECT_EQ(id.variant(), boost::uuids::uuid::variant_rfc_4122);
+        ids.insert(id);
+    }
+    EXPECT_EQ(ids.size(), count);
+    //the threads have their own streams
+    boost::uuids::uuid other;
+    std::thread([&other]{ other = graft::generateUuid(); }).join();
+    EXPECT_EQ(ids.count(other), 0);
+}
+
+TEST(Uuid, chacha20KnownAnswer)
+{//the test vector of RFC 7539 2.3.2
+    graft::detail::ChaCha20 chacha;
+    chacha.setKey({0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c, 0x13121110, 0x17161514, 0x1b1a1918, 0x1f1e1d1c},
+                  1, {0x09000000, 0x4a000000, 0x00000000});
+    const std::array<uint8_t, graft::detail::ChaCha20::BlockSize> expected{
+        0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+        0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+        0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+        0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e};
+    std::array<uint8_t, graft::detail::ChaCha20::BlockSize> block;
+    chacha.block(block.data());
+    EXPECT_EQ(expected, block);
+    EXPECT_EQ(2, chacha.counter());
+}
+
+TEST(Uuid, DISABLED_generatorBenchmark)
+{
+    auto measure = [](size_t threads, auto gen)->double
+    {
+        const int count = 200000;
+        std::vector<std::thread> ths;
+        auto begin = std::chrono::steady_clock::now();
+        for(size_t t = 0; t < threads; ++t)
+        {
+            ths.emplace_back([&gen]
+            {
+                uint8_t x = 0;
+                for(int i = 0; i < count; ++i) x ^= gen().data[0];
+                volatile uint8_t sink = x; (void)sink;
+            });
+        }
+        for(auto& th : ths) th.join();
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - begin;
+        return threads * count / d.count();
+    };
+
+    for(size_t threads : {1, 2, 4, 8})
+    {
+        double boost_rate = measure(threads, []{ return boost::uuids::random_generator()(); });
+        double local_rate = measure(threads, []{ return graft::generateUuid(); });
+        std::cout << threads << " threads, ids per second: boost::uuids::random_generator " << boost_rate
+                  << ", graft::generateUuid " << local_rate << "\n";
+    }
+}
+
 /////////////////////////////////
 
 std::function<GraftServerTestBase::TempCryptoNodeServer::on_http_t> GraftServerTestBase::TempCryptoNodeServer::http_echo =
@@ -777,6 +1422,136 @@ TEST_F(GraftServerTestBase, clientTimeout)
     server.stop_and_wait_for();
 }
 
+TEST_F(GraftServerTestBase, keepAlivePipelining)
+{//the second request is finished first, but the responses are sent in the order of the requests
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        std::string id = vars.find("id")->second;
+        if(id == "1") std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        output.body = "response" + id;
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.workers_count = 2;
+    server.m_copts.http_keep_alive_timeout = 1;
+    server.m_router.addRoute("/keepalive/{id:\\d+}", METHOD_GET, {nullptr, action, nullptr});
+    server.run();
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_LE(0, fd);
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(9084);
+    inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)));
+
+    const std::string requests =
+            "GET /keepalive/1 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+            "GET /keepalive/2 HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+    ASSERT_EQ(static_cast<ssize_t>(requests.size()), send(fd, requests.c_str(), requests.size(), 0));
+
+    std::string responses;
+    char buf[1024];
+    for(ssize_t n; 0 < (n = recv(fd, buf, sizeof(buf), 0)); )
+    {
+        responses.append(buf, n);
+    }
+    close(fd);
+
+    size_t pos1 = responses.find("Connection: keep-alive\r\n\r\nresponse1");
+    size_t pos2 = responses.find("Connection: close\r\n\r\nresponse2");
+    EXPECT_NE(std::string::npos, pos1);
+    EXPECT_NE(std::string::npos, pos2);
+    EXPECT_LT(pos1, pos2);
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, ioThreads)
+{//the loopers of several I/O threads share the global context and the thread pool
+    auto pre_action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        std::function<bool(int&)> inc = [](int& v)->bool { ++v; return true; };
+        ctx.global.apply("counter", inc);
+        return graft::Status::Ok;
+    };
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = "ok";
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.io_threads = 4;
+    server.m_router.addRoute("/iothreads", METHOD_GET, {pre_action, action, nullptr});
+    server.run();
+
+    graft::Context ctx(server.getGcm());
+    ctx.global["counter"] = 0;
+
+    const int count = 32;
+    for(int i = 0; i < count; ++i)
+    {
+        Client client;
+        client.serve("http://127.0.0.1:9084/iothreads");
+        EXPECT_EQ("ok", client.get_body());
+    }
+
+    int counter = ctx.global["counter"];
+    EXPECT_EQ(count, counter);
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, routeConcurrencyLimit)
+{//one worker action of the route runs, one waits and the third request is rejected with 503
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        output.body = "ok";
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.workers_count = 4;
+    server.m_router.addRoute("/limited", METHOD_GET, graft::Router::Handler3(nullptr, action, nullptr).setConcurrency(1, 1));
+    server.run();
+
+    std::vector<int> codes(3);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < codes.size(); ++i)
+    {
+        threads.emplace_back([&codes, i]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50 * i));
+            Client client;
+            client.serve("http://127.0.0.1:9084/limited");
+            codes[i] = client.get_resp_code();
+        });
+    }
+    for(auto& th : threads) th.join();
+    EXPECT_EQ(200, codes[0]);
+    EXPECT_EQ(200, codes[1]);
+    EXPECT_EQ(503, codes[2]);
+
+    uint64_t limit = 0, active = 0, queued = 0, rejected = 0;
+    server.getLooper().runtimeSysInfo().route_limits([&](const std::string& name, const auto& gauges)
+    {
+        if(name != "/limited") return;
+        limit = gauges.limit;
+        active = gauges.active;
+        queued = gauges.queued;
+        rejected = gauges.rejected;
+    });
+    EXPECT_EQ(1, limit);
+    EXPECT_EQ(0, active);
+    EXPECT_EQ(0, queued);
+    EXPECT_EQ(1, rejected);
+
+    server.stop_and_wait_for();
+}
+
 //This test requires comparing logging output, their categories with expected.
 TEST_F(GraftServerTestBase, logging)
 {
@@ -1213,12 +1988,676 @@ TEST_F(GraftServerTestBase, forward)
     crypton.stop_and_wait_for();
 }
 
-GRAFT_DEFINE_IO_STRUCT(GetVersionResp,
-                       (std::string, status),
-                       (uint32_t, version)
-                       );
-
-GRAFT_DEFINE_JSON_RPC_RESPONSE_RESULT(JRResponseResult, GetVersionResp);
+TEST_F(GraftServerTestBase, taskRecycling)
+{//the tasks of sequential requests reuse the memory, the local context fits the task arena
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        ctx.local["key"] = std::string("value");
+        ctx.local["another key"] = 1;
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_router.addRoute("/recycle", METHOD_POST, {nullptr, action, nullptr});
+    server.run();
+
+    auto serve = []
+    {
+        Client client;
+        client.serve("http://127.0.0.1:9084/recycle", "", "data");
+        EXPECT_EQ(200, client.get_resp_code());
+        EXPECT_EQ("data", client.get_body());
+    };
+
+    serve();
+    auto& rsi = server.getLooper().runtimeSysInfo();
+    auto recycled = rsi.tsk_recycled_cnt();
+    auto heapAlloc = rsi.tsk_heap_alloc_cnt();
+
+    const int count = 10;
+    for(int i = 0; i < count; ++i) serve();
+    EXPECT_EQ(recycled + count, rsi.tsk_recycled_cnt());
+    EXPECT_EQ(heapAlloc, rsi.tsk_heap_alloc_cnt());
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, upstreamPool)
+{//the forwarded requests reuse the keep-alive connections of the cryptonode pool
+    TempCryptoNodeServer crypton;
+    crypton.on_http = crypton.http_echo;
+    crypton.keepAlive = true;
+    crypton.run();
+    MainServer mainServer;
+    mainServer.m_copts.cryptonode_pool_size = 2;
+    graft::supernode::request::registerForwardRequests(mainServer.m_router);
+    mainServer.run();
+
+    for(int i = 0; i < 3; ++i)
+    {
+        std::string post_data = "some data " + std::to_string(i);
+        Client client;
+        client.serve("http://localhost:9084/json_rpc", "", post_data);
+        EXPECT_EQ(200, client.get_resp_code());
+        EXPECT_EQ(post_data, client.get_body());
+    }
+
+    uint64_t active = 0, idle = 0, queued = 0;
+    mainServer.getLooper().runtimeSysInfo().upstream_pools([&](const std::string& name, const auto& gauges)
+    {
+        if(name != "cryptonode") return;
+        active = gauges.active;
+        idle = gauges.idle;
+        queued = gauges.queued;
+    });
+    EXPECT_EQ(0, active);
+    EXPECT_EQ(1, idle);
+    EXPECT_EQ(0, queued);
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, reloadConfig)
+{//the changed options are applied in place, the cryptonode pool is replaced as its connections cannot be reused
+    TempCryptoNodeServer crypton;
+    crypton.on_http = crypton.http_echo;
+    crypton.keepAlive = true;
+    crypton.run();
+    MainServer mainServer;
+    mainServer.m_copts.cryptonode_pool_size = 2;
+    graft::supernode::request::registerForwardRequests(mainServer.m_router);
+    mainServer.run();
+
+    auto request = [](const std::string& post_data)
+    {
+        Client client;
+        client.serve("http://localhost:9084/json_rpc", "", post_data);
+        EXPECT_EQ(200, client.get_resp_code());
+        EXPECT_EQ(post_data, client.get_body());
+    };
+    auto idle = [&mainServer]()
+    {
+        uint64_t idle = 0;
+        mainServer.getLooper().runtimeSysInfo().upstream_pools([&](const std::string& name, const auto& gauges)
+        {
+            if(name == "cryptonode") idle = gauges.idle;
+        });
+        return idle;
+    };
+
+    request("before reload");
+    EXPECT_EQ(1, idle());
+    std::shared_ptr<const graft::ConfigOpts> snapshot = mainServer.getLooper().configOpts();
+
+    mainServer.m_copts.cryptonode_pool_size = 0;
+    mainServer.m_copts.upstream_request_timeout = 2;
+    mainServer.reload();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    //the idle connection of the old pool is closed
+    EXPECT_EQ(0, idle());
+    //the handlers get the new options, the snapshot taken before is not changed
+    EXPECT_EQ(2, mainServer.getLooper().configOpts()->upstream_request_timeout);
+    EXPECT_EQ(1, snapshot->upstream_request_timeout);
+
+    request("after reload");
+    EXPECT_EQ(0, idle());
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, reloadConfigBlacklist)
+{//the bans survive a reload unless the ipfilter options or the rules change, a failed reload keeps the live configuration
+    auto echo = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+    boost::filesystem::path rules = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    auto writeRules = [&rules](const std::string& content)
+    {
+        std::ofstream ofs(rules.string(), std::ios::trunc);
+        ofs << content;
+    };
+    writeRules("deny 192.168.0.0/16\n");
+
+    MainServer mainServer;
+    mainServer.m_copts.ipfilter.requests_per_sec = 3;
+    mainServer.m_copts.ipfilter.window_size_sec = 1;
+    mainServer.m_copts.ipfilter.ban_ip_sec = 60;
+    mainServer.m_copts.ipfilter.rules_filename = rules.string();
+    mainServer.m_router.addRoute("/echo", METHOD_POST, graft::Router::Handler3(echo, nullptr, nullptr));
+    mainServer.run();
+
+    auto allowed = []()
+    {
+        Client client;
+        client.serve("http://localhost:9084/echo", "", "data");
+        if(client.get_closed()) return false;
+        EXPECT_EQ("data", client.get_body());
+        return true;
+    };
+    auto reload = [&mainServer]()
+    {
+        mainServer.reload();
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    };
+
+    for(int i = 0; i < 3; ++i) EXPECT_TRUE(allowed());
+    EXPECT_FALSE(allowed());
+
+    //neither the options nor the rules are changed, the ban remains
+    mainServer.m_copts.upstream_request_timeout = 2;
+    reload();
+    EXPECT_FALSE(allowed());
+
+    //the configuration cannot be parsed, the live one remains
+    mainServer.failReload(true);
+    mainServer.m_copts.ipfilter.requests_per_sec = 0;
+    reload();
+    mainServer.failReload(false);
+    EXPECT_EQ(3, mainServer.m_copts.ipfilter.requests_per_sec);
+    EXPECT_FALSE(allowed());
+
+    //the rules are changed, the blacklist is rebuilt
+    writeRules("deny 192.168.0.0/24\n");
+    reload();
+    EXPECT_TRUE(allowed());
+
+    mainServer.stop_and_wait_for();
+    boost::filesystem::remove(rules);
+}
+
+TEST_F(GraftServerTestBase, reloadConfigRestart)
+{//an option that cannot be changed in place makes the server return from run() to be restarted
+    MainServer mainServer;
+    mainServer.run();
+
+    mainServer.m_copts.workers_expelling_interval_ms = 2000;
+    mainServer.reload();
+    for(int i = 0; i < 100 && !mainServer.finished(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ASSERT_TRUE(mainServer.finished());
+    EXPECT_EQ(graft::GraftServer::RunRes::SignalRestart, mainServer.runRes());
+
+    mainServer.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, coap)
+{//CoAP requests are routed like HTTP ones
+    auto echo = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = input.body.empty()? std::string("empty") : input.body;
+        return graft::Status::Ok;
+    };
+    auto slow = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        output.body = "slow";
+        return graft::Status::Ok;
+    };
+    MainServer mainServer;
+    mainServer.m_coapRouter.addRoute("/coap/echo", METHOD_GET|METHOD_POST, graft::Router::Handler3(echo, nullptr, nullptr));
+    mainServer.m_coapRouter.addRoute("/coap/slow", METHOD_GET, graft::Router::Handler3(nullptr, slow, nullptr));
+    mainServer.run();
+
+    CoapClient client;
+    //confirmable, piggybacked response
+    EXPECT_TRUE(client.serve("127.0.0.1:9086", "/coap/echo"));
+    EXPECT_EQ(205, client.get_resp_code());
+    EXPECT_EQ("empty", client.get_body());
+    EXPECT_FALSE(client.get_separate());
+    //non-confirmable
+    EXPECT_TRUE(client.serve("127.0.0.1:9086", "/coap/echo", "hello", false));
+    EXPECT_EQ(205, client.get_resp_code());
+    EXPECT_EQ("hello", client.get_body());
+    //block-wise in both directions
+    std::string large;
+    for(int i = 0; large.size() < 5000; ++i) large += std::to_string(i) + ',';
+    client.block_size = 256;
+    EXPECT_TRUE(client.serve("127.0.0.1:9086", "/coap/echo", large));
+    EXPECT_EQ(205, client.get_resp_code());
+    EXPECT_EQ(large, client.get_body());
+    //the next block of a response that is not served to this request
+    client.block2_start = 1;
+    EXPECT_TRUE(client.serve("127.0.0.1:9086", "/coap/echo"));
+    EXPECT_EQ(408, client.get_resp_code());
+    client.block2_start = 0;
+    //unknown path
+    EXPECT_TRUE(client.serve("127.0.0.1:9086", "/coap/unknown"));
+    EXPECT_EQ(404, client.get_resp_code());
+    //the response is not ready in time, it is sent separately after an empty ACK
+    EXPECT_TRUE(client.serve("127.0.0.1:9086", "/coap/slow"));
+    EXPECT_EQ(205, client.get_resp_code());
+    EXPECT_EQ("slow", client.get_body());
+    EXPECT_TRUE(client.get_separate());
+
+    mainServer.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, DISABLED_coapVsHttpLatency)
+{//loopback round trip of small supernode-to-supernode messages
+    auto echo = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+    MainServer mainServer;
+    mainServer.m_router.addRoute("/dapi/v2.0/echo", METHOD_POST, graft::Router::Handler3(echo, nullptr, nullptr));
+    mainServer.m_coapRouter.addRoute("/dapi/v2.0/echo", METHOD_POST, graft::Router::Handler3(echo, nullptr, nullptr));
+    mainServer.run();
+
+    const int count = 200;
+    const std::string message = "{\"params\":{\"PaymentID\":\"0123456789abcdef\",\"Status\":1}}";
+    using clock = std::chrono::steady_clock;
+
+    auto begin = clock::now();
+    for(int i = 0; i < count; ++i)
+    {
+        Client client;
+        client.serve("http://localhost:9084/dapi/v2.0/echo", "", message);
+        ASSERT_EQ(message, client.get_body());
+    }
+    auto http_us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - begin).count() / count;
+
+    CoapClient coap_client;
+    begin = clock::now();
+    for(int i = 0; i < count; ++i)
+    {
+        ASSERT_TRUE(coap_client.serve("127.0.0.1:9086", "/dapi/v2.0/echo", message));
+        ASSERT_EQ(message, coap_client.get_body());
+    }
+    auto coap_us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - begin).count() / count;
+
+    std::cout << "\nper-request latency: HTTP " << http_us << "us, CoAP " << coap_us << "us\n";
+
+    mainServer.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, resultNotify)
+{//the results pushed while the I/O thread is busy cost one notification, they are taken in batches
+    const int count = 80;
+    std::atomic<int> accepted{0}, delivered{0};
+    std::atomic_bool open{false}, backlogSeen{false};
+    MainServer mainServer;
+    auto accept = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        ++accepted;
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+    auto wait = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        while(!open) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+    auto deliver = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {//the I/O thread, the flag is left by the previous batch
+        if(mainServer.getLooper().hasResultBacklog()) backlogSeen = true;
+        ++delivered;
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+    auto hold = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {//the I/O thread is busy while the workers push all the results
+        open = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        return graft::Status::Ok;
+    };
+    //all the jobs fit the thread pool
+    mainServer.m_copts.workers_count = 2;
+    mainServer.m_copts.worker_queue_len = 64;
+    mainServer.m_copts.workers_expelling_interval_ms = 5000;
+    mainServer.m_copts.http_connection_timeout = 5;
+    mainServer.m_router.addRoute("/job", METHOD_POST, {accept, wait, deliver});
+    mainServer.m_router.addRoute("/hold", METHOD_POST, {hold, nullptr, nullptr});
+    mainServer.run();
+
+    auto& rsi = mainServer.getLooper().runtimeSysInfo();
+    const uint64_t notify0 = rsi.io_notify_cnt();
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < count; ++i)
+    {
+        threads.emplace_back([]
+        {
+            Client client;
+            client.serve("http://localhost:9084/job", "", "data");
+            EXPECT_EQ(200, client.get_resp_code());
+            EXPECT_EQ("data", client.get_body());
+        });
+    }
+    while(accepted < count) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+        Client client;
+        client.serve("http://localhost:9084/hold", "", "hold");
+        EXPECT_EQ(200, client.get_resp_code());
+    }
+    for(auto& th : threads) th.join();
+
+    EXPECT_EQ(count, delivered);
+    EXPECT_TRUE(backlogSeen);
+    EXPECT_GE(3, rsi.io_notify_cnt() - notify0);
+
+    mainServer.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, DISABLED_resultNotifyBenchmark)
+{//the workers notify the I/O thread only when it is not notified yet, it takes the results in batches
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+    MainServer mainServer;
+    mainServer.m_copts.workers_count = 4;
+    mainServer.m_router.addRoute("/notify", METHOD_POST, {nullptr, action, nullptr});
+    mainServer.run();
+
+    auto& rsi = mainServer.getLooper().runtimeSysInfo();
+    const uint64_t notify0 = rsi.io_notify_cnt(), wakeup0 = rsi.io_wakeup_cnt();
+
+    const int threadCount = 8, count = 50;
+    using clock = std::chrono::steady_clock;
+    auto begin = clock::now();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([count]
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                Client client;
+                client.serve("http://localhost:9084/notify", "", "data");
+                EXPECT_EQ("data", client.get_body());
+            }
+        });
+    }
+    for(auto& th : threads) th.join();
+    double sec = std::chrono::duration<double>(clock::now() - begin).count();
+
+    const int requests = threadCount * count;
+    const uint64_t notify = rsi.io_notify_cnt() - notify0, wakeup = rsi.io_wakeup_cnt() - wakeup0;
+    EXPECT_LE(notify, requests);
+
+    std::cout << "\n" << requests << " requests in " << sec << "s: " << double(notify) / requests << " notifications (eventfd writes) per request, "
+              << wakeup / sec << " looper wakeups per second, " << requests / sec << " requests per second\n";
+
+    mainServer.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, forwardCache)
+{//identical concurrent requests share one upstream call, the responses are cached until the height changes
+    std::atomic<int> upstreamCnt{0};
+    std::atomic<int> height{10};
+    TempCryptoNodeServer crypton;
+    crypton.on_http = [&](const http_message *hm, int& status_code, std::string& headers, std::string& data) -> bool
+    {
+        ++upstreamCnt;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        data = "{\"height\": " + std::to_string(height) + ", \"status\": \"OK\"}";
+        headers = "Content-Type: application/json\r\nConnection: close";
+        return true;
+    };
+    crypton.run();
+    MainServer mainServer;
+    mainServer.m_copts.forward_cache_ttl_ms = 60000;
+    graft::supernode::request::registerForwardRequests(mainServer.m_router);
+    mainServer.run();
+
+    auto serve = [](const std::string& path, const std::string& post_data)->std::string
+    {
+        Client client;
+        client.serve("http://localhost:9084/" + path, "", post_data);
+        EXPECT_EQ(200, client.get_resp_code());
+        return client.get_body();
+    };
+
+    const int count = 8;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < count; ++i)
+    {
+        threads.emplace_back([&serve]{ EXPECT_EQ("{\"height\": 10, \"status\": \"OK\"}", serve("getheight", "")); });
+    }
+    for(auto& th : threads) th.join();
+    EXPECT_EQ(1, upstreamCnt);
+
+    serve("getblocks.bin", "blocks");
+    serve("getblocks.bin", "blocks");
+    serve("getblocks.bin", "other blocks");
+    EXPECT_EQ(3, upstreamCnt);
+
+    //the new height drops the cached responses
+    height = 11;
+    EXPECT_EQ("{\"height\": 11, \"status\": \"OK\"}", serve("getheight", ""));
+    EXPECT_EQ("{\"height\": 11, \"status\": \"OK\"}", serve("getblocks.bin", "blocks"));
+    EXPECT_EQ(5, upstreamCnt);
+
+    //not cacheable
+    serve("sendrawtransaction", "tx");
+    serve("sendrawtransaction", "tx");
+    EXPECT_EQ(7, upstreamCnt);
+
+    auto& rsi = mainServer.getLooper().runtimeSysInfo();
+    EXPECT_EQ(count - 1, rsi.fwd_cache_coalesced_cnt());
+    EXPECT_EQ(1, rsi.fwd_cache_hit_cnt());
+    EXPECT_EQ(5, rsi.fwd_cache_miss_cnt());
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, forwardCacheFailure)
+{//the requests waiting for a forwarded one get its error without waiting for the postpone timeout
+    std::atomic<int> upstreamCnt{0};
+    TempCryptoNodeServer crypton;
+    crypton.on_http = [&](const http_message *hm, int& status_code, std::string& headers, std::string& data) -> bool
+    {
+        ++upstreamCnt;
+        //no answer, the upstream request times out
+        return false;
+    };
+    crypton.run();
+    MainServer mainServer;
+    mainServer.m_copts.forward_cache_ttl_ms = 60000;
+    mainServer.m_copts.upstream_request_timeout = 0.3;
+    mainServer.m_copts.http_connection_timeout = 5;
+    graft::supernode::request::registerForwardRequests(mainServer.m_router);
+    mainServer.run();
+
+    const int count = 8;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < count; ++i)
+    {
+        threads.emplace_back([]
+        {
+            auto begin = std::chrono::steady_clock::now();
+            Client client;
+            client.serve("http://localhost:9084/getblocks.bin", "", "blocks");
+            EXPECT_EQ(500, client.get_resp_code());
+            EXPECT_GT(std::chrono::seconds(3), std::chrono::steady_clock::now() - begin);
+        });
+        //the first one is forwarded before the others come
+        if(i == 0) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    for(auto& th : threads) th.join();
+    EXPECT_LE(1, upstreamCnt);
+
+    auto& rsi = mainServer.getLooper().runtimeSysInfo();
+    EXPECT_EQ(count - 1, rsi.fwd_cache_coalesced_cnt());
+    EXPECT_EQ(1, rsi.fwd_cache_miss_cnt());
+
+    //the failed request is not cached
+    Client client;
+    client.serve("http://localhost:9084/getblocks.bin", "", "blocks");
+    EXPECT_EQ(500, client.get_resp_code());
+    EXPECT_EQ(2, rsi.fwd_cache_miss_cnt());
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, hedging)
+{//a late idempotent request is duplicated, the response of the hedged one is used and the late one is discarded
+    std::atomic<int> upstreamCnt{0};
+    const int warmup = 16, slow = warmup + 1;
+    TempCryptoNodeServer crypton;
+    crypton.on_http = [&](const http_message *hm, int& status_code, std::string& headers, std::string& data) -> bool
+    {
+        data = "{\"height\": " + std::to_string(++upstreamCnt) + ", \"status\": \"OK\"}";
+        headers = "Content-Type: application/json\r\nConnection: close";
+        return true;
+    };
+    crypton.reply_delay_ms = [&](const http_message *hm)->int
+    {
+        if(upstreamCnt == slow) return 1000;
+        return (upstreamCnt == slow + 3)? 300 : 0;
+    };
+    crypton.run();
+    MainServer mainServer;
+    mainServer.m_copts.circuit_breaker.hedge_percentile = 50;
+    mainServer.m_copts.circuit_breaker.hedge_min_ms = 100;
+    mainServer.m_copts.upstream_request_timeout = 3;
+    mainServer.m_copts.http_connection_timeout = 5;
+    graft::supernode::request::registerForwardRequests(mainServer.m_router);
+    mainServer.run();
+
+    auto serve = [](const std::string& path)->std::string
+    {
+        Client client;
+        client.serve("http://localhost:9084/" + path);
+        EXPECT_EQ(200, client.get_resp_code());
+        return client.get_body();
+    };
+
+    auto& rsi = mainServer.getLooper().runtimeSysInfo();
+    //no latency samples yet, nothing to hedge by
+    for(int i = 0; i < warmup; ++i)
+    {
+        serve("getheight");
+    }
+    EXPECT_EQ(0, rsi.upstrm_hedged_cnt());
+
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_EQ("{\"height\": " + std::to_string(slow + 1) + ", \"status\": \"OK\"}", serve("getheight"));
+    EXPECT_GT(std::chrono::milliseconds(800), std::chrono::steady_clock::now() - begin);
+    EXPECT_EQ(1, rsi.upstrm_hedged_cnt());
+    EXPECT_EQ(slow + 1, upstreamCnt);
+
+    //the late response comes to nobody
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    EXPECT_EQ("{\"height\": " + std::to_string(slow + 2) + ", \"status\": \"OK\"}", serve("getheight"));
+    EXPECT_EQ(1, rsi.upstrm_hedged_cnt());
+
+    //a late request that is not idempotent is not duplicated
+    serve("sendrawtransaction");
+    EXPECT_EQ(1, rsi.upstrm_hedged_cnt());
+    EXPECT_EQ(slow + 3, upstreamCnt);
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, priorityShedding)
+{//the thread pool is saturated, the critical requests are served while the low ones get 503
+    auto sleep = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        if(!input.body.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(input.body)));
+        output.body = "done";
+        return graft::Status::Ok;
+    };
+    auto route = [&sleep](graft::Priority priority, int deadline_ms)
+    {
+        graft::Router::Handler3 h3(nullptr, sleep, nullptr);
+        h3.setPriority(priority, std::chrono::milliseconds(deadline_ms));
+        return h3;
+    };
+    MainServer mainServer;
+    //the input of the thread pool is two jobs
+    mainServer.m_copts.workers_count = 2;
+    mainServer.m_copts.worker_queue_len = 1;
+    mainServer.m_router.addRoute("/normal", METHOD_POST, route(graft::Priority::Normal, 0));
+    mainServer.m_router.addRoute("/normal_tight", METHOD_POST, route(graft::Priority::Normal, 50));
+    mainServer.m_router.addRoute("/critical", METHOD_POST, route(graft::Priority::Critical, 0));
+    mainServer.m_router.addRoute("/low", METHOD_POST, route(graft::Priority::Low, 0));
+    mainServer.m_router.addRoute("/low_tight", METHOD_POST, route(graft::Priority::Low, 200));
+    mainServer.run();
+
+    struct Result
+    {
+        int code = 0;
+        std::chrono::milliseconds elapsed{0};
+    };
+    std::vector<std::thread> threads;
+    auto request = [&threads](const std::string& path, const std::string& body, Result& res)
+    {
+        threads.emplace_back([path, body, &res]
+        {
+            auto begin = std::chrono::steady_clock::now();
+            Client client;
+            client.serve("http://localhost:9084" + path, "", body);
+            res.code = client.get_resp_code();
+            res.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+        });
+        //the requests come in order
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    };
+    auto join = [&threads]
+    {
+        for(auto& th : threads) th.join();
+        threads.clear();
+    };
+
+    //the normal jobs are fast so far
+    Result warmUp;
+    request("/normal", "10", warmUp);
+    join();
+    EXPECT_EQ(200, warmUp.code);
+
+    //the pool is busy, the waiting low jobs fill the lanes
+    Result slow1, slow2, lowTight, low, critical;
+    request("/normal", "400", slow1);
+    request("/normal", "400", slow2);
+    //the estimated wait is short, but the job is not dispatched before its deadline
+    request("/low_tight", "", lowTight);
+    request("/low", "", low);
+    //the lanes are full, the newest low job is shed in favor of the critical one
+    request("/critical", "", critical);
+    join();
+    EXPECT_EQ(200, slow1.code);
+    EXPECT_EQ(200, slow2.code);
+    EXPECT_EQ(503, lowTight.code);
+    EXPECT_LE(std::chrono::milliseconds(250), lowTight.elapsed);
+    EXPECT_EQ(503, low.code);
+    EXPECT_GT(std::chrono::milliseconds(250), low.elapsed);
+    EXPECT_EQ(200, critical.code);
+
+    //the average of the normal jobs has grown, the deadline cannot be met, the job is shed without waiting
+    Result normalTight;
+    request("/normal", "400", slow1);
+    request("/normal", "400", slow2);
+    request("/normal_tight", "", normalTight);
+    join();
+    EXPECT_EQ(200, slow1.code);
+    EXPECT_EQ(200, slow2.code);
+    EXPECT_EQ(503, normalTight.code);
+    EXPECT_GT(std::chrono::milliseconds(250), normalTight.elapsed);
+
+    mainServer.stop_and_wait_for();
+}
+
+GRAFT_DEFINE_IO_STRUCT(GetVersionResp,
+                       (std::string, status),
+                       (uint32_t, version)
+                       );
+
+GRAFT_DEFINE_JSON_RPC_RESPONSE_RESULT(JRResponseResult, GetVersionResp);
 
 //you can run cryptonodes and enable this tests using
 //--gtest_also_run_disabled_tests
@@ -1420,3 +2859,43 @@ TEST_F(GraftServerBlockingTest, common)
     mainServer.stop_and_wait_for();
     crypton.stop_and_wait_for();
 }
+
+TEST_F(GraftServerBlockingTest, async)
+{
+    TempCryptoN crypton;
+    crypton.answer = "crypton answer";
+    crypton.run();
+    std::atomic<int> ok_count(0), err_count(0);
+    auto callback = [&](graft::Input& input, const std::string& err)
+    {
+        if(err.empty() && input.body == crypton.answer) ++ok_count;
+        else ++err_count;
+    };
+    auto action = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        Sstr ss; ss.s = "my string";
+        graft::Output out; out.load(ss);
+        //the callback is called in the I/O thread later, both from the I/O thread and from a worker
+        ctx.handlerAPI()->sendUpstreamAsync(out, callback);
+        return graft::Status::Ok;
+    };
+
+    MainServer mainServer;
+    mainServer.m_router.addRoute("/json_block", METHOD_POST|METHOD_GET,
+                               graft::Router::Handler3(action, action, nullptr));
+    mainServer.run();
+
+    std::string post_data = "some data";
+    Client client;
+    client.serve("http://localhost:9084/json_block", "", post_data);
+    EXPECT_EQ(200, client.get_resp_code());
+    for(int i = 0; i < 100 && ok_count + err_count < 2; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(2, ok_count);
+    EXPECT_EQ(0, err_count);
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
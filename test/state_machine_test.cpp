@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+#include "lib/graft/dispatch_table.h"
+#include "lib/graft/graft_constants.h"
+#include "lib/graft/state_machine.h"
+#include "fixture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace
+{
+
+//a copy of the task state machine table with trivial guards and actions, the benchmark runs its actions
+
+enum State { EXECUTE, PRE_ACTION, CHK_PRE_ACTION, WORKER_ACTION, CHK_WORKER_ACTION, WORKER_ACTION_DONE,
+             POST_ACTION, CHK_POST_ACTION, AGAIN, EXIT, StateCount };
+
+using St = graft::Status;
+
+struct Task
+{
+    St status = St::None;
+    bool pre = false;
+    bool worker = false;
+    int actions = 0;
+};
+
+using Table = graft::detail::DispatchTableT<State, StateCount, St, graft::StatusCount, Task*>;
+
+std::vector<Table::Row> rows()
+{
+    const Table::Guard has_pre = [](Task* const& t) { return t->pre; };
+    const Table::Guard has_worker = [](Task* const& t) { return t->worker; };
+    const Table::Action act = [](Task* const& t) { ++t->actions; };
+
+#define ANY { }
+    return std::vector<Table::Row>(
+    {
+        {EXECUTE,               ANY,            PRE_ACTION,         nullptr,            act },
+        {PRE_ACTION,            {St::Busy},     EXIT,               nullptr,            nullptr },
+        {PRE_ACTION,            {St::None, St::Ok, St::Forward, St::Postpone},
+                                                CHK_PRE_ACTION,     nullptr,            act },
+        {CHK_PRE_ACTION,        {St::Again},    PRE_ACTION,         nullptr,            act },
+        {CHK_PRE_ACTION,        {St::Ok},       WORKER_ACTION,      has_pre,            nullptr },
+        {CHK_PRE_ACTION,        {St::Forward},  POST_ACTION,        has_pre,            nullptr },
+        {CHK_PRE_ACTION,        {St::Error, St::InternalError, St::CircuitOpen, St::Stop},
+                                                EXIT,               has_pre,            act },
+        {CHK_PRE_ACTION,        {St::Drop},     EXIT,               has_pre,            act },
+        {CHK_PRE_ACTION,        {St::None, St::Ok, St::Forward, St::Postpone},
+                                                WORKER_ACTION,      nullptr,            nullptr },
+        {WORKER_ACTION,         ANY,            CHK_WORKER_ACTION,  nullptr,            act },
+        {CHK_WORKER_ACTION,     ANY,            EXIT,               has_worker,         nullptr },
+        {CHK_WORKER_ACTION,     ANY,            POST_ACTION,        nullptr,            nullptr },
+
+        {WORKER_ACTION_DONE,    {St::Again},    WORKER_ACTION,      nullptr,            act },
+        {WORKER_ACTION_DONE,    ANY,            POST_ACTION,        nullptr,            nullptr },
+        {POST_ACTION,           ANY,            CHK_POST_ACTION,    nullptr,            act },
+        {CHK_POST_ACTION,       {St::Again},    POST_ACTION,        nullptr,            act },
+        {CHK_POST_ACTION,       {St::Forward},  EXIT,               nullptr,            act },
+        {CHK_POST_ACTION,       {St::Ok},       EXIT,               nullptr,            act },
+        {CHK_POST_ACTION,       {St::Error, St::InternalError, St::CircuitOpen, St::Stop},
+                                                EXIT,               nullptr,            act },
+        {CHK_POST_ACTION,       {St::Drop},     EXIT,               nullptr,            act },
+        {CHK_POST_ACTION,       {St::Postpone}, EXIT,               nullptr,            act },
+    });
+#undef ANY
+}
+
+//the scan of the rows the table is compiled from
+template<typename Row, typename State, typename Arg>
+const Row* findLinear(const std::vector<Row>& rows, State state, St status, const Arg& arg)
+{
+    for(auto& r : rows)
+    {
+        if(r.start != state) continue;
+        if(!r.statuses.empty() && std::find(r.statuses.begin(), r.statuses.end(), status) == r.statuses.end()) continue;
+        if(r.guard && !r.guard(arg)) continue;
+        return &r;
+    }
+    return nullptr;
+}
+
+//a task of a route with the given handlers, for the guards of the table
+class GuardTask : public graft::BaseTask
+{
+public:
+    GuardTask(graft::TaskManager& manager, const graft::Router::Handler3& h3)
+        : graft::BaseTask(manager, graft::Router::JobParams({graft::Input(), graft::Router::vars_t(), h3}), false)
+    { }
+    virtual void finalize() override { releaseItself(); }
+};
+
+} //namespace
+
+TEST_F(GraftServerTestBase, stateMachineTable)
+{//the table the tasks are dispatched by matches the scan of its rows for the routes with any handlers
+    using SM = graft::StateMachine;
+    MainServer mainServer;
+    mainServer.run();
+
+    const std::vector<SM::Table::Row> rs = SM::rows();
+    SM sm;
+    const SM::Table& table = sm.table();
+    graft::Router::Handler handler = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)
+    {
+        return graft::Status::Ok;
+    };
+    for(int flags = 0; flags < 8; ++flags)
+    {
+        graft::Router::Handler3 h3((flags & 1)? handler : nullptr, (flags & 2)? handler : nullptr, (flags & 4)? handler : nullptr);
+        graft::BaseTaskPtr bt = graft::BaseTask::Create<GuardTask>(mainServer.getLooper(), h3);
+        for(size_t state = 0; state < SM::StateCount; ++state)
+        {
+            for(size_t status = 0; status < graft::StatusCount; ++status)
+            {
+                const SM::Table::Row* r = findLinear(rs, SM::State(state), St(status), bt);
+                const SM::Table::Transition* t = table.find(SM::State(state), St(status), bt);
+                ASSERT_EQ(r == nullptr, t == nullptr);
+                if(!r) continue;
+                EXPECT_EQ(r->end, t->end);
+                EXPECT_EQ(bool(r->action), bool(t->action));
+            }
+        }
+        bt->finalize();
+    }
+
+    mainServer.stop_and_wait_for();
+}
+
+TEST(StateMachine, compiled)
+{
+    std::vector<Table::Row> rs = rows();
+    Table table(rs);
+
+    Task task;
+    for(int state = 0; state < StateCount; ++state)
+    {
+        for(size_t status = 0; status < graft::StatusCount; ++status)
+        {
+            for(int flags = 0; flags < 4; ++flags)
+            {
+                task.pre = flags & 1; task.worker = flags & 2;
+                const Table::Row* r = findLinear(rs, State(state), St(status), &task);
+                const Table::Transition* t = table.find(State(state), St(status), &task);
+                ASSERT_EQ(r == nullptr, t == nullptr);
+                if(!r) continue;
+                EXPECT_EQ(r->end, t->end);
+                EXPECT_EQ(bool(r->action), bool(t->action));
+            }
+        }
+    }
+}
+
+TEST(StateMachine, DISABLED_benchmark)
+{
+    constexpr int requests = 1000000;
+    std::vector<Table::Row> rs = rows();
+    Table table(rs);
+
+    //the path of a request with all the actions, returning Ok
+    auto run = [](auto find) -> size_t
+    {
+        size_t transitions = 0;
+        Task task;
+        task.pre = task.worker = false;
+        task.status = St::Ok;
+        for(int i = 0; i < requests; ++i)
+        {
+            State state = EXECUTE;
+            while(state != EXIT)
+            {
+                state = find(state, &task);
+                ++transitions;
+            }
+        }
+        return transitions;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    size_t linear = run([&rs](State state, Task* task)
+    {
+        const Table::Row* r = findLinear(rs, state, task->status, task);
+        if(r->action) r->action(task);
+        return r->end;
+    });
+    std::chrono::duration<double> linearTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    size_t compiled = run([&table](State state, Task* task)
+    {
+        const Table::Transition* t = table.find(state, task->status, task);
+        if(t->action) t->action(task);
+        return t->end;
+    });
+    std::chrono::duration<double> compiledTime = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(linear, compiled);
+    std::cout << "state machine transitions per second: linear scan " << size_t(linear / linearTime.count())
+              << ", compiled table " << size_t(compiled / compiledTime.count()) << "\n";
+}
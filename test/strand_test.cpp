@@ -31,6 +31,9 @@
 #include <atomic>
 #include <string>
 #include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
 
 using namespace std;
 using namespace tp;
@@ -66,3 +69,203 @@ TEST(StrandTest, basic)
 
     EXPECT_EQ(value.load(std::memory_order_acquire), max_value);
 }
+
+namespace
+{
+
+std::unique_ptr<ThreadPool> makeThreadPool(size_t thread_count)
+{
+    ThreadPoolOptions options;
+    options.setThreadCount(thread_count);
+    options.setQueueSize(64);
+    return std::make_unique<ThreadPool>(options);
+}
+
+template <typename Pred>
+void waitFor(Pred pred)
+{
+    while (!pred())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+}
+
+//the thread pools are stopped before the strands, a drain can still be finishing when the last handler is done
+
+TEST(StrandTest, bounded)
+{
+    auto thread_pool = makeThreadPool(2);
+    Strand strand(*thread_pool, 2);
+
+    std::atomic<bool> release{false};
+    std::atomic<int> done{0};
+    auto wait = [&release, &done]
+    {
+        waitFor([&release]{ return release.load(); });
+        ++done;
+    };
+
+    strand.post(wait);
+    strand.post(wait);
+    EXPECT_THROW(strand.post(wait), std::overflow_error);
+
+    release = true;
+    waitFor([&done]{ return done == 2; });
+    strand.post(wait);
+    waitFor([&done]{ return done == 3; });
+    thread_pool.reset();
+}
+
+TEST(StrandTest, poolFull)
+{//the handler that is not posted to the thread pool is not called later
+    ThreadPoolOptions options;
+    options.setThreadCount(2);
+    options.setQueueSize(2);
+    auto thread_pool = std::make_unique<ThreadPool>(options);
+    Strand strand(*thread_pool);
+
+    std::atomic<bool> release{false};
+    std::atomic<int> blocked{0};
+    for (int i = 0; i < 2; ++i)
+        thread_pool->post([&]{ ++blocked; waitFor([&release]{ return release.load(); }); }, true);
+    waitFor([&blocked]{ return blocked == 2; });
+    std::atomic<int> jobs{0};
+    try
+    {
+        for (;;)
+        {
+            thread_pool->post([&jobs]{ ++jobs; }, true);
+            ++jobs;
+        }
+    }
+    catch (std::runtime_error&) { }
+
+    std::atomic<bool> rejected_called{false}, called{false};
+    EXPECT_THROW(strand.post([&rejected_called]{ rejected_called = true; }), std::runtime_error);
+
+    release = true;
+    const int queued = jobs;
+    waitFor([&]{ return jobs == 2 * queued; });
+    strand.post([&called]{ called = true; });
+    waitFor([&called]{ return called.load(); });
+    EXPECT_FALSE(rejected_called);
+    thread_pool.reset();
+}
+
+TEST(StrandTest, poolFullFromManyThreads)
+{//no post returns as if its handler is scheduled while the thread pool is full
+    ThreadPoolOptions options;
+    options.setThreadCount(2);
+    options.setQueueSize(2);
+    auto thread_pool = std::make_unique<ThreadPool>(options);
+    Strand strand(*thread_pool);
+
+    std::atomic<bool> release{false};
+    std::atomic<int> blocked{0};
+    for (int i = 0; i < 2; ++i)
+        thread_pool->post([&]{ ++blocked; waitFor([&release]{ return release.load(); }); }, true);
+    waitFor([&blocked]{ return blocked == 2; });
+    std::atomic<int> jobs{0};
+    try
+    {
+        for (;;)
+        {
+            thread_pool->post([&jobs]{ ++jobs; }, true);
+            ++jobs;
+        }
+    }
+    catch (std::runtime_error&) { }
+
+    std::atomic<int> posted{0}, called{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]
+        {
+            for (int i = 0; i < 2000; ++i)
+            {
+                try
+                {
+                    strand.post([&called]{ ++called; });
+                    ++posted;
+                }
+                catch (std::runtime_error&) { }
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    EXPECT_EQ(posted, 0);
+
+    release = true;
+    const int queued = jobs;
+    waitFor([&]{ return jobs == 2 * queued; });
+    strand.post([&called]{ ++called; });
+    waitFor([&called]{ return called == 1; });
+    EXPECT_EQ(called, 1);
+    thread_pool.reset();
+}
+
+TEST(StrandTest, unboundedFromManyThreads)
+{//the handlers of a producer are called in the order of posting, one at a time
+    auto thread_pool = makeThreadPool(4);
+    Strand strand(*thread_pool);
+
+    const int producers = 4, count = 20000;
+    std::vector<int> last(producers, -1);
+    std::atomic<int> running{0}, done{0};
+    bool ordered = true, serial = true;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                strand.post([&, p, i]
+                {
+                    if (running.fetch_add(1) != 0) serial = false;
+                    if (last[p] + 1 != i) ordered = false;
+                    last[p] = i;
+                    running.fetch_sub(1);
+                    ++done;
+                }, true);
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    waitFor([&done]{ return done == producers * count; });
+    EXPECT_TRUE(ordered);
+    EXPECT_TRUE(serial);
+    thread_pool.reset();
+}
+
+TEST(StrandTest, fairness)
+{//a busy strand gives its worker up after a batch, the other strands are not starved
+    auto thread_pool = makeThreadPool(2);
+    const int batch = 4, busy_count = 4, count = 100;
+    std::vector<std::unique_ptr<Strand>> busy;
+    for (int i = 0; i < busy_count; ++i)
+        busy.emplace_back(std::make_unique<Strand>(*thread_pool, 0, batch));
+    Strand other(*thread_pool, 0, batch);
+
+    //the workers are kept until all the strands are posted
+    std::atomic<bool> release{false};
+    std::atomic<int> blocked{0};
+    for (int i = 0; i < 2; ++i)
+        thread_pool->post([&]{ ++blocked; waitFor([&release]{ return release.load(); }); }, true);
+    waitFor([&blocked]{ return blocked == 2; });
+
+    std::atomic<int> busy_done{0}, busy_done_at_other{-1};
+    for (auto& strand : busy)
+        for (int i = 0; i < count; ++i)
+            strand->post([&busy_done]{ ++busy_done; }, true);
+    other.post([&]{ busy_done_at_other = busy_done.load(); }, true);
+    release = true;
+
+    waitFor([&]{ return busy_done == busy_count * count && 0 <= busy_done_at_other; });
+    //each busy strand runs a batch or two before the other one, without batches it would be a whole queue
+    EXPECT_GE(2 * busy_count * batch, busy_done_at_other);
+    thread_pool.reset();
+}
@@ -46,6 +46,20 @@ TEST(SysInfo, counter_initial_state)
     EXPECT_EQ(sic.upstrm_http_req_bytes_raw_cnt(), 0);
     EXPECT_EQ(sic.upstrm_http_resp_bytes_raw_cnt(), 0);
 
+    EXPECT_EQ(sic.upstrm_breaker_open_cnt(), 0);
+    EXPECT_EQ(sic.upstrm_fast_fail_cnt(), 0);
+    EXPECT_EQ(sic.upstrm_hedged_cnt(), 0);
+
+    EXPECT_EQ(sic.fwd_cache_hit_cnt(), 0);
+    EXPECT_EQ(sic.fwd_cache_miss_cnt(), 0);
+    EXPECT_EQ(sic.fwd_cache_coalesced_cnt(), 0);
+
+    EXPECT_EQ(sic.tsk_heap_alloc_cnt(), 0);
+    EXPECT_EQ(sic.tsk_recycled_cnt(), 0);
+
+    EXPECT_EQ(sic.io_notify_cnt(), 0);
+    EXPECT_EQ(sic.io_wakeup_cnt(), 0);
+
     EXPECT_EQ(sic.system_uptime_sec(), 0);
 }
 
@@ -141,6 +155,30 @@ TEST(SysInfo, counters_in_action)
     EXPECT_EQ(sic.upstrm_http_resp_bytes_raw_cnt(), 2);
     sic.count_upstrm_http_resp_bytes_raw(8);
     EXPECT_EQ(sic.upstrm_http_resp_bytes_raw_cnt(), 10);
+
+    sic.count_fwd_cache_hit();
+    EXPECT_EQ(sic.fwd_cache_hit_cnt(), 1);
+    sic.count_fwd_cache_miss();
+    EXPECT_EQ(sic.fwd_cache_miss_cnt(), 1);
+    sic.count_fwd_cache_coalesced();
+    EXPECT_EQ(sic.fwd_cache_coalesced_cnt(), 1);
+
+    sic.count_upstrm_breaker_open();
+    EXPECT_EQ(sic.upstrm_breaker_open_cnt(), 1);
+    sic.count_upstrm_fast_fail();
+    EXPECT_EQ(sic.upstrm_fast_fail_cnt(), 1);
+    sic.count_upstrm_hedged();
+    EXPECT_EQ(sic.upstrm_hedged_cnt(), 1);
+
+    sic.count_tsk_heap_alloc(3);
+    EXPECT_EQ(sic.tsk_heap_alloc_cnt(), 3);
+    sic.count_tsk_recycled();
+    EXPECT_EQ(sic.tsk_recycled_cnt(), 1);
+
+    sic.count_io_notify();
+    EXPECT_EQ(sic.io_notify_cnt(), 1);
+    sic.count_io_wakeup();
+    EXPECT_EQ(sic.io_wakeup_cnt(), 1);
 }
 
 namespace detail
@@ -150,6 +188,7 @@ class HandlerAPIImpl : public graft::HandlerAPI
 {
 public:
     virtual void sendUpstreamBlocking(Output& output, Input& input, std::string& err) override { }
+    virtual void sendUpstreamAsync(const Output& output, UpstreamCallback callback) override { }
     virtual bool addPeriodicTask(const Router::Handler& h_worker,
                                  std::chrono::milliseconds interval_ms,
                                  std::chrono::milliseconds initial_interval_ms = std::chrono::milliseconds::max(),
@@ -261,6 +300,10 @@ TEST(SysInfo, response_content_initial_and_after_handler)
     sic.count_upstrm_http_req_bytes_raw(1);
     sic.count_upstrm_http_resp_bytes_raw(1);
 
+    EXPECT_TRUE(resp.running_info.route_limits.empty());
+    auto& rlg = sic.route_limit("debug");
+    rlg.limit = 2; rlg.active = 2; rlg.queued = 1; ++rlg.rejected;
+
     jp.h3.worker_action(vars, inp, ctx, otp); // call the target handler
     resp = Response::fromJson(otp.body);
 
@@ -282,5 +325,13 @@ TEST(SysInfo, response_content_initial_and_after_handler)
 
     EXPECT_EQ(resp.running_info.upstrm_http_req_bytes_raw, 1);
     EXPECT_EQ(resp.running_info.upstrm_http_resp_bytes_raw, 1);
+
+    ASSERT_EQ(resp.running_info.route_limits.size(), 1);
+    const auto& rl = resp.running_info.route_limits.front();
+    EXPECT_EQ(rl.name, "debug");
+    EXPECT_EQ(rl.limit, 2);
+    EXPECT_EQ(rl.active, 2);
+    EXPECT_EQ(rl.queued, 1);
+    EXPECT_EQ(rl.rejected, 1);
 }
 
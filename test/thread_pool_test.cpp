@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <functional>
+#include <algorithm>
+#include <vector>
 #include "lib/graft/thread_pool/thread_pool.hpp"
 
 namespace detail
@@ -101,3 +103,119 @@ TEST(ThreadPool, expelling)
     }
     EXPECT_EQ(s, fast_per_slow * (slow_cnt+1) * slow_cnt /2 );
 }
+
+TEST(ThreadPool, postFromWorker)
+{
+    tp::ThreadPoolOptions th_op;
+    th_op.setThreadCount(3);
+    th_op.setQueueSize(16);
+    auto thPool = std::make_unique<tp::ThreadPool>(th_op);
+    EXPECT_EQ(thPool->getWorkersCount(), 3);
+
+    //the tasks posted by a worker go into its deque and are stolen by the others
+    const int count = 10000;
+    std::atomic<int> done = 0;
+    std::atomic<bool> posted = false;
+    tp::ThreadPool* pool = thPool.get();
+    thPool->post([pool,&done,&posted]()
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            pool->post([&done]{ ++done; });
+        }
+        posted = true;
+    });
+
+    while(!posted || done != count)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    thPool.reset();
+    EXPECT_EQ(done, count);
+}
+
+TEST(ThreadPool, expelledDeque)
+{
+    tp::ThreadPoolOptions th_op;
+    th_op.setThreadCount(2);
+    th_op.setQueueSize(16);
+    th_op.setExpellingIntervalMs(100);
+    auto thPool = std::make_unique<tp::ThreadPool>(th_op);
+
+    //the tasks posted by the stuck workers to themselves are run by the workers that replace them
+    const int count = 10;
+    std::atomic<int> done = 0, blocked = 0;
+    std::atomic<bool> release = false;
+    tp::ThreadPool* pool = thPool.get();
+    for(int w = 0; w < 2; ++w)
+    {
+        thPool->post([pool,&done,&blocked,&release]()
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                pool->post([&done]{ ++done; });
+            }
+            ++blocked;
+            while(!release)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            --blocked;
+        }, true);
+    }
+    while(blocked != 2)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    thPool->expelWorkers();
+
+    auto begin = std::chrono::steady_clock::now();
+    while(done != 2 * count && std::chrono::steady_clock::now() - begin < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(done, 2 * count);
+    //the expelled threads are detached
+    release = true;
+    while(blocked != 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    thPool.reset();
+}
+
+TEST(ThreadPool, DISABLED_latencyBenchmark)
+{
+    tp::ThreadPoolOptions th_op;
+    th_op.setThreadCount(std::thread::hardware_concurrency());
+    th_op.setQueueSize(1024);
+    auto thPool = std::make_unique<tp::ThreadPool>(th_op);
+
+    using Clock = std::chrono::steady_clock;
+    const int count = 2000;
+    std::vector<Clock::duration> latency(count);
+    std::atomic<int> done = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        //the pool is idle between the jobs
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        Clock::time_point posted = Clock::now();
+        thPool->post([&latency,&done,i,posted]
+        {
+            latency[i] = Clock::now() - posted;
+            ++done;
+        });
+    }
+    while(done != count)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    thPool.reset();
+
+    std::sort(latency.begin(), latency.end());
+    auto us = [](Clock::duration d){ return std::chrono::duration<double, std::micro>(d).count(); };
+    std::cout << "post to start latency, us: p50 " << us(latency[count/2])
+              << ", p99 " << us(latency[count*99/100])
+              << ", max " << us(latency.back()) << "\n";
+}
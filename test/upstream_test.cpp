@@ -1,7 +1,158 @@
 #include <gtest/gtest.h>
 #include "lib/graft/jsonrpc.h"
+#include "lib/graft/circuit_breaker.h"
+#include "lib/graft/sys_info.h"
+#include "supernode/requests.h"
 #include "fixture.h"
 
+namespace
+{
+
+struct FakeClock
+{
+    using duration = std::chrono::milliseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<FakeClock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now() { return time_point(duration(ms)); }
+    static int64_t ms;
+};
+
+int64_t FakeClock::ms = 0;
+
+using CircuitBreaker = graft::detail::CircuitBreakerT<FakeClock>;
+using State = CircuitBreaker::State;
+using std::chrono::milliseconds;
+
+}
+
+TEST(CircuitBreaker, errorRate)
+{
+    FakeClock::ms = 0;
+    CircuitBreaker cb(0.5, milliseconds(0), 4, milliseconds(1000));
+    EXPECT_TRUE(cb.enabled());
+    //the window is not full
+    EXPECT_FALSE(cb.onResult(false, milliseconds(1)));
+    EXPECT_FALSE(cb.onResult(false, milliseconds(1)));
+    EXPECT_FALSE(cb.onResult(true, milliseconds(1)));
+    EXPECT_EQ(State::Closed, cb.state());
+    //2 of 4 failed
+    EXPECT_TRUE(cb.onResult(true, milliseconds(1)));
+    EXPECT_EQ(State::Open, cb.state());
+    EXPECT_FALSE(cb.allow());
+    //the results of the requests sent before opening are ignored
+    EXPECT_FALSE(cb.onResult(false, milliseconds(1)));
+
+    //the window slides
+    CircuitBreaker cb1(0.5, milliseconds(0), 4, milliseconds(1000));
+    for(int i = 0; i < 20; ++i)
+    {
+        EXPECT_FALSE(cb1.onResult(i % 4 != 0, milliseconds(1)));
+    }
+    EXPECT_EQ(State::Closed, cb1.state());
+
+    CircuitBreaker disabled;
+    EXPECT_FALSE(disabled.enabled());
+    for(int i = 0; i < 20; ++i)
+    {
+        EXPECT_FALSE(disabled.onResult(false, milliseconds(1)));
+    }
+    EXPECT_TRUE(disabled.allow());
+}
+
+TEST(CircuitBreaker, halfOpen)
+{
+    FakeClock::ms = 0;
+    //a request slower than 100ms fails
+    CircuitBreaker cb(1, milliseconds(100), 2, milliseconds(1000));
+    EXPECT_FALSE(cb.onResult(true, milliseconds(150)));
+    EXPECT_TRUE(cb.onResult(true, milliseconds(200)));
+    EXPECT_FALSE(cb.allow());
+
+    FakeClock::ms = 1000;
+    EXPECT_TRUE(cb.allow());
+    cb.onSend();
+    EXPECT_EQ(State::HalfOpen, cb.state());
+    //the only probe is in flight
+    EXPECT_FALSE(cb.allow());
+    //the probe fails
+    EXPECT_TRUE(cb.onResult(false, milliseconds(1)));
+    EXPECT_EQ(State::Open, cb.state());
+    FakeClock::ms = 1999;
+    EXPECT_FALSE(cb.allow());
+
+    FakeClock::ms = 2000;
+    EXPECT_TRUE(cb.allow());
+    cb.onSend();
+    EXPECT_FALSE(cb.onResult(true, milliseconds(1)));
+    EXPECT_EQ(State::Closed, cb.state());
+    EXPECT_TRUE(cb.allow());
+}
+
+TEST(CircuitBreaker, percentile)
+{
+    CircuitBreaker cb;
+    //not enough samples
+    for(size_t i = 1; i < CircuitBreaker::MinLatencySamples; ++i)
+    {
+        cb.onResult(true, milliseconds(i));
+    }
+    EXPECT_EQ(milliseconds(0), cb.percentile(90));
+    //the failed requests are not sampled
+    cb.onResult(false, milliseconds(1000));
+    EXPECT_EQ(milliseconds(0), cb.percentile(90));
+
+    for(size_t i = CircuitBreaker::MinLatencySamples; i <= 100; ++i)
+    {
+        cb.onResult(true, milliseconds(i));
+    }
+    EXPECT_EQ(milliseconds(91), cb.percentile(90));
+    EXPECT_EQ(milliseconds(100), cb.percentile(99.9));
+    //the oldest samples are replaced
+    for(size_t i = 0; i < CircuitBreaker::LatencySamples; ++i)
+    {
+        cb.onResult(true, milliseconds(5));
+    }
+    EXPECT_EQ(milliseconds(5), cb.percentile(90));
+}
+
+TEST_F(GraftServerTestBase, upstreamCircuitBreaker)
+{//the cryptonode is down, the breaker opens and the requests fail at once with 503
+    MainServer mainServer;
+    mainServer.m_copts.circuit_breaker.error_rate = 0.5;
+    mainServer.m_copts.circuit_breaker.window = 4;
+    mainServer.m_copts.circuit_breaker.open_ms = 60000;
+    graft::supernode::request::registerForwardRequests(mainServer.m_router);
+    //a handler can fail with the status of the open breaker too
+    auto shed = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        return graft::Status::CircuitOpen;
+    };
+    mainServer.m_router.addRoute("/shed", METHOD_GET, {nullptr, shed, nullptr});
+    mainServer.run();
+
+    for(int i = 0; i < 6; ++i)
+    {
+        Client client;
+        client.serve("http://localhost:9084/json_rpc", "", "some data");
+        EXPECT_EQ((i < 4)? 500 : 503, client.get_resp_code());
+    }
+
+    auto& rsi = mainServer.getLooper().runtimeSysInfo();
+    EXPECT_EQ(1, rsi.upstrm_breaker_open_cnt());
+    EXPECT_EQ(2, rsi.upstrm_fast_fail_cnt());
+    EXPECT_EQ(4, rsi.upstrm_http_resp_err_cnt());
+
+    Client client;
+    client.serve("http://localhost:9084/shed");
+    EXPECT_EQ(503, client.get_resp_code());
+    EXPECT_EQ(3, rsi.http_resp_status_busy_cnt());
+
+    mainServer.stop_and_wait_for();
+}
+
 TEST_F(GraftServerTestBase, upstreamKeepAlive)
 {
     auto action = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status